@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "buffer_pool.h"
+
+/*
+ * Frame buffer pool - capture buffers we allocate ourselves (for V4L2_MEMORY_USERPTR).
+ *
+ * Large frames touch a lot of 4K pages, and every one of them costs a TLB entry in the driver's
+ * DMA setup, the writer and the conversion kernels alike.  So the pool first asks for explicit
+ * 2 MB hugepages, which only works if the administrator reserved some (vm.nr_hugepages).
+ * Otherwise it falls back to regular pages, and asks for transparent hugepages on them, which
+ * the kernel may or may not grant.
+ */
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+static size_t round_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+/**
+ * buffer_pool_alloc - allocate "count" buffers of "buf_size" bytes into "bufs"
+ *
+ * Every buffer starts on a page boundary, a hugepage boundary when the pool got hugepages.
+ * @returns 0 on success, -1 with errno set
+ */
+int buffer_pool_alloc(struct buffer_pool *pool, struct mmaped_buffer *bufs, int count,
+        size_t buf_size) {
+    if (pool == NULL || bufs == NULL || count <= 0 || buf_size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+
+    pool->page = HUGEPAGE_SIZE;
+    pool->size = round_up(buf_size, pool->page) * count;
+    pool->base = mmap(NULL, pool->size, (PROT_READ | PROT_WRITE),
+            (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB | MAP_POPULATE), -1, 0);
+    pool->hugetlb = 1;
+
+    if (pool->base == MAP_FAILED) {
+        pool->page = sysconf(_SC_PAGESIZE);
+        pool->size = round_up(buf_size, pool->page) * count;
+        pool->hugetlb = 0;
+
+        // Populate only after the advice, so the faults can already use transparent hugepages
+        pool->base = mmap(NULL, pool->size, (PROT_READ | PROT_WRITE),
+                (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+        if (pool->base == MAP_FAILED) {
+            pool->base = NULL;
+            return -1;
+        }
+
+        madvise(pool->base, pool->size, MADV_HUGEPAGE);
+        if (-1 == madvise(pool->base, pool->size, MADV_POPULATE_WRITE)) {
+            // Older kernels can't prefault for us
+            for (size_t off = 0; off < pool->size; off += pool->page) {
+                ((volatile uint8_t *) pool->base)[off] = 0;
+            }
+        }
+    }
+
+    fprintf(stdout, "Buffer pool: %d buffers of %zu bytes in %s pages\n", count, buf_size,
+            pool->hugetlb ? "2 MB huge" : "regular (or transparent huge)");
+
+    size_t stride = pool->size / count;
+    for (int i = 0; i < count; i++) {
+        bufs[i].start = (uint8_t *) pool->base + stride * i;
+        bufs[i].length = buf_size;
+    }
+
+    return 0;
+}
+
+/**
+ * buffer_pool_free - unmap every buffer of the pool
+ */
+void buffer_pool_free(struct buffer_pool *pool) {
+    if (pool != NULL && pool->base != NULL) {
+        munmap(pool->base, pool->size);
+        pool->base = NULL;
+    }
+}
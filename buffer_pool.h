@@ -0,0 +1,22 @@
+#ifndef __BUFFER_POOL_H_
+#define __BUFFER_POOL_H_
+
+#include <stddef.h>
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+
+/**
+ * buffer_pool - one mapping holding a set of frame buffers, backed by hugepages if possible
+ */
+struct buffer_pool {
+    void *base;
+    size_t size;
+    size_t page;        // page size the buffers are aligned to
+    int hugetlb;        // 1 if the pool got explicit 2 MB hugepages
+};
+
+int buffer_pool_alloc(struct buffer_pool *pool, struct mmaped_buffer *bufs, int count,
+        size_t buf_size);
+void buffer_pool_free(struct buffer_pool *pool);
+#endif
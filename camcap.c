@@ -6,88 +6,1679 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 
 #include <linux/videodev2.h>
 
 #include "v4l2_helper.h"
+#include "source.h"
+#include "sink.h"
+#include "frame_stats.h"
+#include "frame_sync.h"
+#include "convert.h"
+#include "scale.h"
+#include "motion.h"
+#include "codec.h"
+#include "stripe.h"
+#include "probe.h"
 
 #define BUFFER_COUNT 4
+#define BUFFER_BUDGET_MB 256
+#define POOL_FRAMES 16
+#define SHM_SLOTS 8
+#define MAX_CAMERAS 16
+#define FRAME_TIMEOUT_MS 2000
+#define SYNC_TOLERANCE_US 5000
+#define SYNC_DEPTH 2
+#define CONVERT_IN_FLIGHT 2
+#define MOTION_LEVEL 4.0
+#define MOTION_STEP 4
 
-static void print_pixel_formats(int fd) {
-    // Check to see if they've selected a valid pixel format
-    struct v4l2_fmtdesc *format = NULL;
+enum long_only_options {
+    OPT_REPLAY = 256,
+    OPT_SYNTHETIC,
+    OPT_FPS,
+    OPT_WRITER,
+    OPT_POOL_FRAMES,
+    OPT_URING,
+    OPT_DIRECT,
+    OPT_VMSPLICE,
+    OPT_CONTAINER,
+    OPT_COMPRESS,
+    OPT_SHARE,
+    OPT_SHM,
+    OPT_SHM_SLOTS,
+    OPT_MEMORY,
+    OPT_BUFFERS,
+    OPT_ADAPTIVE_BUFFERS,
+    OPT_TRACE,
+    OPT_RESCAN,
+    OPT_SYNC,
+    OPT_SYNC_DEPTH,
+    OPT_RING,
+    OPT_RING_POST,
+    OPT_RING_SOCKET,
+    OPT_SEGMENT,
+    OPT_STRIPE,
+    OPT_STRIPE_POLICY,
+    OPT_MOTION,
+    OPT_MOTION_STEP,
+    OPT_PRE_ROLL,
+    OPT_POST_ROLL,
+    OPT_MOTION_LOG,
+    OPT_CROP,
+    OPT_SCALE,
+    OPT_CONVERT_TO,
+    OPT_CONVERT_THREADS,
+    OPT_CONVERT_CPUS,
+    OPT_CONVERT_IN_FLIGHT,
+    OPT_DEMOSAIC,
+};
 
-    int fmt_cnt = enum_pixel_formats(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, &format);
-    if (fmt_cnt < -1) {
-        fprintf(stderr, "Unable to enumerate video capture formats\n");
+enum writer_mode {
+    WRITER_INLINE,
+    WRITER_HOLD,
+    WRITER_COPY,
+};
+
+/**
+ * output_config - how and where frames are written
+ */
+struct output_config {
+    const char *out_name;
+    int out_fd;             // where frames go without an output file
+    enum writer_mode writer;
+    int pool_frames;
+    int uring;
+    int uring_sqpoll;
+    int direct;
+    int vmsplice;               // splice the frame pages into the stdout pipe
+    int container;              // write frames into a frame container rather than back to back
+    int compress;               // compress them losslessly in there
+    const char *share_path;     // socket to share the capture buffers through instead
+    const char *shm_name;       // shared memory ring to publish frames into instead
+    int shm_slots;
+    double ring_seconds;        // keep this much in a ring in memory until triggered, or
+    uint64_t ring_bytes;        // this many bytes
+    int ring_post;
+    const char *ring_socket;
+    double segment_seconds;     // start a new file after this long, and
+    uint64_t segment_bytes;     // before the file grows past this
+    const char *stripes[STRIPE_MAX];    // deal frames out across these files instead
+    int stripe_count;
+    enum stripe_policy stripe_policy;
+    double fps;                 // to size the ring and segments by, filled in by setup_camera()
+    int motion;                 // only write frames that changed, and the frames around them
+    double motion_level;        // mean luma difference that counts as a change
+    int motion_step;
+    int pre_roll;
+    int post_roll;
+    const char *motion_log;
+    struct v4l2_rect crop;      // region of the frame to keep, 0 wide for all of it
+    uint32_t scale_width;       // size to scale frames (or their region) to, 0 to keep it
+    uint32_t scale_height;
+    uint32_t convert_to;        // pixel format to convert frames to before writing, 0 for none
+    int convert_threads;
+    int convert_cpus[THREAD_POOL_MAX_THREADS];  // CPUs to pin the conversion threads to
+    int convert_cpu_count;
+    int convert_in_flight;
+    enum demosaic_method demosaic;
+};
+
+/**
+ * capture - the state shared between the capture loop and the sink's release callback
+ */
+struct capture {
+    struct capture_source *src;
+    struct frame_stats *stats;
+    int held;   // buffers the sink is holding on to
+};
+
+/**
+ * requeue_frame - give a buffer the sink is done with back to the source
+ */
+static void requeue_frame(struct capture *cap, struct v4l2_buffer *buf) {
+    frame_stats_written(cap->stats, buf->index);
+    if (-1 == source_enqueue(cap->src, buf)) {
+        perror("Error requeueing frame");
         return;
     }
+    frame_stats_requeued(cap->stats, buf->index);
+}
 
-    fprintf(stdout, "No/invalid pixel format specified! Please select from the following:\n");
-    for (int i = 0; i < fmt_cnt; i++) {
-        fprintf(stdout, "%s\n", pix_fmt_to_str(format[i].pixelformat));
+static void release_frame(void *arg, struct v4l2_buffer *buf) {
+    struct capture *cap = arg;
+    cap->held--;
+    requeue_frame(cap, buf);
+}
+
+/**
+ * resize_buffers - restart streaming with "count" buffers
+ *
+ * The sink has to hand every buffer back first, as they all go away.
+ */
+static int resize_buffers(struct capture *cap, struct sink *snk, int count) {
+    struct capture_source *src = cap->src;
+
+    if (-1 == sink_flush(snk) || -1 == source_stop(src) || -1 == source_release_buffers(src)
+            || -1 == source_init_buffers(src, count) || -1 == source_start(src)) {
+        return -1;
     }
 
-    free(format);
-    format = NULL;
+    // Drivers start counting from 0 again
+    frame_stats_restart(cap->stats);
+    return 0;
 }
 
-static void print_frame_sizes(int fd, uint32_t pixel_format) {
-    struct v4l2_frmsizeenum *fsze = NULL;
-    int frm_sz_cnt = enum_frame_size(fd, pixel_format, &fsze);
-    if (frm_sz_cnt < 0) {
-        perror("Error enumerating frame sizes for pixel format");
-        return;
+/**
+ * camera_config - what the command line asked of one camera
+ */
+struct camera_config {
+    const char *dev_name;
+    const char *replay_name;    // replay this file, or a test pattern with "synthetic" set
+    int synthetic;
+    double fps;
+    uint32_t pixel_format;
+    int width, height;
+    int frame_count;            // 0 goes on until stopped
+    uint32_t memory;
+    int buffer_count;
+    long buffer_budget_mb;      // 0 keeps the buffer count fixed
+    const char *trace_name;
+    int rescan;                 // enumerate the device's formats even if they are cached
+    struct output_config out;
+    unsigned int given;         // options that can only be given once per camera, GIVEN_*
+};
+
+enum given_option {
+    GIVEN_FORMAT = 1 << 0,
+    GIVEN_WIDTH = 1 << 1,
+    GIVEN_HEIGHT = 1 << 2,
+    GIVEN_COUNT = 1 << 3,
+    GIVEN_OUTPUT = 1 << 4,
+};
+
+/**
+ * camera - one capture pipeline, from its source to its sink
+ */
+struct camera {
+    struct camera_config cfg;
+    char label[16];             // prefix for its messages, empty with a single camera
+    struct capture cap;         // the source and the stats live in here
+    struct sink *snk;
+    struct sink *trigger;       // the trigger sink in "snk", if there is one
+    struct v4l2_format fmt;
+    int max_buffers;
+    uint64_t sink_stalls;       // drops with buffers still queued to the driver
+    uint64_t cur_frame;
+    int streaming;
+    uint64_t last_frame_ms;     // when a frame last arrived, for the timeout
+};
+
+static void print_pixel_formats(const struct device_probe *probe) {
+    fprintf(stdout, "No/invalid pixel format specified! Please select from the following:\n");
+    for (int i = 0; i < probe->format_count; i++) {
+        fprintf(stdout, "%s\n", pix_fmt_to_str(probe->formats[i].pixelformat));
     }
+}
 
+/**
+ * print_frame_rates - print the frame rates the device captures a discrete frame size at, as
+ * far as the probe knows them
+ */
+static void print_frame_rates(const struct device_probe *probe, uint32_t pixel_format,
+        uint32_t width, uint32_t height) {
+    const char *sep = " at ";
+    for (int i = 0; i < probe->interval_count; i++) {
+        const struct v4l2_frmivalenum *ival = &probe->intervals[i];
+        if (ival->pixel_format != pixel_format || ival->width != width
+                || ival->height != height) {
+            continue;
+        }
+
+        // A range of intervals goes from the longest frame time to the shortest
+        const struct v4l2_fract *slow = &ival->discrete, *fast = &ival->discrete;
+        if (ival->type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+            slow = &ival->stepwise.max;
+            fast = &ival->stepwise.min;
+        }
+        if (slow->numerator == 0 || fast->numerator == 0) {
+            continue;
+        }
+
+        fprintf(stdout, "%s%.4g", sep, (double) slow->denominator / slow->numerator);
+        if (fast != slow) {
+            fprintf(stdout, " to %.4g", (double) fast->denominator / fast->numerator);
+        }
+        sep = ", ";
+    }
+    if (sep[0] == ',') {
+        fprintf(stdout, " fps");
+    }
+}
+
+static void print_frame_sizes(const struct device_probe *probe, uint32_t pixel_format) {
     fprintf(stdout, "Not all/invalid frame sizes specified! Please select from the following:\n");
 
-    for (int i = 0; i < frm_sz_cnt; i++) {
-        switch(fsze[i].type) {
+    for (int i = 0; i < probe->size_count; i++) {
+        const struct v4l2_frmsizeenum *fsze = &probe->sizes[i];
+        if (fsze->pixel_format != pixel_format) {
+            continue;
+        }
+
+        switch(fsze->type) {
             case V4L2_FRMSIZE_TYPE_DISCRETE:
-                fprintf(stdout, "%dx%d\n", fsze[i].discrete.width, fsze[i].discrete.height);
+                fprintf(stdout, "%dx%d", fsze->discrete.width, fsze->discrete.height);
+                print_frame_rates(probe, pixel_format, fsze->discrete.width,
+                        fsze->discrete.height);
+                fprintf(stdout, "\n");
                 break;
 
             case V4L2_FRMSIZE_TYPE_STEPWISE:
                 fprintf(stdout, "From %dx%d to %dx%d by %dx%d\n",
-                        fsze[i].stepwise.min_width, fsze[i].stepwise.min_height,
-                        fsze[i].stepwise.max_width, fsze[i].stepwise.max_height,
-                        fsze[i].stepwise.step_width, fsze[i].stepwise.step_height);
+                        fsze->stepwise.min_width, fsze->stepwise.min_height,
+                        fsze->stepwise.max_width, fsze->stepwise.max_height,
+                        fsze->stepwise.step_width, fsze->stepwise.step_height);
                 break;
                 
             case V4L2_FRMSIZE_TYPE_CONTINUOUS:
                 fprintf(stdout, "Any dimension between %dx%d and %dx%d\n",
-                        fsze[i].stepwise.min_width, fsze[i].stepwise.min_height,
-                        fsze[i].stepwise.max_width, fsze[i].stepwise.max_height);
+                        fsze->stepwise.min_width, fsze->stepwise.min_height,
+                        fsze->stepwise.max_width, fsze->stepwise.max_height);
+                break;
+
+            default:
+                fprintf(stdout, "Unable to show frame formats, this program does not know how to "
+                        "utilize this device. Got V4L2_FRMSIZE_TYPE: %d\n", fsze->type);
                 break;
+        }
+    }
+}
+
+/**
+ * check_format - check the requested format against what the device can do, as listed by its
+ * probe
+ *
+ * A catalogue from the cache that doesn't list the format may be out of date, so the device is
+ * asked again before giving up on it.
+ * @returns 0 if the device can capture the format, 1 if the format or frame size was not
+ *          valid and the valid choices were printed instead, -1 on error
+ */
+static int check_format(int fd, const struct v4l2_capability *caps, int rescan,
+        uint32_t pixel_format, int width, int height) {
+    struct device_probe probe;
+    if (-1 == probe_device(fd, caps, rescan, &probe)) {
+        perror("Error enumerating formats and frame sizes");
+        return -1;
+    }
+
+    int valid = probe_format_valid(&probe, pixel_format)
+        && probe_frame_size_valid(&probe, pixel_format, width, height);
+    if (!valid && probe.cached) {
+        fprintf(stdout, "Format not in the probe cache, asking the device again\n");
+        probe_free(&probe);
+        if (-1 == probe_device(fd, caps, 1, &probe)) {
+            perror("Error enumerating formats and frame sizes");
+            return -1;
+        }
+        valid = probe_format_valid(&probe, pixel_format)
+            && probe_frame_size_valid(&probe, pixel_format, width, height);
+    } else if (probe.cached) {
+        fprintf(stdout, "Formats from the probe cache\n");
+    }
+
+    if (!probe_format_valid(&probe, pixel_format)) {
+        print_pixel_formats(&probe);
+    } else if (!valid) {
+        print_frame_sizes(&probe, pixel_format);
+    }
+
+    probe_free(&probe);
+    return valid ? 0 : 1;
+}
+
+/**
+ * open_device - open a V4L2 device, describe it and check the requested format against it
+ *
+ * "rescan" asks the device for its formats even if the probe cache has them.
+ * @returns 0 if the device can capture the format, 1 if the format or frame size was not
+ *          valid and the valid choices were printed instead, -1 on error
+ */
+static int open_device(const char *dev_name, struct capture_source **src, int rescan,
+        uint32_t pixel_format, int width, int height) {
+    *src = v4l2_source_open(dev_name);
+    if (*src == NULL) {
+        perror("Error opening video device");
+        fprintf(stderr, "Unable to open %s\n", dev_name);
+        return -1;
+    }
+    int fd = (*src)->fd;
+
+    struct v4l2_capability caps;
+    if (get_device_capabilities(fd, &caps) < 0) {
+        perror("Error querying capabilities");
+        return -1;
+    }
+
+    char driver[sizeof(caps.driver) + 1] = {'\0'};
+    memcpy(driver, caps.driver, sizeof(caps.driver));
+    fprintf(stdout, "Driver= \"%s\"\n", driver);
+
+    char card[sizeof(caps.card) + 1] = {'\0'};
+    memcpy(card, caps.card, sizeof(caps.card));
+    fprintf(stdout, "Card = \"%s\"\n", card);
+
+    char bus_info[sizeof(caps.bus_info) + 1] = {'\0'};
+    memcpy(bus_info, caps.bus_info, sizeof(caps.bus_info));
+    fprintf(stdout, "Bus info = \"%s\"\n", bus_info);
+
+    fprintf(stdout, "V4L2 driver version = %d\n", caps.version);
+    fprintf(stdout, "Capabilities = 0x%08x\n", caps.capabilities);
+    if (caps.capabilities & V4L2_CAP_DEVICE_CAPS) {
+        fprintf(stdout, "Device caps = 0x%08x\n", caps.device_caps);
+        print_capabilities(caps.device_caps);
+    } else {
+        print_capabilities(caps.capabilities);
+    }
+
+    if (!(caps.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+        fprintf(stderr, "Error: device does not support video capture!\n");
+        return -1;
+    }
+
+    return check_format(fd, &caps, rescan, pixel_format, width, height);
+}
+
+/**
+ * open_file - build the sink that writes frames of format "fmt" into the file "name", or "fd"
+ * without one
+ *
+ * With --direct "prealloc" bytes are reserved up front.
+ */
+static struct sink *open_file(const struct output_config *cfg, const char *name, int fd,
+        const struct v4l2_format *fmt, uint64_t prealloc, uint32_t codec) {
+    if (cfg->direct) {
+        return direct_sink_open(name, prealloc);
+    }
+    if (cfg->container) {
+        return container_sink_open(name, fd, fmt, codec);
+    }
+    return file_sink_open(name, fd);
+}
+
+/**
+ * open_thread - move the writes of "snk" onto a writer thread, closing it on failure
+ */
+static struct sink *open_thread(const struct output_config *cfg, struct sink *snk,
+        int max_buffers, size_t frame_size) {
+    struct sink *ts = thread_sink_open(snk,
+            (cfg->writer == WRITER_COPY) ? THREAD_SINK_COPY : THREAD_SINK_HOLD,
+            max_buffers, cfg->pool_frames, frame_size);
+    if (ts == NULL) {
+        int err = errno;
+        sink_close(snk);
+        errno = err;
+    }
+    return ts;
+}
+
+/**
+ * open_stripes - build the sink that deals frames out across the --stripe files, each written
+ * on its own thread, with the manifest at the output name
+ */
+static struct sink *open_stripes(const struct output_config *cfg, const struct v4l2_format *fmt,
+        int frame_count, int max_buffers, size_t frame_size, uint32_t codec) {
+    struct sink *stripes[STRIPE_MAX] = { NULL };
+    int count = cfg->stripe_count;
+    uint64_t prealloc = (uint64_t) fmt->fmt.pix.sizeimage * ((frame_count + count - 1) / count);
+
+    for (int i = 0; i < count; i++) {
+        struct sink *file = open_file(cfg, cfg->stripes[i], -1, fmt, prealloc, codec);
+        if (file == NULL || NULL == (stripes[i] = open_thread(cfg, file, max_buffers,
+                        frame_size))) {
+            int err = errno;
+            fprintf(stderr, "Error opening stripe %s: %s\n", cfg->stripes[i], strerror(err));
+            errno = err;
+            goto fail;
+        }
+    }
+
+    fprintf(stdout, "Striping frames across %d files %s, listing them in %s\n", count,
+            (cfg->stripe_policy == STRIPE_LEAST_LOADED) ? "by load" : "in turn", cfg->out_name);
+    struct sink *snk = stripe_sink_open(cfg->out_name, stripes, cfg->stripes, count,
+            cfg->stripe_policy, fmt, cfg->container);
+    if (snk != NULL) {
+        return snk;
+    }
+
+fail: ;
+    int err = errno;
+    for (int i = 0; i < count; i++) {
+        sink_close(stripes[i]);
+    }
+    errno = err;
+    return NULL;
+}
+
+/**
+ * open_writer - build the sink that writes or publishes frames of format "fmt"
+ *
+ * A trigger sink is also handed back through "trigger".
+ */
+static struct sink *open_writer(const struct output_config *cfg, struct capture_source *src,
+        const struct v4l2_format *fmt, int frame_count, int max_buffers, struct sink **trigger) {
+    if (cfg->shm_name != NULL) {
+        return shm_sink_open(cfg->shm_name, fmt, cfg->shm_slots);
+    }
+
+    // Compressed frames come in any size up to the bound
+    size_t frame_size = cfg->compress ? codec_bound(fmt) : fmt->fmt.pix.sizeimage;
+    uint32_t codec = cfg->compress ? CODEC_MED_RICE : CODEC_NONE;
+
+    if (cfg->ring_seconds > 0 || cfg->ring_bytes > 0) {
+        uint64_t frames = (cfg->ring_bytes > 0) ? cfg->ring_bytes / frame_size
+            : (uint64_t) (cfg->ring_seconds * cfg->fps + 0.5);
+        if (frames == 0 || frames > INT_MAX / 2) {
+            fprintf(stderr, "The ring has to hold 1 to %d frames of %zu bytes, not %llu!\n",
+                    INT_MAX / 2, frame_size, (unsigned long long) frames);
+            errno = EINVAL;
+            return NULL;
+        }
+        fprintf(stdout, "Keeping the last %llu frames in memory, writing them and %d more when "
+                "triggered%s%s\n", (unsigned long long) frames, cfg->ring_post,
+                (cfg->ring_socket != NULL) ? " through " : "",
+                (cfg->ring_socket != NULL) ? cfg->ring_socket : "");
+        *trigger = trigger_sink_open(cfg->out_name, (int) frames, cfg->ring_post, frame_size,
+                cfg->ring_socket, cfg->container ? fmt : NULL, codec);
+        return *trigger;
+    }
+
+    if (cfg->uring) {
+        return uring_sink_open(cfg->out_name, cfg->out_fd, src->bufs, src->buf_count,
+                cfg->uring_sqpoll);
+    }
+
+    // Only when asked for: the reader has to read() the frames for us to see them consumed
+    if (cfg->vmsplice) {
+        struct stat st;
+        if (-1 == fstat(cfg->out_fd, &st) || !S_ISFIFO(st.st_mode)) {
+            fprintf(stderr, "--vmsplice needs standard output to be a pipe!\n");
+            errno = EINVAL;
+            return NULL;
+        }
+        return splice_sink_open(cfg->out_fd, fmt->fmt.pix.sizeimage, max_buffers);
+    }
+
+    if (cfg->stripe_count > 0) {
+        return open_stripes(cfg, fmt, frame_count, max_buffers, frame_size, codec);
+    }
+
+    struct sink *snk;
+    if (cfg->segment_seconds > 0 || cfg->segment_bytes > 0) {
+        // Reserve what a segment will take, as far as that can be told
+        uint64_t prealloc = cfg->segment_bytes;
+        if (cfg->segment_seconds > 0 && cfg->fps > 0) {
+            uint64_t expected = (uint64_t) (cfg->segment_seconds * cfg->fps + 1)
+                * fmt->fmt.pix.sizeimage;
+            if (prealloc == 0 || expected < prealloc) {
+                prealloc = expected;
+            }
+        }
+        snk = segment_sink_open(cfg->out_name, cfg->segment_bytes,
+                (uint64_t) (cfg->segment_seconds * 1e9), prealloc, cfg->container ? fmt : NULL,
+                codec);
+    } else {
+        snk = open_file(cfg, cfg->out_name, cfg->out_fd, fmt,
+                (uint64_t) fmt->fmt.pix.sizeimage * frame_count, codec);
+    }
+    if (snk == NULL || cfg->writer == WRITER_INLINE) {
+        return snk;
+    }
+    return open_thread(cfg, snk, max_buffers, frame_size);
+}
+
+/**
+ * open_conversion - build the sink that scales, converts and compresses frames before writing
+ * them, or only writes them
+ *
+ * "crop" is the region of the frames to keep, or NULL for all of them (also when the device
+ * crops already).  "max_buffers" is how many buffers the sink may be given at once.
+ */
+static struct sink *open_conversion(const struct output_config *cfg,
+        struct capture_source *src, const struct v4l2_format *fmt, const struct v4l2_rect *crop,
+        int frame_count, int max_buffers, struct sink **trigger) {
+    // Without --scale frames keep the size of the region
+    uint32_t width = cfg->scale_width, height = cfg->scale_height;
+    if (width == 0 && cfg->crop.width != 0) {
+        width = cfg->crop.width;
+        height = cfg->crop.height;
+    }
+    int scale = (crop != NULL) || (width != 0
+            && (width != fmt->fmt.pix.width || height != fmt->fmt.pix.height));
+
+    if (cfg->convert_to == 0 && !scale && !cfg->compress) {
+        return open_writer(cfg, src, fmt, frame_count, max_buffers, trigger);
+    }
+
+    // Scaling, conversion and compression share one pool of threads
+    struct thread_pool *threads = NULL;
+    struct scaler *sc = NULL;
+    struct converter *cv = NULL;
+    struct compressor *cmp = NULL;
+    if (cfg->convert_threads > 1) {
+        threads = thread_pool_create(cfg->convert_threads, cfg->convert_cpus,
+                cfg->convert_cpu_count);
+        if (threads == NULL) {
+            return NULL;
+        }
+    }
+
+    // The writer only ever sees scaled and converted frames
+    struct v4l2_format scaled = *fmt;
+    if (scale) {
+        sc = scaler_create(fmt, crop, width, height, NULL, &scaled);
+        if (sc == NULL || -1 == scaler_set_pool(sc, threads)) {
+            goto fail;
+        }
+        fprintf(stdout, "Scaling %ux%u", fmt->fmt.pix.width, fmt->fmt.pix.height);
+        if (crop != NULL) {
+            fprintf(stdout, " (%ux%u at %d,%d)", crop->width, crop->height, crop->left,
+                    crop->top);
+        }
+        fprintf(stdout, " to %ux%u with the %s filter\n", scaled.fmt.pix.width,
+                scaled.fmt.pix.height, scaler_filter(sc));
+    }
+
+    struct v4l2_format out = scaled;
+    if (cfg->convert_to != 0) {
+        cv = converter_create(&scaled, cfg->convert_to, NULL, &out);
+        if (cv == NULL || -1 == converter_set_pool(cv, threads)) {
+            goto fail;
+        }
+        converter_set_demosaic(cv, cfg->demosaic);
+        fprintf(stdout, "Converting %s to %s with %s kernels",
+                pix_fmt_to_str(fmt->fmt.pix.pixelformat), pix_fmt_to_str(cfg->convert_to),
+                converter_kernels(cv)->name);
+        if (threads != NULL) {
+            fprintf(stdout, " on %d threads, %d frames in flight", cfg->convert_threads,
+                    cfg->convert_in_flight);
+        }
+        fprintf(stdout, "\n");
+    }
+
+    if (cfg->compress) {
+        cmp = compressor_create(&out);
+        if (cmp == NULL) {
+            if (errno == EINVAL) {
+                fprintf(stderr, "%s frames of %u bytes a row can't be compressed!\n",
+                        pix_fmt_to_str(out.fmt.pix.pixelformat), out.fmt.pix.bytesperline);
+            }
+            goto fail;
+        }
+        if (-1 == compressor_set_pool(cmp, threads)) {
+            goto fail;
+        }
+        fprintf(stdout, "Compressing %s frames with %s", pix_fmt_to_str(out.fmt.pix.pixelformat),
+                codec_name(CODEC_MED_RICE));
+        if (threads != NULL) {
+            fprintf(stdout, " on %d threads, %d frames in flight", cfg->convert_threads,
+                    cfg->convert_in_flight);
+        }
+        fprintf(stdout, "\n");
+    }
+
+    struct sink *snk = open_writer(cfg, src, &out, frame_count, max_buffers, trigger);
+    if (snk == NULL) {
+        goto fail;
+    }
+    return convert_sink_open(snk, sc, cv, cmp, threads, &out, max_buffers,
+            cfg->convert_in_flight);
+
+fail: ;
+    int err = errno;
+    compressor_free(cmp);
+    converter_free(cv);
+    scaler_free(sc);
+    thread_pool_free(threads);
+    errno = err;
+    return NULL;
+}
+
+/**
+ * open_output - build the sink frames from "src" are written to
+ *
+ * "crop" is the region of the frames to keep, or NULL for all of them (also when the device
+ * crops already).  "max_buffers" is how many buffers the source may end up with, if it can
+ * grow its queue.  A trigger sink in there is also handed back through "trigger".
+ */
+static struct sink *open_output(const struct output_config *cfg, struct capture_source *src,
+        const struct v4l2_format *fmt, const struct v4l2_rect *crop, int frame_count,
+        int max_buffers, struct sink **trigger) {
+    if (cfg->share_path != NULL) {
+        return dmabuf_sink_open(cfg->share_path, src, fmt);
+    }
+    if (!cfg->motion) {
+        return open_conversion(cfg, src, fmt, crop, frame_count, max_buffers, trigger);
+    }
+
+    // Frames are compared before they are scaled or converted, so dropped ones never are
+    struct motion_detector *md = motion_create(fmt, cfg->motion_step, NULL);
+    if (md == NULL) {
+        return NULL;
+    }
+    fprintf(stdout, "Writing frames that differ by more than %.1f, comparing every %d%s row, "
+            "with %d frames of pre-roll and %d of post-roll\n", cfg->motion_level,
+            cfg->motion_step, (cfg->motion_step == 1) ? "st" : "th", cfg->pre_roll,
+            cfg->post_roll);
+
+    // The motion sink passes on the frames of its pre-roll as well
+    struct sink *snk = open_conversion(cfg, src, fmt, crop, frame_count,
+            max_buffers + cfg->pre_roll, trigger);
+    if (snk == NULL) {
+        int err = errno;
+        motion_free(md);
+        errno = err;
+        return NULL;
+    }
+    return motion_sink_open(snk, md, cfg->motion_level, cfg->pre_roll, cfg->post_roll,
+            max_buffers, fmt->fmt.pix.sizeimage, cfg->motion_log);
+}
+
+/**
+ * camera_name - what the user called the camera on the command line
+ */
+static const char *camera_name(const struct camera_config *cfg) {
+    if (cfg->dev_name != NULL) {
+        return cfg->dev_name;
+    }
+    return (cfg->replay_name != NULL) ? cfg->replay_name : "synthetic";
+}
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * camera_error - perror() for one camera, naming it when there are several
+ */
+static void camera_error(const struct camera *cam, const char *msg) {
+    fprintf(stderr, "%s%s: %s\n", cam->label, msg, strerror(errno));
+}
+
+/**
+ * check_camera - reject option combinations one camera can't work with
+ *
+ * Also settles the buffer memory type for --share.
+ * @returns 0 if the camera can be set up, -1 if not
+ */
+static int check_camera(struct camera_config *cfg) {
+    struct output_config *out = &cfg->out;
+
+    if (out->uring && out->writer != WRITER_INLINE) {
+        fprintf(stderr, "io_uring writes are already asynchronous, it can't be used with --writer!\n");
+        return -1;
+    }
+
+    if (out->direct && (out->out_name == NULL || out->uring)) {
+        fprintf(stderr, "--direct needs an output file, and can't be combined with --uring!\n");
+        return -1;
+    }
+
+    if (out->compress && !out->container) {
+        fprintf(stderr, "--compress needs --container, which tells which frames are "
+                "compressed!\n");
+        return -1;
+    }
+
+    if (out->container && (out->uring || out->direct)) {
+        fprintf(stderr, "--container writes frame headers and an index along with the frames, "
+                "it can't be combined with --uring or --direct!\n");
+        return -1;
+    }
+
+    int publish = (out->share_path != NULL) || (out->shm_name != NULL);
+    if (publish && (out->out_name != NULL || out->uring || out->direct || out->container
+                || out->writer != WRITER_INLINE
+                || (out->share_path != NULL && out->shm_name != NULL))) {
+        fprintf(stderr, "--share and --shm don't write frames, they can't be combined with each "
+                "other or with output options!\n");
+        return -1;
+    }
+
+    if (out->vmsplice && (out->out_name != NULL || out->uring || out->container
+                || out->writer != WRITER_INLINE || publish)) {
+        fprintf(stderr, "--vmsplice streams frames into standard output, it can't be combined "
+                "with --output, --uring, --container, --writer, --share or --shm!\n");
+        return -1;
+    }
+
+    if (cfg->buffer_budget_mb > 0 && (out->uring || out->share_path != NULL)) {
+        fprintf(stderr, "--uring and --share are tied to the buffers they started with, they "
+                "can't be used with --adaptive-buffers!\n");
+        return -1;
+    }
+
+    // Only the driver's own buffers can be exported to other processes
+    if (out->share_path != NULL) {
+        if (cfg->memory == V4L2_MEMORY_USERPTR) {
+            fprintf(stderr, "--share needs the driver's own buffers, it can't use --memory=userptr!\n");
+            return -1;
+        }
+        cfg->memory = V4L2_MEMORY_MMAP;
+    }
+
+    if (out->ring_seconds > 0 || out->ring_bytes > 0) {
+        if (out->out_name == NULL || out->uring || out->direct || out->writer != WRITER_INLINE
+                || publish) {
+            fprintf(stderr, "--ring needs an --output to number its files after, and writes them "
+                    "on its own thread, it can't be combined with --uring, --direct, --writer, "
+                    "--share or --shm!\n");
+            return -1;
+        }
+    } else if (out->ring_post != 0 || out->ring_socket != NULL) {
+        fprintf(stderr, "--ring-post and --ring-socket only work with --ring!\n");
+        return -1;
+    }
+
+    if ((out->segment_seconds > 0 || out->segment_bytes > 0)
+            && (out->out_name == NULL || out->uring || out->direct || publish
+                || out->ring_seconds > 0 || out->ring_bytes > 0)) {
+        fprintf(stderr, "--segment needs an --output to number its files after, and can't be "
+                "combined with --uring, --direct, --share, --shm or --ring!\n");
+        return -1;
+    }
+
+    if (out->stripe_count > 0) {
+        if (out->out_name == NULL || out->uring || publish || out->ring_seconds > 0
+                || out->ring_bytes > 0 || out->segment_seconds > 0 || out->segment_bytes > 0) {
+            fprintf(stderr, "--stripe needs an --output to list the frames in, and writes the "
+                    "stripes on threads of its own, it can't be combined with --uring, --share, "
+                    "--shm, --ring or --segment!\n");
+            return -1;
+        }
+        for (int i = 0; i < out->stripe_count; i++) {
+            for (int j = i + 1; j <= out->stripe_count; j++) {
+                const char *other = (j < out->stripe_count) ? out->stripes[j] : out->out_name;
+                if (strcmp(out->stripes[i], other) == 0) {
+                    fprintf(stderr, "\"%s\" is given twice, every stripe and the --output need "
+                            "a file of their own!\n", other);
+                    return -1;
+                }
+            }
+        }
+    } else if (out->stripe_policy != STRIPE_ROUND_ROBIN) {
+        fprintf(stderr, "--stripe-policy only works with --stripe!\n");
+        return -1;
+    }
+
+    if (out->motion) {
+        if (out->uring || out->share_path != NULL) {
+            fprintf(stderr, "--uring and --share work on the capture buffers themselves, they "
+                    "can't be used with --motion!\n");
+            return -1;
+        }
+        if (cfg->pixel_format != 0 && !motion_supported(cfg->pixel_format)) {
+            fprintf(stderr, "Can't look for motion in %s frames, only in GREY, 8-bit Bayer and "
+                    "YUV ones!\n", pix_fmt_to_str(cfg->pixel_format));
+            return -1;
+        }
+    } else if (out->pre_roll != 0 || out->post_roll != 0 || out->motion_log != NULL) {
+        fprintf(stderr, "--pre-roll, --post-roll and --motion-log only work with --motion!\n");
+        return -1;
+    }
+
+    if (out->crop.width != 0 || out->scale_width != 0) {
+        if (out->uring || out->share_path != NULL) {
+            fprintf(stderr, "--uring and --share work on the capture buffers themselves, they "
+                    "can't be used with --crop or --scale!\n");
+            return -1;
+        }
+        if (cfg->pixel_format != 0 && !scale_supported(cfg->pixel_format)) {
+            fprintf(stderr, "Can't crop or scale %s, only GREY, RGB24, YUYV, UYVY and NV12!\n",
+                    pix_fmt_to_str(cfg->pixel_format));
+            return -1;
+        }
+        // Chroma is shared by pixel pairs, and in NV12 by row pairs as well
+        uint32_t pf = cfg->pixel_format;
+        if ((pf == V4L2_PIX_FMT_YUYV || pf == V4L2_PIX_FMT_UYVY || pf == V4L2_PIX_FMT_NV12)
+                && ((out->crop.left | out->crop.width | out->scale_width) & 1) != 0) {
+            fprintf(stderr, "%s frames can only be cropped and scaled in pairs of columns!\n",
+                    pix_fmt_to_str(pf));
+            return -1;
+        }
+        if (pf == V4L2_PIX_FMT_NV12
+                && ((out->crop.top | out->crop.height | out->scale_height) & 1) != 0) {
+            fprintf(stderr, "NV12 frames can only be cropped and scaled in pairs of rows!\n");
+            return -1;
+        }
+        if (cfg->width != 0 && cfg->height != 0 && out->crop.width != 0
+                && ((uint64_t) out->crop.left + out->crop.width > (uint64_t) cfg->width
+                    || (uint64_t) out->crop.top + out->crop.height > (uint64_t) cfg->height)) {
+            fprintf(stderr, "The --crop region has to lie within the %dx%d frame!\n",
+                    cfg->width, cfg->height);
+            return -1;
+        }
+    }
+
+    if (out->convert_to != 0) {
+        if (out->uring || out->share_path != NULL) {
+            fprintf(stderr, "--uring and --share work on the capture buffers themselves, they "
+                    "can't be used with --convert-to!\n");
+            return -1;
+        }
+        if (cfg->pixel_format != 0 && !convert_supported(cfg->pixel_format, out->convert_to)) {
+            fprintf(stderr, "Can't convert %s to %s, only YUYV, UYVY and NV12 to YUV420, RGB24 "
+                    "and GREY, Bayer formats to RGB24 and GREY, and Y10BPACK, Y10P, Y10 and "
+                    "Y12 to Y16 and GREY (packed ones also to Y10)!\n",
+                    pix_fmt_to_str(cfg->pixel_format), pix_fmt_to_str(out->convert_to));
+            return -1;
+        }
+    }
+
+    int replay = (cfg->replay_name != NULL) || cfg->synthetic;
+    if (replay && (cfg->pixel_format == 0 || cfg->width == 0 || cfg->height == 0)) {
+        fprintf(stderr, "Please provide the format, width and height of the frames to replay!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * same_name - whether two cameras were given the same, non-NULL, file or object name
+ */
+static int same_name(const char *a, const char *b) {
+    return a != NULL && b != NULL && strcmp(a, b) == 0;
+}
+
+/**
+ * stripe_clash - a --stripe file of "a" that "b" writes to as well, or NULL
+ */
+static const char *stripe_clash(const struct output_config *a, const struct output_config *b) {
+    for (int i = 0; i < a->stripe_count; i++) {
+        if (same_name(a->stripes[i], b->out_name)) {
+            return a->stripes[i];
+        }
+        for (int j = 0; j < b->stripe_count; j++) {
+            if (same_name(a->stripes[i], b->stripes[j])) {
+                return a->stripes[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * check_cameras - make sure no two cameras write to, or publish under, the same name
+ */
+static int check_cameras(const struct camera *cams, int cam_count) {
+    for (int i = 0; i < cam_count; i++) {
+        for (int j = i + 1; j < cam_count; j++) {
+            const struct camera_config *a = &cams[i].cfg, *b = &cams[j].cfg;
+            const char *clash = same_name(a->out.out_name, b->out.out_name) ? a->out.out_name
+                : same_name(a->out.share_path, b->out.share_path) ? a->out.share_path
+                : same_name(a->out.shm_name, b->out.shm_name) ? a->out.shm_name
+                : same_name(a->trace_name, b->trace_name) ? a->trace_name
+                : same_name(a->out.motion_log, b->out.motion_log) ? a->out.motion_log
+                : same_name(a->out.ring_socket, b->out.ring_socket) ? a->out.ring_socket
+                : (stripe_clash(&a->out, &b->out) != NULL) ? stripe_clash(&a->out, &b->out)
+                : stripe_clash(&b->out, &a->out);
+            if (clash != NULL) {
+                fprintf(stderr, "Cameras %d and %d can't both use \"%s\", give each camera its own "
+                        "output and trace options after its --device!\n", i, j, clash);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * setup_camera - open the camera's source and sink and start it streaming
+ *
+ * @returns 0 once streaming, 1 if the format or frame size was not valid and the valid choices
+ *          were printed instead, -1 on error
+ */
+static int setup_camera(struct camera *cam) {
+    struct camera_config *cfg = &cam->cfg;
+
+    if (cfg->dev_name == NULL) {
+        cam->cap.src = replay_source_open(cfg->replay_name, cfg->fps);
+        if (cam->cap.src == NULL) {
+            camera_error(cam, "Error opening replay source");
+            return -1;
+        }
+    } else {
+        int r = open_device(cfg->dev_name, &cam->cap.src, cfg->rescan, cfg->pixel_format,
+                cfg->width, cfg->height);
+        if (r != 0) {
+            return r;
+        }
+    }
+    struct capture_source *src = cam->cap.src;
+
+    fprintf(stdout, "%sSetting stream format\n", cam->label);
+
+    struct v4l2_format *fmt = &cam->fmt;
+    fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt->fmt.pix.width = cfg->width;
+    fmt->fmt.pix.height = cfg->height;
+    fmt->fmt.pix.pixelformat = cfg->pixel_format;
+    fmt->fmt.pix.field = V4L2_FIELD_NONE;
+
+    if (source_set_format(src, fmt) != 0) {
+        camera_error(cam, "Error setting format");
+        return -1;
+    }
+
+    // Let the driver crop when it can, and only crop what it doesn't in software
+    const struct v4l2_rect *crop = (cfg->out.crop.width != 0) ? &cfg->out.crop : NULL;
+    if (crop != NULL && cfg->dev_name != NULL) {
+        struct v4l2_format requested = *fmt;
+        if (0 == set_crop(src->fd, crop)) {
+            if (-1 == get_stream_format(src->fd, fmt)) {
+                camera_error(cam, "Error reading back the cropped format");
+                return -1;
+            }
+            fprintf(stdout, "%sDriver crops to %ux%u at %d,%d, frames are %ux%u\n", cam->label,
+                    crop->width, crop->height, crop->left, crop->top, fmt->fmt.pix.width,
+                    fmt->fmt.pix.height);
+            crop = NULL;
+        } else {
+            fprintf(stdout, "%sDriver can't crop (%s), cropping in software\n", cam->label,
+                    strerror(errno));
+            *fmt = requested;
+            if (source_set_format(src, fmt) != 0) {
+                camera_error(cam, "Error setting format");
+                return -1;
+            }
+        }
+    }
+
+    fprintf(stdout, "%sSetting up buffers\n", cam->label);
+    // Initialize all the buffers. We give a few spots so the camera can continue to stream
+    // the next frame while our program processes the previous one.  The number of buffers
+    // should be no less than 2 for streaming, the v4l2 docs example gives 4
+    src->memory = cfg->memory;
+    if (-1 == source_init_buffers(src, cfg->buffer_count)) {
+        camera_error(cam, "Error setting up buffers");
+        return -1;
+    }
+    if (src->buf_count != cfg->buffer_count) {
+        fprintf(stdout, "%sDriver granted %d buffers instead of %d\n", cam->label, src->buf_count,
+                cfg->buffer_count);
+    }
+    fprintf(stdout, "%sCapturing into %d of %s buffers\n", cam->label, src->buf_count,
+            (src->memory == V4L2_MEMORY_USERPTR) ? "our own (userptr)" : "the driver's (mmap)");
+
+    // How deep the queue may get when it adapts to dropped frames
+    cam->max_buffers = src->buf_count;
+    if (cfg->buffer_budget_mb > 0) {
+        uint64_t fit = ((uint64_t) cfg->buffer_budget_mb << 20) / fmt->fmt.pix.sizeimage;
+        if (fit > VIDEO_MAX_FRAME) {
+            fit = VIDEO_MAX_FRAME;
+        }
+        if (fit > (uint64_t) cam->max_buffers) {
+            cam->max_buffers = (int) fit;
+        }
+    }
+
+    // A ring sized in seconds needs the frame rate, segments are only preallocated by it
+    cfg->out.fps = cfg->fps;
+    if (cfg->dev_name != NULL && -1 == get_frame_rate(src->fd, &cfg->out.fps)) {
+        cfg->out.fps = 0;
+    }
+    if (cfg->out.ring_seconds > 0 && cfg->out.fps <= 0) {
+        fprintf(stderr, "%sCan't tell the frame rate to size the ring by, give it in bytes%s!\n",
+                cam->label, (cfg->dev_name == NULL) ? " or give a --fps" : "");
+        return -1;
+    }
+
+    cam->snk = open_output(&cfg->out, src, fmt, crop, cfg->frame_count, cam->max_buffers,
+            &cam->trigger);
+    if (cam->snk == NULL) {
+        camera_error(cam, "Error opening output");
+        return -1;
+    }
+
+    cam->cap.stats = frame_stats_create(cfg->trace_name);
+    if (cam->cap.stats == NULL) {
+        camera_error(cam, "Error opening trace file");
+        return -1;
+    }
+
+    cam->cap.held = 0;
+    sink_set_release(cam->snk, release_frame, &cam->cap);
+
+    // Start streaming!
+    if (-1 == source_start(src)) {
+        camera_error(cam, "Error starting stream");
+        return -1;
+    }
+
+    cam->streaming = 1;
+    cam->last_frame_ms = monotonic_ms();
+    return 0;
+}
+
+/**
+ * camera_done - whether the camera has all the frames it was asked for
+ */
+static int camera_done(const struct camera *cam) {
+    return cam->cfg.frame_count > 0 && cam->cur_frame >= (uint64_t) cam->cfg.frame_count;
+}
+
+/**
+ * capture_frame - dequeue the frame the camera has ready and hand it to the sink
+ *
+ * With "sync" the frame waits for frames of the other cameras instead, as camera "stream".
+ * @returns 0 on success, also if the frame wasn't ready after all, -1 on error
+ */
+static int capture_frame(struct camera *cam, struct frame_sync *sync, int stream) {
+    struct capture_source *src = cam->cap.src;
+
+    struct v4l2_buffer buf;
+    if (-1 == source_dequeue(src, &buf)) {
+        if (EAGAIN == errno)
+            return 0;
+
+        camera_error(cam, "Error reading frame");
+        return -1;
+    }
+    cam->last_frame_ms = monotonic_ms();
+
+    uint32_t dropped = frame_stats_dequeued(cam->cap.stats, &buf);
+    if (sync != NULL) {
+        // Sets are matched on timestamps, which only the monotonic clock makes comparable
+        if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+            fprintf(stderr, "%s--sync needs monotonic frame timestamps, and the driver's aren't!\n",
+                    cam->label);
+            requeue_frame(&cam->cap, &buf);
+            errno = EINVAL;
+            return -1;
+        }
+        cam->cap.held++;
+        return frame_sync_push(sync, stream, &buf);
+    }
+
+    int queued = src->buf_count - cam->cap.held - 1;
+
+    int r = sink_submit(cam->snk, src->bufs[buf.index].start, &buf);
+    if (-1 == r) {
+        camera_error(cam, "Error writing output");
+        return -1;
+    }
+
+    if (0 == r) {
+        requeue_frame(&cam->cap, &buf);
+    } else {
+        cam->cap.held++;
+    }
+
+    fprintf(stdout, "%sWritten frame %llu\n", cam->label, (unsigned long long) cam->cur_frame);
+    cam->cur_frame++;
+
+    // Frames are getting dropped while the driver is starved of buffers, give it a deeper queue
+    // as far as the budget goes.  Drops with buffers still queued are counted as sink stalls
+    // instead: a restart for every one of them costs more frames than it could save.
+    if (dropped > 0 && queued > 1) {
+        cam->sink_stalls++;
+    } else if (dropped > 0 && src->buf_count < cam->max_buffers && !camera_done(cam)) {
+        int old_count = src->buf_count;
+        int count = (old_count * 2 < cam->max_buffers) ? old_count * 2 : cam->max_buffers;
+        fprintf(stdout, "%sDropped %u frames with %d of %d buffers queued, restarting with %d\n",
+                cam->label, dropped, queued, old_count, count);
+
+        if (-1 == resize_buffers(&cam->cap, cam->snk, count)) {
+            camera_error(cam, "Error resizing the buffer queue");
+            return -1;
+        }
+
+        // Don't keep asking if the driver won't give us more
+        if (src->buf_count <= old_count) {
+            cam->max_buffers = src->buf_count;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * write_set - hand every frame of a set to its camera's sink
+ */
+static int write_set(void *arg, uint64_t set, struct v4l2_buffer *bufs, int streams,
+        uint64_t spread_ns) {
+    struct camera *cams = arg;
+    int ret = 0;
+
+    for (int s = 0; s < streams; s++) {
+        struct camera *cam = &cams[s];
+        struct v4l2_buffer *buf = &bufs[s];
+
+        // Past an error the rest of the set only goes back to the driver
+        int r = (ret == 0) ? sink_submit(cam->snk, cam->cap.src->bufs[buf->index].start, buf) : 0;
+        if (-1 == r) {
+            camera_error(cam, "Error writing output");
+            ret = -1;
+            r = 0;
+        }
+
+        if (0 == r) {
+            cam->cap.held--;
+            requeue_frame(&cam->cap, buf);
+        }
+        cam->cur_frame++;
+    }
+
+    fprintf(stdout, "Written set %llu, spread %.1f us, sequences", (unsigned long long) set,
+            spread_ns / 1000.0);
+    for (int s = 0; s < streams; s++) {
+        fprintf(stdout, " %u", bufs[s].sequence);
+    }
+    fprintf(stdout, "\n");
+
+    return ret;
+}
+
+/**
+ * drop_frame - give a frame that didn't make it into a set back to its camera
+ */
+static void drop_frame(void *arg, int stream, struct v4l2_buffer *buf, enum frame_sync_drop why) {
+    struct camera *cam = &((struct camera *) arg)[stream];
+    if (why != FRAME_SYNC_FLUSHED) {
+        fprintf(stdout, "%sDropped %s frame %u\n", cam->label,
+                (why == FRAME_SYNC_LATE) ? "late" : "unmatched", buf->sequence);
+    }
+
+    cam->cap.held--;
+    requeue_frame(&cam->cap, buf);
+}
+
+/**
+ * finish_camera - wait for the sink to write everything, stop streaming and print the stats
+ */
+static int finish_camera(struct camera *cam) {
+    int ret = 0;
+
+    cam->streaming = 0;
+    if (-1 == sink_flush(cam->snk)) {
+        camera_error(cam, "Error writing output");
+        ret = -1;
+    }
+
+    if (-1 == source_stop(cam->cap.src)) {
+        camera_error(cam, "Error stopping stream");
+        ret = -1;
+    }
+
+    if (cam->label[0] != '\0') {
+        fprintf(stdout, "%s%llu frames from %s\n", cam->label,
+                (unsigned long long) cam->cur_frame, camera_name(&cam->cfg));
+    }
+    frame_stats_print(cam->cap.stats, stdout);
+    if (cam->cfg.buffer_budget_mb > 0) {
+        fprintf(stdout, "%sFinished with %d buffers, %llu drops with buffers still queued\n",
+                cam->label, cam->cap.src->buf_count, (unsigned long long) cam->sink_stalls);
+    }
+
+    return ret;
+}
+
+static void close_camera(struct camera *cam) {
+    if (-1 == sink_close(cam->snk)) {
+        camera_error(cam, "Error closing output");
+    }
+    cam->snk = NULL;
+
+    source_close(cam->cap.src);
+    cam->cap.src = NULL;
+
+    if (-1 == frame_stats_close(cam->cap.stats)) {
+        camera_error(cam, "Error writing trace file");
+    }
+    cam->cap.stats = NULL;
+
+    if (cam->cfg.out.out_fd >= 0) {
+        close(cam->cfg.out.out_fd);
+        cam->cfg.out.out_fd = -1;
+    }
+}
+
+/*
+ * Every camera's source fd and sink event fd are watched by one epoll instance.  The event data
+ * holds the camera's index, shifted left by one, with the low bit set for the sink's fd.
+ */
+
+static int watch_camera(int epfd, struct camera *cam, int index) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = (uint64_t) index << 1 };
+    if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, cam->cap.src->fd, &ev)) {
+        return -1;
+    }
+
+    if (cam->snk->event_fd >= 0) {
+        ev.data.u64 |= 1;
+        if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, cam->snk->event_fd, &ev)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void unwatch_camera(int epfd, struct camera *cam) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, cam->cap.src->fd, NULL);
+    if (cam->snk->event_fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, cam->snk->event_fd, NULL);
+    }
+}
+
+/**
+ * stop_camera - stop watching a camera, finishing it cleanly unless it failed
+ */
+static int stop_camera(int epfd, struct camera *cam, int failed) {
+    unwatch_camera(epfd, cam);
+    if (failed) {
+        cam->streaming = 0;
+        return -1;
+    }
+    return finish_camera(cam);
+}
+
+/**
+ * handle_signals - act on the signals that came in through the signalfd "signal_fd"
+ *
+ * SIGUSR1 fires the ring of every streaming camera that keeps one.  SIGINT and SIGTERM are let
+ * through again, so a second one ends the program at once.
+ * @returns 1 if the cameras should stop, 0 otherwise
+ */
+static int handle_signals(struct camera *cams, int cam_count, int signal_fd) {
+    struct signalfd_siginfo info;
+    int trigger = 0, stop = 0;
+    while (read(signal_fd, &info, sizeof(info)) == (ssize_t) sizeof(info)) {
+        if (info.ssi_signo == SIGUSR1) {
+            trigger = 1;
+        } else if (!stop) {
+            stop = 1;
+            fprintf(stdout, "Stopping on %s, once more to quit at once\n",
+                    (info.ssi_signo == SIGINT) ? "SIGINT" : "SIGTERM");
+
+            sigset_t set;
+            sigemptyset(&set);
+            sigaddset(&set, SIGINT);
+            sigaddset(&set, SIGTERM);
+            sigprocmask(SIG_UNBLOCK, &set, NULL);
+        }
+    }
+
+    if (trigger && !stop) {
+        fprintf(stdout, "Triggering on SIGUSR1\n");
+        for (int i = 0; i < cam_count; i++) {
+            struct camera *cam = &cams[i];
+            if (cam->streaming && cam->trigger != NULL && -1 == trigger_sink_fire(cam->trigger)) {
+                camera_error(cam, "Error triggering");
+            }
+        }
+    }
+
+    return stop;
+}
+
+/**
+ * run_cameras - capture from every streaming camera until each has all its frames
+ *
+ * A camera that fails is stopped without holding up the others.  With "sync" the frames are
+ * grouped into sets instead, and once one camera stops there are no more sets to make.  Signals
+ * arrive through the signalfd "signal_fd", see handle_signals().
+ * @returns 0 if every camera finished cleanly, -1 otherwise
+ */
+static int run_cameras(struct camera *cams, int cam_count, struct frame_sync *sync,
+        int signal_fd) {
+    int ret = 0;
+    int active = 0;
+    int stopping = 0;
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("Error creating epoll instance");
+        return -1;
+    }
+
+    for (int i = 0; i < cam_count; i++) {
+        struct camera *cam = &cams[i];
+        if (!cam->streaming) {
+            continue;
+        }
+
+        if (-1 == watch_camera(epfd, cam, i)) {
+            camera_error(cam, "Error watching camera");
+            ret = -1;
+            goto out;
+        }
+        active++;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = UINT64_MAX };
+    if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, signal_fd, &ev)) {
+        perror("Error watching for signals");
+        ret = -1;
+        goto out;
+    }
+
+    for (;;) {
+        int done = 0;
+        for (int i = 0; i < cam_count; i++) {
+            done |= cams[i].streaming && (stopping || camera_done(&cams[i]));
+        }
+
+        if (sync != NULL && (done || active < cam_count) && active > 0) {
+            // Frames still waiting for a set go back before the cameras stop
+            frame_sync_flush(sync);
+            for (int i = 0; i < cam_count; i++) {
+                if (cams[i].streaming) {
+                    if (-1 == stop_camera(epfd, &cams[i], 0)) {
+                        ret = -1;
+                    }
+                    active--;
+                }
+            }
+        } else if (done) {
+            for (int i = 0; i < cam_count; i++) {
+                if (cams[i].streaming && (stopping || camera_done(&cams[i]))) {
+                    if (-1 == stop_camera(epfd, &cams[i], 0)) {
+                        ret = -1;
+                    }
+                    active--;
+                }
+            }
+        }
+
+        if (active == 0) {
+            break;
+        }
+
+        // Wake up in time for the first camera that would time out
+        uint64_t now = monotonic_ms();
+        int timeout = FRAME_TIMEOUT_MS;
+        for (int i = 0; i < cam_count; i++) {
+            if (!cams[i].streaming) {
+                continue;
+            }
+            uint64_t due = cams[i].last_frame_ms + FRAME_TIMEOUT_MS;
+            int left = (due > now) ? (int) (due - now) : 0;
+            if (left < timeout) {
+                timeout = left;
+            }
+        }
+
+        struct epoll_event events[2 * MAX_CAMERAS];
+        int n = epoll_wait(epfd, events, 2 * MAX_CAMERAS, timeout);
+        if (-1 == n) {
+            if (EINTR == errno)
+                continue;
+
+            perror("Error waiting for next frame");
+            ret = -1;
+            goto out;
+        }
+
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.u64 == UINT64_MAX) {
+                stopping |= handle_signals(cams, cam_count, signal_fd);
+                continue;
+            }
+
+            int index = events[e].data.u64 >> 1;
+            struct camera *cam = &cams[index];
+            if (!cam->streaming) {
+                continue;
+            }
+
+            int r;
+            if (events[e].data.u64 & 1) {
+                r = sink_process_events(cam->snk);
+                if (-1 == r) {
+                    camera_error(cam, "Error writing output");
+                }
+            } else if (cam->cap.held == cam->cap.src->buf_count) {
+                // The sink has every buffer, nothing can have been captured
+                continue;
+            } else {
+                r = capture_frame(cam, sync, index);
+            }
+
+            if (-1 == r) {
+                ret = stop_camera(epfd, cam, 1);
+                active--;
+            }
+        }
+
+        now = monotonic_ms();
+        for (int i = 0; i < cam_count; i++) {
+            struct camera *cam = &cams[i];
+            if (!cam->streaming || now < cam->last_frame_ms + FRAME_TIMEOUT_MS) {
+                continue;
+            }
+
+            // No frame can arrive while the sink holds every buffer, so that's not a timeout
+            if (cam->cap.held == cam->cap.src->buf_count) {
+                cam->last_frame_ms = now;
+                continue;
+            }
+
+            fprintf(stderr, "%sTimeout waiting for next frame\n", cam->label);
+            ret = stop_camera(epfd, cam, 1);
+            active--;
+        }
+    }
+
+    if (sync != NULL) {
+        frame_sync_print(sync, stdout);
+    }
+
+out:
+    close(epfd);
+    return ret;
+}
+
+/**
+ * parse_amount - parse an amount of frames, in seconds ("10s") or in bytes ("512M", with K, M
+ * or G), into "seconds" or "bytes"
+ */
+static int parse_amount(const char *arg, double *seconds, uint64_t *bytes) {
+    char *endptr = NULL;
+    double parsed = strtod(arg, &endptr);
+    if (endptr == arg || parsed <= 0) {
+        return -1;
+    }
+
+    if (strcmp(endptr, "s") == 0) {
+        if (parsed > 86400) {
+            return -1;
+        }
+        *seconds = parsed;
+        return 0;
+    }
+
+    int shift = (*endptr == 'K') ? 10 : (*endptr == 'M') ? 20 : (*endptr == 'G') ? 30 : 0;
+    if ((shift != 0 && endptr[1] != '\0') || (shift == 0 && *endptr != '\0')
+            || parsed * (double) (1ull << shift) > (double) (1ull << 40)) {
+        return -1;
+    }
+    *bytes = (uint64_t) (parsed * (double) (1ull << shift));
+    return 0;
+}
+
+/**
+ * parse_crop - parse a region like "320,180,1280,720" (X,Y,W,H)
+ */
+static int parse_crop(const char *arg, struct v4l2_rect *rect) {
+    long v[4];
+    const char *p = arg;
+    for (int i = 0; i < 4; i++) {
+        char *endptr = NULL;
+        v[i] = strtol(p, &endptr, 10);
+        if (endptr == p || v[i] < 0 || v[i] > 65535 || *endptr != ((i < 3) ? ',' : '\0')) {
+            return -1;
+        }
+        p = endptr + 1;
+    }
+    if (v[2] == 0 || v[3] == 0) {
+        return -1;
+    }
+
+    rect->left = v[0];
+    rect->top = v[1];
+    rect->width = v[2];
+    rect->height = v[3];
+    return 0;
+}
 
-            default:
-                fprintf(stdout, "Unable to show frame formats, this program does not know how to "
-                        "utilize this device. Got V4L2_FRMSIZE_TYPE: %d\n", fsze[i].type);
-                break;
+/**
+ * parse_cpu_list - parse a list of CPUs like "0,2,4-7" into up to "max" entries of "cpus"
+ *
+ * @returns the number of CPUs, or -1 if the list doesn't parse or is too long
+ */
+static int parse_cpu_list(const char *list, int *cpus, int max) {
+    int count = 0;
+    const char *p = list;
+    for (;;) {
+        char *endptr = NULL;
+        long first = strtol(p, &endptr, 10);
+        long last = first;
+        if (endptr == p || first < 0 || first > INT_MAX) {
+            return -1;
+        }
+        p = endptr;
+        if (*p == '-') {
+            last = strtol(p + 1, &endptr, 10);
+            if (endptr == p + 1 || last < first || last > INT_MAX) {
+                return -1;
+            }
+            p = endptr;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (count == max) {
+                return -1;
+            }
+            cpus[count++] = (int) cpu;
         }
-    }
 
-    free(fsze);
-    fsze = NULL;
+        if (*p == '\0') {
+            return count;
+        }
+        if (*p++ != ',') {
+            return -1;
+        }
+    }
 }
 
 void print_usage(const char *argv0) {
-    fprintf(stderr, "Usage: %s --device=/dev/video0 [options]\n\n"
+    fprintf(stderr, "Usage: %s [options] --device=/dev/video0 [options] "
+            "[--device=/dev/video1 [options]]...\n\n"
+            "Up to %d cameras can be captured at once, each given by --device, --replay or\n"
+            "--synthetic. Options before the first camera apply to all of them, options after a\n"
+            "camera only to that camera.\n\n"
             "-d | --device  The video capture device to use\n"
             "-f | --format  The pixel format of the video (YUYV, MJPEG, etc)\n"
             "-w | --width   The frame width, in pixels\n"
             "-h | --height  The frame height, in pixels\n"
-            "-c | --count   The number of frames to grab from the camera\n"
-            "-o | --output  The filename to output data to (stdout normally)\n",
-            argv0);
+            "-c | --count   The number of frames to grab from the camera, 0 to go on until\n"
+            "               SIGINT or SIGTERM\n"
+            "-o | --output  The filename to output data to (stdout normally)\n"
+            "     --replay=FILE  Replay raw frames recorded in FILE instead of using a device\n"
+            "     --synthetic    Generate a moving test pattern instead of using a device\n"
+            "     --fps=RATE     Frame rate for --replay/--synthetic (0 = as fast as possible)\n"
+            "     --buffers=N    Number of capture buffers to ask the driver for (default %d)\n"
+            "     --adaptive-buffers[=MB]  Restart with a deeper buffer queue when frames get\n"
+            "                    dropped with at most one buffer left queued to the driver,\n"
+            "                    using up to MB megabytes of buffers (default %d)\n"
+            "     --trace=FILE   Record the timing of every frame in the binary trace FILE\n"
+            "     --rescan       Ask the device for its formats and frame sizes again, rather\n"
+            "                    than reading them from the probe cache in ~/.cache/camcap\n"
+            "     --memory=TYPE  Capture buffers: the driver's own (mmap), our own hugepage-backed\n"
+            "                    ones (userptr), or userptr whenever the driver supports it (auto)\n"
+            "     --writer=MODE  Where frames are written: inline (default) in the capture loop,\n"
+            "                    or on a writer thread, either holding the capture buffer until\n"
+            "                    written (hold) or copying it into a pool and requeueing (copy)\n"
+            "     --pool-frames=N  Number of frames in the --writer=copy pool (default %d)\n"
+            "     --uring[=sqpoll]  Write frames asynchronously with io_uring, straight from the\n"
+            "                    capture buffers. \"sqpoll\" lets a kernel thread submit writes\n"
+            "     --direct       Write the output file with O_DIRECT, bypassing the page cache\n"
+            "     --vmsplice     Splice the capture buffers into the standard output pipe rather\n"
+            "                    than copying them.  The reader has to consume the pipe with\n"
+            "                    read(): one that moves the data on with splice() or tee() (like\n"
+            "                    pv) gets frames overwritten by later ones\n"
+            "     --container    Write every frame with its size, sequence number, timestamp and\n"
+            "                    flags, and an index to find any frame by (see camcap-container)\n"
+            "     --compress     Compress frames losslessly into the --container, on the\n"
+            "                    --convert-threads pool.  Works on GREY, Y10, Y12, Y16, YUYV,\n"
+            "                    UYVY, RGB24, YUV420, NV12 and Bayer frames up to 16 bits\n"
+            "     --share=SOCKET  Instead of writing frames, share the capture buffers with\n"
+            "                    other processes connecting to the Unix socket SOCKET\n"
+            "     --shm=NAME     Instead of writing frames, publish them into a ring in the POSIX\n"
+            "                    shared memory object NAME (like /camcap) for any number of readers\n"
+            "     --shm-slots=N  Number of frames in the --shm ring (default %d)\n"
+            "     --ring=SIZE    Keep only the last SIZE of frames in memory, as seconds (10s)\n"
+            "                    or bytes (512M), and write them to a new file numbered after\n"
+            "                    --output each time SIGUSR1 arrives\n"
+            "     --ring-post=N  Also write the N frames after a trigger\n"
+            "     --ring-socket=PATH  Also trigger on a \"trigger\" datagram to the Unix socket\n"
+            "                    PATH\n"
+            "     --segment=SIZE  Write into a new file numbered after --output every SIZE, in\n"
+            "                    seconds (600s) or bytes (1G).  Give both to start a new file at\n"
+            "                    whichever comes first\n"
+            "     --stripe=FILE  Deal frames out across several files, each written on a thread\n"
+            "                    of its own: give --stripe for every file (like one per disk),\n"
+            "                    up to %d.  --output gets a manifest of where every frame went,\n"
+            "                    to put them back in order with camcap-stripe\n"
+            "     --stripe-policy=POLICY  round-robin (default), or least-loaded, which gives\n"
+            "                    every frame to the file with the fewest frames waiting\n"
+            "     --motion[=LEVEL]  Only write frames whose luma differs from the last frame\n"
+            "                    written by more than LEVEL on average (default %.0f)\n"
+            "     --motion-step=N  Compare every Nth row of the frames (default %d)\n"
+            "     --pre-roll=N   Also write the N frames before a change\n"
+            "     --post-roll=N  Also write the N frames after a change\n"
+            "     --motion-log=FILE  Record the sequence number, timestamp and luma difference\n"
+            "                    of every frame written with --motion in the binary FILE\n"
+            "     --crop=X,Y,W,H  Keep only the W x H region at X,Y of every frame.  The driver\n"
+            "                    crops when it can, otherwise it is cut out in software\n"
+            "     --scale=WxH    Scale frames, or the --crop region, down (or up) to W x H.\n"
+            "                    Both work on GREY, RGB24, YUYV, UYVY and NV12 frames\n"
+            "     --convert-to=FORMAT  Convert YUYV, UYVY or NV12 frames to YUV420, RGB24 or\n"
+            "                    GREY, or demosaic Bayer frames (8, 10, 12 or 16-bit, A-law or\n"
+            "                    DPCM compressed) to RGB24 or GREY, or unpack Y10BPACK, Y10P,\n"
+            "                    Y10 or Y12 to Y10, Y16 (shifted to full range) or GREY,\n"
+            "                    before writing them\n"
+            "     --convert-threads=N  Scale and convert frames in bands of rows on a pool of N\n"
+            "                    threads, converting while the capture loop goes on\n"
+            "     --convert-cpus=LIST  Pin the conversion threads to the CPUs in LIST (like\n"
+            "                    0,2,4-7)\n"
+            "     --convert-in-flight=N  Frames converted at once with --convert-threads\n"
+            "                    (default %d)\n"
+            "     --demosaic=METHOD  bilinear (default), or edge-aware, which interpolates green\n"
+            "                    along edges rather than across them\n"
+            "     --sync[=US]    Group the frames of all cameras into sets whose timestamps are\n"
+            "                    at most US microseconds apart (default %d), dropping the rest.\n"
+            "                    --count then is the number of sets\n"
+            "     --sync-depth=N  Frames each camera may keep waiting for a set (default %d)\n",
+            argv0, MAX_CAMERAS, BUFFER_COUNT, BUFFER_BUDGET_MB, POOL_FRAMES, SHM_SLOTS,
+            STRIPE_MAX, MOTION_LEVEL, MOTION_STEP, CONVERT_IN_FLIGHT, SYNC_TOLERANCE_US,
+            SYNC_DEPTH);
 }
 
 int main(int argc, char *argv[]) {
-    int fd = -1, ret = 0;
+    int ret = 0;
     static struct option long_options[] = {
         {"device", required_argument, 0, 'd' },
         {"format", required_argument, 0, 'f' },
@@ -95,98 +1686,489 @@ int main(int argc, char *argv[]) {
         {"height", required_argument, 0, 'h' },
         {"count",  required_argument, 0, 'c' },
         {"output", required_argument, 0, 'o' },
+        {"replay", required_argument, 0, OPT_REPLAY },
+        {"synthetic", no_argument,    0, OPT_SYNTHETIC },
+        {"fps",    required_argument, 0, OPT_FPS },
+        {"memory", required_argument, 0, OPT_MEMORY },
+        {"buffers", required_argument, 0, OPT_BUFFERS },
+        {"adaptive-buffers", optional_argument, 0, OPT_ADAPTIVE_BUFFERS },
+        {"trace",  required_argument, 0, OPT_TRACE },
+        {"rescan", no_argument,       0, OPT_RESCAN },
+        {"writer", required_argument, 0, OPT_WRITER },
+        {"pool-frames", required_argument, 0, OPT_POOL_FRAMES },
+        {"uring",  optional_argument, 0, OPT_URING },
+        {"direct", no_argument,       0, OPT_DIRECT },
+        {"vmsplice", no_argument,     0, OPT_VMSPLICE },
+        {"container", no_argument,    0, OPT_CONTAINER },
+        {"compress", no_argument,     0, OPT_COMPRESS },
+        {"share",  required_argument, 0, OPT_SHARE },
+        {"shm",    required_argument, 0, OPT_SHM },
+        {"shm-slots", required_argument, 0, OPT_SHM_SLOTS },
+        {"sync",   optional_argument, 0, OPT_SYNC },
+        {"sync-depth", required_argument, 0, OPT_SYNC_DEPTH },
+        {"ring",   required_argument, 0, OPT_RING },
+        {"ring-post", required_argument, 0, OPT_RING_POST },
+        {"ring-socket", required_argument, 0, OPT_RING_SOCKET },
+        {"segment", required_argument, 0, OPT_SEGMENT },
+        {"stripe", required_argument, 0, OPT_STRIPE },
+        {"stripe-policy", required_argument, 0, OPT_STRIPE_POLICY },
+        {"motion", optional_argument, 0, OPT_MOTION },
+        {"motion-step", required_argument, 0, OPT_MOTION_STEP },
+        {"pre-roll", required_argument, 0, OPT_PRE_ROLL },
+        {"post-roll", required_argument, 0, OPT_POST_ROLL },
+        {"motion-log", required_argument, 0, OPT_MOTION_LOG },
+        {"crop",   required_argument, 0, OPT_CROP },
+        {"scale",  required_argument, 0, OPT_SCALE },
+        {"convert-to", required_argument, 0, OPT_CONVERT_TO },
+        {"convert-threads", required_argument, 0, OPT_CONVERT_THREADS },
+        {"convert-cpus", required_argument, 0, OPT_CONVERT_CPUS },
+        {"convert-in-flight", required_argument, 0, OPT_CONVERT_IN_FLIGHT },
+        {"demosaic", required_argument, 0, OPT_DEMOSAIC },
         {0,        0,                 0,  0  }
     };
     static char options[] = "d:f:w:h:c:o:";
 
-    const char *dev_name = NULL;
-    const char *out_name = NULL;
-    FILE *out = NULL;
-    uint32_t pixel_format = 0;
-    int width = 0, height = 0;
-    int frame_count = 1;
+    // Options before the first camera fill in the defaults every camera starts from
+    struct camera_config defaults = {
+        .fps = 30,
+        .frame_count = 1,
+        .buffer_count = BUFFER_COUNT,
+        .out = { .out_fd = -1, .writer = WRITER_INLINE, .pool_frames = POOL_FRAMES,
+            .shm_slots = SHM_SLOTS, .convert_threads = 1,
+            .convert_in_flight = CONVERT_IN_FLIGHT, .demosaic = DEMOSAIC_BILINEAR,
+            .motion_level = MOTION_LEVEL, .motion_step = MOTION_STEP },
+    };
+    static struct camera cams[MAX_CAMERAS];
+    int cam_count = 0;
+    long sync_tolerance_us = -1;    // not grouping frames into sets
+    int sync_depth = SYNC_DEPTH;
+    struct frame_sync *sync = NULL;
+    int signal_fd = -1;
+    struct camera_config *cfg = &defaults;
     int opt;
     while (-1 != (opt = getopt_long(argc, argv, options, long_options, NULL))) {
         switch (opt) {
+            case 'd':
+            case OPT_REPLAY:
+            case OPT_SYNTHETIC:
+                if (cam_count == MAX_CAMERAS) {
+                    fprintf(stderr, "ERROR: Can only capture from %d cameras at once!\n",
+                            MAX_CAMERAS);
+                    return -1;
+                }
+                cfg = &cams[cam_count++].cfg;
+                *cfg = defaults;
+                cfg->given = 0;
+                if (opt == 'd') {
+                    cfg->dev_name = optarg;
+                } else if (opt == OPT_REPLAY) {
+                    cfg->replay_name = optarg;
+                } else {
+                    cfg->synthetic = 1;
+                }
+                break;
+
             case 'c':
-                if (frame_count == 1) {
+                if (!(cfg->given & GIVEN_COUNT)) {
                     char *endptr = NULL;
                     long parsed = strtol(optarg, &endptr, 0);
-                    if (parsed > INT_MAX || parsed <= 0 || *endptr != '\0') {
+                    if (parsed > INT_MAX || parsed < 0 || *endptr != '\0') {
                         fprintf(stderr, "ERROR: Unable to parse given frame count: \"%s\"\n", optarg);
+                        return -1;
                     }
-                    frame_count = (int) parsed;
+                    cfg->frame_count = (int) parsed;
+                    cfg->given |= GIVEN_COUNT;
                 } else {
-                    fprintf(stderr, "ERROR: Can only accept 1 frame count per instantiation."
-                            "%d is already the current frame count, cannot accept \"%s\"\n", frame_count, optarg);
-                    return -1;
-                }
-                break;
-
-            case 'd':
-                if (dev_name == NULL) {
-                    dev_name = optarg;
-                } else {
-                    fprintf(stderr, "ERROR: Can only accept 1 device name per instantiation! "
-                            "\"%s\" is already set, cannot accept \"%s\"\n", dev_name, optarg);
+                    fprintf(stderr, "ERROR: Can only accept 1 frame count per camera."
+                            "%d is already the current frame count, cannot accept \"%s\"\n",
+                            cfg->frame_count, optarg);
                     return -1;
                 }
                 break;
 
             case 'f':
-                if (pixel_format == 0) {
-                    pixel_format = str_to_pix_fmt(optarg);
-                    if (pixel_format == 0) {
+                if (!(cfg->given & GIVEN_FORMAT)) {
+                    cfg->pixel_format = str_to_pix_fmt(optarg);
+                    if (cfg->pixel_format == 0) {
                         fprintf(stderr, "ERROR: Unable to parse pixel format \"%s\"!", optarg);
                         return -1;
                     }
+                    cfg->given |= GIVEN_FORMAT;
                 } else {
-                    fprintf(stderr, "ERROR: Can only accept 1 pixel format per instantiation! "
+                    fprintf(stderr, "ERROR: Can only accept 1 pixel format per camera! "
                             "\"%s\" is already set, cannot accept \"%s\"\n",
-                            pix_fmt_to_str(pixel_format), optarg);
+                            pix_fmt_to_str(cfg->pixel_format), optarg);
                     return -1;
                 }
                 break;
 
             case 'h':
-                if (height == 0) {
+                if (!(cfg->given & GIVEN_HEIGHT)) {
                     char *endptr = NULL;
                     long parsed = strtol(optarg, &endptr, 0);
                     if (parsed > INT_MAX || parsed <= 0 || *endptr != '\0') {
                         fprintf(stderr, "ERROR: Unable to parse given height: \"%s\"\n", optarg);
                     }
-                    height = (int) parsed;
+                    cfg->height = (int) parsed;
+                    cfg->given |= GIVEN_HEIGHT;
                 } else {
-                    fprintf(stderr, "ERROR: Can only accept 1 height per instantiation."
-                            "%d is already the current height, cannot accept \"%s\"\n", height, optarg);
+                    fprintf(stderr, "ERROR: Can only accept 1 height per camera."
+                            "%d is already the current height, cannot accept \"%s\"\n",
+                            cfg->height, optarg);
                     return -1;
                 }
                 break;
 
             case 'o':
-                if (out_name == NULL) {
-                    out_name = optarg;
+                if (!(cfg->given & GIVEN_OUTPUT)) {
+                    cfg->out.out_name = optarg;
+                    cfg->given |= GIVEN_OUTPUT;
                 } else {
-                    fprintf(stderr, "ERROR: Can only accept 1 output file name per instantiation! "
-                            "\"%s\" is already set, cannot accept \"%s\"\n", out_name, optarg);
+                    fprintf(stderr, "ERROR: Can only accept 1 output file name per camera! "
+                            "\"%s\" is already set, cannot accept \"%s\"\n", cfg->out.out_name,
+                            optarg);
                     return -1;
                 }
                 break;
 
             case 'w':
-                if (width == 0) {
+                if (!(cfg->given & GIVEN_WIDTH)) {
                     char *endptr = NULL;
                     long parsed = strtol(optarg, &endptr, 0);
                     if (parsed > INT_MAX || parsed <= 0 || *endptr != '\0') {
                         fprintf(stderr, "ERROR: Unable to parse given width: \"%s\"\n", optarg);
                     }
-                    width = (int) parsed;
+                    cfg->width = (int) parsed;
+                    cfg->given |= GIVEN_WIDTH;
+                } else {
+                    fprintf(stderr, "ERROR: Can only accept 1 width per camera."
+                            "%d is already the current width, cannot accept \"%s\"\n",
+                            cfg->width, optarg);
+                    return -1;
+                }
+                break;
+
+            case OPT_FPS: {
+                char *endptr = NULL;
+                cfg->fps = strtod(optarg, &endptr);
+                if (cfg->fps < 0 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given frame rate: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+            }
+
+            case OPT_BUFFERS: {
+                char *endptr = NULL;
+                long parsed = strtol(optarg, &endptr, 0);
+                if (parsed > VIDEO_MAX_FRAME || parsed < 2 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Buffer count must be between 2 and %d, not \"%s\"\n",
+                            VIDEO_MAX_FRAME, optarg);
+                    return -1;
+                }
+                cfg->buffer_count = (int) parsed;
+                break;
+            }
+
+            case OPT_ADAPTIVE_BUFFERS: {
+                cfg->buffer_budget_mb = BUFFER_BUDGET_MB;
+                if (optarg == NULL) {
+                    break;
+                }
+
+                char *endptr = NULL;
+                cfg->buffer_budget_mb = strtol(optarg, &endptr, 0);
+                if (cfg->buffer_budget_mb > INT_MAX || cfg->buffer_budget_mb <= 0
+                        || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given buffer budget: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+            }
+
+            case OPT_TRACE:
+                cfg->trace_name = optarg;
+                break;
+
+            case OPT_RESCAN:
+                cfg->rescan = 1;
+                break;
+
+            case OPT_MEMORY:
+                if (strcmp(optarg, "auto") == 0) {
+                    cfg->memory = 0;
+                } else if (strcmp(optarg, "mmap") == 0) {
+                    cfg->memory = V4L2_MEMORY_MMAP;
+                } else if (strcmp(optarg, "userptr") == 0) {
+                    cfg->memory = V4L2_MEMORY_USERPTR;
+                } else {
+                    fprintf(stderr, "ERROR: Unknown buffer memory type \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPT_WRITER:
+                if (strcmp(optarg, "inline") == 0) {
+                    cfg->out.writer = WRITER_INLINE;
+                } else if (strcmp(optarg, "hold") == 0) {
+                    cfg->out.writer = WRITER_HOLD;
+                } else if (strcmp(optarg, "copy") == 0) {
+                    cfg->out.writer = WRITER_COPY;
+                } else {
+                    fprintf(stderr, "ERROR: Unknown writer mode \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPT_POOL_FRAMES: {
+                char *endptr = NULL;
+                long parsed = strtol(optarg, &endptr, 0);
+                if (parsed > INT_MAX || parsed <= 0 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given pool size: \"%s\"\n", optarg);
+                    return -1;
+                }
+                cfg->out.pool_frames = (int) parsed;
+                break;
+            }
+
+            case OPT_URING:
+                if (optarg != NULL && strcmp(optarg, "sqpoll") != 0) {
+                    fprintf(stderr, "ERROR: Unknown io_uring option \"%s\"\n", optarg);
+                    return -1;
+                }
+                cfg->out.uring = 1;
+                cfg->out.uring_sqpoll = (optarg != NULL);
+                break;
+
+            case OPT_DIRECT:
+                cfg->out.direct = 1;
+                break;
+
+            case OPT_VMSPLICE:
+                cfg->out.vmsplice = 1;
+                break;
+
+            case OPT_CONTAINER:
+                cfg->out.container = 1;
+                break;
+
+            case OPT_COMPRESS:
+                cfg->out.compress = 1;
+                break;
+
+            case OPT_SHARE:
+                cfg->out.share_path = optarg;
+                break;
+
+            case OPT_SHM:
+                cfg->out.shm_name = optarg;
+                break;
+
+            case OPT_SHM_SLOTS: {
+                char *endptr = NULL;
+                long parsed = strtol(optarg, &endptr, 0);
+                if (parsed > INT_MAX || parsed < 2 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given slot count: \"%s\"\n", optarg);
+                    return -1;
+                }
+                cfg->out.shm_slots = (int) parsed;
+                break;
+            }
+
+            case OPT_RING:
+            case OPT_SEGMENT: {
+                double seconds = 0;
+                uint64_t bytes = 0;
+                if (-1 == parse_amount(optarg, &seconds, &bytes)) {
+                    fprintf(stderr, "ERROR: %s size must be seconds (like 10s) or bytes, with K, "
+                            "M or G, up to 1T: \"%s\"\n", (opt == OPT_RING) ? "Ring" : "Segment",
+                            optarg);
+                    return -1;
+                }
+                // A ring has one size, segments end at whichever limit comes first
+                if (opt == OPT_RING) {
+                    cfg->out.ring_seconds = seconds;
+                    cfg->out.ring_bytes = bytes;
+                } else if (seconds > 0) {
+                    cfg->out.segment_seconds = seconds;
+                } else {
+                    cfg->out.segment_bytes = bytes;
+                }
+                break;
+            }
+
+            case OPT_STRIPE:
+                if (cfg->out.stripe_count == STRIPE_MAX) {
+                    fprintf(stderr, "ERROR: Can only stripe frames across %d files!\n",
+                            STRIPE_MAX);
+                    return -1;
+                }
+                cfg->out.stripes[cfg->out.stripe_count++] = optarg;
+                break;
+
+            case OPT_STRIPE_POLICY:
+                if (strcmp(optarg, "round-robin") == 0) {
+                    cfg->out.stripe_policy = STRIPE_ROUND_ROBIN;
+                } else if (strcmp(optarg, "least-loaded") == 0) {
+                    cfg->out.stripe_policy = STRIPE_LEAST_LOADED;
+                } else {
+                    fprintf(stderr, "ERROR: Stripe policy must be round-robin or least-loaded: "
+                            "\"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPT_RING_POST: {
+                char *endptr = NULL;
+                long parsed = strtol(optarg, &endptr, 0);
+                if (parsed < 0 || parsed > INT_MAX / 4 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given frame count: \"%s\"\n", optarg);
+                    return -1;
+                }
+                cfg->out.ring_post = (int) parsed;
+                break;
+            }
+
+            case OPT_RING_SOCKET:
+                cfg->out.ring_socket = optarg;
+                break;
+
+            case OPT_MOTION: {
+                cfg->out.motion = 1;
+                if (optarg == NULL) {
+                    break;
+                }
+
+                char *endptr = NULL;
+                double parsed = strtod(optarg, &endptr);
+                if (parsed < 0 || parsed > 255 || endptr == optarg || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Motion level must be 0 to 255: \"%s\"\n", optarg);
+                    return -1;
+                }
+                cfg->out.motion_level = parsed;
+                break;
+            }
+
+            case OPT_MOTION_STEP:
+            case OPT_PRE_ROLL:
+            case OPT_POST_ROLL: {
+                char *endptr = NULL;
+                long parsed = strtol(optarg, &endptr, 0);
+                long min = (opt == OPT_MOTION_STEP) ? 1 : 0;
+                if (parsed < min || parsed > 1024 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Frame or row count must be %ld to 1024: \"%s\"\n",
+                            min, optarg);
+                    return -1;
+                }
+                int *field = (opt == OPT_MOTION_STEP) ? &cfg->out.motion_step
+                    : (opt == OPT_PRE_ROLL) ? &cfg->out.pre_roll : &cfg->out.post_roll;
+                *field = (int) parsed;
+                break;
+            }
+
+            case OPT_MOTION_LOG:
+                cfg->out.motion_log = optarg;
+                break;
+
+            case OPT_CROP:
+                if (-1 == parse_crop(optarg, &cfg->out.crop)) {
+                    fprintf(stderr, "ERROR: Crop region must be X,Y,W,H: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPT_SCALE: {
+                char *endptr = NULL;
+                long w = strtol(optarg, &endptr, 10);
+                long h = (*endptr == 'x') ? strtol(endptr + 1, &endptr, 10) : 0;
+                if (w <= 0 || w > 16384 || h <= 0 || h > 16384 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Scaled size must be WxH up to 16384x16384: \"%s\"\n",
+                            optarg);
+                    return -1;
+                }
+                cfg->out.scale_width = (uint32_t) w;
+                cfg->out.scale_height = (uint32_t) h;
+                break;
+            }
+
+            case OPT_CONVERT_TO:
+                cfg->out.convert_to = str_to_pix_fmt(optarg);
+                if (cfg->out.convert_to == 0) {
+                    fprintf(stderr, "ERROR: Unable to parse pixel format \"%s\"!\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPT_CONVERT_THREADS: {
+                char *endptr = NULL;
+                long parsed = strtol(optarg, &endptr, 0);
+                if (parsed < 1 || parsed > THREAD_POOL_MAX_THREADS || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Conversion threads must be 1 to %d: \"%s\"\n",
+                            THREAD_POOL_MAX_THREADS, optarg);
+                    return -1;
+                }
+                cfg->out.convert_threads = (int) parsed;
+                break;
+            }
+
+            case OPT_CONVERT_CPUS:
+                cfg->out.convert_cpu_count = parse_cpu_list(optarg, cfg->out.convert_cpus,
+                        THREAD_POOL_MAX_THREADS);
+                if (cfg->out.convert_cpu_count == -1) {
+                    fprintf(stderr, "ERROR: Unable to parse CPU list, or more than %d CPUs: "
+                            "\"%s\"\n", THREAD_POOL_MAX_THREADS, optarg);
+                    return -1;
+                }
+                break;
+
+            case OPT_CONVERT_IN_FLIGHT: {
+                char *endptr = NULL;
+                long parsed = strtol(optarg, &endptr, 0);
+                if (parsed < 1 || parsed > 64 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Frames in flight must be 1 to 64: \"%s\"\n", optarg);
+                    return -1;
+                }
+                cfg->out.convert_in_flight = (int) parsed;
+                break;
+            }
+
+            case OPT_DEMOSAIC:
+                if (strcmp(optarg, "bilinear") == 0) {
+                    cfg->out.demosaic = DEMOSAIC_BILINEAR;
+                } else if (strcmp(optarg, "edge-aware") == 0) {
+                    cfg->out.demosaic = DEMOSAIC_EDGE_AWARE;
                 } else {
-                    fprintf(stderr, "ERROR: Can only accept 1 width per instantiation."
-                            "%d is already the current width, cannot accept \"%s\"\n", width, optarg);
+                    fprintf(stderr, "ERROR: Demosaic method must be bilinear or edge-aware: "
+                            "\"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPT_SYNC: {
+                sync_tolerance_us = SYNC_TOLERANCE_US;
+                if (optarg == NULL) {
+                    break;
+                }
+
+                char *endptr = NULL;
+                sync_tolerance_us = strtol(optarg, &endptr, 0);
+                if (sync_tolerance_us > INT_MAX || sync_tolerance_us < 0 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given sync tolerance: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+            }
+
+            case OPT_SYNC_DEPTH: {
+                char *endptr = NULL;
+                long parsed = strtol(optarg, &endptr, 0);
+                if (parsed >= VIDEO_MAX_FRAME || parsed <= 0 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given sync depth: \"%s\"\n", optarg);
                     return -1;
                 }
+                sync_depth = (int) parsed;
                 break;
+            }
 
             case '?':
             default:
@@ -195,176 +2177,131 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (dev_name == NULL) {
+    if (cam_count == 0) {
         fprintf(stderr, "Please provide a valid device name (like /dev/video0)!\n");
         print_usage(argv[0]);
         return -1;
     }
 
-    fd = open(dev_name, O_RDWR);
-    if (fd == -1) {
-        perror("Error opening video device");
-        fprintf(stderr, "Unable to open %s\n", dev_name);
-        ret = -1;
-        goto fail;
-    }
-
-    if (out_name != NULL) {
-        out = fopen(out_name, "w");
-        if (out == NULL) {
-            perror("Error opening output file");
-            ret = -1;
-            goto fail;
+    // Frames without an output file or a publishing sink go to stdout, which only one can have
+    struct camera *to_stdout = NULL;
+    for (int i = 0; i < cam_count; i++) {
+        struct camera *cam = &cams[i];
+        if (-1 == check_camera(&cam->cfg)) {
+            return -1;
         }
-    }
-
-    struct v4l2_capability caps;
-    if (get_device_capabilities(fd, &caps) < 0) {
-        perror("Error querying capabilities");
-        ret = -1;
-        goto fail;
-    }
-
-    char driver[sizeof(caps.driver) + 1] = {'\0'};
-    memcpy(driver, caps.driver, sizeof(caps.driver));
-    fprintf(stdout, "Driver= \"%s\"\n", driver);
-
-    char card[sizeof(caps.card) + 1] = {'\0'};
-    memcpy(card, caps.card, sizeof(caps.card));
-    fprintf(stdout, "Card = \"%s\"\n", card);
 
-    char bus_info[sizeof(caps.bus_info) + 1] = {'\0'};
-    memcpy(bus_info, caps.bus_info, sizeof(caps.bus_info));
-    fprintf(stdout, "Bus info = \"%s\"\n", bus_info);
+        const struct output_config *out = &cam->cfg.out;
+        if (out->out_name == NULL && out->share_path == NULL && out->shm_name == NULL) {
+            if (to_stdout != NULL) {
+                fprintf(stderr, "Only one camera can write its frames to stdout, give the others "
+                        "an --output!\n");
+                return -1;
+            }
+            to_stdout = cam;
+        }
 
-    fprintf(stdout, "V4L2 driver version = %d\n", caps.version);
-    fprintf(stdout, "Capabilities = 0x%08x\n", caps.capabilities);
-    if (caps.capabilities & V4L2_CAP_DEVICE_CAPS) {
-        fprintf(stdout, "Device caps = 0x%08x\n", caps.device_caps);
-        print_capabilities(caps.device_caps);
-    } else {
-        print_capabilities(caps.capabilities);
+        if (cam_count > 1) {
+            snprintf(cam->label, sizeof(cam->label), "cam%d: ", i);
+        }
     }
 
-    if (!(caps.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
-        fprintf(stderr, "Error: device does not support video capture!\n");
-        ret = -1;
-        goto fail;
+    if (-1 == check_cameras(cams, cam_count)) {
+        return -1;
     }
 
-    if (!pixel_format_valid(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, pixel_format)) {
-        print_pixel_formats(fd);
-        goto fail;
-    }
+    if (sync_tolerance_us >= 0) {
+        if (cam_count < 2) {
+            fprintf(stderr, "--sync needs at least two cameras to group frames from!\n");
+            return -1;
+        }
 
-    if (!frame_size_valid(fd, pixel_format, width, height)) {
-        print_frame_sizes(fd, pixel_format);
-        goto fail;
+        for (int i = 0; i < cam_count; i++) {
+            if (cams[i].cfg.buffer_budget_mb > 0) {
+                fprintf(stderr, "Frames waiting for a set would be lost restarting the buffer "
+                        "queue, --sync can't be used with --adaptive-buffers!\n");
+                return -1;
+            }
+        }
     }
 
-    fprintf(stdout, "Setting stream format\n");
-
-    struct v4l2_format fmt = {0};
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = width;
-    fmt.fmt.pix.height = height;
-    fmt.fmt.pix.pixelformat = pixel_format;
-    fmt.fmt.pix.field = V4L2_FIELD_NONE;
-
-    if (set_stream_format(fd, &fmt) != 0) {
-        perror("Error setting format");
-        ret = -1;
-        goto fail;
+    // Keep the real stdout for the frames, and send everything we'd normally print on stdout to
+    // stderr, so it can't end up inside the video
+    if (to_stdout != NULL) {
+        to_stdout->cfg.out.out_fd = dup(STDOUT_FILENO);
+        if (to_stdout->cfg.out.out_fd == -1 || -1 == dup2(STDERR_FILENO, STDOUT_FILENO)) {
+            perror("Error setting up stdout for frames");
+            return -1;
+        }
+        setvbuf(stdout, NULL, _IOLBF, 0);
     }
 
-    fprintf(stdout, "Mmaping buffers\n");
-    // Initialize all the buffers. We give a few spots so the camera can continue to stream
-    // the next frame while our program processes the previous one.  The number of buffers
-    // should be no less than 2 for streaming, the v4l2 docs example gives 4
-    struct mmaped_buffer bufs[BUFFER_COUNT];
-    if (-1 == init_mmap_buffers(fd, bufs, BUFFER_COUNT)) {
-        perror("Error mmaping buffers");
-        ret = -1;
-        goto fail;
+    // SIGINT and SIGTERM stop the cameras cleanly, and SIGUSR1 triggers the rings.  They're
+    // blocked before any thread starts, so every thread inherits that and they only ever
+    // arrive through the signalfd
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    for (int i = 0; i < cam_count; i++) {
+        if (cams[i].cfg.out.ring_seconds > 0 || cams[i].cfg.out.ring_bytes > 0) {
+            sigaddset(&set, SIGUSR1);
+        }
     }
-
-    // Start streaming!
-    if (-1 == start_mmap_streaming(fd, BUFFER_COUNT)) {
-        perror("Error starting stream");
-        ret = -1;
-        goto fail;
+    if (-1 == sigprocmask(SIG_BLOCK, &set, NULL)
+            || -1 == (signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC))) {
+        perror("Error setting up signals");
+        return -1;
     }
 
-    // Select loop while we read frames
-    int cur_frame = 0;
-    while (cur_frame < frame_count) {
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-
-        struct timeval tv = {0};
-        tv.tv_sec = 2;
-
-        int r = select((fd + 1), &fds, NULL, NULL, &tv);
-        if(-1 == r) {
-            if (EINTR == errno)
-                continue;
+    for (int i = 0; i < cam_count; i++) {
+        struct camera *cam = &cams[i];
+        if (cam_count > 1) {
+            fprintf(stdout, "%s%s\n", cam->label, camera_name(&cam->cfg));
+        }
 
-            perror("Error waiting for next frame");
-            ret = -1;
+        int r = setup_camera(cam);
+        if (r != 0) {
+            // A positive result means the valid choices were listed for the user
+            ret = (r < 0) ? -1 : 0;
             goto fail;
         }
+    }
 
-        if (0 == r) {
-            fprintf(stderr, "Timeout waiting for next frame\n");
-            ret = -1;
-            goto fail;
+    if (sync_tolerance_us >= 0) {
+        // Every camera has to keep a buffer queued with the driver while the others catch up
+        for (int i = 0; i < cam_count; i++) {
+            if (sync_depth > cams[i].cap.src->buf_count - 1) {
+                sync_depth = cams[i].cap.src->buf_count - 1;
+            }
         }
 
-        struct v4l2_buffer buf;
-        if (-1 == read_frame(fd, &buf)) {
-            perror("Error reading frame");
+        sync = frame_sync_create(cam_count, sync_depth, (uint64_t) sync_tolerance_us * 1000,
+                write_set, drop_frame, cams);
+        if (sync == NULL) {
+            perror("Error setting up frame sets");
             ret = -1;
             goto fail;
         }
-
-        if (NULL != out) {
-            if (!fwrite((bufs[buf.index].start), buf.bytesused, 1, out)) {
-                perror("Error writing output to file");
-                ret = -1;
-                goto fail;
-            }
-        } else {
-            write(STDOUT_FILENO, bufs[buf.index].start, buf.bytesused);
-        }
-
-        enqueue_frame(fd, &buf);
-
-        fprintf(stdout, "Written frame %d\n", cur_frame);
-        cur_frame++;
+        fprintf(stdout, "Grouping frames within %ld us into sets, up to %d frames waiting per "
+                "camera\n", sync_tolerance_us, sync_depth);
     }
 
-    if(-1 == stop_streaming(fd)) {
-        perror("Error stopping stream");
-        ret = 1;
-    }
+    // Poll all cameras while we read frames, and get buffers back from the sinks as they
+    // finish them
+    ret = run_cameras(cams, cam_count, sync, signal_fd);
 
 fail:
-    if ((out != NULL) && (EOF == fclose(out))) {
-        perror("Error closing file");
+    if (sync != NULL) {
+        frame_sync_flush(sync);
+        frame_sync_close(sync);
     }
 
-    for (int i = 0; i < BUFFER_COUNT; i++) {
-        if (bufs[i].start != NULL && bufs[i].start != MAP_FAILED) {
-            munmap(bufs[i].start, bufs[i].length);
-        }
+    for (int i = 0; i < cam_count; i++) {
+        close_camera(&cams[i]);
     }
 
-    if ((fd >= 0) && (close(fd) == -1)) {
-        perror("Error closing file descriptor");
-    }
-    fd = -1;
+    close(signal_fd);
 
     return ret;
 }
-
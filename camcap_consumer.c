@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <linux/dma-buf.h>
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+#include "share_proto.h"
+
+/*
+ * Reference subscriber for camcap --share: maps the shared capture buffers and reports the
+ * average byte value and the age of every frame it is told about, then releases it.
+ */
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * buffer_sync - tell the exporter we start or stop reading a DMABUF through its mapping
+ *
+ * Buffers that aren't DMABUFs (a replayed capture shares memfds) don't need it, so failures
+ * are ignored.
+ */
+static void buffer_sync(int fd, uint64_t flags) {
+    struct dma_buf_sync sync = { .flags = flags | DMA_BUF_SYNC_READ };
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+/**
+ * receive_hello - read the stream description and the buffer fds camcap sends first
+ */
+static int receive_hello(int sock, struct share_hello *hello, int *fds) {
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * VIDEO_MAX_FRAME)];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov = { .iov_base = hello, .iov_len = sizeof(*hello) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (r == -1) {
+        return -1;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (r != sizeof(*hello) || hello->type != SHARE_MSG_HELLO
+            || hello->version != SHARE_PROTO_VERSION || hello->buf_count > VIDEO_MAX_FRAME
+            || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS
+            || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * hello->buf_count)) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * hello->buf_count);
+    return 0;
+}
+
+void print_usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [options] SOCKET\n\n"
+            "-c | --count   Stop after this many frames (default: until camcap stops)\n"
+            "-s | --sleep   Milliseconds to hold every frame for, to act like a slow consumer\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"count",  required_argument, 0, 'c' },
+        {"sleep",  required_argument, 0, 's' },
+        {0,        0,                 0,  0  }
+    };
+
+    long frame_count = 0;
+    long sleep_ms = 0;
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "c:s:", long_options, NULL))) {
+        char *endptr = NULL;
+        switch (opt) {
+            case 'c':
+                frame_count = strtol(optarg, &endptr, 0);
+                if (frame_count <= 0 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given frame count: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 's':
+                sleep_ms = strtol(optarg, &endptr, 0);
+                if (sleep_ms < 0 || sleep_ms > INT_MAX || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given sleep time: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(argv[optind]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, argv[optind]);
+
+    int sock = socket(AF_UNIX, (SOCK_SEQPACKET | SOCK_CLOEXEC), 0);
+    if (sock == -1 || -1 == connect(sock, (struct sockaddr *) &addr, sizeof(addr))) {
+        perror("Error connecting to camcap");
+        return -1;
+    }
+
+    struct share_hello hello;
+    int fds[VIDEO_MAX_FRAME];
+    if (-1 == receive_hello(sock, &hello, fds)) {
+        perror("Error receiving the buffers");
+        close(sock);
+        return -1;
+    }
+
+    fprintf(stdout, "%s %ux%u, %u buffers of %u bytes, holding at most %u\n",
+            pix_fmt_to_str(hello.pixelformat), hello.width, hello.height, hello.buf_count,
+            hello.sizeimage, hello.max_held);
+
+    int ret = 0;
+    const uint8_t *maps[VIDEO_MAX_FRAME] = {0};
+    for (uint32_t i = 0; i < hello.buf_count; i++) {
+        void *p = mmap(NULL, hello.length[i], PROT_READ, MAP_SHARED, fds[i], 0);
+        if (p == MAP_FAILED) {
+            perror("Error mapping shared buffer");
+            ret = -1;
+            goto fail;
+        }
+        maps[i] = p;
+    }
+
+    long frames = 0;
+    uint32_t last_seq = 0;
+    while (frame_count == 0 || frames < frame_count) {
+        struct share_frame msg;
+        ssize_t r = recv(sock, &msg, sizeof(msg), 0);
+        if (r == 0) {
+            fprintf(stdout, "camcap stopped\n");
+            break;
+        }
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error receiving frame");
+            ret = -1;
+            break;
+        }
+
+        if (r != sizeof(msg) || msg.type != SHARE_MSG_READY || msg.index >= hello.buf_count
+                || msg.bytesused > hello.length[msg.index]) {
+            fprintf(stderr, "Ignoring an invalid message\n");
+            continue;
+        }
+
+        buffer_sync(fds[msg.index], DMA_BUF_SYNC_START);
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < msg.bytesused; i++) {
+            sum += maps[msg.index][i];
+        }
+        buffer_sync(fds[msg.index], DMA_BUF_SYNC_END);
+
+        if (frames > 0 && msg.sequence != last_seq + 1) {
+            fprintf(stdout, "Missed %u frames\n", msg.sequence - last_seq - 1);
+        }
+        last_seq = msg.sequence;
+
+        fprintf(stdout, "Frame %u in buffer %u: %u bytes, average %.1f, %.3f ms old\n",
+                msg.sequence, msg.index, msg.bytesused,
+                msg.bytesused ? (double) sum / msg.bytesused : 0.0,
+                (double) (monotonic_us() - msg.timestamp_us) / 1000);
+
+        if (sleep_ms > 0) {
+            struct timespec ts = { .tv_sec = sleep_ms / 1000, .tv_nsec = (sleep_ms % 1000) * 1000000 };
+            nanosleep(&ts, NULL);
+        }
+
+        msg.type = SHARE_MSG_RELEASE;
+        if (-1 == send(sock, &msg, sizeof(msg), MSG_NOSIGNAL)) {
+            perror("Error releasing frame");
+            ret = -1;
+            break;
+        }
+        frames++;
+    }
+
+fail:
+    for (uint32_t i = 0; i < hello.buf_count; i++) {
+        if (maps[i] != NULL) {
+            munmap((void *) maps[i], hello.length[i]);
+        }
+        close(fds[i]);
+    }
+    close(sock);
+
+    return ret;
+}
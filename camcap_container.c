@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+#include "container.h"
+#include "codec.h"
+
+/*
+ * Reader for camcap --container: tells what a container holds, lists its frames, and copies
+ * any range of them out as raw frames, going straight to the first one.  Frames written with
+ * --compress are decompressed on the way.
+ */
+
+void print_usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [options] FILE\n\n"
+            "-s | --start   The first frame to read, counting from 0 (default 0)\n"
+            "-c | --count   The number of frames to read (default: up to the last one)\n"
+            "-l | --list    Print the sequence number, timestamp, size, flags and codec of\n"
+            "               every frame read\n"
+            "-o | --output  Write the frames read back to back to this file\n",
+            argv0);
+}
+
+static int parse_count(const char *arg, uint64_t *value) {
+    char *endptr = NULL;
+    errno = 0;
+    unsigned long long parsed = strtoull(arg, &endptr, 0);
+    if (errno != 0 || endptr == arg || *endptr != '\0' || arg[0] == '-') {
+        return -1;
+    }
+    *value = parsed;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"start",  required_argument, 0, 's' },
+        {"count",  required_argument, 0, 'c' },
+        {"list",   no_argument,       0, 'l' },
+        {"output", required_argument, 0, 'o' },
+        {0,        0,                 0,  0  }
+    };
+
+    uint64_t start = 0, count = UINT64_MAX;
+    const char *out_name = NULL;
+    int list = 0;
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "s:c:lo:", long_options, NULL))) {
+        switch (opt) {
+            case 's':
+                if (-1 == parse_count(optarg, &start)) {
+                    fprintf(stderr, "ERROR: Unable to parse given frame: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'c':
+                if (-1 == parse_count(optarg, &count) || count == 0) {
+                    fprintf(stderr, "ERROR: Unable to parse given frame count: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'l':
+                list = 1;
+                break;
+
+            case 'o':
+                out_name = optarg;
+                break;
+
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    struct container_reader *rd = container_open(argv[optind]);
+    if (rd == NULL) {
+        perror((errno == EPROTO) ? "Not a frame container" : "Error opening container");
+        return -1;
+    }
+
+    const struct container_header *hdr = container_header(rd);
+    uint64_t frame_count = container_frame_count(rd);
+    fprintf(stdout, "%s %ux%u, %llu frames%s\n", pix_fmt_to_str(hdr->pixelformat), hdr->width,
+            hdr->height, (unsigned long long) frame_count,
+            container_recovered(rd) ? ", never closed (index rebuilt)" : "");
+
+    struct v4l2_format fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+    fmt.fmt.pix.width = hdr->width;
+    fmt.fmt.pix.height = hdr->height;
+    fmt.fmt.pix.pixelformat = hdr->pixelformat;
+    fmt.fmt.pix.bytesperline = hdr->bytesperline;
+    fmt.fmt.pix.sizeimage = hdr->sizeimage;
+
+    int ret = 0;
+    FILE *out = NULL;
+    uint8_t *frame_buf = NULL;
+    if (start > frame_count) {
+        fprintf(stderr, "There is no frame %llu!\n", (unsigned long long) start);
+        ret = -1;
+        goto fail;
+    }
+    if (count > frame_count - start) {
+        count = frame_count - start;
+    }
+
+    if (out_name != NULL) {
+        out = fopen(out_name, "w");
+        if (out == NULL) {
+            perror("Error opening output file");
+            ret = -1;
+            goto fail;
+        }
+        frame_buf = malloc(hdr->sizeimage);
+        if (frame_buf == NULL) {
+            perror("Error allocating a frame");
+            ret = -1;
+            goto fail;
+        }
+    }
+
+    uint64_t bytes = 0, missing = 0, raw_bytes = 0;
+    uint64_t first_ns = 0, last_ns = 0;
+    uint32_t last_sequence = 0;
+    for (uint64_t n = start; n < start + count; n++) {
+        const struct container_frame *frame = container_frame(rd, n);
+        if (frame == NULL) {
+            fprintf(stderr, "Error finding frame %llu: %s\n", (unsigned long long) n,
+                    strerror(errno));
+            ret = -1;
+            break;
+        }
+
+        if (list) {
+            fprintf(stdout, "Frame %llu: sequence %u, %llu.%06llu s, %u bytes, flags 0x%08x, "
+                    "codec %s\n", (unsigned long long) n, frame->sequence,
+                    (unsigned long long) (frame->timestamp_ns / 1000000000ULL),
+                    (unsigned long long) (frame->timestamp_ns % 1000000000ULL) / 1000,
+                    frame->size, frame->flags, codec_name(frame->codec));
+        }
+
+        const uint8_t *data = container_frame_data(frame);
+        uint32_t size = frame->size;
+        if (frame->codec != CODEC_NONE) {
+            if (out != NULL) {
+                if (frame->codec != CODEC_MED_RICE
+                        || -1 == decompress_frame(&fmt, data, size, frame_buf, NULL)) {
+                    fprintf(stderr, "Error decompressing frame %llu: %s\n",
+                            (unsigned long long) n,
+                            (frame->codec != CODEC_MED_RICE) ? "unknown codec" : strerror(errno));
+                    ret = -1;
+                    break;
+                }
+                data = frame_buf;
+            }
+            size = hdr->sizeimage;
+        }
+
+        if (out != NULL && size > 0 && !fwrite(data, size, 1, out)) {
+            perror("Error writing output");
+            ret = -1;
+            break;
+        }
+
+        // Sequence numbers skipped between the frames read
+        if (n > start) {
+            missing += (uint32_t) (frame->sequence - last_sequence - 1);
+        } else {
+            first_ns = frame->timestamp_ns;
+        }
+        last_sequence = frame->sequence;
+        last_ns = frame->timestamp_ns;
+        bytes += frame->size;
+        raw_bytes += size;
+    }
+
+    if (count > 0) {
+        double span = (last_ns > first_ns) ? (double) (last_ns - first_ns) / 1e9 : 0;
+        fprintf(stdout, "Frames %llu to %llu: %llu bytes over %.3f s, %llu missing from the "
+                "sequence\n", (unsigned long long) start,
+                (unsigned long long) (start + count - 1), (unsigned long long) bytes, span,
+                (unsigned long long) missing);
+        if (raw_bytes != bytes) {
+            fprintf(stdout, "Compressed from %llu bytes, %.2f:1\n",
+                    (unsigned long long) raw_bytes, bytes ? (double) raw_bytes / bytes : 0.0);
+        }
+    }
+
+fail:
+    if (out != NULL && EOF == fclose(out)) {
+        perror("Error closing output file");
+        ret = -1;
+    }
+    free(frame_buf);
+    container_close(rd);
+
+    return ret;
+}
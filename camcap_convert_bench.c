@@ -0,0 +1,650 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+#include "convert.h"
+#include "scale.h"
+#include "codec.h"
+
+/*
+ * Checks every conversion kernel this CPU can run against the scalar reference, byte for byte,
+ * and measures how many frames per second each of them converts.  The checks run single and
+ * multi-threaded, and Bayer formats with both demosaic methods.  The scaler is checked the same
+ * way, box filtered, bilinear and cropped, and so are the differences motion gating measures.
+ * The lossless codec is checked to give back every frame it compresses, and measured for speed
+ * and compression on frames like sensors give: smooth, with a little noise.
+ */
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_MS 500
+
+#define CHECK_THREADS 3
+
+static const uint32_t in_formats[] = {
+    V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_SRGGB8,
+    V4L2_PIX_FMT_SGRBG10, V4L2_PIX_FMT_SBGGR12, V4L2_PIX_FMT_SGBRG10ALAW8,
+    V4L2_PIX_FMT_SBGGR10DPCM8, V4L2_PIX_FMT_Y10BPACK, V4L2_PIX_FMT_Y10P, V4L2_PIX_FMT_Y10,
+    V4L2_PIX_FMT_Y12,
+};
+static const uint32_t out_formats[] = {
+    V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_Y10, V4L2_PIX_FMT_Y16,
+};
+static const uint32_t scale_formats[] = {
+    V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_NV12,
+};
+static const uint32_t codec_formats[] = {
+    V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_RGB24,
+    V4L2_PIX_FMT_SRGGB8, V4L2_PIX_FMT_SGRBG10, V4L2_PIX_FMT_Y12,
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void input_format(struct v4l2_format *fmt, uint32_t fourcc, int width, int height) {
+    memset(fmt, 0, sizeof(*fmt));
+    fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt->fmt.pix.pixelformat = fourcc;
+    fmt->fmt.pix.width = width;
+    fmt->fmt.pix.height = height;
+    pix_fmt_frame_size(fourcc, width, height, &fmt->fmt.pix.bytesperline,
+            &fmt->fmt.pix.sizeimage);
+}
+
+static int is_bayer(uint32_t fourcc) {
+    return convert_supported(fourcc, V4L2_PIX_FMT_RGB24)
+        && !convert_supported(fourcc, V4L2_PIX_FMT_YUV420);
+}
+
+/**
+ * make_pool - a pool to run on "threads" threads with: the calling one and the pool's, or none
+ * for just the calling one
+ */
+static int make_pool(int threads, struct thread_pool **pool) {
+    *pool = NULL;
+    if (threads == 1) {
+        return 0;
+    }
+    *pool = thread_pool_create(threads - 1, NULL, 0);
+    return (*pool == NULL) ? -1 : 0;
+}
+
+/**
+ * check - convert a frame of random pixels with "k" on "threads" threads and with the scalar
+ * kernels on one, and compare
+ *
+ * @returns 0 if they match, 1 if they don't, -1 on error
+ */
+static int check(const struct convert_kernels *k, uint32_t in_fourcc, uint32_t out_fourcc,
+        int width, int height, int threads, enum demosaic_method method) {
+    struct v4l2_format in, out;
+    input_format(&in, in_fourcc, width, height);
+
+    struct converter *ref = converter_create(&in, out_fourcc, &convert_kernels_scalar, &out);
+    struct converter *cv = converter_create(&in, out_fourcc, k, &out);
+    uint8_t *src = malloc(in.fmt.pix.sizeimage);
+    uint8_t *want = malloc(out.fmt.pix.sizeimage);
+    uint8_t *got = malloc(out.fmt.pix.sizeimage);
+    struct thread_pool *pool = NULL;
+
+    int ret = -1;
+    if (ref == NULL || cv == NULL || src == NULL || want == NULL || got == NULL
+            || -1 == make_pool(threads, &pool) || -1 == converter_set_pool(cv, pool)) {
+        goto out;
+    }
+    converter_set_demosaic(ref, method);
+    converter_set_demosaic(cv, method);
+
+    for (uint32_t i = 0; i < in.fmt.pix.sizeimage; i++) {
+        src[i] = rand();
+    }
+    convert_frame(ref, src, want);
+    convert_frame(cv, src, got);
+
+    ret = 0;
+    for (uint32_t i = 0; i < out.fmt.pix.sizeimage; i++) {
+        if (want[i] != got[i]) {
+            fprintf(stdout, "MISMATCH %s %s -> %s %dx%d (%d threads%s) at byte %u: "
+                    "%u instead of %u\n", k->name, pix_fmt_to_str(in_fourcc),
+                    pix_fmt_to_str(out_fourcc), width, height, threads,
+                    (method == DEMOSAIC_EDGE_AWARE) ? ", edge-aware" : "", i, got[i], want[i]);
+            ret = 1;
+            break;
+        }
+    }
+
+out:
+    free(src);
+    free(want);
+    free(got);
+    converter_free(ref);
+    converter_free(cv);
+    thread_pool_free(pool);
+    return ret;
+}
+
+/**
+ * check_scale - scale the "crop" region (NULL for all) of a frame of random pixels to
+ * "out_width" x "out_height" with "k" on "threads" threads and with the scalar kernels on one,
+ * and compare
+ *
+ * @returns 0 if they match, 1 if they don't, -1 on error
+ */
+static int check_scale(const struct convert_kernels *k, uint32_t fourcc, int width, int height,
+        const struct v4l2_rect *crop, int out_width, int out_height, int threads) {
+    struct v4l2_format in, out;
+    input_format(&in, fourcc, width, height);
+
+    struct scaler *ref = scaler_create(&in, crop, out_width, out_height, &convert_kernels_scalar,
+            &out);
+    struct scaler *sc = scaler_create(&in, crop, out_width, out_height, k, &out);
+    uint8_t *src = malloc(in.fmt.pix.sizeimage);
+    uint8_t *want = malloc(out.fmt.pix.sizeimage);
+    uint8_t *got = malloc(out.fmt.pix.sizeimage);
+    struct thread_pool *pool = NULL;
+
+    int ret = -1;
+    if (ref == NULL || sc == NULL || src == NULL || want == NULL || got == NULL
+            || -1 == make_pool(threads, &pool) || -1 == scaler_set_pool(sc, pool)) {
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < in.fmt.pix.sizeimage; i++) {
+        src[i] = rand();
+    }
+    scale_frame(ref, src, want);
+    scale_frame(sc, src, got);
+
+    ret = 0;
+    for (uint32_t i = 0; i < out.fmt.pix.sizeimage; i++) {
+        if (want[i] != got[i]) {
+            fprintf(stdout, "MISMATCH %s scaling %s %dx%d to %dx%d (%s, %d threads) at byte %u: "
+                    "%u instead of %u\n", k->name, pix_fmt_to_str(fourcc), width, height,
+                    out_width, out_height, scaler_filter(sc), threads, i, got[i], want[i]);
+            ret = 1;
+            break;
+        }
+    }
+
+out:
+    free(src);
+    free(want);
+    free(got);
+    scaler_free(ref);
+    scaler_free(sc);
+    thread_pool_free(pool);
+    return ret;
+}
+
+/**
+ * check_sad - compare the sums of absolute differences "k" and the scalar kernels take of rows
+ * of random bytes, up to "width" long
+ *
+ * @returns 0 if they match, 1 if they don't, -1 on error
+ */
+static int check_sad(const struct convert_kernels *k, int width) {
+    uint8_t *a = malloc(width), *b = malloc(width);
+    if (a == NULL || b == NULL) {
+        free(a);
+        free(b);
+        return -1;
+    }
+
+    int ret = 0;
+    for (int n = 0; n <= width && ret == 0; n += (n < 100) ? 1 : n / 2 + 1) {
+        for (int i = 0; i < n; i++) {
+            a[i] = rand();
+            b[i] = (i % 3) ? rand() : a[i];
+        }
+        uint32_t want = convert_kernels_scalar.sad_row(a, b, n), got = k->sad_row(a, b, n);
+        if (want != got) {
+            fprintf(stdout, "MISMATCH %s sad_row of %d bytes: %u instead of %u\n", k->name, n,
+                    got, want);
+            ret = 1;
+        }
+    }
+
+    free(a);
+    free(b);
+    return ret;
+}
+
+/**
+ * bench - convert frames with "k" for a while
+ *
+ * @returns frames converted per second, or -1 on error
+ */
+static double bench(const struct convert_kernels *k, uint32_t in_fourcc, uint32_t out_fourcc,
+        int width, int height, int ms, int threads) {
+    struct v4l2_format in, out;
+    input_format(&in, in_fourcc, width, height);
+
+    struct converter *cv = converter_create(&in, out_fourcc, k, &out);
+    uint8_t *src = malloc(in.fmt.pix.sizeimage);
+    uint8_t *dst = malloc(out.fmt.pix.sizeimage);
+    struct thread_pool *pool = NULL;
+
+    double fps = -1;
+    if (cv != NULL && src != NULL && dst != NULL && 0 == make_pool(threads, &pool)
+            && 0 == converter_set_pool(cv, pool)) {
+        memset(src, 0x80, in.fmt.pix.sizeimage);
+        memset(dst, 0, out.fmt.pix.sizeimage);
+
+        uint64_t start = monotonic_ns(), end = start + (uint64_t) ms * 1000000, now;
+        long frames = 0;
+        do {
+            convert_frame(cv, src, dst);
+            frames++;
+            now = monotonic_ns();
+        } while (now < end);
+        fps = frames * 1e9 / (now - start);
+    }
+
+    free(src);
+    free(dst);
+    converter_free(cv);
+    thread_pool_free(pool);
+    return fps;
+}
+
+/**
+ * bench_scale - scale frames down to "out_width" x "out_height" with "k" for a while
+ *
+ * @returns frames scaled per second, or -1 on error
+ */
+static double bench_scale(const struct convert_kernels *k, uint32_t fourcc, int width,
+        int height, int out_width, int out_height, int ms, int threads) {
+    struct v4l2_format in, out;
+    input_format(&in, fourcc, width, height);
+
+    struct scaler *sc = scaler_create(&in, NULL, out_width, out_height, k, &out);
+    uint8_t *src = malloc(in.fmt.pix.sizeimage);
+    uint8_t *dst = (sc != NULL) ? malloc(out.fmt.pix.sizeimage) : NULL;
+    struct thread_pool *pool = NULL;
+
+    double fps = -1;
+    if (sc != NULL && src != NULL && dst != NULL && 0 == make_pool(threads, &pool)
+            && 0 == scaler_set_pool(sc, pool)) {
+        memset(src, 0x80, in.fmt.pix.sizeimage);
+        memset(dst, 0, out.fmt.pix.sizeimage);
+
+        uint64_t start = monotonic_ns(), end = start + (uint64_t) ms * 1000000, now;
+        long frames = 0;
+        do {
+            scale_frame(sc, src, dst);
+            frames++;
+            now = monotonic_ns();
+        } while (now < end);
+        fps = frames * 1e9 / (now - start);
+    }
+
+    free(src);
+    free(dst);
+    scaler_free(sc);
+    thread_pool_free(pool);
+    return fps;
+}
+
+/**
+ * fill_frame - fill a frame with noise, or with a gradient and a little noise, like a sensor
+ * would give
+ */
+static void fill_frame(const struct v4l2_format *fmt, uint8_t *buf, int noise) {
+    uint32_t fourcc = fmt->fmt.pix.pixelformat;
+    int bits = (fourcc == V4L2_PIX_FMT_SGRBG10) ? 10 : (fourcc == V4L2_PIX_FMT_Y12) ? 12 : 8;
+    uint32_t bpl = fmt->fmt.pix.bytesperline, rows = fmt->fmt.pix.sizeimage / bpl;
+    uint32_t samples = (bits > 8) ? bpl / 2 : bpl, max = (1u << bits) - 1;
+
+    for (uint32_t y = 0; y < rows; y++) {
+        for (uint32_t x = 0; x < samples; x++) {
+            int v = noise ? rand() : (int) (((x + y) * (uint64_t) max) / (samples + rows))
+                + rand() % 7 - 3;
+            v = noise ? (v & 0xffff) : (v < 0) ? 0 : ((uint32_t) v > max) ? (int) max : v;
+            if (bits > 8) {
+                buf[y * bpl + 2 * x] = v;
+                buf[y * bpl + 2 * x + 1] = v >> 8;
+            } else {
+                buf[y * bpl + x] = v;
+            }
+        }
+    }
+}
+
+/**
+ * check_codec - compress a frame on "threads" threads, decompress it, and compare
+ *
+ * @returns 0 if it comes back the same, 1 if it doesn't, -1 on error
+ */
+static int check_codec(uint32_t fourcc, int width, int height, int threads, int noise) {
+    struct v4l2_format fmt;
+    input_format(&fmt, fourcc, width, height);
+
+    struct compressor *cmp = compressor_create(&fmt);
+    uint8_t *src = malloc(fmt.fmt.pix.sizeimage);
+    uint8_t *packed = malloc(codec_bound(&fmt));
+    uint8_t *got = malloc(fmt.fmt.pix.sizeimage);
+    struct thread_pool *pool = NULL;
+
+    int ret = -1;
+    if (cmp == NULL || src == NULL || packed == NULL || got == NULL
+            || -1 == make_pool(threads, &pool) || -1 == compressor_set_pool(cmp, pool)) {
+        goto out;
+    }
+
+    fill_frame(&fmt, src, noise);
+    memset(got, 0, fmt.fmt.pix.sizeimage);
+    uint32_t size = compress_frame(cmp, src, packed);
+
+    ret = 0;
+    if (size > codec_bound(&fmt) || -1 == decompress_frame(&fmt, packed, size, got, pool)
+            || 0 != memcmp(src, got, fmt.fmt.pix.sizeimage)) {
+        fprintf(stdout, "MISMATCH %s %s %dx%d (%d threads, %s) compressed to %u bytes\n",
+                codec_name(CODEC_MED_RICE), pix_fmt_to_str(fourcc), width, height, threads,
+                noise ? "noise" : "smooth", size);
+        ret = 1;
+    }
+
+out:
+    free(src);
+    free(packed);
+    free(got);
+    compressor_free(cmp);
+    thread_pool_free(pool);
+    return ret;
+}
+
+/**
+ * bench_codec - compress, then decompress, smooth frames for a while each
+ *
+ * @returns frames compressed per second, or -1 on error, with the frames decompressed per
+ *          second and the compression ratio in "decompress_fps" and "ratio"
+ */
+static double bench_codec(uint32_t fourcc, int width, int height, int ms, int threads,
+        double *decompress_fps, double *ratio) {
+    struct v4l2_format fmt;
+    input_format(&fmt, fourcc, width, height);
+
+    struct compressor *cmp = compressor_create(&fmt);
+    uint8_t *src = malloc(fmt.fmt.pix.sizeimage);
+    uint8_t *packed = malloc(codec_bound(&fmt));
+    uint8_t *dst = malloc(fmt.fmt.pix.sizeimage);
+    struct thread_pool *pool = NULL;
+
+    double fps = -1;
+    if (cmp != NULL && src != NULL && packed != NULL && dst != NULL
+            && 0 == make_pool(threads, &pool) && 0 == compressor_set_pool(cmp, pool)) {
+        fill_frame(&fmt, src, 0);
+
+        uint64_t start = monotonic_ns(), end = start + (uint64_t) ms * 1000000, now;
+        long frames = 0;
+        uint32_t size;
+        do {
+            size = compress_frame(cmp, src, packed);
+            frames++;
+            now = monotonic_ns();
+        } while (now < end);
+        fps = frames * 1e9 / (now - start);
+        *ratio = (double) fmt.fmt.pix.sizeimage / size;
+
+        start = now;
+        end = start + (uint64_t) ms * 1000000;
+        frames = 0;
+        do {
+            decompress_frame(&fmt, packed, size, dst, pool);
+            frames++;
+            now = monotonic_ns();
+        } while (now < end);
+        *decompress_fps = frames * 1e9 / (now - start);
+    }
+
+    free(src);
+    free(packed);
+    free(dst);
+    compressor_free(cmp);
+    thread_pool_free(pool);
+    return fps;
+}
+
+void print_usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [options]\n\n"
+            "-w | --width   Frame width to benchmark with (default %d)\n"
+            "-h | --height  Frame height to benchmark with (default %d)\n"
+            "-t | --time    Milliseconds to benchmark every kernel for (default %d)\n"
+            "-j | --threads Threads to benchmark with (default 1)\n"
+            "-n | --no-bench  Only check the kernels against the scalar reference\n",
+            argv0, BENCH_WIDTH, BENCH_HEIGHT, BENCH_MS);
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"width",  required_argument, 0, 'w' },
+        {"height", required_argument, 0, 'h' },
+        {"time",   required_argument, 0, 't' },
+        {"threads", required_argument, 0, 'j' },
+        {"no-bench", no_argument,     0, 'n' },
+        {0,        0,                 0,  0  }
+    };
+
+    long width = BENCH_WIDTH, height = BENCH_HEIGHT, ms = BENCH_MS, threads = 1;
+    int run_bench = 1;
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "w:h:t:j:n", long_options, NULL))) {
+        char *endptr = NULL;
+        switch (opt) {
+            case 'w':
+                width = strtol(optarg, &endptr, 0);
+                if (width <= 0 || width > 16384 || (width % 4) != 0 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Width must be a multiple of 4 up to 16384: \"%s\"\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+
+            case 'h':
+                height = strtol(optarg, &endptr, 0);
+                if (height <= 0 || height > 16384 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given height: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 't':
+                ms = strtol(optarg, &endptr, 0);
+                if (ms <= 0 || ms > INT_MAX || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given time: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'j':
+                threads = strtol(optarg, &endptr, 0);
+                if (threads <= 0 || threads > THREAD_POOL_MAX_THREADS || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Threads must be 1 to %d: \"%s\"\n",
+                            THREAD_POOL_MAX_THREADS, optarg);
+                    return -1;
+                }
+                break;
+
+            case 'n':
+                run_bench = 0;
+                break;
+
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    const struct convert_kernels *kernels[CONVERT_MAX_KERNELS];
+    int kernel_cnt = convert_kernels_available(kernels);
+
+    // Odd sizes as well, so the tails get checked too
+    static const int sizes[][2] = { { 2, 1 }, { 30, 3 }, { 44, 5 }, { 94, 7 }, { 636, 479 } };
+    int failed = 0;
+    for (int k = 0; k < kernel_cnt; k++) {
+        int mismatch = 0;
+        for (size_t i = 0; i < sizeof(in_formats) / sizeof(in_formats[0]); i++) {
+            for (size_t o = 0; o < sizeof(out_formats) / sizeof(out_formats[0]); o++) {
+                if (!convert_supported(in_formats[i], out_formats[o])) {
+                    continue;
+                }
+                int methods = is_bayer(in_formats[i]) ? 2 : 1;
+                for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) + 1; s++) {
+                    int w = (s < sizeof(sizes) / sizeof(sizes[0])) ? sizes[s][0] : width;
+                    int h = (s < sizeof(sizes) / sizeof(sizes[0])) ? sizes[s][1] : height;
+                    if (in_formats[i] == V4L2_PIX_FMT_Y10P && (w % 4) != 0) {
+                        continue;
+                    }
+                    for (int m = 0; m < methods; m++) {
+                        for (int t = 1; t <= CHECK_THREADS; t += CHECK_THREADS - 1) {
+                            int r = check(kernels[k], in_formats[i], out_formats[o], w, h, t,
+                                    m ? DEMOSAIC_EDGE_AWARE : DEMOSAIC_BILINEAR);
+                            if (r == -1) {
+                                perror("Error checking kernels");
+                                return -1;
+                            }
+                            mismatch |= r;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Box filtered, bilinear down and up, and cropped regions, all with odd output rows
+        static const struct {
+            int width, height;
+            struct v4l2_rect crop;
+            int out_width, out_height;
+        } scales[] = {
+            { 64, 36, { 0, 0, 0, 0 }, 32, 18 },
+            { 96, 60, { 0, 0, 0, 0 }, 32, 20 },
+            { 640, 480, { 0, 0, 0, 0 }, 426, 240 },
+            { 100, 50, { 0, 0, 0, 0 }, 34, 14 },
+            { 40, 20, { 0, 0, 0, 0 }, 70, 34 },
+            { 640, 480, { 64, 40, 320, 240 }, 320, 240 },
+            { 640, 480, { 2, 2, 300, 180 }, 100, 60 },
+            { 640, 480, { 10, 6, 402, 300 }, 130, 98 },
+        };
+        for (size_t i = 0; i < sizeof(scale_formats) / sizeof(scale_formats[0]); i++) {
+            for (size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); s++) {
+                for (int t = 1; t <= CHECK_THREADS; t += CHECK_THREADS - 1) {
+                    const struct v4l2_rect *crop = (scales[s].crop.width != 0)
+                        ? &scales[s].crop : NULL;
+                    int r = check_scale(kernels[k], scale_formats[i], scales[s].width,
+                            scales[s].height, crop, scales[s].out_width, scales[s].out_height,
+                            t);
+                    if (r == -1) {
+                        perror("Error checking the scaler");
+                        return -1;
+                    }
+                    mismatch |= r;
+                }
+            }
+        }
+        int r = check_sad(kernels[k], width * 2);
+        if (r == -1) {
+            perror("Error checking kernels");
+            return -1;
+        }
+        mismatch |= r;
+        fprintf(stdout, "%s kernels %s the scalar reference\n", kernels[k]->name,
+                mismatch ? "DON'T match" : "match");
+        failed |= mismatch;
+    }
+
+    // Frames of noise are stored as they are, smooth ones get compressed
+    int mismatch = 0;
+    for (size_t i = 0; i < sizeof(codec_formats) / sizeof(codec_formats[0]); i++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) + 1; s++) {
+            int w = (s < sizeof(sizes) / sizeof(sizes[0])) ? sizes[s][0] : width;
+            int h = (s < sizeof(sizes) / sizeof(sizes[0])) ? sizes[s][1] : height;
+            for (int noise = 0; noise < 2; noise++) {
+                for (int t = 1; t <= CHECK_THREADS; t += CHECK_THREADS - 1) {
+                    int r = check_codec(codec_formats[i], w, h, t, noise);
+                    if (r == -1) {
+                        perror("Error checking the codec");
+                        return -1;
+                    }
+                    mismatch |= r;
+                }
+            }
+        }
+    }
+    fprintf(stdout, "%s codec round trips %s\n", codec_name(CODEC_MED_RICE),
+            mismatch ? "DON'T match" : "match");
+    failed |= mismatch;
+
+    if (!run_bench) {
+        return failed ? 1 : 0;
+    }
+
+    fprintf(stdout, "\n%ldx%ld frames per second on %ld thread%s\n%-24s", width, height,
+            threads, (threads == 1) ? "" : "s", "");
+    for (int k = 0; k < kernel_cnt; k++) {
+        fprintf(stdout, " %10s", kernels[k]->name);
+    }
+    fprintf(stdout, "\n");
+
+    for (size_t i = 0; i < sizeof(in_formats) / sizeof(in_formats[0]); i++) {
+        for (size_t o = 0; o < sizeof(out_formats) / sizeof(out_formats[0]); o++) {
+            if (!convert_supported(in_formats[i], out_formats[o])) {
+                continue;
+            }
+            char name[40];
+            snprintf(name, sizeof(name), "%s -> %s", pix_fmt_to_str(in_formats[i]),
+                    pix_fmt_to_str(out_formats[o]));
+            fprintf(stdout, "%-24s", name);
+            for (int k = 0; k < kernel_cnt; k++) {
+                fprintf(stdout, " %10.1f", bench(kernels[k], in_formats[i], out_formats[o],
+                            width, height, ms, threads));
+                fflush(stdout);
+            }
+            fprintf(stdout, "\n");
+        }
+    }
+
+    // Halving takes the box filter, two thirds the bilinear one
+    for (size_t i = 0; i < sizeof(scale_formats) / sizeof(scale_formats[0]); i++) {
+        for (int b = 0; b < 2; b++) {
+            int w = b ? width / 3 * 2 : width / 2, h = b ? height / 3 * 2 : height / 2;
+            w &= ~1;
+            h &= ~1;
+            if (w == 0 || h == 0) {
+                continue;
+            }
+            char name[40];
+            snprintf(name, sizeof(name), "%s -> %dx%d", pix_fmt_to_str(scale_formats[i]), w, h);
+            fprintf(stdout, "%-24s", name);
+            for (int k = 0; k < kernel_cnt; k++) {
+                fprintf(stdout, " %10.1f", bench_scale(kernels[k], scale_formats[i], width,
+                            height, w, h, ms, threads));
+                fflush(stdout);
+            }
+            fprintf(stdout, "\n");
+        }
+    }
+
+    fprintf(stdout, "\n%ldx%ld frames per second compressed with %s on %ld thread%s\n"
+            "%-24s %10s %10s %10s\n", width, height, codec_name(CODEC_MED_RICE), threads,
+            (threads == 1) ? "" : "s", "", "compress", "decompress", "ratio");
+    for (size_t i = 0; i < sizeof(codec_formats) / sizeof(codec_formats[0]); i++) {
+        double decompress_fps = 0, ratio = 0;
+        double fps = bench_codec(codec_formats[i], width, height, ms, threads, &decompress_fps,
+                &ratio);
+        fprintf(stdout, "%-24s %10.1f %10.1f %9.2f:1\n", pix_fmt_to_str(codec_formats[i]), fps,
+                decompress_fps, ratio);
+    }
+
+    return failed ? 1 : 0;
+}
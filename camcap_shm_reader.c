@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+#include "shm_ring.h"
+
+/*
+ * Reader for camcap --shm: follows the shared memory ring, reports how far behind it is, and
+ * optionally writes the frames it read to a file.
+ */
+
+#define READ_TIMEOUT_MS 2000
+
+void print_usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [options] NAME\n\n"
+            "-c | --count   Stop after this many frames (default: until camcap stops)\n"
+            "-o | --output  Write the frames read to this file\n"
+            "-l | --latest  Start at the newest frame instead of the oldest one in the ring\n"
+            "-s | --sleep   Milliseconds to spend on every frame, to act like a slow reader\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"count",  required_argument, 0, 'c' },
+        {"output", required_argument, 0, 'o' },
+        {"latest", no_argument,       0, 'l' },
+        {"sleep",  required_argument, 0, 's' },
+        {0,        0,                 0,  0  }
+    };
+
+    long frame_count = 0;
+    long sleep_ms = 0;
+    const char *out_name = NULL;
+    int latest = 0;
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "c:o:ls:", long_options, NULL))) {
+        char *endptr = NULL;
+        switch (opt) {
+            case 'c':
+                frame_count = strtol(optarg, &endptr, 0);
+                if (frame_count <= 0 || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given frame count: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'o':
+                out_name = optarg;
+                break;
+
+            case 'l':
+                latest = 1;
+                break;
+
+            case 's':
+                sleep_ms = strtol(optarg, &endptr, 0);
+                if (sleep_ms < 0 || sleep_ms > INT_MAX || *endptr != '\0') {
+                    fprintf(stderr, "ERROR: Unable to parse given sleep time: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    struct shm_reader *rd = shm_reader_open(argv[optind], latest);
+    if (rd == NULL) {
+        perror("Error attaching to the shared memory ring");
+        return -1;
+    }
+
+    const struct shm_ring_header *hdr = shm_reader_header(rd);
+    fprintf(stdout, "%s %ux%u, %u slots of %u bytes\n", pix_fmt_to_str(hdr->pixelformat),
+            hdr->width, hdr->height, hdr->slot_count, hdr->slot_size);
+
+    int ret = 0;
+    FILE *out = NULL;
+    uint8_t *frame = malloc(hdr->slot_size);
+    if (frame == NULL) {
+        perror("Error allocating frame");
+        ret = -1;
+        goto fail;
+    }
+
+    if (out_name != NULL) {
+        out = fopen(out_name, "w");
+        if (out == NULL) {
+            perror("Error opening output file");
+            ret = -1;
+            goto fail;
+        }
+    }
+
+    long frames = 0;
+    uint64_t lost = 0, max_lag = 0;
+    while (frame_count == 0 || frames < frame_count) {
+        struct shm_ring_frame info;
+        int r = shm_reader_next(rd, frame, hdr->slot_size, &info, READ_TIMEOUT_MS);
+        if (r == 0) {
+            fprintf(stdout, "camcap stopped\n");
+            break;
+        }
+        if (r == -1) {
+            perror("Error reading frame");
+            ret = -1;
+            break;
+        }
+
+        if (info.lost > 0) {
+            fprintf(stdout, "Lost %llu frames\n", (unsigned long long) info.lost);
+        }
+        fprintf(stdout, "Frame %u: %u bytes, %llu frames behind\n", info.sequence,
+                info.bytesused, (unsigned long long) info.lag);
+
+        // Empty error buffers have nothing to write
+        if (out != NULL && info.bytesused > 0 && !fwrite(frame, info.bytesused, 1, out)) {
+            perror("Error writing output");
+            ret = -1;
+            break;
+        }
+
+        lost += info.lost;
+        if (info.lag > max_lag) {
+            max_lag = info.lag;
+        }
+        frames++;
+
+        if (sleep_ms > 0) {
+            struct timespec ts = { .tv_sec = sleep_ms / 1000, .tv_nsec = (sleep_ms % 1000) * 1000000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    fprintf(stdout, "%ld frames read, %llu lost, at most %llu frames behind\n", frames,
+            (unsigned long long) lost, (unsigned long long) max_lag);
+
+fail:
+    if (out != NULL && EOF == fclose(out)) {
+        perror("Error closing output file");
+        ret = -1;
+    }
+    free(frame);
+    shm_reader_close(rd);
+
+    return ret;
+}
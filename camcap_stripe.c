@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+#include "container.h"
+#include "codec.h"
+#include "stripe.h"
+
+/*
+ * Reader for camcap --stripe: follows the manifest to put the frames dealt out across the
+ * stripes back in the order they were captured, listing them or copying any range of them out
+ * as raw frames.  Frames written with --compress are decompressed on the way.
+ */
+
+/**
+ * stripe_file - a stripe of frames back to back, or a frame container
+ */
+struct stripe_file {
+    int fd;
+    struct container_reader *rd;
+    uint64_t frames;
+};
+
+void print_usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [options] MANIFEST\n\n"
+            "-s | --start   The first frame to read, counting from 0 (default 0)\n"
+            "-c | --count   The number of frames to read (default: up to the last one)\n"
+            "-l | --list    Print the sequence number, timestamp, size and stripe of every\n"
+            "               frame read\n"
+            "-o | --output  Write the frames read back to back, in order, to this file\n\n"
+            "The stripes are opened by the names they were given to camcap.\n",
+            argv0);
+}
+
+static int parse_count(const char *arg, uint64_t *value) {
+    char *endptr = NULL;
+    errno = 0;
+    unsigned long long parsed = strtoull(arg, &endptr, 0);
+    if (errno != 0 || endptr == arg || *endptr != '\0' || arg[0] == '-') {
+        return -1;
+    }
+    *value = parsed;
+    return 0;
+}
+
+/**
+ * read_header - read the manifest header, and the stripe names into "names"
+ */
+static int read_header(FILE *manifest, struct stripe_manifest_header *hdr, char **names) {
+    if (!fread(hdr, sizeof(*hdr), 1, manifest) || hdr->magic != STRIPE_MANIFEST_MAGIC
+            || hdr->version != STRIPE_MANIFEST_VERSION
+            || hdr->record_size < sizeof(struct stripe_manifest_record)
+            || hdr->stripe_count == 0 || hdr->stripe_count > STRIPE_MAX
+            || hdr->header_size <= sizeof(*hdr)) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    size_t names_size = hdr->header_size - sizeof(*hdr);
+    *names = malloc(names_size + 1);
+    if (*names == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (!fread(*names, names_size, 1, manifest)) {
+        errno = EPROTO;
+        return -1;
+    }
+    (*names)[names_size] = '\0';
+    return 0;
+}
+
+/**
+ * read_stripe_frame - read the frame "rec" points to, decompressed, into "frame_buf"
+ *
+ * @returns the frame's data, which may be inside the container, or NULL with errno set
+ */
+static const uint8_t *read_stripe_frame(const struct stripe_file *st,
+        const struct stripe_manifest_record *rec, const struct v4l2_format *fmt,
+        uint8_t *frame_buf, uint32_t *size) {
+    if (st->rd == NULL) {
+        ssize_t r = pread(st->fd, frame_buf, rec->size, rec->position);
+        if (r != (ssize_t) rec->size) {
+            errno = (r == -1) ? errno : EPROTO;
+            return NULL;
+        }
+        *size = rec->size;
+        return frame_buf;
+    }
+
+    const struct container_frame *frame = container_frame(st->rd, rec->position);
+    if (frame == NULL) {
+        return NULL;
+    }
+    if (frame->sequence != rec->sequence || frame->size != rec->size) {
+        errno = EPROTO;
+        return NULL;
+    }
+
+    *size = frame->size;
+    if (frame->codec == CODEC_NONE) {
+        return container_frame_data(frame);
+    }
+    if (frame->codec != CODEC_MED_RICE
+            || -1 == decompress_frame(fmt, container_frame_data(frame), frame->size, frame_buf,
+                NULL)) {
+        errno = (frame->codec != CODEC_MED_RICE) ? EPROTO : errno;
+        return NULL;
+    }
+    *size = fmt->fmt.pix.sizeimage;
+    return frame_buf;
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"start",  required_argument, 0, 's' },
+        {"count",  required_argument, 0, 'c' },
+        {"list",   no_argument,       0, 'l' },
+        {"output", required_argument, 0, 'o' },
+        {0,        0,                 0,  0  }
+    };
+
+    uint64_t start = 0, count = UINT64_MAX;
+    const char *out_name = NULL;
+    int list = 0;
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "s:c:lo:", long_options, NULL))) {
+        switch (opt) {
+            case 's':
+                if (-1 == parse_count(optarg, &start)) {
+                    fprintf(stderr, "ERROR: Unable to parse given frame: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'c':
+                if (-1 == parse_count(optarg, &count) || count == 0) {
+                    fprintf(stderr, "ERROR: Unable to parse given frame count: \"%s\"\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'l':
+                list = 1;
+                break;
+
+            case 'o':
+                out_name = optarg;
+                break;
+
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    FILE *manifest = fopen(argv[optind], "r");
+    if (manifest == NULL) {
+        perror("Error opening manifest");
+        return -1;
+    }
+
+    int ret = 0;
+    FILE *out = NULL;
+    uint8_t *frame_buf = NULL;
+    char *names = NULL;
+    struct stripe_file stripes[STRIPE_MAX];
+    for (int i = 0; i < STRIPE_MAX; i++) {
+        stripes[i] = (struct stripe_file) { .fd = -1 };
+    }
+
+    struct stripe_manifest_header hdr;
+    if (-1 == read_header(manifest, &hdr, &names)) {
+        perror((errno == EPROTO) ? "Not a stripe manifest" : "Error reading manifest");
+        ret = -1;
+        goto fail;
+    }
+
+    // Records follow the names, and one cut short by a crash is left out
+    if (-1 == fseek(manifest, 0, SEEK_END)) {
+        perror("Error reading manifest");
+        ret = -1;
+        goto fail;
+    }
+    uint64_t frame_count = ((uint64_t) ftell(manifest) - hdr.header_size) / hdr.record_size;
+
+    fprintf(stdout, "%s %ux%u, %llu frames across %u stripes%s\n",
+            pix_fmt_to_str(hdr.pixelformat), hdr.width, hdr.height,
+            (unsigned long long) frame_count, hdr.stripe_count,
+            hdr.container ? " written as containers" : "");
+
+    struct v4l2_format fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+    fmt.fmt.pix.width = hdr.width;
+    fmt.fmt.pix.height = hdr.height;
+    fmt.fmt.pix.pixelformat = hdr.pixelformat;
+    fmt.fmt.pix.bytesperline = hdr.bytesperline;
+    fmt.fmt.pix.sizeimage = hdr.sizeimage;
+
+    const char *name = names;
+    for (uint32_t i = 0; i < hdr.stripe_count; i++) {
+        if (name >= names + (hdr.header_size - sizeof(hdr)) || *name == '\0') {
+            fprintf(stderr, "Not a stripe manifest: stripe %u has no name\n", i);
+            ret = -1;
+            goto fail;
+        }
+
+        if (hdr.container) {
+            stripes[i].rd = container_open(name);
+        } else {
+            stripes[i].fd = open(name, O_RDONLY | O_CLOEXEC);
+        }
+        if (stripes[i].rd == NULL && stripes[i].fd == -1) {
+            fprintf(stderr, "Error opening stripe %s: %s\n", name,
+                    (errno == EPROTO) ? "not a frame container" : strerror(errno));
+            ret = -1;
+            goto fail;
+        }
+        name += strlen(name) + 1;
+    }
+
+    if (start > frame_count) {
+        fprintf(stderr, "There is no frame %llu!\n", (unsigned long long) start);
+        ret = -1;
+        goto fail;
+    }
+    if (count > frame_count - start) {
+        count = frame_count - start;
+    }
+
+    if (out_name != NULL) {
+        out = fopen(out_name, "w");
+        if (out == NULL) {
+            perror("Error opening output file");
+            ret = -1;
+            goto fail;
+        }
+    }
+
+    // Raw frames are read whole, so the buffer grows for any bigger than "sizeimage"
+    size_t buf_size = hdr.sizeimage;
+    frame_buf = malloc(buf_size);
+    if (frame_buf == NULL) {
+        perror("Error allocating a frame");
+        ret = -1;
+        goto fail;
+    }
+
+    if (-1 == fseek(manifest, hdr.header_size + start * hdr.record_size, SEEK_SET)) {
+        perror("Error reading manifest");
+        ret = -1;
+        goto fail;
+    }
+
+    uint64_t bytes = 0, missing = 0;
+    uint64_t first_ns = 0, last_ns = 0;
+    uint32_t last_sequence = 0;
+    for (uint64_t n = start; n < start + count; n++) {
+        struct stripe_manifest_record rec;
+        if (!fread(&rec, sizeof(rec), 1, manifest)
+                || (hdr.record_size > sizeof(rec)
+                    && -1 == fseek(manifest, hdr.record_size - sizeof(rec), SEEK_CUR))) {
+            fprintf(stderr, "Error reading the manifest at frame %llu\n", (unsigned long long) n);
+            ret = -1;
+            break;
+        }
+        if (rec.stripe >= hdr.stripe_count) {
+            fprintf(stderr, "Frame %llu is in stripe %u, which there isn't\n",
+                    (unsigned long long) n, rec.stripe);
+            ret = -1;
+            break;
+        }
+
+        if (list) {
+            fprintf(stdout, "Frame %llu: sequence %u, %llu.%06llu s, %u bytes, flags 0x%08x, "
+                    "stripe %u\n", (unsigned long long) n, rec.sequence,
+                    (unsigned long long) (rec.timestamp_ns / 1000000000ULL),
+                    (unsigned long long) (rec.timestamp_ns % 1000000000ULL) / 1000,
+                    rec.size, rec.flags, rec.stripe);
+        }
+
+        if (out != NULL) {
+            if (!hdr.container && rec.size > buf_size) {
+                uint8_t *grown = realloc(frame_buf, rec.size);
+                if (grown == NULL) {
+                    perror("Error allocating a frame");
+                    ret = -1;
+                    break;
+                }
+                frame_buf = grown;
+                buf_size = rec.size;
+            }
+
+            uint32_t size;
+            const uint8_t *data = read_stripe_frame(&stripes[rec.stripe], &rec, &fmt,
+                    frame_buf, &size);
+            if (data == NULL) {
+                fprintf(stderr, "Error reading frame %llu from stripe %u: %s\n",
+                        (unsigned long long) n, rec.stripe,
+                        (errno == EPROTO) ? "it doesn't match the manifest" : strerror(errno));
+                ret = -1;
+                break;
+            }
+            if (size > 0 && !fwrite(data, size, 1, out)) {
+                perror("Error writing output");
+                ret = -1;
+                break;
+            }
+        }
+
+        // Sequence numbers skipped between the frames read
+        if (n > start) {
+            missing += (uint32_t) (rec.sequence - last_sequence - 1);
+        } else {
+            first_ns = rec.timestamp_ns;
+        }
+        last_sequence = rec.sequence;
+        last_ns = rec.timestamp_ns;
+        bytes += rec.size;
+        stripes[rec.stripe].frames++;
+    }
+
+    if (count > 0) {
+        double span = (last_ns > first_ns) ? (double) (last_ns - first_ns) / 1e9 : 0;
+        fprintf(stdout, "Frames %llu to %llu: %llu bytes over %.3f s, %llu missing from the "
+                "sequence\n", (unsigned long long) start,
+                (unsigned long long) (start + count - 1), (unsigned long long) bytes, span,
+                (unsigned long long) missing);
+        name = names;
+        for (uint32_t i = 0; i < hdr.stripe_count; i++) {
+            fprintf(stdout, "Stripe %u: %llu frames from %s\n", i,
+                    (unsigned long long) stripes[i].frames, name);
+            name += strlen(name) + 1;
+        }
+    }
+
+fail:
+    if (out != NULL && EOF == fclose(out)) {
+        perror("Error closing output file");
+        ret = -1;
+    }
+    for (int i = 0; i < STRIPE_MAX; i++) {
+        if (stripes[i].fd >= 0) {
+            close(stripes[i].fd);
+        }
+        if (stripes[i].rd != NULL) {
+            container_close(stripes[i].rd);
+        }
+    }
+    free(frame_buf);
+    free(names);
+    fclose(manifest);
+
+    return ret;
+}
@@ -0,0 +1,688 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "codec.h"
+#include "thread_pool.h"
+
+/*
+ * Lossless frame codec - see codec.h for the format.
+ *
+ * Frames are taken as rows of bytesperline bytes, or of 16-bit little endian samples for
+ * formats deeper than 8 bits.  Which sample is a sample's neighbour depends on the format:
+ * "dx" samples to the left (in a pattern repeating every 4 samples, for packed YUV) and "dy"
+ * rows up (2 for Bayer).  The first "dy" rows of a band are predicted from the left only.
+ *
+ * Prediction errors are taken modulo the sample range and folded to unsigned (0, -1, 1, -2,
+ * ...).  Every row is cut into blocks of CODEC_BLOCK of them, the last one shorter, and every
+ * block starts with 4 bits: 0 if all its errors are 0, or k + 1 for Rice parameter
+ * k.  An error e is then coded as e >> k in unary (ones ended by a zero) and the low k bits of
+ * e, or, from CODEC_ESCAPE ones on, as that many ones and e in full.  Bits are packed from the
+ * lowest bit of every byte up.
+ */
+
+#define CODEC_ESCAPE 16
+
+// For the band loops to be built once for 8 and once for 16-bit samples
+#define SPECIALIZED inline __attribute__((always_inline))
+
+// Room a band may take while being coded, beyond its raw size: it is given up on after that
+#define BAND_SLACK 256
+
+/**
+ * codec_format - how the samples of a pixel format are laid out
+ */
+struct codec_format {
+    uint32_t fourcc;
+    uint8_t wide;               // 16-bit samples
+    uint8_t dy;
+    uint8_t dx[4];
+};
+
+static const struct codec_format codec_formats[] = {
+    { V4L2_PIX_FMT_GREY, 0, 1, { 1, 1, 1, 1 } },
+    { V4L2_PIX_FMT_Y10, 1, 1, { 1, 1, 1, 1 } },
+    { V4L2_PIX_FMT_Y12, 1, 1, { 1, 1, 1, 1 } },
+    { V4L2_PIX_FMT_Y16, 1, 1, { 1, 1, 1, 1 } },
+    { V4L2_PIX_FMT_YUYV, 0, 1, { 2, 4, 2, 4 } },
+    { V4L2_PIX_FMT_YVYU, 0, 1, { 2, 4, 2, 4 } },
+    { V4L2_PIX_FMT_UYVY, 0, 1, { 4, 2, 4, 2 } },
+    { V4L2_PIX_FMT_VYUY, 0, 1, { 4, 2, 4, 2 } },
+    { V4L2_PIX_FMT_RGB24, 0, 1, { 3, 3, 3, 3 } },
+    { V4L2_PIX_FMT_BGR24, 0, 1, { 3, 3, 3, 3 } },
+    { V4L2_PIX_FMT_YUV420, 0, 1, { 1, 1, 1, 1 } },
+    { V4L2_PIX_FMT_NV12, 0, 1, { 1, 1, 1, 1 } },
+    { V4L2_PIX_FMT_SBGGR8, 0, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SGBRG8, 0, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SGRBG8, 0, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SRGGB8, 0, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SBGGR10, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SGBRG10, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SGRBG10, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SRGGB10, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SBGGR12, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SGBRG12, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SGRBG12, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SRGGB12, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SBGGR16, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SGBRG16, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SGRBG16, 1, 2, { 2, 2, 2, 2 } },
+    { V4L2_PIX_FMT_SRGGB16, 1, 2, { 2, 2, 2, 2 } },
+};
+
+/**
+ * codec_layout - the rows and samples of frames of one format
+ */
+struct codec_layout {
+    const struct codec_format *f;
+    uint32_t bpl;
+    uint32_t rows;
+    uint32_t samples;           // per row
+    int band_count;
+};
+
+struct compressor {
+    struct codec_layout lay;
+    size_t band_slot;           // room every band is coded into
+    struct thread_pool *pool;
+};
+
+static const struct codec_format *find_format(uint32_t fourcc) {
+    for (size_t i = 0; i < sizeof(codec_formats) / sizeof(codec_formats[0]); i++) {
+        if (codec_formats[i].fourcc == fourcc) {
+            return &codec_formats[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * codec_supported - whether frames of pixel format "fourcc" can be compressed
+ */
+int codec_supported(uint32_t fourcc) {
+    return find_format(fourcc) != NULL;
+}
+
+/**
+ * codec_name - what to call codec "codec" when printing it
+ */
+const char *codec_name(uint32_t codec) {
+    switch (codec) {
+        case CODEC_NONE:
+            return "none";
+        case CODEC_MED_RICE:
+            return "med-rice";
+        default:
+            return "unknown";
+    }
+}
+
+static int get_layout(const struct v4l2_format *fmt, struct codec_layout *lay) {
+    const struct v4l2_pix_format *pix = &fmt->fmt.pix;
+    lay->f = find_format(pix->pixelformat);
+    if (lay->f == NULL || pix->bytesperline == 0 || pix->sizeimage % pix->bytesperline != 0
+            || (lay->f->wide && (pix->bytesperline & 1) != 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    lay->bpl = pix->bytesperline;
+    lay->rows = pix->sizeimage / pix->bytesperline;
+    lay->samples = lay->f->wide ? lay->bpl / 2 : lay->bpl;
+    lay->band_count = (lay->rows + CODEC_BAND_ROWS - 1) / CODEC_BAND_ROWS;
+    return 0;
+}
+
+static size_t header_size(int band_count) {
+    return sizeof(struct codec_header) + (size_t) band_count * sizeof(uint32_t);
+}
+
+static size_t band_slot(const struct codec_layout *lay) {
+    return (size_t) CODEC_BAND_ROWS * lay->bpl + BAND_SLACK;
+}
+
+/**
+ * codec_bound - the room a frame of format "fmt" takes while it is compressed, and at most
+ * after, or 0 if it can't be compressed
+ */
+size_t codec_bound(const struct v4l2_format *fmt) {
+    struct codec_layout lay;
+    if (-1 == get_layout(fmt, &lay)) {
+        return 0;
+    }
+    return header_size(lay.band_count) + (size_t) lay.band_count * band_slot(&lay);
+}
+
+static inline uint32_t sample(const uint8_t *row, uint32_t i, int wide) {
+    return wide ? (uint32_t) row[2 * i] | ((uint32_t) row[2 * i + 1] << 8) : row[i];
+}
+
+static inline void set_sample(uint8_t *row, uint32_t i, uint32_t v, int wide) {
+    if (wide) {
+        row[2 * i] = v;
+        row[2 * i + 1] = v >> 8;
+    } else {
+        row[i] = v;
+    }
+}
+
+/**
+ * med - the median edge detector: the median of "a", "b" and the gradient a + b - c
+ *
+ * Taken as a median, without branches that noise would make impossible to predict.
+ */
+static inline uint32_t med(uint32_t a, uint32_t b, uint32_t c) {
+    int lo = (a < b) ? a : b, hi = (a < b) ? b : a, grad = (int) (a + b) - (int) c;
+    int m = (grad < hi) ? grad : hi;
+    return (m > lo) ? m : lo;
+}
+
+/**
+ * predict - the prediction of sample "i" of "row", from the row "up" above it (or NULL)
+ */
+static inline uint32_t predict(const uint8_t *row, const uint8_t *up, uint32_t i, uint32_t dx,
+        int wide) {
+    if (up == NULL) {
+        return (i >= dx) ? sample(row, i - dx, wide) : 0;
+    }
+    if (i < dx) {
+        return sample(up, i, wide);
+    }
+    return med(sample(row, i - dx, wide), sample(up, i, wide), sample(up, i - dx, wide));
+}
+
+static inline uint32_t fold(uint32_t diff, int wide) {
+    int s = wide ? (int16_t) diff : (int8_t) diff;
+    return (uint32_t) ((s * 2) ^ (s >> 31)) & (wide ? 0xffff : 0xff);
+}
+
+static inline uint32_t unfold(uint32_t e) {
+    return (e >> 1) ^ -(e & 1);
+}
+
+/**
+ * block_errors - the folded prediction errors of the "n" samples of "row" from "i" on
+ *
+ * Only the first block of a row, and rows without one above, have samples at the edges.
+ */
+static inline void block_errors(const uint8_t *row, const uint8_t *up, const uint8_t *dx,
+        uint32_t i, int n, uint16_t *err, int wide) {
+    if (up == NULL || i == 0) {
+        for (int j = 0; j < n; j++) {
+            uint32_t p = predict(row, up, i + j, dx[(i + j) & 3], wide);
+            err[j] = fold(sample(row, i + j, wide) - p, wide);
+        }
+        return;
+    }
+
+    for (int j = 0; j < n; j++) {
+        uint32_t at = i + j, left = at - dx[at & 3];
+        uint32_t p = med(sample(row, left, wide), sample(up, at, wide), sample(up, left, wide));
+        err[j] = fold(sample(row, at, wide) - p, wide);
+    }
+}
+
+/**
+ * block_samples - the "n" samples of "row" from "i" on, from their folded prediction errors
+ */
+static inline void block_samples(uint8_t *row, const uint8_t *up, const uint8_t *dx,
+        uint32_t i, int n, const uint16_t *err, int wide) {
+    uint32_t mask = wide ? 0xffff : 0xff;
+    if (up == NULL || i == 0) {
+        for (int j = 0; j < n; j++) {
+            uint32_t p = predict(row, up, i + j, dx[(i + j) & 3], wide);
+            set_sample(row, i + j, (p + unfold(err[j])) & mask, wide);
+        }
+        return;
+    }
+
+    for (int j = 0; j < n; j++) {
+        uint32_t at = i + j, left = at - dx[at & 3];
+        uint32_t p = med(sample(row, left, wide), sample(up, at, wide), sample(up, left, wide));
+        set_sample(row, at, (p + unfold(err[j])) & mask, wide);
+    }
+}
+
+/**
+ * bit_writer - packs bits into bytes, always storing 8 bytes at a time, so whatever it writes
+ * into needs 8 bytes of room past the end
+ */
+struct bit_writer {
+    uint64_t acc;
+    int n;
+    uint8_t *p;
+};
+
+// Up to 32 bits can be put between two stores
+static inline void put_bits(struct bit_writer *bw, uint32_t v, int len) {
+    bw->acc |= (uint64_t) v << bw->n;
+    bw->n += len;
+}
+
+static inline void store_bits(struct bit_writer *bw) {
+    uint64_t le = htole64(bw->acc);
+    memcpy(bw->p, &le, sizeof(le));
+    bw->p += bw->n >> 3;
+    bw->acc >>= bw->n & ~7;
+    bw->n &= 7;
+}
+
+static void flush_bits(struct bit_writer *bw) {
+    store_bits(bw);
+    if (bw->n > 0) {
+        bw->p++;
+    }
+    bw->acc = 0;
+    bw->n = 0;
+}
+
+/**
+ * put_block - code the "n" folded errors of a block
+ */
+static inline void put_block(struct bit_writer *bw, const uint16_t *err, int n, int wide) {
+    uint32_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += err[i];
+    }
+    if (sum == 0) {
+        put_bits(bw, 0, 4);
+        store_bits(bw);
+        return;
+    }
+
+    // The largest k with 2^k up to the mean error
+    int k = 0, max_k = wide ? 14 : 7, bits = wide ? 16 : 8;
+    while (k < max_k && ((uint32_t) n << (k + 1)) <= sum) {
+        k++;
+    }
+    put_bits(bw, k + 1, 4);
+
+    // An 8-bit error takes up to 24 bits, so two fit between stores
+    uint32_t low = (1u << k) - 1;
+    for (int i = 0; i < n; i++) {
+        uint32_t e = err[i], q = e >> k;
+        if (q < CODEC_ESCAPE) {
+            put_bits(bw, ((1u << q) - 1) | ((e & low) << (q + 1)), q + 1 + k);
+        } else {
+            put_bits(bw, (1u << CODEC_ESCAPE) - 1, CODEC_ESCAPE);
+            put_bits(bw, e, bits);
+        }
+        if (wide || (i & 1)) {
+            store_bits(bw);
+        }
+    }
+    store_bits(bw);
+}
+
+/**
+ * encode_band - code band "band" of "src" into "out"
+ *
+ * @returns the size of the band coded, or 0 if it doesn't come out smaller than it is
+ */
+static SPECIALIZED uint32_t encode_band(const struct codec_layout *lay, const uint8_t *src,
+        int band, uint8_t *out, int wide) {
+    const uint8_t *dx = lay->f->dx;
+    uint32_t dy = lay->f->dy;
+    uint32_t r0 = band * CODEC_BAND_ROWS;
+    uint32_t r1 = (r0 + CODEC_BAND_ROWS < lay->rows) ? r0 + CODEC_BAND_ROWS : lay->rows;
+    const uint8_t *limit = out + (size_t) (r1 - r0) * lay->bpl;
+
+    struct bit_writer bw = { .p = out };
+    uint16_t err[CODEC_BLOCK];
+    for (uint32_t r = r0; r < r1; r++) {
+        const uint8_t *row = src + (size_t) r * lay->bpl;
+        const uint8_t *up = (r >= r0 + dy) ? row - (size_t) dy * lay->bpl : NULL;
+        for (uint32_t i = 0; i < lay->samples; i += CODEC_BLOCK) {
+            int n = (lay->samples - i < CODEC_BLOCK) ? lay->samples - i : CODEC_BLOCK;
+            block_errors(row, up, dx, i, n, err, wide);
+            put_block(&bw, err, n, wide);
+            if (bw.p >= limit) {
+                return 0;
+            }
+        }
+    }
+    flush_bits(&bw);
+    return (bw.p < limit) ? (uint32_t) (bw.p - out) : 0;
+}
+
+struct bit_reader {
+    uint64_t acc;
+    int n;
+    const uint8_t *p;
+    const uint8_t *end;
+    size_t past;                // bytes read past the end, as zeros
+};
+
+/**
+ * refill - have at least 57 bits to read
+ */
+static inline void refill(struct bit_reader *br) {
+    if (br->end - br->p >= 8) {
+        uint64_t le;
+        memcpy(&le, br->p, sizeof(le));
+        br->acc |= le64toh(le) << br->n;
+        br->p += (63 - br->n) >> 3;
+        br->n |= 56;
+        return;
+    }
+
+    while (br->n <= 56) {
+        if (br->p < br->end) {
+            br->acc |= (uint64_t) *br->p++ << br->n;
+        } else {
+            br->past++;
+        }
+        br->n += 8;
+    }
+}
+
+static inline uint32_t get_bits(struct bit_reader *br, int len) {
+    uint32_t v = br->acc & ((1ULL << len) - 1);
+    br->acc >>= len;
+    br->n -= len;
+    return v;
+}
+
+/**
+ * get_block - read "n" folded errors of a block
+ */
+static inline void get_block(struct bit_reader *br, uint16_t *err, int n, int wide) {
+    refill(br);
+    uint32_t head = get_bits(br, 4);
+    if (head == 0) {
+        memset(err, 0, n * sizeof(uint16_t));
+        return;
+    }
+
+    int k = head - 1, bits = wide ? 16 : 8;
+    for (int i = 0; i < n; i++) {
+        if (wide || !(i & 1)) {
+            refill(br);
+        }
+        int q = __builtin_ctzll(~br->acc | (1ULL << CODEC_ESCAPE));
+        if (q < CODEC_ESCAPE) {
+            get_bits(br, q + 1);
+            err[i] = ((uint32_t) q << k) | get_bits(br, k);
+        } else {
+            get_bits(br, CODEC_ESCAPE);
+            err[i] = get_bits(br, bits);
+        }
+    }
+}
+
+/**
+ * decode_band - decode band "band" from the "size" bytes at "in" into "dst"
+ */
+static SPECIALIZED int decode_band(const struct codec_layout *lay, const uint8_t *in, uint32_t size,
+        int band, uint8_t *dst, int wide) {
+    const uint8_t *dx = lay->f->dx;
+    uint32_t dy = lay->f->dy;
+    uint32_t r0 = band * CODEC_BAND_ROWS;
+    uint32_t r1 = (r0 + CODEC_BAND_ROWS < lay->rows) ? r0 + CODEC_BAND_ROWS : lay->rows;
+
+    struct bit_reader br = { .p = in, .end = in + size };
+    uint16_t err[CODEC_BLOCK];
+    for (uint32_t r = r0; r < r1; r++) {
+        uint8_t *row = dst + (size_t) r * lay->bpl;
+        const uint8_t *up = (r >= r0 + dy) ? row - (size_t) dy * lay->bpl : NULL;
+        for (uint32_t i = 0; i < lay->samples; i += CODEC_BLOCK) {
+            int n = (lay->samples - i < CODEC_BLOCK) ? lay->samples - i : CODEC_BLOCK;
+            get_block(&br, err, n, wide);
+            block_samples(row, up, dx, i, n, err, wide);
+        }
+    }
+
+    // Only the padding of the last byte may be taken from past the end
+    uint64_t used = (uint64_t) (br.p - in + br.past) * 8 - br.n;
+    return (used > (uint64_t) size * 8) ? -1 : 0;
+}
+
+/**
+ * code_band - compress band "band" of "src" into its slot in "dst", and note its size
+ */
+static void code_band(const struct compressor *cmp, const uint8_t *src, uint8_t *dst, int band) {
+    const struct codec_layout *lay = &cmp->lay;
+    struct codec_header *hdr = (struct codec_header *) dst;
+    uint8_t *out = dst + header_size(lay->band_count) + (size_t) band * cmp->band_slot;
+
+    uint32_t size = lay->f->wide ? encode_band(lay, src, band, out, 1)
+        : encode_band(lay, src, band, out, 0);
+    if (size == 0) {
+        uint32_t r0 = band * CODEC_BAND_ROWS;
+        uint32_t r1 = (r0 + CODEC_BAND_ROWS < lay->rows) ? r0 + CODEC_BAND_ROWS : lay->rows;
+        size = (r1 - r0) * lay->bpl;
+        memcpy(out, src + (size_t) r0 * lay->bpl, size);
+        size |= CODEC_BAND_RAW;
+    }
+    hdr->sizes[band] = size;
+}
+
+static void compress_job_band(void *arg, int band, int slot) {
+    (void) slot;
+    struct compress_job *job = arg;
+    code_band(job->cmp, job->src, job->dst, band);
+}
+
+/**
+ * compressor_create - a compressor for frames of format "fmt"
+ *
+ * @returns the new compressor, or NULL with errno set (EINVAL if the format can't be
+ *          compressed)
+ */
+struct compressor *compressor_create(const struct v4l2_format *fmt) {
+    struct codec_layout lay;
+    if (-1 == get_layout(fmt, &lay)) {
+        return NULL;
+    }
+
+    struct compressor *cmp = calloc(1, sizeof(struct compressor));
+    if (cmp == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    cmp->lay = lay;
+    cmp->band_slot = band_slot(&lay);
+    return cmp;
+}
+
+/**
+ * compressor_set_pool - compress the bands of frames on the threads of "pool", which has to
+ * outlive the compressor
+ */
+int compressor_set_pool(struct compressor *cmp, struct thread_pool *pool) {
+    cmp->pool = pool;
+    return 0;
+}
+
+/**
+ * compressor_pool - the thread pool the compressor runs on, or NULL
+ */
+struct thread_pool *compressor_pool(const struct compressor *cmp) {
+    return cmp->pool;
+}
+
+
+/**
+ * compress_frame - compress the frame at "src" into "dst", which holds codec_bound()
+ *
+ * @returns the size of the compressed frame
+ */
+uint32_t compress_frame(struct compressor *cmp, const uint8_t *src, uint8_t *dst) {
+    struct compress_job job;
+    compress_frame_start(cmp, &job, src, dst, -1);
+    compress_frame_wait(&job);
+    return compress_frame_finish(&job);
+}
+
+/**
+ * compress_frame_start - start compressing a frame on the compressor's pool, and return
+ *
+ * "job" has to stay around until compress_frame_finish(), "done_fd" is an eventfd to signal
+ * when the bands are done, or -1.  Several frames can be compressed at once.  Without a pool
+ * the frame is compressed right away.
+ */
+void compress_frame_start(struct compressor *cmp, struct compress_job *job, const uint8_t *src,
+        uint8_t *dst, int done_fd) {
+    job->cmp = cmp;
+    job->src = src;
+    job->dst = dst;
+    job->batch = (struct pool_batch) { .fn = compress_job_band, .arg = job,
+        .count = cmp->lay.band_count, .done_fd = done_fd };
+
+    struct codec_header *hdr = (struct codec_header *) dst;
+    hdr->band_count = cmp->lay.band_count;
+    hdr->band_rows = CODEC_BAND_ROWS;
+
+    if (cmp->pool != NULL) {
+        thread_pool_start(cmp->pool, &job->batch);
+        return;
+    }
+
+    for (int i = 0; i < cmp->lay.band_count; i++) {
+        code_band(cmp, src, dst, i);
+    }
+    job->batch.finished = 1;
+    if (done_fd >= 0) {
+        uint64_t one = 1;
+        while (-1 == write(done_fd, &one, sizeof(one)) && errno == EINTR) {
+        }
+    }
+}
+
+/**
+ * compress_frame_done - whether the bands of a started compression are done
+ */
+int compress_frame_done(const struct compress_job *job) {
+    return thread_pool_done(&job->batch);
+}
+
+/**
+ * compress_frame_wait - help compressing until the bands of "job" are done
+ */
+void compress_frame_wait(struct compress_job *job) {
+    if (job->cmp->pool != NULL) {
+        thread_pool_wait(job->cmp->pool, &job->batch);
+    }
+}
+
+/**
+ * compress_frame_finish - move the bands of a done compression together
+ *
+ * @returns the size of the compressed frame
+ */
+uint32_t compress_frame_finish(struct compress_job *job) {
+    const struct compressor *cmp = job->cmp;
+    const struct codec_header *hdr = (const struct codec_header *) job->dst;
+    size_t start = header_size(cmp->lay.band_count), pos = start;
+
+    for (int i = 0; i < cmp->lay.band_count; i++) {
+        size_t size = hdr->sizes[i] & ~CODEC_BAND_RAW;
+        size_t at = start + (size_t) i * cmp->band_slot;
+        if (at != pos) {
+            memmove(job->dst + pos, job->dst + at, size);
+        }
+        pos += size;
+    }
+    return pos;
+}
+
+void compressor_free(struct compressor *cmp) {
+    free(cmp);
+}
+
+/**
+ * decode_job - a frame being decompressed, a band per item
+ */
+struct decode_job {
+    struct codec_layout lay;
+    const uint8_t *src;
+    const uint64_t *offsets;    // of every band, and the end of the last one
+    uint8_t *dst;
+    int error;
+};
+
+static void decode_job_band(void *arg, int band, int slot) {
+    (void) slot;
+    struct decode_job *job = arg;
+    const struct codec_layout *lay = &job->lay;
+    const struct codec_header *hdr = (const struct codec_header *) job->src;
+    const uint8_t *in = job->src + job->offsets[band];
+    uint32_t size = job->offsets[band + 1] - job->offsets[band];
+
+    int r;
+    if (hdr->sizes[band] & CODEC_BAND_RAW) {
+        uint32_t r0 = band * CODEC_BAND_ROWS;
+        uint32_t r1 = (r0 + CODEC_BAND_ROWS < lay->rows) ? r0 + CODEC_BAND_ROWS : lay->rows;
+        r = (size == (r1 - r0) * lay->bpl) ? 0 : -1;
+        if (r == 0) {
+            memcpy(job->dst + (size_t) r0 * lay->bpl, in, size);
+        }
+    } else {
+        r = lay->f->wide ? decode_band(lay, in, size, band, job->dst, 1)
+            : decode_band(lay, in, size, band, job->dst, 0);
+    }
+    if (r == -1) {
+        __atomic_store_n(&job->error, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * decompress_frame - decompress the "size" bytes at "src" into a frame of format "fmt" at "dst",
+ * on the threads of "pool" if not NULL
+ *
+ * @returns 0 on success, -1 with errno set on failure (EPROTO if "src" isn't a frame compressed
+ *          in that format)
+ */
+int decompress_frame(const struct v4l2_format *fmt, const uint8_t *src, uint32_t size,
+        uint8_t *dst, struct thread_pool *pool) {
+    struct decode_job job = { .src = src, .dst = dst };
+    if (-1 == get_layout(fmt, &job.lay)) {
+        return -1;
+    }
+
+    const struct codec_header *hdr = (const struct codec_header *) src;
+    int band_count = job.lay.band_count;
+    if (size < header_size(band_count) || hdr->band_count != (uint32_t) band_count
+            || hdr->band_rows != CODEC_BAND_ROWS) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    uint64_t *offsets = malloc((band_count + 1) * sizeof(uint64_t));
+    if (offsets == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    offsets[0] = header_size(band_count);
+    for (int i = 0; i < band_count; i++) {
+        offsets[i + 1] = offsets[i] + (hdr->sizes[i] & ~CODEC_BAND_RAW);
+    }
+
+    int ret = 0;
+    if (offsets[band_count] > size) {
+        errno = EPROTO;
+        ret = -1;
+    } else {
+        job.offsets = offsets;
+        if (pool != NULL) {
+            thread_pool_run(pool, band_count, decode_job_band, &job);
+        } else {
+            for (int i = 0; i < band_count; i++) {
+                decode_job_band(&job, i, 0);
+            }
+        }
+        if (job.error) {
+            errno = EPROTO;
+            ret = -1;
+        }
+    }
+
+    free(offsets);
+    return ret;
+}
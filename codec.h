@@ -0,0 +1,64 @@
+#ifndef __CODEC_H_
+#define __CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#include "thread_pool.h"
+
+/*
+ * Lossless frame codec, for raw frames written with camcap --compress.
+ *
+ * Every sample is predicted from its neighbours of the same colour (the median edge detector
+ * of LOCO-I: left, above and above left), and the prediction errors are Rice coded in blocks of
+ * CODEC_BLOCK, each block with the parameter that suits it.  The frame is cut into bands of
+ * CODEC_BAND_ROWS rows which are coded on their own, so bands can be compressed and
+ * decompressed on the threads of a pool, and a band that doesn't get any smaller is stored
+ * as it is.
+ *
+ * A compressed frame is a codec_header, the size of every band, and the bands back to back.
+ * Frames are compressed whole, padding included, so they come back byte for byte.
+ */
+
+#define CODEC_NONE 0                // frames as they came
+#define CODEC_MED_RICE 1
+
+#define CODEC_BAND_ROWS 16
+#define CODEC_BLOCK 32
+#define CODEC_BAND_RAW 0x80000000   // band size flag: the band is stored as it is
+
+struct codec_header {
+    uint32_t band_count;
+    uint32_t band_rows;
+    uint32_t sizes[];           // of every band, with CODEC_BAND_RAW if stored as it is
+};
+
+struct compressor;
+
+/**
+ * compress_job - a frame being compressed on a thread pool
+ */
+struct compress_job {
+    struct pool_batch batch;
+    struct compressor *cmp;
+    const uint8_t *src;
+    uint8_t *dst;
+};
+
+int codec_supported(uint32_t fourcc);
+const char *codec_name(uint32_t codec);
+size_t codec_bound(const struct v4l2_format *fmt);
+struct compressor *compressor_create(const struct v4l2_format *fmt);
+int compressor_set_pool(struct compressor *cmp, struct thread_pool *pool);
+struct thread_pool *compressor_pool(const struct compressor *cmp);
+uint32_t compress_frame(struct compressor *cmp, const uint8_t *src, uint8_t *dst);
+void compress_frame_start(struct compressor *cmp, struct compress_job *job, const uint8_t *src,
+        uint8_t *dst, int done_fd);
+int compress_frame_done(const struct compress_job *job);
+void compress_frame_wait(struct compress_job *job);
+uint32_t compress_frame_finish(struct compress_job *job);
+void compressor_free(struct compressor *cmp);
+int decompress_frame(const struct v4l2_format *fmt, const uint8_t *src, uint32_t size,
+        uint8_t *dst, struct thread_pool *pool);
+#endif
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "container.h"
+
+/*
+ * Frame container reader library - see container.h for the layout.
+ *
+ * The whole file is mapped.  A closed file is looked up through its directory and index chunks
+ * in place; the index of a file that was never closed is rebuilt into one offset per frame.
+ */
+
+struct container_reader {
+    const uint8_t *base;
+    size_t size;
+    const struct container_header *hdr;
+    uint64_t frame_count;
+
+    // A closed file's directory of index chunks, in the mapping
+    const uint64_t *directory;
+    uint64_t chunk_count;
+
+    // Or the offset of every frame, rebuilt
+    uint64_t *offsets;
+    uint64_t offsets_len;
+};
+
+static uint64_t padded(uint64_t size) {
+    return (size + 7) & ~(uint64_t) 7;
+}
+
+/**
+ * index_at - the index chunk at "offset", if that is where a whole one lies
+ */
+static const struct container_index *index_at(const struct container_reader *rd,
+        uint64_t offset) {
+    if (offset < rd->hdr->header_size || (offset & 7) != 0
+            || offset > rd->size - sizeof(struct container_index)) {
+        return NULL;
+    }
+
+    const struct container_index *ix = (const struct container_index *) (rd->base + offset);
+    if (ix->magic != CONTAINER_INDEX_MAGIC || ix->count > rd->hdr->chunk_frames
+            || (uint64_t) ix->count * sizeof(uint64_t)
+                > rd->size - offset - sizeof(struct container_index)) {
+        return NULL;
+    }
+    return ix;
+}
+
+/**
+ * frame_at - the frame at "offset", if that is where a whole one lies
+ */
+static const struct container_frame *frame_at(const struct container_reader *rd,
+        uint64_t offset) {
+    if (offset < rd->hdr->header_size || (offset & 7) != 0
+            || offset > rd->size - sizeof(struct container_frame)) {
+        return NULL;
+    }
+
+    const struct container_frame *frame = (const struct container_frame *) (rd->base + offset);
+    if (frame->magic != CONTAINER_FRAME_MAGIC
+            || frame->size > rd->size - offset - sizeof(struct container_frame)) {
+        return NULL;
+    }
+    return frame;
+}
+
+/**
+ * read_trailer - use the directory of a closed file
+ *
+ * @returns 0 if the file has a valid trailer, -1 if it has to be recovered
+ */
+static int read_trailer(struct container_reader *rd) {
+    if (rd->size < rd->hdr->header_size + sizeof(struct container_trailer)) {
+        return -1;
+    }
+
+    uint64_t at = rd->size - sizeof(struct container_trailer);
+    const struct container_trailer *tr = (const struct container_trailer *) (rd->base + at);
+    uint64_t chunk_frames = rd->hdr->chunk_frames;
+    if ((at & 7) != 0 || tr->magic != CONTAINER_TRAILER_MAGIC
+            || tr->chunk_frames != chunk_frames
+            || tr->chunk_count != (tr->frame_count + chunk_frames - 1) / chunk_frames
+            || tr->chunk_count > at / sizeof(uint64_t)
+            || tr->directory != at - tr->chunk_count * sizeof(uint64_t)
+            || tr->directory < rd->hdr->header_size) {
+        return -1;
+    }
+
+    rd->directory = (const uint64_t *) (rd->base + tr->directory);
+    rd->chunk_count = tr->chunk_count;
+    rd->frame_count = tr->frame_count;
+    return 0;
+}
+
+static int add_offset(struct container_reader *rd, uint64_t offset) {
+    if (rd->frame_count == rd->offsets_len) {
+        uint64_t len = (rd->offsets_len > 0) ? rd->offsets_len * 2 : rd->hdr->chunk_frames;
+        uint64_t *offsets = realloc(rd->offsets, len * sizeof(uint64_t));
+        if (offsets == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        rd->offsets = offsets;
+        rd->offsets_len = len;
+    }
+
+    rd->offsets[rd->frame_count++] = offset;
+    return 0;
+}
+
+/**
+ * recover - rebuild the index of a file that was never closed
+ *
+ * The chunks are found through the header, newest first, and taken oldest first.  After the
+ * last of them, the frames are followed one by one, to the first that wasn't written in full.
+ */
+static int recover(struct container_reader *rd) {
+    uint64_t *chain = NULL;
+    uint64_t chain_len = 0, chain_cnt = 0;
+    uint64_t pos = rd->hdr->header_size;
+
+    for (uint64_t at = rd->hdr->last_chunk; at != 0; ) {
+        const struct container_index *ix = index_at(rd, at);
+        if (ix == NULL || (ix->prev != 0 && ix->prev >= at)) {
+            break;
+        }
+        if (chain_cnt == chain_len) {
+            chain_len = (chain_len > 0) ? chain_len * 2 : 64;
+            uint64_t *grown = realloc(chain, chain_len * sizeof(uint64_t));
+            if (grown == NULL) {
+                free(chain);
+                errno = ENOMEM;
+                return -1;
+            }
+            chain = grown;
+        }
+        chain[chain_cnt++] = at;
+        at = ix->prev;
+    }
+
+    // Chunks that don't pick up where the ones before left off aren't trusted
+    while (chain_cnt > 0) {
+        uint64_t at = chain[--chain_cnt];
+        const struct container_index *ix = index_at(rd, at);
+        if (ix->first_frame != rd->frame_count) {
+            break;
+        }
+        for (uint32_t i = 0; i < ix->count; i++) {
+            if (-1 == add_offset(rd, ix->offsets[i])) {
+                free(chain);
+                return -1;
+            }
+        }
+        pos = at + sizeof(struct container_index) + (uint64_t) ix->count * sizeof(uint64_t);
+    }
+    free(chain);
+
+    // Chunks among the rest list frames found on the way anyway
+    while (pos < rd->size) {
+        const struct container_frame *frame = frame_at(rd, pos);
+        if (frame != NULL) {
+            if (-1 == add_offset(rd, pos)) {
+                return -1;
+            }
+            pos += sizeof(struct container_frame) + padded(frame->size);
+            continue;
+        }
+
+        const struct container_index *ix = index_at(rd, pos);
+        if (ix == NULL) {
+            break;
+        }
+        pos += sizeof(struct container_index) + (uint64_t) ix->count * sizeof(uint64_t);
+    }
+
+    return 0;
+}
+
+/**
+ * container_open - map the container "name" and find its frames
+ *
+ * @returns the new reader, or NULL with errno set (EPROTO if it isn't a container)
+ */
+struct container_reader *container_open(const char *name) {
+    struct container_reader *rd = calloc(1, sizeof(struct container_reader));
+    if (rd == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    int fd = open(name, (O_RDONLY | O_CLOEXEC));
+    if (fd == -1) {
+        goto fail;
+    }
+
+    struct stat st;
+    if (-1 == fstat(fd, &st)) {
+        close(fd);
+        goto fail;
+    }
+
+    if ((size_t) st.st_size < sizeof(struct container_header)) {
+        close(fd);
+        errno = EPROTO;
+        goto fail;
+    }
+
+    rd->size = st.st_size;
+    void *map = mmap(NULL, rd->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        goto fail;
+    }
+    rd->base = map;
+    rd->hdr = map;
+
+    const struct container_header *hdr = rd->hdr;
+    if (hdr->magic != CONTAINER_MAGIC || hdr->version != CONTAINER_VERSION
+            || hdr->header_size < sizeof(struct container_header) || (hdr->header_size & 7) != 0
+            || hdr->header_size > rd->size || hdr->chunk_frames == 0) {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    if (-1 == read_trailer(rd) && -1 == recover(rd)) {
+        goto fail;
+    }
+
+    return rd;
+
+fail:
+    {
+        int err = errno;
+        container_close(rd);
+        errno = err;
+    }
+    return NULL;
+}
+
+const struct container_header *container_header(const struct container_reader *rd) {
+    return rd->hdr;
+}
+
+uint64_t container_frame_count(const struct container_reader *rd) {
+    return rd->frame_count;
+}
+
+/**
+ * container_recovered - whether the file was never closed, and its index had to be rebuilt
+ */
+int container_recovered(const struct container_reader *rd) {
+    return rd->directory == NULL;
+}
+
+/**
+ * container_frame - find frame "n", counting from 0
+ *
+ * The frame's data follows it, see container_frame_data().  Both stay valid until the reader
+ * is closed.
+ * @returns the frame, or NULL with errno set (ERANGE past the last frame, EPROTO if the index
+ *          doesn't lead to a frame)
+ */
+const struct container_frame *container_frame(const struct container_reader *rd, uint64_t n) {
+    if (n >= rd->frame_count) {
+        errno = ERANGE;
+        return NULL;
+    }
+
+    uint64_t offset;
+    if (rd->directory != NULL) {
+        uint32_t chunk_frames = rd->hdr->chunk_frames;
+        const struct container_index *ix = index_at(rd, rd->directory[n / chunk_frames]);
+        if (ix == NULL || ix->first_frame != n - (n % chunk_frames)
+                || n % chunk_frames >= ix->count) {
+            errno = EPROTO;
+            return NULL;
+        }
+        offset = ix->offsets[n % chunk_frames];
+    } else {
+        offset = rd->offsets[n];
+    }
+
+    const struct container_frame *frame = frame_at(rd, offset);
+    if (frame == NULL) {
+        errno = EPROTO;
+    }
+    return frame;
+}
+
+void container_close(struct container_reader *rd) {
+    if (rd->base != NULL) {
+        munmap((void *) rd->base, rd->size);
+    }
+    free(rd->offsets);
+    free(rd);
+}
@@ -0,0 +1,95 @@
+#ifndef __CONTAINER_H_
+#define __CONTAINER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+/*
+ * Frame container, written by camcap --container, which keeps the boundaries and metadata of
+ * every frame so frames of any size (MJPEG) can be read back, and any frame found without
+ * reading the ones before it.
+ *
+ * The file starts with a container_header.  Every frame follows as a container_frame and its
+ * data, padded to a multiple of 8 bytes.  After every "chunk_frames" frames an index chunk
+ * lists where each of them starts, and the header's "last_chunk" is updated to point at it
+ * (when the output can be seeked), each chunk pointing at the one before.  Closing the file
+ * writes the chunk for the frames left, then a directory with the offset of every chunk, and a
+ * container_trailer at the very end.  Frame n is listed in chunk n / chunk_frames, so finding
+ * it takes two lookups.
+ *
+ * Frames written with --compress hold their data compressed (see codec.h), the header's
+ * "sizeimage" is then what they decompress to.
+ *
+ * A file that was never closed has no trailer; its index is rebuilt from the chain of chunks,
+ * and the frames after the last chunk are found by following their headers.
+ *
+ * All offsets are from the start of the file, and everything is in host byte order.
+ */
+
+#define CONTAINER_MAGIC 0x46434343          // "CCCF"
+#define CONTAINER_FRAME_MAGIC 0x52464343    // "CCFR"
+#define CONTAINER_INDEX_MAGIC 0x58494343    // "CCIX"
+#define CONTAINER_TRAILER_MAGIC 0x45464343  // "CCFE"
+#define CONTAINER_VERSION 1
+#define CONTAINER_CHUNK_FRAMES 1024
+
+struct container_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t chunk_frames;      // frames listed in every index chunk but the last
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;
+    uint32_t bytesperline;
+    uint32_t sizeimage;
+    uint32_t field;
+
+    uint64_t last_chunk;        // offset of the newest index chunk, 0 before the first one
+    uint64_t reserved;
+};
+
+struct container_frame {
+    uint32_t magic;
+    uint32_t size;              // bytes of frame data following this header
+    uint32_t sequence;
+    uint32_t flags;             // v4l2_buffer flags
+    uint32_t pixelformat;
+    uint32_t codec;             // CODEC_NONE, or the codec the data is compressed with
+    uint64_t timestamp_ns;      // driver timestamp
+};
+
+struct container_index {
+    uint32_t magic;
+    uint32_t count;             // frames listed
+    uint64_t first_frame;       // number of the first frame listed
+    uint64_t prev;              // offset of the chunk before, 0 for the first one
+    uint64_t offsets[];         // of the container_frame of each frame
+};
+
+struct container_trailer {
+    uint32_t magic;
+    uint32_t chunk_frames;
+    uint64_t frame_count;
+    uint64_t chunk_count;
+    uint64_t directory;         // offset of the chunk_count chunk offsets
+};
+
+/**
+ * container_frame_data - the data of a frame, right after its header
+ */
+static inline const uint8_t *container_frame_data(const struct container_frame *frame) {
+    return (const uint8_t *) (frame + 1);
+}
+
+struct container_reader;
+
+struct container_reader *container_open(const char *name);
+const struct container_header *container_header(const struct container_reader *rd);
+uint64_t container_frame_count(const struct container_reader *rd);
+int container_recovered(const struct container_reader *rd);
+const struct container_frame *container_frame(const struct container_reader *rd, uint64_t n);
+void container_close(struct container_reader *rd);
+#endif
@@ -0,0 +1,853 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "convert.h"
+#include "v4l2_helper.h"
+#include "thread_pool.h"
+
+/*
+ * Scalar reference kernels - the SIMD kernels have to match these byte for byte.
+ */
+
+static inline uint8_t clamp_u8(int v) {
+    return (v < 0) ? 0 : (v > 255) ? 255 : v;
+}
+
+static void packed_y_scalar(const uint8_t *src, uint8_t *y, int width, int y_offset) {
+    for (int x = 0; x < width; x++) {
+        y[x] = src[(2 * x) + y_offset];
+    }
+}
+
+static void packed_uv_scalar(const uint8_t *row0, const uint8_t *row1, uint8_t *u, uint8_t *v,
+        int width, int uv_offset) {
+    for (int x = 0; x < width / 2; x++) {
+        int i = (4 * x) + uv_offset;
+        u[x] = (row0[i] + row1[i] + 1) >> 1;
+        v[x] = (row0[i + 2] + row1[i + 2] + 1) >> 1;
+    }
+}
+
+static void split_uv_scalar(const uint8_t *uv, uint8_t *u, uint8_t *v, int pairs) {
+    for (int x = 0; x < pairs; x++) {
+        u[x] = uv[2 * x];
+        v[x] = uv[(2 * x) + 1];
+    }
+}
+
+static void yuv_to_rgb_scalar(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+        uint8_t *rgb, int width) {
+    for (int x = 0; x < width; x++) {
+        int c = (y[x] - 16) * 75;
+        int d = u[x / 2] - 128;
+        int e = v[x / 2] - 128;
+        rgb[(3 * x) + 0] = clamp_u8((c + (102 * e) + 32) >> 6);
+        rgb[(3 * x) + 1] = clamp_u8((c - (25 * d) - (52 * e) + 32) >> 6);
+        rgb[(3 * x) + 2] = clamp_u8((c + (129 * d) + 32) >> 6);
+    }
+}
+
+static inline int avg2(int a, int b) {
+    return (a + b + 1) >> 1;
+}
+
+static void bayer_row_scalar(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out, int width, int g_first, int red_row, int edge_aware, int grey) {
+    for (int x = 0; x < width; x++) {
+        int h = avg2(mid[x - 1], mid[x + 1]);
+        int v = avg2(up[x], down[x]);
+
+        // The color this row has besides green, green, and the color of the rows around it
+        int own, g, other;
+        if (((x & 1) == 0) == (g_first != 0)) {
+            own = h;
+            g = mid[x];
+            other = v;
+        } else {
+            own = mid[x];
+            g = avg2(h, v);
+            if (edge_aware) {
+                int gh = abs(mid[x - 1] - mid[x + 1]);
+                int gv = abs(up[x] - down[x]);
+                g = (gh < gv) ? h : (gh > gv) ? v : g;
+            }
+            other = avg2(avg2(up[x - 1], up[x + 1]), avg2(down[x - 1], down[x + 1]));
+        }
+
+        int r = red_row ? own : other;
+        int b = red_row ? other : own;
+        if (grey) {
+            out[x] = ((77 * r) + (150 * g) + (29 * b) + 128) >> 8;
+        } else {
+            out[(3 * x) + 0] = r;
+            out[(3 * x) + 1] = g;
+            out[(3 * x) + 2] = b;
+        }
+    }
+}
+
+static void unpack16_scalar(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    for (int x = 0; x < width; x++) {
+        dst[x] = clamp_u8((src[2 * x] | (src[(2 * x) + 1] << 8)) >> shift);
+    }
+}
+
+static inline void store_le16(uint8_t *dst, int v) {
+    dst[0] = v;
+    dst[1] = v >> 8;
+}
+
+static void unpack_y10b_scalar(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    for (int x = 0; x < width; x++) {
+        int bit = 10 * x;
+        int word = (src[bit / 8] << 8) | src[(bit / 8) + 1];
+        store_le16(dst + 2 * x, ((word >> (6 - (bit % 8))) & 0x3ff) << shift);
+    }
+}
+
+static void unpack_y10p_scalar(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    for (int x = 0; x < width; x++) {
+        const uint8_t *group = src + 5 * (x / 4);
+        int i = x % 4;
+        store_le16(dst + 2 * x, ((group[i] << 2) | ((group[4] >> (2 * i)) & 3)) << shift);
+    }
+}
+
+static void shift16_scalar(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    for (int x = 0; x < width; x++) {
+        store_le16(dst + 2 * x, (src[2 * x] | (src[(2 * x) + 1] << 8)) << shift);
+    }
+}
+
+static void lerp_row_scalar(const uint8_t *row0, const uint8_t *row1, uint8_t *out, int n,
+        int frac) {
+    for (int x = 0; x < n; x++) {
+        out[x] = ((row0[x] * (256 - frac)) + (row1[x] * frac) + 128) >> 8;
+    }
+}
+
+static void sum_row_scalar(const uint8_t *row, uint16_t *acc, int n, int first) {
+    for (int x = 0; x < n; x++) {
+        acc[x] = (first ? 0 : acc[x]) + row[x];
+    }
+}
+
+static uint32_t sad_row_scalar(const uint8_t *row0, const uint8_t *row1, int n) {
+    uint32_t sad = 0;
+    for (int x = 0; x < n; x++) {
+        sad += (row0[x] > row1[x]) ? row0[x] - row1[x] : row1[x] - row0[x];
+    }
+    return sad;
+}
+
+const struct convert_kernels convert_kernels_scalar = {
+    .name = "scalar",
+    .packed_y = packed_y_scalar,
+    .packed_uv = packed_uv_scalar,
+    .split_uv = split_uv_scalar,
+    .yuv_to_rgb = yuv_to_rgb_scalar,
+    .bayer_row = bayer_row_scalar,
+    .unpack16 = unpack16_scalar,
+    .unpack_y10b = unpack_y10b_scalar,
+    .unpack_y10p = unpack_y10p_scalar,
+    .shift16 = shift16_scalar,
+    .lerp_row = lerp_row_scalar,
+    .sum_row = sum_row_scalar,
+    .sad_row = sad_row_scalar,
+};
+
+/**
+ * convert_kernels_available - list the kernels this CPU can run, fastest last
+ *
+ * "list" needs room for CONVERT_MAX_KERNELS entries.
+ * @returns the number of kernels listed
+ */
+int convert_kernels_available(const struct convert_kernels **list) {
+    int n = 0;
+    list[n++] = &convert_kernels_scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        list[n++] = &convert_kernels_sse2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        list[n++] = &convert_kernels_avx2;
+    }
+#endif
+#if defined(__ARM_NEON)
+    list[n++] = &convert_kernels_neon;
+#endif
+
+    return n;
+}
+
+/**
+ * convert_kernels_best - the fastest kernels this CPU can run
+ */
+const struct convert_kernels *convert_kernels_best(void) {
+    const struct convert_kernels *list[CONVERT_MAX_KERNELS];
+    return list[convert_kernels_available(list) - 1];
+}
+
+/*
+ * Bayer input
+ */
+
+enum bayer_packing {
+    BAYER_NONE,         // not a Bayer format
+    BAYER_8,
+    BAYER_16,           // 10, 12 or 16 bits in 16-bit little-endian words
+    BAYER_ALAW8,        // 10 bits A-law compressed to 8
+    BAYER_DPCM8,        // 10 bits DPCM compressed to 8
+};
+
+/*
+ * The first row of every CFA order, as "g_first" and "red_row"; the second row has both the
+ * other way around
+ */
+#define BGGR 0, 0
+#define GBRG 1, 0
+#define GRBG 1, 1
+#define RGGB 0, 1
+
+static const struct bayer_format {
+    uint32_t fourcc;
+    uint8_t g_first;
+    uint8_t red_row;
+    uint8_t packing;
+    uint8_t shift;
+} bayer_formats[] = {
+    { V4L2_PIX_FMT_SBGGR8, BGGR, BAYER_8, 0 },
+    { V4L2_PIX_FMT_SGBRG8, GBRG, BAYER_8, 0 },
+    { V4L2_PIX_FMT_SGRBG8, GRBG, BAYER_8, 0 },
+    { V4L2_PIX_FMT_SRGGB8, RGGB, BAYER_8, 0 },
+    { V4L2_PIX_FMT_SBGGR10, BGGR, BAYER_16, 2 },
+    { V4L2_PIX_FMT_SGBRG10, GBRG, BAYER_16, 2 },
+    { V4L2_PIX_FMT_SGRBG10, GRBG, BAYER_16, 2 },
+    { V4L2_PIX_FMT_SRGGB10, RGGB, BAYER_16, 2 },
+    { V4L2_PIX_FMT_SBGGR12, BGGR, BAYER_16, 4 },
+    { V4L2_PIX_FMT_SGBRG12, GBRG, BAYER_16, 4 },
+    { V4L2_PIX_FMT_SGRBG12, GRBG, BAYER_16, 4 },
+    { V4L2_PIX_FMT_SRGGB12, RGGB, BAYER_16, 4 },
+    { V4L2_PIX_FMT_SBGGR16, BGGR, BAYER_16, 8 },
+    { V4L2_PIX_FMT_SBGGR10ALAW8, BGGR, BAYER_ALAW8, 0 },
+    { V4L2_PIX_FMT_SGBRG10ALAW8, GBRG, BAYER_ALAW8, 0 },
+    { V4L2_PIX_FMT_SGRBG10ALAW8, GRBG, BAYER_ALAW8, 0 },
+    { V4L2_PIX_FMT_SRGGB10ALAW8, RGGB, BAYER_ALAW8, 0 },
+    { V4L2_PIX_FMT_SBGGR10DPCM8, BGGR, BAYER_DPCM8, 0 },
+    { V4L2_PIX_FMT_SGBRG10DPCM8, GBRG, BAYER_DPCM8, 0 },
+    { V4L2_PIX_FMT_SGRBG10DPCM8, GRBG, BAYER_DPCM8, 0 },
+    { V4L2_PIX_FMT_SRGGB10DPCM8, RGGB, BAYER_DPCM8, 0 },
+};
+
+#undef BGGR
+#undef GBRG
+#undef GRBG
+#undef RGGB
+
+static const struct bayer_format *find_bayer(uint32_t fourcc) {
+    for (size_t i = 0; i < sizeof(bayer_formats) / sizeof(bayer_formats[0]); i++) {
+        if (bayer_formats[i].fourcc == fourcc) {
+            return &bayer_formats[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * 10-bit values of the 8-bit A-law codes, the inverse of the A-law curve (A = 87.6) over the
+ * 10-bit range
+ */
+static const uint16_t alaw_decode[256] = {
+    0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4,
+    4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 8, 8,
+    8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11, 12, 12,
+    12, 12, 13, 13, 13, 13, 14, 14, 14, 15, 15, 15, 16, 16, 16, 17,
+    17, 17, 18, 18, 18, 19, 19, 20, 20, 21, 21, 21, 22, 22, 23, 23,
+    24, 24, 25, 26, 26, 27, 27, 28, 28, 29, 30, 30, 31, 32, 32, 33,
+    34, 34, 35, 36, 37, 38, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+    48, 49, 50, 51, 52, 53, 54, 55, 56, 58, 59, 60, 61, 63, 64, 66,
+    67, 68, 70, 71, 73, 75, 76, 78, 80, 81, 83, 85, 87, 89, 90, 92,
+    94, 97, 99, 101, 103, 105, 107, 110, 112, 115, 117, 120, 122, 125, 128, 130,
+    133, 136, 139, 142, 145, 148, 151, 155, 158, 162, 165, 169, 172, 176, 180, 184,
+    188, 192, 196, 200, 205, 209, 214, 218, 223, 228, 233, 238, 243, 248, 254, 259,
+    265, 270, 276, 282, 288, 295, 301, 308, 314, 321, 328, 335, 342, 350, 357, 365,
+    373, 381, 389, 398, 407, 415, 424, 434, 443, 453, 462, 472, 483, 493, 504, 515,
+    526, 537, 549, 561, 573, 586, 598, 611, 624, 638, 652, 666, 680, 695, 710, 726,
+    741, 758, 774, 791, 808, 825, 843, 862, 880, 899, 919, 939, 959, 980, 1001, 1023,
+};
+
+/**
+ * dpcm8_decode - decode a row of 10-8-10 DPCM (MIPI CSI-2 predictor 1) to 8 bits
+ *
+ * Every pixel is predicted from the last one of the same color, so a row has to be decoded
+ * from left to right; the first two pixels are plain 8-bit PCM.
+ */
+static void dpcm8_decode(const uint8_t *src, uint8_t *dst, int width) {
+    int pred[2] = { 0, 0 };
+    for (int x = 0; x < width; x++) {
+        int code = src[x];
+        int p = pred[x & 1];
+        int val;
+        if (x < 2) {
+            val = (code << 2) | 2;
+        } else if ((code & 0xc0) == 0x00) {
+            val = (code & 0x20) ? p - (code & 0x1f) : p + (code & 0x1f);
+        } else if ((code & 0xe0) == 0x40) {
+            int diff = ((code & 0x0f) << 1) + 32;
+            val = (code & 0x10) ? p - diff : p + diff;
+        } else if ((code & 0xe0) == 0x60) {
+            int diff = ((code & 0x0f) << 2) + 64 + 1;
+            val = (code & 0x10) ? p - diff : p + diff;
+        } else {
+            val = (code & 0x7f) << 3;
+            val += (val > p) ? 3 : 4;
+        }
+        val = (val < 0) ? 0 : (val > 1023) ? 1023 : val;
+        pred[x & 1] = val;
+        dst[x] = val >> 2;
+    }
+}
+
+/**
+ * mirror - the pixel index "i" ends up at when reflecting at the first and last of "n" pixels
+ *
+ * Reflecting keeps the CFA color of every pixel, as long as there are enough of them.
+ */
+static inline int mirror(int i, int n) {
+    i = (i < 0) ? -i : (i >= n) ? (2 * n) - 2 - i : i;
+    return (i < 0) ? 0 : (i >= n) ? n - 1 : i;
+}
+
+/*
+ * Greyscale input
+ */
+
+enum grey_packing {
+    GREY_Y10BPACK,
+    GREY_Y10P,
+    GREY_16,            // in 16-bit little-endian words
+};
+
+static const struct grey_format {
+    uint32_t fourcc;
+    uint8_t packing;
+    uint8_t bits;
+} grey_formats[] = {
+    { V4L2_PIX_FMT_Y10BPACK, GREY_Y10BPACK, 10 },
+    { V4L2_PIX_FMT_Y10P, GREY_Y10P, 10 },
+    { V4L2_PIX_FMT_Y10, GREY_16, 10 },
+    { V4L2_PIX_FMT_Y12, GREY_16, 12 },
+};
+
+static const struct grey_format *find_grey(uint32_t fourcc) {
+    for (size_t i = 0; i < sizeof(grey_formats) / sizeof(grey_formats[0]); i++) {
+        if (grey_formats[i].fourcc == fourcc) {
+            return &grey_formats[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Frame conversion
+ *
+ * A frame is converted in bands of whole row pairs.  With a thread pool, the bands are spread
+ * over its threads, which each have scratch rows of their own.
+ */
+
+struct convert_scratch {
+    // One row of scratch Y, U and V for conversions that don't go straight to the output; for
+    // greyscale "tmp_y" holds a row of 16-bit samples
+    uint8_t *tmp_y;
+    uint8_t *tmp_u;
+    uint8_t *tmp_v;
+    // Three 8-bit Bayer rows, with 2 pixels of room at either end
+    uint8_t *bayer[3];
+};
+
+struct converter {
+    const struct convert_kernels *k;
+    uint32_t in_fourcc;
+    uint32_t out_fourcc;
+    uint32_t width;
+    uint32_t height;
+    uint32_t in_bpl;
+    const struct bayer_format *bayer;
+    enum demosaic_method demosaic;
+    const struct grey_format *grey;
+
+    struct pool_bands bands;    // scratch is a convert_scratch per slot
+};
+
+/**
+ * convert_supported - whether frames in "in_fourcc" can be converted to "out_fourcc"
+ */
+int convert_supported(uint32_t in_fourcc, uint32_t out_fourcc) {
+    if (find_bayer(in_fourcc) != NULL) {
+        return out_fourcc == V4L2_PIX_FMT_RGB24 || out_fourcc == V4L2_PIX_FMT_GREY;
+    }
+
+    const struct grey_format *grey = find_grey(in_fourcc);
+    if (grey != NULL) {
+        // Y10 only as the unpacked version of a packed format
+        return out_fourcc == V4L2_PIX_FMT_Y16 || out_fourcc == V4L2_PIX_FMT_GREY
+            || (out_fourcc == V4L2_PIX_FMT_Y10 && grey->bits == 10 && grey->packing != GREY_16);
+    }
+
+    int in_ok = (in_fourcc == V4L2_PIX_FMT_YUYV || in_fourcc == V4L2_PIX_FMT_UYVY
+            || in_fourcc == V4L2_PIX_FMT_NV12);
+    int out_ok = (out_fourcc == V4L2_PIX_FMT_YUV420 || out_fourcc == V4L2_PIX_FMT_RGB24
+            || out_fourcc == V4L2_PIX_FMT_GREY);
+    return in_ok && out_ok;
+}
+
+static void free_scratch(void *scratch) {
+    struct convert_scratch *s = scratch;
+    free(s->tmp_y);
+    free(s->tmp_u);
+    free(s->tmp_v);
+    for (int r = 0; r < 3; r++) {
+        free(s->bayer[r]);
+    }
+}
+
+/**
+ * init_scratch - scratch rows for one thread
+ */
+static int init_scratch(void *owner, void *scratch) {
+    const struct converter *cv = owner;
+    struct convert_scratch *s = scratch;
+    if (cv->bayer != NULL) {
+        for (int r = 0; r < 3; r++) {
+            if (NULL == (s->bayer[r] = malloc(cv->width + 4))) {
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+    } else if (cv->grey != NULL) {
+        if (NULL == (s->tmp_y = malloc((size_t) cv->width * 2))) {
+            errno = ENOMEM;
+            return -1;
+        }
+    } else {
+        s->tmp_y = malloc(cv->width);
+        s->tmp_u = malloc(cv->width / 2);
+        s->tmp_v = malloc(cv->width / 2);
+        if (s->tmp_y == NULL || s->tmp_u == NULL || s->tmp_v == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * converter_create - set up converting frames of format "in" to "out_fourcc"
+ *
+ * "kernels" can be NULL for the fastest ones the CPU supports.  The format of the converted
+ * frames is filled in to "out".  Frames are converted on the calling thread, and Bayer
+ * frames demosaiced bilinearly, until converter_set_pool() or converter_set_demosaic() say
+ * otherwise.
+ * @returns the new converter, or NULL with errno set (EINVAL for conversions we can't do)
+ */
+struct converter *converter_create(const struct v4l2_format *in, uint32_t out_fourcc,
+        const struct convert_kernels *kernels, struct v4l2_format *out) {
+    const struct v4l2_pix_format *pix = &in->fmt.pix;
+    if (!convert_supported(pix->pixelformat, out_fourcc) || pix->width == 0 || pix->height == 0
+            || (pix->width % 2) != 0
+            || (pix->pixelformat == V4L2_PIX_FMT_Y10P && (pix->width % 4) != 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct converter *cv = calloc(1, sizeof(struct converter));
+    if (cv == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    cv->k = (kernels != NULL) ? kernels : convert_kernels_best();
+    cv->in_fourcc = pix->pixelformat;
+    cv->out_fourcc = out_fourcc;
+    cv->width = pix->width;
+    cv->height = pix->height;
+    cv->bayer = find_bayer(pix->pixelformat);
+    cv->demosaic = DEMOSAIC_BILINEAR;
+    cv->grey = find_grey(pix->pixelformat);
+
+    uint32_t in_bpl, in_size;
+    if (-1 == pix_fmt_frame_size(pix->pixelformat, pix->width, pix->height, &in_bpl, &in_size)) {
+        converter_free(cv);
+        return NULL;
+    }
+    cv->in_bpl = (pix->bytesperline != 0) ? pix->bytesperline : in_bpl;
+
+    cv->bands = (struct pool_bands) { .height = cv->height,
+        .scratch_size = sizeof(struct convert_scratch), .scratch_init = init_scratch,
+        .scratch_free = free_scratch, .owner = cv };
+    if (-1 == pool_bands_set_pool(&cv->bands, NULL)) {
+        converter_free(cv);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    *out = *in;
+    out->fmt.pix.pixelformat = out_fourcc;
+    out->fmt.pix.field = V4L2_FIELD_NONE;
+    size_t plane = (size_t) cv->width * cv->height;
+    switch (out_fourcc) {
+        case V4L2_PIX_FMT_YUV420:
+            out->fmt.pix.bytesperline = cv->width;
+            out->fmt.pix.sizeimage = plane + 2 * (cv->width / 2) * ((cv->height + 1) / 2);
+            break;
+
+        case V4L2_PIX_FMT_RGB24:
+            out->fmt.pix.bytesperline = cv->width * 3;
+            out->fmt.pix.sizeimage = plane * 3;
+            break;
+
+        case V4L2_PIX_FMT_Y10:
+        case V4L2_PIX_FMT_Y16:
+            out->fmt.pix.bytesperline = cv->width * 2;
+            out->fmt.pix.sizeimage = plane * 2;
+            break;
+
+        default:
+            out->fmt.pix.bytesperline = cv->width;
+            out->fmt.pix.sizeimage = plane;
+            break;
+    }
+    out->fmt.pix.colorspace = (out_fourcc == V4L2_PIX_FMT_RGB24 || cv->bayer != NULL)
+        ? V4L2_COLORSPACE_SRGB : pix->colorspace;
+
+    return cv;
+}
+
+/**
+ * convert_packed - convert rows "r0" up to "r1" of a YUYV or UYVY frame
+ */
+static void convert_packed(struct converter *cv, struct convert_scratch *scratch,
+        const uint8_t *src, uint8_t *dst, int r0, int r1) {
+    const struct convert_kernels *k = cv->k;
+    int w = cv->width, h = cv->height;
+    int yuyv = (cv->in_fourcc == V4L2_PIX_FMT_YUYV);
+    int y_off = yuyv ? 0 : 1;
+    int uv_off = yuyv ? 1 : 0;
+
+    switch (cv->out_fourcc) {
+        case V4L2_PIX_FMT_GREY:
+            for (int r = r0; r < r1; r++) {
+                k->packed_y(src + (size_t) r * cv->in_bpl, dst + (size_t) r * w, w, y_off);
+            }
+            break;
+
+        case V4L2_PIX_FMT_YUV420: {
+            uint8_t *u = dst + (size_t) w * h;
+            uint8_t *v = u + (size_t) (w / 2) * ((h + 1) / 2);
+            for (int r = r0; r < r1; r += 2) {
+                const uint8_t *row0 = src + (size_t) r * cv->in_bpl;
+                const uint8_t *row1 = (r + 1 < h) ? row0 + cv->in_bpl : row0;
+                k->packed_y(row0, dst + (size_t) r * w, w, y_off);
+                if (r + 1 < h) {
+                    k->packed_y(row1, dst + (size_t) (r + 1) * w, w, y_off);
+                }
+                k->packed_uv(row0, row1, u + (size_t) (r / 2) * (w / 2),
+                        v + (size_t) (r / 2) * (w / 2), w, uv_off);
+            }
+            break;
+        }
+
+        case V4L2_PIX_FMT_RGB24:
+            for (int r = r0; r < r1; r++) {
+                const uint8_t *row = src + (size_t) r * cv->in_bpl;
+                k->packed_y(row, scratch->tmp_y, w, y_off);
+                k->packed_uv(row, row, scratch->tmp_u, scratch->tmp_v, w, uv_off);
+                k->yuv_to_rgb(scratch->tmp_y, scratch->tmp_u, scratch->tmp_v,
+                        dst + (size_t) r * w * 3, w);
+            }
+            break;
+    }
+}
+
+/**
+ * convert_nv12 - convert rows "r0" up to "r1" of an NV12 frame, whose chroma plane follows
+ * "height" luma rows
+ */
+static void convert_nv12(struct converter *cv, struct convert_scratch *scratch, const uint8_t *src,
+        uint8_t *dst, int r0, int r1) {
+    const struct convert_kernels *k = cv->k;
+    int w = cv->width, h = cv->height;
+    const uint8_t *uv = src + (size_t) cv->in_bpl * h;
+
+    switch (cv->out_fourcc) {
+        case V4L2_PIX_FMT_GREY:
+            for (int r = r0; r < r1; r++) {
+                memcpy(dst + (size_t) r * w, src + (size_t) r * cv->in_bpl, w);
+            }
+            break;
+
+        case V4L2_PIX_FMT_YUV420: {
+            for (int r = r0; r < r1; r++) {
+                memcpy(dst + (size_t) r * w, src + (size_t) r * cv->in_bpl, w);
+            }
+            uint8_t *u = dst + (size_t) w * h;
+            uint8_t *v = u + (size_t) (w / 2) * ((h + 1) / 2);
+            for (int r = r0 / 2; r < (r1 + 1) / 2; r++) {
+                k->split_uv(uv + (size_t) r * cv->in_bpl, u + (size_t) r * (w / 2),
+                        v + (size_t) r * (w / 2), w / 2);
+            }
+            break;
+        }
+
+        case V4L2_PIX_FMT_RGB24:
+            for (int r = r0; r < r1; r++) {
+                if ((r % 2) == 0) {
+                    k->split_uv(uv + (size_t) (r / 2) * cv->in_bpl, scratch->tmp_u, scratch->tmp_v,
+                            w / 2);
+                }
+                k->yuv_to_rgb(src + (size_t) r * cv->in_bpl, scratch->tmp_u, scratch->tmp_v,
+                        dst + (size_t) r * w * 3, w);
+            }
+            break;
+    }
+}
+
+/**
+ * bayer_unpack - decode Bayer row "r" to 8 bits into "row", mirrored 2 pixels beyond its ends
+ */
+static void bayer_unpack(const struct converter *cv, const uint8_t *src, int r, uint8_t *row) {
+    const uint8_t *in = src + (size_t) r * cv->in_bpl;
+    uint8_t *p = row + 2;
+    int w = cv->width;
+
+    switch (cv->bayer->packing) {
+        case BAYER_8:
+            memcpy(p, in, w);
+            break;
+
+        case BAYER_16:
+            cv->k->unpack16(in, p, w, cv->bayer->shift);
+            break;
+
+        case BAYER_ALAW8:
+            for (int x = 0; x < w; x++) {
+                p[x] = alaw_decode[in[x]] >> 2;
+            }
+            break;
+
+        case BAYER_DPCM8:
+            dpcm8_decode(in, p, w);
+            break;
+    }
+
+    p[-2] = p[mirror(-2, w)];
+    p[-1] = p[mirror(-1, w)];
+    p[w] = p[mirror(w, w)];
+    p[w + 1] = p[mirror(w + 1, w)];
+}
+
+/**
+ * convert_bayer - demosaic rows "r0" up to "r1" of a Bayer frame
+ *
+ * Only three rows are unpacked at any time, each of them once per band.
+ */
+static void convert_bayer(struct converter *cv, struct convert_scratch *scratch, const uint8_t *src,
+        uint8_t *dst, int r0, int r1) {
+    int w = cv->width, h = cv->height;
+    int grey = (cv->out_fourcc == V4L2_PIX_FMT_GREY);
+    int edge_aware = (cv->demosaic == DEMOSAIC_EDGE_AWARE);
+    size_t out_bpl = grey ? (size_t) w : (size_t) w * 3;
+
+    uint8_t *up = scratch->bayer[0], *mid = scratch->bayer[1], *down = scratch->bayer[2];
+    bayer_unpack(cv, src, mirror(r0 - 1, h), up);
+    bayer_unpack(cv, src, r0, mid);
+    for (int r = r0; r < r1; r++) {
+        bayer_unpack(cv, src, mirror(r + 1, h), down);
+
+        int odd = r & 1;
+        cv->k->bayer_row(up + 2, mid + 2, down + 2, dst + (size_t) r * out_bpl, w,
+                cv->bayer->g_first ^ odd, cv->bayer->red_row ^ odd, edge_aware, grey);
+
+        uint8_t *next = up;
+        up = mid;
+        mid = down;
+        down = next;
+    }
+}
+
+/**
+ * convert_grey - unpack rows "r0" up to "r1" of a 10 or 12-bit greyscale frame
+ */
+static void convert_grey(struct converter *cv, struct convert_scratch *scratch, const uint8_t *src,
+        uint8_t *dst, int r0, int r1) {
+    const struct convert_kernels *k = cv->k;
+    int w = cv->width;
+    int bits = cv->grey->bits;
+    int to_grey = (cv->out_fourcc == V4L2_PIX_FMT_GREY);
+    // GREY is cut down from the samples as they are, Y16 gets them at full range
+    int shift = (cv->out_fourcc == V4L2_PIX_FMT_Y16) ? 16 - bits : 0;
+
+    for (int r = r0; r < r1; r++) {
+        const uint8_t *in = src + (size_t) r * cv->in_bpl;
+        if (to_grey && cv->grey->packing == GREY_16) {
+            k->unpack16(in, dst + (size_t) r * w, w, bits - 8);
+            continue;
+        }
+
+        uint8_t *out = to_grey ? scratch->tmp_y : dst + (size_t) r * w * 2;
+        switch (cv->grey->packing) {
+            case GREY_Y10BPACK:
+                k->unpack_y10b(in, out, w, shift);
+                break;
+
+            case GREY_Y10P:
+                k->unpack_y10p(in, out, w, shift);
+                break;
+
+            case GREY_16:
+                k->shift16(in, out, w, shift);
+                break;
+        }
+
+        if (to_grey) {
+            k->unpack16(scratch->tmp_y, dst + (size_t) r * w, w, bits - 8);
+        }
+    }
+}
+
+/**
+ * convert_band - convert band "band" of a frame, with the scratch rows of "slot"
+ */
+static void convert_band(struct converter *cv, int band, int slot, const uint8_t *src,
+        uint8_t *dst) {
+    struct convert_scratch *scratch = pool_bands_scratch(&cv->bands, slot);
+    int rows = cv->bands.band_rows;
+    int r0 = band * rows;
+    int r1 = (r0 + rows < (int) cv->height) ? r0 + rows : (int) cv->height;
+
+    if (cv->bayer != NULL) {
+        convert_bayer(cv, scratch, src, dst, r0, r1);
+    } else if (cv->grey != NULL) {
+        convert_grey(cv, scratch, src, dst, r0, r1);
+    } else if (cv->in_fourcc == V4L2_PIX_FMT_NV12) {
+        convert_nv12(cv, scratch, src, dst, r0, r1);
+    } else {
+        convert_packed(cv, scratch, src, dst, r0, r1);
+    }
+}
+
+static void convert_job_band(void *arg, int band, int slot) {
+    struct convert_job *job = arg;
+    convert_band(job->cv, band, slot, job->src, job->dst);
+}
+
+/**
+ * converter_set_pool - convert frames in bands of rows on the threads of "pool", which has to
+ * outlive the converter
+ *
+ * @returns 0 on success, -1 with errno set on failure (and then converts on one thread)
+ */
+int converter_set_pool(struct converter *cv, struct thread_pool *pool) {
+    return pool_bands_set_pool(&cv->bands, pool);
+}
+
+/**
+ * converter_pool - the thread pool the converter runs on, or NULL
+ */
+struct thread_pool *converter_pool(const struct converter *cv) {
+    return cv->bands.pool;
+}
+
+/**
+ * converter_set_demosaic - the demosaic method for Bayer frames
+ */
+void converter_set_demosaic(struct converter *cv, enum demosaic_method method) {
+    cv->demosaic = method;
+}
+
+/**
+ * convert_frame - convert the frame at "src" into "dst", which holds the output's sizeimage
+ */
+void convert_frame(struct converter *cv, const uint8_t *src, uint8_t *dst) {
+    if (cv->bands.pool == NULL) {
+        for (int i = 0; i < cv->bands.band_count; i++) {
+            convert_band(cv, i, 0, src, dst);
+        }
+        return;
+    }
+
+    struct convert_job job;
+    convert_frame_start(cv, &job, src, dst, -1);
+    convert_frame_wait(&job);
+}
+
+/**
+ * convert_frame_start - start converting a frame on the converter's pool, and return
+ *
+ * "job" has to stay around until the conversion is done, "done_fd" is an eventfd to signal
+ * then, or -1.  Several frames can be converted at once.  Without a pool the frame is converted
+ * right away.
+ */
+void convert_frame_start(struct converter *cv, struct convert_job *job, const uint8_t *src,
+        uint8_t *dst, int done_fd) {
+    job->cv = cv;
+    job->src = src;
+    job->dst = dst;
+    job->batch = (struct pool_batch) { .fn = convert_job_band, .arg = job,
+        .count = cv->bands.band_count, .done_fd = done_fd };
+
+    if (cv->bands.pool != NULL) {
+        thread_pool_start(cv->bands.pool, &job->batch);
+        return;
+    }
+
+    for (int i = 0; i < cv->bands.band_count; i++) {
+        convert_band(cv, i, 0, src, dst);
+    }
+    job->batch.finished = 1;
+    if (done_fd >= 0) {
+        uint64_t one = 1;
+        while (-1 == write(done_fd, &one, sizeof(one)) && errno == EINTR) {
+        }
+    }
+}
+
+/**
+ * convert_frame_done - whether a started conversion is done
+ */
+int convert_frame_done(const struct convert_job *job) {
+    return thread_pool_done(&job->batch);
+}
+
+/**
+ * convert_frame_wait - help converting until "job" is done
+ */
+void convert_frame_wait(struct convert_job *job) {
+    if (job->cv->bands.pool != NULL) {
+        thread_pool_wait(job->cv->bands.pool, &job->batch);
+    }
+}
+
+/**
+ * converter_kernels - the kernels the converter runs
+ */
+const struct convert_kernels *converter_kernels(const struct converter *cv) {
+    return cv->k;
+}
+
+void converter_free(struct converter *cv) {
+    if (cv == NULL) {
+        return;
+    }
+
+    pool_bands_free(&cv->bands);
+    free(cv);
+}
@@ -0,0 +1,120 @@
+#ifndef __CONVERT_H_
+#define __CONVERT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#include "thread_pool.h"
+
+/*
+ * Pixel format conversion from the packed and semi-planar YUV formats cameras deliver (YUYV,
+ * UYVY, NV12) into planar I420 (YUV420), RGB24 or GREY, from raw Bayer sensor formats into
+ * RGB24 or GREY, and from 10 and 12-bit greyscale into 16 bits per pixel or GREY.
+ *
+ * Greyscale comes bit-packed (Y10BPACK, Y10P) or in 16-bit words (Y10, Y12).  It is unpacked to
+ * 16-bit little-endian words holding the same value (Y10), or shifted up to the full 16-bit
+ * range (Y16), or cut down to 8 bits (GREY).
+ *
+ * Bayer frames are demosaiced at 8 bits per channel.  10, 12 and 16-bit samples are shifted
+ * down, and the A-law and DPCM compressed 10-bit variants are decoded, one row at a time as the
+ * demosaic needs them.  The demosaic is bilinear, or edge-aware, which interpolates green along
+ * the direction with the smaller gradient.  Averages of four pixels are taken as the average of
+ * two pairwise averages, all rounding up, so SIMD averaging instructions match them exactly.
+ *
+ * A frame is converted row by row with a small set of kernels.  Every kernel has a scalar
+ * reference implementation, and SSE2, AVX2 and NEON versions that give bit-exact the same
+ * results; the best one the CPU supports is picked at run time.  RGB uses BT.601 limited range
+ * with 6 fractional bits, which keeps every intermediate within 16 bits.
+ *
+ * With a thread pool, a frame is split into bands of row pairs that run on the pool's threads.
+ * Conversions can be started and left running, so several frames are converted at once.
+ */
+
+/**
+ * convert_kernels - the row kernels conversions are built from
+ *
+ * Widths are in pixels and always even.
+ *   packed_y:   the Y of a YUYV ("y_offset" 0) or UYVY (1) row
+ *   packed_uv:  the U and V of a YUYV ("uv_offset" 1) or UYVY (0) row pair, averaged vertically
+ *   split_uv:   deinterleave an NV12 chroma row of "pairs" UV pairs
+ *   yuv_to_rgb: a row of RGB24 from a Y row and horizontally subsampled U and V rows
+ *   bayer_row:  demosaic the 8-bit Bayer row "mid" into RGB24, or GREY with "grey" set.  "up"
+ *               and "down" are the rows around it, and all three can be read 2 pixels beyond
+ *               either end.  "g_first" says whether the row starts with green, "red_row"
+ *               whether its other color is red (or blue)
+ *   unpack16:   shift 16-bit little-endian samples down by "shift" (at least 2) to 8 bits
+ *   unpack_y10b: a Y10BPACK row, a big-endian bit stream of 10-bit samples, to 16-bit
+ *               little-endian samples shifted up by "shift"
+ *   unpack_y10p: the same for a Y10P row, where every 4 samples take 5 bytes: their high 8 bits,
+ *               then their low 2 bits in one byte.  The width is a multiple of 4
+ *   shift16:    shift 16-bit little-endian samples up by "shift"
+ *   lerp_row:   blend "n" bytes of two rows, "frac" (1 to 255) 256ths of the way from "row0"
+ *               to "row1", rounding
+ *   sum_row:    add "n" bytes of a row to the 16-bit sums in "acc", or set them with "first"
+ *   sad_row:    the sum of the absolute differences between "n" bytes of two rows
+ */
+struct convert_kernels {
+    const char *name;
+    void (*packed_y)(const uint8_t *src, uint8_t *y, int width, int y_offset);
+    void (*packed_uv)(const uint8_t *row0, const uint8_t *row1, uint8_t *u, uint8_t *v,
+            int width, int uv_offset);
+    void (*split_uv)(const uint8_t *uv, uint8_t *u, uint8_t *v, int pairs);
+    void (*yuv_to_rgb)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgb,
+            int width);
+    void (*bayer_row)(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint8_t *out,
+            int width, int g_first, int red_row, int edge_aware, int grey);
+    void (*unpack16)(const uint8_t *src, uint8_t *dst, int width, int shift);
+    void (*unpack_y10b)(const uint8_t *src, uint8_t *dst, int width, int shift);
+    void (*unpack_y10p)(const uint8_t *src, uint8_t *dst, int width, int shift);
+    void (*shift16)(const uint8_t *src, uint8_t *dst, int width, int shift);
+    void (*lerp_row)(const uint8_t *row0, const uint8_t *row1, uint8_t *out, int n, int frac);
+    void (*sum_row)(const uint8_t *row, uint16_t *acc, int n, int first);
+    uint32_t (*sad_row)(const uint8_t *row0, const uint8_t *row1, int n);
+};
+
+enum demosaic_method {
+    DEMOSAIC_BILINEAR,
+    DEMOSAIC_EDGE_AWARE,
+};
+
+extern const struct convert_kernels convert_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+extern const struct convert_kernels convert_kernels_sse2;
+extern const struct convert_kernels convert_kernels_avx2;
+#endif
+#if defined(__ARM_NEON)
+extern const struct convert_kernels convert_kernels_neon;
+#endif
+
+#define CONVERT_MAX_KERNELS 4
+
+int convert_kernels_available(const struct convert_kernels **list);
+const struct convert_kernels *convert_kernels_best(void);
+
+struct converter;
+
+/**
+ * convert_job - a frame being converted on a thread pool
+ */
+struct convert_job {
+    struct pool_batch batch;
+    struct converter *cv;
+    const uint8_t *src;
+    uint8_t *dst;
+};
+
+int convert_supported(uint32_t in_fourcc, uint32_t out_fourcc);
+struct converter *converter_create(const struct v4l2_format *in, uint32_t out_fourcc,
+        const struct convert_kernels *kernels, struct v4l2_format *out);
+int converter_set_pool(struct converter *cv, struct thread_pool *pool);
+struct thread_pool *converter_pool(const struct converter *cv);
+void converter_set_demosaic(struct converter *cv, enum demosaic_method method);
+void convert_frame(struct converter *cv, const uint8_t *src, uint8_t *dst);
+void convert_frame_start(struct converter *cv, struct convert_job *job, const uint8_t *src,
+        uint8_t *dst, int done_fd);
+int convert_frame_done(const struct convert_job *job);
+void convert_frame_wait(struct convert_job *job);
+const struct convert_kernels *converter_kernels(const struct converter *cv);
+void converter_free(struct converter *cv);
+#endif
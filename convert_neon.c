@@ -0,0 +1,285 @@
+#include <stdint.h>
+
+#include "convert.h"
+
+/*
+ * NEON conversion kernels.  NEON is part of the baseline on 64-bit ARM, so these need no
+ * run-time check there.  The structure loads and stores do all the (de)interleaving, and the
+ * narrowing saturating shifts clamp to 0..255 just like the scalar code.
+ */
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+static void packed_y_neon(const uint8_t *src, uint8_t *y, int width, int y_offset) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x2_t p = vld2q_u8(src + 2 * x);
+        vst1q_u8(y + x, y_offset ? p.val[1] : p.val[0]);
+    }
+    for (; x < width; x++) {
+        y[x] = src[(2 * x) + y_offset];
+    }
+}
+
+static void packed_uv_neon(const uint8_t *row0, const uint8_t *row1, uint8_t *u, uint8_t *v,
+        int width, int uv_offset) {
+    // Every 4 bytes hold Y0 U Y1 V (YUYV) or U Y0 V Y1 (UYVY)
+    int ui = uv_offset ? 1 : 0;
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        uint8x16x4_t a = vld4q_u8(row0 + 2 * x);
+        uint8x16x4_t b = vld4q_u8(row1 + 2 * x);
+        vst1q_u8(u + x / 2, vrhaddq_u8(a.val[ui], b.val[ui]));
+        vst1q_u8(v + x / 2, vrhaddq_u8(a.val[ui + 2], b.val[ui + 2]));
+    }
+    for (x /= 2; x < width / 2; x++) {
+        int i = (4 * x) + uv_offset;
+        u[x] = (row0[i] + row1[i] + 1) >> 1;
+        v[x] = (row0[i + 2] + row1[i + 2] + 1) >> 1;
+    }
+}
+
+static void split_uv_neon(const uint8_t *uv, uint8_t *u, uint8_t *v, int pairs) {
+    int x = 0;
+    for (; x + 16 <= pairs; x += 16) {
+        uint8x16x2_t p = vld2q_u8(uv + 2 * x);
+        vst1q_u8(u + x, p.val[0]);
+        vst1q_u8(v + x, p.val[1]);
+    }
+    for (; x < pairs; x++) {
+        u[x] = uv[2 * x];
+        v[x] = uv[(2 * x) + 1];
+    }
+}
+
+/**
+ * rgb8_neon - R, G and B of 8 pixels, from their Y and the U and V they share in pairs
+ */
+static inline uint8x8x3_t rgb8_neon(uint8x8_t y, uint8x8_t u, uint8x8_t v) {
+    int16x8_t c = vmulq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y)), vdupq_n_s16(16)), 75);
+    int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u)), vdupq_n_s16(128));
+    int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v)), vdupq_n_s16(128));
+    int16x8_t half = vdupq_n_s16(32);
+
+    int16x8_t r = vqaddq_s16(vqaddq_s16(c, vmulq_n_s16(e, 102)), half);
+    int16x8_t g = vaddq_s16(vsubq_s16(vsubq_s16(c, vmulq_n_s16(d, 25)), vmulq_n_s16(e, 52)),
+            half);
+    int16x8_t b = vqaddq_s16(vqaddq_s16(c, vmulq_n_s16(d, 129)), half);
+
+    uint8x8x3_t out;
+    out.val[0] = vqshrun_n_s16(r, 6);
+    out.val[1] = vqshrun_n_s16(g, 6);
+    out.val[2] = vqshrun_n_s16(b, 6);
+    return out;
+}
+
+static void yuv_to_rgb_neon(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgb,
+        int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t yv = vld1q_u8(y + x);
+        uint8x8x2_t uu = vzip_u8(vld1_u8(u + x / 2), vld1_u8(u + x / 2));
+        uint8x8x2_t vv = vzip_u8(vld1_u8(v + x / 2), vld1_u8(v + x / 2));
+
+        vst3_u8(rgb + 3 * x, rgb8_neon(vget_low_u8(yv), uu.val[0], vv.val[0]));
+        vst3_u8(rgb + 3 * x + 24, rgb8_neon(vget_high_u8(yv), uu.val[1], vv.val[1]));
+    }
+    for (; x < width; x++) {
+        int c = (y[x] - 16) * 75;
+        int d = u[x / 2] - 128;
+        int e = v[x / 2] - 128;
+        int r = (c + (102 * e) + 32) >> 6;
+        int g = (c - (25 * d) - (52 * e) + 32) >> 6;
+        int b = (c + (129 * d) + 32) >> 6;
+        rgb[(3 * x) + 0] = (r < 0) ? 0 : (r > 255) ? 255 : r;
+        rgb[(3 * x) + 1] = (g < 0) ? 0 : (g > 255) ? 255 : g;
+        rgb[(3 * x) + 2] = (b < 0) ? 0 : (b > 255) ? 255 : b;
+    }
+}
+
+/**
+ * luma8_neon - (77 R + 150 G + 29 B + 128) >> 8 of 8 pixels
+ */
+static inline uint8x8_t luma8_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+    uint16x8_t y = vmull_u8(r, vdup_n_u8(77));
+    y = vmlal_u8(y, g, vdup_n_u8(150));
+    y = vmlal_u8(y, b, vdup_n_u8(29));
+    return vshrn_n_u16(vaddq_u16(y, vdupq_n_u16(128)), 8);
+}
+
+static void bayer_row_neon(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out, int width, int g_first, int red_row, int edge_aware, int grey) {
+    const uint8x16_t green = vreinterpretq_u8_u16(vdupq_n_u16(g_first ? 0x00ff : 0xff00));
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t c = vld1q_u8(mid + x), l = vld1q_u8(mid + x - 1), r = vld1q_u8(mid + x + 1);
+        uint8x16_t u = vld1q_u8(up + x), d = vld1q_u8(down + x);
+        uint8x16_t diag = vrhaddq_u8(vrhaddq_u8(vld1q_u8(up + x - 1), vld1q_u8(up + x + 1)),
+                vrhaddq_u8(vld1q_u8(down + x - 1), vld1q_u8(down + x + 1)));
+        uint8x16_t h = vrhaddq_u8(l, r);
+        uint8x16_t v = vrhaddq_u8(u, d);
+        uint8x16_t g = vrhaddq_u8(h, v);
+        if (edge_aware) {
+            uint8x16_t gh = vabdq_u8(l, r), gv = vabdq_u8(u, d);
+            g = vbslq_u8(vceqq_u8(gh, gv), g, vbslq_u8(vcltq_u8(gh, gv), h, v));
+        }
+
+        uint8x16_t own = vbslq_u8(green, h, c);
+        uint8x16_t other = vbslq_u8(green, v, diag);
+        g = vbslq_u8(green, c, g);
+        uint8x16x3_t rgb;
+        rgb.val[0] = red_row ? own : other;
+        rgb.val[1] = g;
+        rgb.val[2] = red_row ? other : own;
+
+        if (grey) {
+            vst1q_u8(out + x, vcombine_u8(
+                        luma8_neon(vget_low_u8(rgb.val[0]), vget_low_u8(rgb.val[1]),
+                            vget_low_u8(rgb.val[2])),
+                        luma8_neon(vget_high_u8(rgb.val[0]), vget_high_u8(rgb.val[1]),
+                            vget_high_u8(rgb.val[2]))));
+        } else {
+            vst3q_u8(out + 3 * x, rgb);
+        }
+    }
+
+    convert_kernels_scalar.bayer_row(up + x, mid + x, down + x, out + (grey ? x : 3 * x),
+            width - x, g_first, red_row, edge_aware, grey);
+}
+
+static void unpack16_neon(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    const int16x8_t count = vdupq_n_s16(-shift);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint16x8_t a = vshlq_u16(vreinterpretq_u16_u8(vld1q_u8(src + 2 * x)), count);
+        uint16x8_t b = vshlq_u16(vreinterpretq_u16_u8(vld1q_u8(src + 2 * x + 16)), count);
+        vst1q_u8(dst + x, vcombine_u8(vqmovn_u16(a), vqmovn_u16(b)));
+    }
+    convert_kernels_scalar.unpack16(src + 2 * x, dst + x, width - x, shift);
+}
+
+#if defined(__aarch64__)
+/*
+ * Table lookups gathering 8 packed 10-bit samples (10 bytes) into 16-bit words, like the AVX2
+ * byte shuffles.  Indexes past the table give 0.
+ */
+static const uint8_t y10b_table[16] = { 1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8 };
+static const uint8_t y10p_high_table[16] = {
+    0, 0xff, 1, 0xff, 2, 0xff, 3, 0xff, 5, 0xff, 6, 0xff, 7, 0xff, 8, 0xff,
+};
+static const uint8_t y10p_low_table[16] = {
+    4, 0xff, 4, 0xff, 4, 0xff, 4, 0xff, 9, 0xff, 9, 0xff, 9, 0xff, 9, 0xff,
+};
+static const uint16_t y10b_align[8] = { 1, 4, 16, 64, 1, 4, 16, 64 };
+static const uint16_t y10p_align[8] = { 256, 64, 16, 4, 256, 64, 16, 4 };
+
+// Loads of 8 samples read 16 bytes, so the loops stop while 16 samples (20 bytes) are left
+static void unpack_y10b_neon(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    const uint16x8_t align = vld1q_u16(y10b_align);
+    const uint8x16_t table = vld1q_u8(y10b_table);
+    const int16x8_t count = vdupq_n_s16(shift);
+    int x = 0;
+    for (; x + 16 <= width; x += 8) {
+        uint16x8_t words = vreinterpretq_u16_u8(vqtbl1q_u8(vld1q_u8(src + 5 * x / 4), table));
+        uint16x8_t v = vshrq_n_u16(vmulq_u16(words, align), 6);
+        vst1q_u8(dst + 2 * x, vreinterpretq_u8_u16(vshlq_u16(v, count)));
+    }
+    convert_kernels_scalar.unpack_y10b(src + 5 * x / 4, dst + 2 * x, width - x, shift);
+}
+
+static void unpack_y10p_neon(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    const uint16x8_t align = vld1q_u16(y10p_align);
+    const uint8x16_t high_table = vld1q_u8(y10p_high_table);
+    const uint8x16_t low_table = vld1q_u8(y10p_low_table);
+    const int16x8_t count = vdupq_n_s16(shift);
+    int x = 0;
+    for (; x + 16 <= width; x += 8) {
+        uint8x16_t packed = vld1q_u8(src + 5 * x / 4);
+        uint16x8_t high = vshlq_n_u16(vreinterpretq_u16_u8(vqtbl1q_u8(packed, high_table)), 2);
+        uint16x8_t low = vmulq_u16(vreinterpretq_u16_u8(vqtbl1q_u8(packed, low_table)), align);
+        low = vandq_u16(vshrq_n_u16(low, 8), vdupq_n_u16(3));
+        vst1q_u8(dst + 2 * x, vreinterpretq_u8_u16(vshlq_u16(vorrq_u16(high, low), count)));
+    }
+    convert_kernels_scalar.unpack_y10p(src + 5 * x / 4, dst + 2 * x, width - x, shift);
+}
+#else
+// 32-bit ARM has no full-width table lookup, the packed samples are unpacked by the scalar code
+static void unpack_y10b_neon(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    convert_kernels_scalar.unpack_y10b(src, dst, width, shift);
+}
+
+static void unpack_y10p_neon(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    convert_kernels_scalar.unpack_y10p(src, dst, width, shift);
+}
+#endif
+
+static void shift16_neon(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    const int16x8_t count = vdupq_n_s16(shift);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint16x8_t a = vreinterpretq_u16_u8(vld1q_u8(src + 2 * x));
+        vst1q_u8(dst + 2 * x, vreinterpretq_u8_u16(vshlq_u16(a, count)));
+    }
+    convert_kernels_scalar.shift16(src + 2 * x, dst + 2 * x, width - x, shift);
+}
+
+static void lerp_row_neon(const uint8_t *row0, const uint8_t *row1, uint8_t *out, int n,
+        int frac) {
+    const uint8x8_t w0 = vdup_n_u8(256 - frac), w1 = vdup_n_u8(frac);
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        uint8x16_t a = vld1q_u8(row0 + x), b = vld1q_u8(row1 + x);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a), w0), vget_low_u8(b), w1);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a), w0), vget_high_u8(b), w1);
+        vst1q_u8(out + x, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+    convert_kernels_scalar.lerp_row(row0 + x, row1 + x, out + x, n - x, frac);
+}
+
+static void sum_row_neon(const uint8_t *row, uint16_t *acc, int n, int first) {
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        uint8x16_t a = vld1q_u8(row + x);
+        uint16x8_t lo = first ? vmovl_u8(vget_low_u8(a))
+            : vaddw_u8(vld1q_u16(acc + x), vget_low_u8(a));
+        uint16x8_t hi = first ? vmovl_u8(vget_high_u8(a))
+            : vaddw_u8(vld1q_u16(acc + x + 8), vget_high_u8(a));
+        vst1q_u16(acc + x, lo);
+        vst1q_u16(acc + x + 8, hi);
+    }
+    convert_kernels_scalar.sum_row(row + x, acc + x, n - x, first);
+}
+
+static uint32_t sad_row_neon(const uint8_t *row0, const uint8_t *row1, int n) {
+    // The 16-bit sums take 128 rounds of 2 * 255 before they could overflow
+    uint32x4_t sum = vdupq_n_u32(0);
+    int x = 0;
+    while (x + 16 <= n) {
+        uint16x8_t part = vdupq_n_u16(0);
+        for (int i = 0; i < 128 && x + 16 <= n; i++, x += 16) {
+            part = vpadalq_u8(part, vabdq_u8(vld1q_u8(row0 + x), vld1q_u8(row1 + x)));
+        }
+        sum = vpadalq_u16(sum, part);
+    }
+    uint64x2_t pairs = vpaddlq_u32(sum);
+    uint32_t sad = (uint32_t) (vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1));
+    return sad + convert_kernels_scalar.sad_row(row0 + x, row1 + x, n - x);
+}
+
+const struct convert_kernels convert_kernels_neon = {
+    .name = "neon",
+    .packed_y = packed_y_neon,
+    .packed_uv = packed_uv_neon,
+    .split_uv = split_uv_neon,
+    .yuv_to_rgb = yuv_to_rgb_neon,
+    .bayer_row = bayer_row_neon,
+    .unpack16 = unpack16_neon,
+    .unpack_y10b = unpack_y10b_neon,
+    .unpack_y10p = unpack_y10p_neon,
+    .shift16 = shift16_neon,
+    .lerp_row = lerp_row_neon,
+    .sum_row = sum_row_neon,
+    .sad_row = sad_row_neon,
+};
+#endif
@@ -0,0 +1,701 @@
+#include <stdint.h>
+
+#include "convert.h"
+
+/*
+ * SSE2 and AVX2 conversion kernels.  Both are built with per-function target attributes so the
+ * rest of camcap keeps the baseline instruction set; convert_kernels_available() only offers
+ * the ones the CPU has.  Tails narrower than a vector go through the scalar code.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+static void packed_y_tail(const uint8_t *src, uint8_t *y, int x, int width, int y_offset) {
+    for (; x < width; x++) {
+        y[x] = src[(2 * x) + y_offset];
+    }
+}
+
+static void packed_uv_tail(const uint8_t *row0, const uint8_t *row1, uint8_t *u, uint8_t *v,
+        int x, int width, int uv_offset) {
+    for (x /= 2; x < width / 2; x++) {
+        int i = (4 * x) + uv_offset;
+        u[x] = (row0[i] + row1[i] + 1) >> 1;
+        v[x] = (row0[i + 2] + row1[i + 2] + 1) >> 1;
+    }
+}
+
+static void split_uv_tail(const uint8_t *uv, uint8_t *u, uint8_t *v, int x, int pairs) {
+    for (; x < pairs; x++) {
+        u[x] = uv[2 * x];
+        v[x] = uv[(2 * x) + 1];
+    }
+}
+
+static void yuv_to_rgb_tail(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgb,
+        int x, int width) {
+    for (; x < width; x++) {
+        int c = (y[x] - 16) * 75;
+        int d = u[x / 2] - 128;
+        int e = v[x / 2] - 128;
+        int r = (c + (102 * e) + 32) >> 6;
+        int g = (c - (25 * d) - (52 * e) + 32) >> 6;
+        int b = (c + (129 * d) + 32) >> 6;
+        rgb[(3 * x) + 0] = (r < 0) ? 0 : (r > 255) ? 255 : r;
+        rgb[(3 * x) + 1] = (g < 0) ? 0 : (g > 255) ? 255 : g;
+        rgb[(3 * x) + 2] = (b < 0) ? 0 : (b > 255) ? 255 : b;
+    }
+}
+
+/*
+ * SSE2
+ */
+
+SSE2 static inline __m128i low_bytes_sse2(__m128i a, int high) {
+    return high ? _mm_srli_epi16(a, 8) : _mm_and_si128(a, _mm_set1_epi16(0x00ff));
+}
+
+SSE2 static void packed_y_sse2(const uint8_t *src, uint8_t *y, int width, int y_offset) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src + 2 * x));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 2 * x + 16));
+        a = low_bytes_sse2(a, y_offset);
+        b = low_bytes_sse2(b, y_offset);
+        _mm_storeu_si128((__m128i *) (y + x), _mm_packus_epi16(a, b));
+    }
+    packed_y_tail(src, y, x, width, y_offset);
+}
+
+SSE2 static void packed_uv_sse2(const uint8_t *row0, const uint8_t *row1, uint8_t *u,
+        uint8_t *v, int width, int uv_offset) {
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m128i c[4];
+        for (int i = 0; i < 4; i++) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (row0 + 2 * x + 16 * i));
+            __m128i b = _mm_loadu_si128((const __m128i *) (row1 + 2 * x + 16 * i));
+            c[i] = low_bytes_sse2(_mm_avg_epu8(a, b), uv_offset);
+        }
+
+        // UVUV... for 16 pixel pairs, then split into U and V
+        __m128i p0 = _mm_packus_epi16(c[0], c[1]);
+        __m128i p1 = _mm_packus_epi16(c[2], c[3]);
+        _mm_storeu_si128((__m128i *) (u + x / 2),
+                _mm_packus_epi16(low_bytes_sse2(p0, 0), low_bytes_sse2(p1, 0)));
+        _mm_storeu_si128((__m128i *) (v + x / 2),
+                _mm_packus_epi16(low_bytes_sse2(p0, 1), low_bytes_sse2(p1, 1)));
+    }
+    packed_uv_tail(row0, row1, u, v, x, width, uv_offset);
+}
+
+SSE2 static void split_uv_sse2(const uint8_t *uv, uint8_t *u, uint8_t *v, int pairs) {
+    int x = 0;
+    for (; x + 16 <= pairs; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (uv + 2 * x));
+        __m128i b = _mm_loadu_si128((const __m128i *) (uv + 2 * x + 16));
+        _mm_storeu_si128((__m128i *) (u + x),
+                _mm_packus_epi16(low_bytes_sse2(a, 0), low_bytes_sse2(b, 0)));
+        _mm_storeu_si128((__m128i *) (v + x),
+                _mm_packus_epi16(low_bytes_sse2(a, 1), low_bytes_sse2(b, 1)));
+    }
+    split_uv_tail(uv, u, v, x, pairs);
+}
+
+/**
+ * rgb_sse2 - R, G and B of 8 pixels as 16-bit values, from 16-bit Y, U and V
+ *
+ * Saturating adds only clip values that end up above 255 anyway, so this matches the scalar
+ * integer math exactly.
+ */
+SSE2 static inline void rgb_sse2(__m128i y, __m128i u, __m128i v, __m128i *r, __m128i *g,
+        __m128i *b) {
+    __m128i c = _mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), _mm_set1_epi16(75));
+    __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+    __m128i half = _mm_set1_epi16(32);
+
+    *r = _mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(102))), half);
+    *g = _mm_sub_epi16(_mm_sub_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(25))),
+            _mm_mullo_epi16(e, _mm_set1_epi16(52)));
+    *g = _mm_add_epi16(*g, half);
+    *b = _mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(129))), half);
+    *r = _mm_srai_epi16(*r, 6);
+    *g = _mm_srai_epi16(*g, 6);
+    *b = _mm_srai_epi16(*b, 6);
+}
+
+/**
+ * rgb16_sse2 - R, G and B of 16 pixels as bytes
+ */
+SSE2 static inline void rgb16_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+        __m128i *r, __m128i *g, __m128i *b) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i yv = _mm_loadu_si128((const __m128i *) y);
+    __m128i uv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) u), zero);
+    __m128i vv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) v), zero);
+
+    __m128i r0, g0, b0, r1, g1, b1;
+    rgb_sse2(_mm_unpacklo_epi8(yv, zero), _mm_unpacklo_epi16(uv, uv),
+            _mm_unpacklo_epi16(vv, vv), &r0, &g0, &b0);
+    rgb_sse2(_mm_unpackhi_epi8(yv, zero), _mm_unpackhi_epi16(uv, uv),
+            _mm_unpackhi_epi16(vv, vv), &r1, &g1, &b1);
+    *r = _mm_packus_epi16(r0, r1);
+    *g = _mm_packus_epi16(g0, g1);
+    *b = _mm_packus_epi16(b0, b1);
+}
+
+SSE2 static void yuv_to_rgb_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+        uint8_t *rgb, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i r, g, b;
+        rgb16_sse2(y + x, u + x / 2, v + x / 2, &r, &g, &b);
+
+        // SSE2 has no byte shuffle, interleave through the stack
+        uint8_t planes[3][16] __attribute__((aligned(16)));
+        _mm_store_si128((__m128i *) planes[0], r);
+        _mm_store_si128((__m128i *) planes[1], g);
+        _mm_store_si128((__m128i *) planes[2], b);
+        uint8_t *out = rgb + 3 * x;
+        for (int i = 0; i < 16; i++) {
+            out[3 * i + 0] = planes[0][i];
+            out[3 * i + 1] = planes[1][i];
+            out[3 * i + 2] = planes[2][i];
+        }
+    }
+    yuv_to_rgb_tail(y, u, v, rgb, x, width);
+}
+
+SSE2 static inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+SSE2 static inline __m128i absdiff_sse2(__m128i a, __m128i b) {
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+/**
+ * luma_sse2 - (77 R + 150 G + 29 B + 128) >> 8 of 8 pixels, which never leaves 16 bits
+ */
+SSE2 static inline __m128i luma_sse2(__m128i r, __m128i g, __m128i b) {
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)),
+            _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(29)));
+    return _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+}
+
+SSE2 static void bayer_row_sse2(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out, int width, int g_first, int red_row, int edge_aware, int grey) {
+    // Green sites are the even or the odd bytes
+    const __m128i green = _mm_set1_epi16(g_first ? 0x00ff : (short) 0xff00);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+#define LOAD(p) _mm_loadu_si128((const __m128i *) (p))
+        __m128i c = LOAD(mid + x), l = LOAD(mid + x - 1), r = LOAD(mid + x + 1);
+        __m128i u = LOAD(up + x), d = LOAD(down + x);
+        __m128i diag = _mm_avg_epu8(_mm_avg_epu8(LOAD(up + x - 1), LOAD(up + x + 1)),
+                _mm_avg_epu8(LOAD(down + x - 1), LOAD(down + x + 1)));
+#undef LOAD
+        __m128i h = _mm_avg_epu8(l, r);
+        __m128i v = _mm_avg_epu8(u, d);
+        __m128i g = _mm_avg_epu8(h, v);
+        if (edge_aware) {
+            __m128i gh = absdiff_sse2(l, r), gv = absdiff_sse2(u, d);
+            __m128i same = _mm_cmpeq_epi8(gh, gv);
+            __m128i h_less = _mm_andnot_si128(same, _mm_cmpeq_epi8(_mm_max_epu8(gh, gv), gv));
+            g = select_sse2(same, g, select_sse2(h_less, h, v));
+        }
+
+        __m128i own = select_sse2(green, h, c);
+        __m128i other = select_sse2(green, v, diag);
+        g = select_sse2(green, c, g);
+        __m128i rr = red_row ? own : other;
+        __m128i bb = red_row ? other : own;
+
+        if (grey) {
+            __m128i lo = luma_sse2(_mm_unpacklo_epi8(rr, zero), _mm_unpacklo_epi8(g, zero),
+                    _mm_unpacklo_epi8(bb, zero));
+            __m128i hi = luma_sse2(_mm_unpackhi_epi8(rr, zero), _mm_unpackhi_epi8(g, zero),
+                    _mm_unpackhi_epi8(bb, zero));
+            _mm_storeu_si128((__m128i *) (out + x), _mm_packus_epi16(lo, hi));
+            continue;
+        }
+
+        uint8_t planes[3][16] __attribute__((aligned(16)));
+        _mm_store_si128((__m128i *) planes[0], rr);
+        _mm_store_si128((__m128i *) planes[1], g);
+        _mm_store_si128((__m128i *) planes[2], bb);
+        uint8_t *o = out + 3 * x;
+        for (int i = 0; i < 16; i++) {
+            o[3 * i + 0] = planes[0][i];
+            o[3 * i + 1] = planes[1][i];
+            o[3 * i + 2] = planes[2][i];
+        }
+    }
+
+    // x is a multiple of 16, so the tail starts on the same CFA color as the row
+    convert_kernels_scalar.bayer_row(up + x, mid + x, down + x, out + (grey ? x : 3 * x),
+            width - x, g_first, red_row, edge_aware, grey);
+}
+
+/*
+ * Samples are shifted down by at least 2, which keeps them positive for the signed saturation
+ * of packus
+ */
+SSE2 static void unpack16_sse2(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i a = _mm_srl_epi16(_mm_loadu_si128((const __m128i *) (src + 2 * x)), count);
+        __m128i b = _mm_srl_epi16(_mm_loadu_si128((const __m128i *) (src + 2 * x + 16)), count);
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(a, b));
+    }
+    convert_kernels_scalar.unpack16(src + 2 * x, dst + x, width - x, shift);
+}
+
+/*
+ * Gathering the bits of packed 10-bit samples takes a byte shuffle, which SSE2 doesn't have
+ */
+static void unpack_y10b_sse2(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    convert_kernels_scalar.unpack_y10b(src, dst, width, shift);
+}
+
+static void unpack_y10p_sse2(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    convert_kernels_scalar.unpack_y10p(src, dst, width, shift);
+}
+
+SSE2 static void shift16_sse2(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src + 2 * x));
+        _mm_storeu_si128((__m128i *) (dst + 2 * x), _mm_sll_epi16(a, count));
+    }
+    convert_kernels_scalar.shift16(src + 2 * x, dst + 2 * x, width - x, shift);
+}
+
+/*
+ * Blends multiply 16-bit words: 255 * 256 + 128 still fits without a sign bit to care about
+ */
+SSE2 static inline __m128i lerp_sse2(__m128i a, __m128i b, __m128i w0, __m128i w1) {
+    __m128i v = _mm_add_epi16(_mm_mullo_epi16(a, w0), _mm_mullo_epi16(b, w1));
+    return _mm_srli_epi16(_mm_add_epi16(v, _mm_set1_epi16(128)), 8);
+}
+
+SSE2 static void lerp_row_sse2(const uint8_t *row0, const uint8_t *row1, uint8_t *out, int n,
+        int frac) {
+    const __m128i w0 = _mm_set1_epi16(256 - frac), w1 = _mm_set1_epi16(frac);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (row0 + x));
+        __m128i b = _mm_loadu_si128((const __m128i *) (row1 + x));
+        __m128i lo = lerp_sse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), w0, w1);
+        __m128i hi = lerp_sse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), w0, w1);
+        _mm_storeu_si128((__m128i *) (out + x), _mm_packus_epi16(lo, hi));
+    }
+    convert_kernels_scalar.lerp_row(row0 + x, row1 + x, out + x, n - x, frac);
+}
+
+SSE2 static void sum_row_sse2(const uint8_t *row, uint16_t *acc, int n, int first) {
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (row + x));
+        __m128i lo = _mm_unpacklo_epi8(a, zero), hi = _mm_unpackhi_epi8(a, zero);
+        if (!first) {
+            lo = _mm_add_epi16(lo, _mm_loadu_si128((const __m128i *) (acc + x)));
+            hi = _mm_add_epi16(hi, _mm_loadu_si128((const __m128i *) (acc + x + 8)));
+        }
+        _mm_storeu_si128((__m128i *) (acc + x), lo);
+        _mm_storeu_si128((__m128i *) (acc + x + 8), hi);
+    }
+    convert_kernels_scalar.sum_row(row + x, acc + x, n - x, first);
+}
+
+SSE2 static uint32_t sad_row_sse2(const uint8_t *row0, const uint8_t *row1, int n) {
+    // psadbw leaves two 64-bit sums
+    __m128i sum = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (row0 + x));
+        __m128i b = _mm_loadu_si128((const __m128i *) (row1 + x));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(a, b));
+    }
+    uint32_t sad = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+    return sad + convert_kernels_scalar.sad_row(row0 + x, row1 + x, n - x);
+}
+
+const struct convert_kernels convert_kernels_sse2 = {
+    .name = "sse2",
+    .packed_y = packed_y_sse2,
+    .packed_uv = packed_uv_sse2,
+    .split_uv = split_uv_sse2,
+    .yuv_to_rgb = yuv_to_rgb_sse2,
+    .bayer_row = bayer_row_sse2,
+    .unpack16 = unpack16_sse2,
+    .unpack_y10b = unpack_y10b_sse2,
+    .unpack_y10p = unpack_y10p_sse2,
+    .shift16 = shift16_sse2,
+    .lerp_row = lerp_row_sse2,
+    .sum_row = sum_row_sse2,
+    .sad_row = sad_row_sse2,
+};
+
+/*
+ * AVX2
+ *
+ * Packs work within 128-bit lanes, so their results come out with the lanes interleaved and
+ * get put back in order with a cross-lane permute.
+ */
+
+AVX2 static inline __m256i low_bytes_avx2(__m256i a, int high) {
+    return high ? _mm256_srli_epi16(a, 8) : _mm256_and_si256(a, _mm256_set1_epi16(0x00ff));
+}
+
+AVX2 static inline __m256i pack_ordered_avx2(__m256i a, __m256i b) {
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+}
+
+AVX2 static void packed_y_avx2(const uint8_t *src, uint8_t *y, int width, int y_offset) {
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (src + 2 * x));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src + 2 * x + 32));
+        _mm256_storeu_si256((__m256i *) (y + x),
+                pack_ordered_avx2(low_bytes_avx2(a, y_offset), low_bytes_avx2(b, y_offset)));
+    }
+    packed_y_tail(src, y, x, width, y_offset);
+}
+
+AVX2 static void packed_uv_avx2(const uint8_t *row0, const uint8_t *row1, uint8_t *u,
+        uint8_t *v, int width, int uv_offset) {
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int x = 0;
+    for (; x + 64 <= width; x += 64) {
+        __m256i c[4];
+        for (int i = 0; i < 4; i++) {
+            __m256i a = _mm256_loadu_si256((const __m256i *) (row0 + 2 * x + 32 * i));
+            __m256i b = _mm256_loadu_si256((const __m256i *) (row1 + 2 * x + 32 * i));
+            c[i] = low_bytes_avx2(_mm256_avg_epu8(a, b), uv_offset);
+        }
+
+        // Two in-lane packs leave groups of 4 pixel pairs in dword order 0 2 4 6 1 3 5 7
+        __m256i p0 = _mm256_packus_epi16(c[0], c[1]);
+        __m256i p1 = _mm256_packus_epi16(c[2], c[3]);
+        __m256i uu = _mm256_packus_epi16(low_bytes_avx2(p0, 0), low_bytes_avx2(p1, 0));
+        __m256i vv = _mm256_packus_epi16(low_bytes_avx2(p0, 1), low_bytes_avx2(p1, 1));
+        _mm256_storeu_si256((__m256i *) (u + x / 2), _mm256_permutevar8x32_epi32(uu, order));
+        _mm256_storeu_si256((__m256i *) (v + x / 2), _mm256_permutevar8x32_epi32(vv, order));
+    }
+    packed_uv_tail(row0, row1, u, v, x, width, uv_offset);
+}
+
+AVX2 static void split_uv_avx2(const uint8_t *uv, uint8_t *u, uint8_t *v, int pairs) {
+    int x = 0;
+    for (; x + 32 <= pairs; x += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (uv + 2 * x));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (uv + 2 * x + 32));
+        _mm256_storeu_si256((__m256i *) (u + x),
+                pack_ordered_avx2(low_bytes_avx2(a, 0), low_bytes_avx2(b, 0)));
+        _mm256_storeu_si256((__m256i *) (v + x),
+                pack_ordered_avx2(low_bytes_avx2(a, 1), low_bytes_avx2(b, 1)));
+    }
+    split_uv_tail(uv, u, v, x, pairs);
+}
+
+/*
+ * Byte shuffles spreading 16 R, G or B values over the three 16-byte blocks of 16 RGB24
+ * pixels, -1 clears the byte
+ */
+static const int8_t rgb_shuffle[3][3][16] __attribute__((aligned(16))) = {
+    {
+        { 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+        { -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+        { -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 },
+    },
+    {
+        { -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+        { 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+        { -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 },
+    },
+    {
+        { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+        { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+        { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 },
+    },
+};
+
+/**
+ * store_rgb_avx2 - interleave 16 pixels worth of R, G and B bytes into RGB24
+ */
+AVX2 static inline void store_rgb_avx2(uint8_t *out, __m128i r, __m128i g, __m128i b) {
+    for (int k = 0; k < 3; k++) {
+        __m128i block = _mm_or_si128(
+                _mm_shuffle_epi8(r, _mm_load_si128((const __m128i *) rgb_shuffle[k][0])),
+                _mm_or_si128(
+                    _mm_shuffle_epi8(g, _mm_load_si128((const __m128i *) rgb_shuffle[k][1])),
+                    _mm_shuffle_epi8(b, _mm_load_si128((const __m128i *) rgb_shuffle[k][2]))));
+        _mm_storeu_si128((__m128i *) (out + 16 * k), block);
+    }
+}
+
+AVX2 static inline __m256i rgb_channel_avx2(__m256i acc, int saturate) {
+    acc = saturate ? _mm256_adds_epi16(acc, _mm256_set1_epi16(32))
+        : _mm256_add_epi16(acc, _mm256_set1_epi16(32));
+    return _mm256_srai_epi16(acc, 6);
+}
+
+AVX2 static void yuv_to_rgb_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+        uint8_t *rgb, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // 16 pixels at 16 bits per value fill one 256-bit register
+        __m256i yv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y + x)));
+        __m128i u8 = _mm_loadl_epi64((const __m128i *) (u + x / 2));
+        __m128i v8 = _mm_loadl_epi64((const __m128i *) (v + x / 2));
+        __m256i uv = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u8, u8));
+        __m256i vv = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v8, v8));
+
+        __m256i c = _mm256_mullo_epi16(_mm256_sub_epi16(yv, _mm256_set1_epi16(16)),
+                _mm256_set1_epi16(75));
+        __m256i d = _mm256_sub_epi16(uv, _mm256_set1_epi16(128));
+        __m256i e = _mm256_sub_epi16(vv, _mm256_set1_epi16(128));
+
+        __m256i r = rgb_channel_avx2(
+                _mm256_adds_epi16(c, _mm256_mullo_epi16(e, _mm256_set1_epi16(102))), 1);
+        __m256i g = rgb_channel_avx2(_mm256_sub_epi16(
+                    _mm256_sub_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(25))),
+                    _mm256_mullo_epi16(e, _mm256_set1_epi16(52))), 0);
+        __m256i b = rgb_channel_avx2(
+                _mm256_adds_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(129))), 1);
+
+        // Pack to bytes, with the 16 pixels in order in the low lane
+        __m256i rg = pack_ordered_avx2(r, g);
+        __m256i bb = pack_ordered_avx2(b, b);
+        store_rgb_avx2(rgb + 3 * x, _mm256_castsi256_si128(rg),
+                _mm256_extracti128_si256(rg, 1), _mm256_castsi256_si128(bb));
+    }
+    yuv_to_rgb_tail(y, u, v, rgb, x, width);
+}
+
+AVX2 static inline __m256i select_avx2(__m256i mask, __m256i a, __m256i b) {
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+AVX2 static inline __m256i absdiff_avx2(__m256i a, __m256i b) {
+    return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+}
+
+AVX2 static inline __m256i luma_avx2(__m256i r, __m256i g, __m256i b) {
+    __m256i y = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(77)),
+            _mm256_mullo_epi16(g, _mm256_set1_epi16(150)));
+    y = _mm256_add_epi16(y, _mm256_mullo_epi16(b, _mm256_set1_epi16(29)));
+    return _mm256_srli_epi16(_mm256_add_epi16(y, _mm256_set1_epi16(128)), 8);
+}
+
+AVX2 static void bayer_row_avx2(const uint8_t *up, const uint8_t *mid, const uint8_t *down,
+        uint8_t *out, int width, int g_first, int red_row, int edge_aware, int grey) {
+    const __m256i green = _mm256_set1_epi16(g_first ? 0x00ff : (short) 0xff00);
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+#define LOAD(p) _mm256_loadu_si256((const __m256i *) (p))
+        __m256i c = LOAD(mid + x), l = LOAD(mid + x - 1), r = LOAD(mid + x + 1);
+        __m256i u = LOAD(up + x), d = LOAD(down + x);
+        __m256i diag = _mm256_avg_epu8(_mm256_avg_epu8(LOAD(up + x - 1), LOAD(up + x + 1)),
+                _mm256_avg_epu8(LOAD(down + x - 1), LOAD(down + x + 1)));
+#undef LOAD
+        __m256i h = _mm256_avg_epu8(l, r);
+        __m256i v = _mm256_avg_epu8(u, d);
+        __m256i g = _mm256_avg_epu8(h, v);
+        if (edge_aware) {
+            __m256i gh = absdiff_avx2(l, r), gv = absdiff_avx2(u, d);
+            __m256i same = _mm256_cmpeq_epi8(gh, gv);
+            __m256i h_less = _mm256_andnot_si256(same,
+                    _mm256_cmpeq_epi8(_mm256_max_epu8(gh, gv), gv));
+            g = select_avx2(same, g, select_avx2(h_less, h, v));
+        }
+
+        __m256i own = select_avx2(green, h, c);
+        __m256i other = select_avx2(green, v, diag);
+        g = select_avx2(green, c, g);
+        __m256i rr = red_row ? own : other;
+        __m256i bb = red_row ? other : own;
+
+        if (grey) {
+            // Unpacking and packing within the same lanes keeps the pixels in order
+            __m256i lo = luma_avx2(_mm256_unpacklo_epi8(rr, zero),
+                    _mm256_unpacklo_epi8(g, zero), _mm256_unpacklo_epi8(bb, zero));
+            __m256i hi = luma_avx2(_mm256_unpackhi_epi8(rr, zero),
+                    _mm256_unpackhi_epi8(g, zero), _mm256_unpackhi_epi8(bb, zero));
+            _mm256_storeu_si256((__m256i *) (out + x), _mm256_packus_epi16(lo, hi));
+            continue;
+        }
+
+        store_rgb_avx2(out + 3 * x, _mm256_castsi256_si128(rr), _mm256_castsi256_si128(g),
+                _mm256_castsi256_si128(bb));
+        store_rgb_avx2(out + 3 * x + 48, _mm256_extracti128_si256(rr, 1),
+                _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(bb, 1));
+    }
+
+    convert_kernels_scalar.bayer_row(up + x, mid + x, down + x, out + (grey ? x : 3 * x),
+            width - x, g_first, red_row, edge_aware, grey);
+}
+
+AVX2 static void unpack16_avx2(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i a = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) (src + 2 * x)), count);
+        __m256i b = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) (src + 2 * x + 32)),
+                count);
+        _mm256_storeu_si256((__m256i *) (dst + x), pack_ordered_avx2(a, b));
+    }
+    convert_kernels_scalar.unpack16(src + 2 * x, dst + x, width - x, shift);
+}
+
+/*
+ * Byte shuffles gathering 8 packed 10-bit samples (10 bytes) per lane into 16-bit words.
+ * Y10BPACK takes the two bytes holding each sample, big-endian; Y10P the high 8 bits of every
+ * sample, and the byte with their low 2 bits.
+ */
+static const int8_t y10b_shuffle[16] __attribute__((aligned(16))) = {
+    1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8,
+};
+static const int8_t y10p_high_shuffle[16] __attribute__((aligned(16))) = {
+    0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8, -1,
+};
+static const int8_t y10p_low_shuffle[16] __attribute__((aligned(16))) = {
+    4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1,
+};
+
+/**
+ * load_y10_avx2 - 16 packed 10-bit samples, 8 from "src" in the low lane and 8 from "src" + 10
+ * in the high one
+ */
+AVX2 static inline __m256i load_y10_avx2(const uint8_t *src) {
+    return _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) src)),
+            _mm_loadu_si128((const __m128i *) (src + 10)), 1);
+}
+
+AVX2 static inline __m256i shuffle_avx2(__m256i a, const int8_t *table) {
+    return _mm256_shuffle_epi8(a, _mm256_broadcastsi128_si256(
+                _mm_load_si128((const __m128i *) table)));
+}
+
+/*
+ * The loads of 16 samples read 26 bytes, so the loops stop while at least 24 samples (30 bytes)
+ * of the row are left
+ */
+AVX2 static void unpack_y10b_avx2(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    // Sample i of 4 sits 2i bits further into its big-endian word, shift it to the top
+    const __m256i align = _mm256_setr_epi16(1, 4, 16, 64, 1, 4, 16, 64,
+            1, 4, 16, 64, 1, 4, 16, 64);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x = 0;
+    for (; x + 24 <= width; x += 16) {
+        __m256i words = shuffle_avx2(load_y10_avx2(src + 5 * x / 4), y10b_shuffle);
+        __m256i v = _mm256_srli_epi16(_mm256_mullo_epi16(words, align), 6);
+        _mm256_storeu_si256((__m256i *) (dst + 2 * x), _mm256_sll_epi16(v, count));
+    }
+    convert_kernels_scalar.unpack_y10b(src + 5 * x / 4, dst + 2 * x, width - x, shift);
+}
+
+AVX2 static void unpack_y10p_avx2(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    // Moves the low 2 bits of sample i of 4 to bits 8 and 9
+    const __m256i align = _mm256_setr_epi16(256, 64, 16, 4, 256, 64, 16, 4,
+            256, 64, 16, 4, 256, 64, 16, 4);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x = 0;
+    for (; x + 24 <= width; x += 16) {
+        __m256i packed = load_y10_avx2(src + 5 * x / 4);
+        __m256i high = _mm256_slli_epi16(shuffle_avx2(packed, y10p_high_shuffle), 2);
+        __m256i low = _mm256_mullo_epi16(shuffle_avx2(packed, y10p_low_shuffle), align);
+        low = _mm256_and_si256(_mm256_srli_epi16(low, 8), _mm256_set1_epi16(3));
+        _mm256_storeu_si256((__m256i *) (dst + 2 * x),
+                _mm256_sll_epi16(_mm256_or_si256(high, low), count));
+    }
+    convert_kernels_scalar.unpack_y10p(src + 5 * x / 4, dst + 2 * x, width - x, shift);
+}
+
+AVX2 static void shift16_avx2(const uint8_t *src, uint8_t *dst, int width, int shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (src + 2 * x));
+        _mm256_storeu_si256((__m256i *) (dst + 2 * x), _mm256_sll_epi16(a, count));
+    }
+    convert_kernels_scalar.shift16(src + 2 * x, dst + 2 * x, width - x, shift);
+}
+
+AVX2 static inline __m256i lerp_avx2(__m256i a, __m256i b, __m256i w0, __m256i w1) {
+    __m256i v = _mm256_add_epi16(_mm256_mullo_epi16(a, w0), _mm256_mullo_epi16(b, w1));
+    return _mm256_srli_epi16(_mm256_add_epi16(v, _mm256_set1_epi16(128)), 8);
+}
+
+AVX2 static void lerp_row_avx2(const uint8_t *row0, const uint8_t *row1, uint8_t *out, int n,
+        int frac) {
+    const __m256i w0 = _mm256_set1_epi16(256 - frac), w1 = _mm256_set1_epi16(frac);
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 32 <= n; x += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (row0 + x));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (row1 + x));
+        __m256i lo = lerp_avx2(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero),
+                w0, w1);
+        __m256i hi = lerp_avx2(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero),
+                w0, w1);
+        _mm256_storeu_si256((__m256i *) (out + x), _mm256_packus_epi16(lo, hi));
+    }
+    convert_kernels_scalar.lerp_row(row0 + x, row1 + x, out + x, n - x, frac);
+}
+
+AVX2 static void sum_row_avx2(const uint8_t *row, uint16_t *acc, int n, int first) {
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (row + x)));
+        if (!first) {
+            a = _mm256_add_epi16(a, _mm256_loadu_si256((const __m256i *) (acc + x)));
+        }
+        _mm256_storeu_si256((__m256i *) (acc + x), a);
+    }
+    convert_kernels_scalar.sum_row(row + x, acc + x, n - x, first);
+}
+
+AVX2 static uint32_t sad_row_avx2(const uint8_t *row0, const uint8_t *row1, int n) {
+    __m256i sum = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 32 <= n; x += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (row0 + x));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (row1 + x));
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(a, b));
+    }
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    uint32_t sad = _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+    return sad + convert_kernels_scalar.sad_row(row0 + x, row1 + x, n - x);
+}
+
+const struct convert_kernels convert_kernels_avx2 = {
+    .name = "avx2",
+    .packed_y = packed_y_avx2,
+    .packed_uv = packed_uv_avx2,
+    .split_uv = split_uv_avx2,
+    .yuv_to_rgb = yuv_to_rgb_avx2,
+    .bayer_row = bayer_row_avx2,
+    .unpack16 = unpack16_avx2,
+    .unpack_y10b = unpack_y10b_avx2,
+    .unpack_y10p = unpack_y10p_avx2,
+    .shift16 = shift16_avx2,
+    .lerp_row = lerp_row_avx2,
+    .sum_row = sum_row_avx2,
+    .sad_row = sad_row_avx2,
+};
+#endif
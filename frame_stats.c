@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <linux/videodev2.h>
+
+#include "frame_stats.h"
+
+/*
+ * Log-linear histogram: values below HIST_SUB_COUNT get a bucket each, above that every power
+ * of two is split into HIST_SUB_COUNT equal buckets.  Recording is a count-leading-zeros and a
+ * shift, and the relative error of a reported value is below 1 / HIST_SUB_COUNT.
+ */
+
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+struct histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[HIST_BUCKETS];
+};
+
+static unsigned int hist_index(uint64_t v) {
+    if (v < HIST_SUB_COUNT) {
+        return v;
+    }
+
+    unsigned int msb = 63 - __builtin_clzll(v);
+    unsigned int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + (unsigned int) ((v >> shift) - HIST_SUB_COUNT);
+}
+
+/**
+ * hist_value - the middle of the range of values counted in bucket "i"
+ */
+static uint64_t hist_value(unsigned int i) {
+    if (i < HIST_SUB_COUNT) {
+        return i;
+    }
+
+    unsigned int shift = i / HIST_SUB_COUNT - 1;
+    uint64_t sub = (i % HIST_SUB_COUNT) + HIST_SUB_COUNT;
+    return (sub << shift) + ((1ULL << shift) >> 1);
+}
+
+static void hist_record(struct histogram *h, uint64_t v) {
+    if (h->count == 0 || v < h->min) {
+        h->min = v;
+    }
+    if (v > h->max) {
+        h->max = v;
+    }
+    h->count++;
+    h->sum += v;
+    h->buckets[hist_index(v)]++;
+}
+
+static uint64_t hist_percentile(const struct histogram *h, double pct) {
+    uint64_t want = (uint64_t) (h->count * pct / 100.0 + 0.5);
+    if (want == 0) {
+        want = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= want) {
+            uint64_t v = hist_value(i);
+            return (v > h->max) ? h->max : (v < h->min) ? h->min : v;
+        }
+    }
+
+    return h->max;
+}
+
+/*
+ * Frame stats
+ */
+
+enum stage {
+    STAGE_DRIVER,       // driver timestamp to dequeue
+    STAGE_WRITE,        // dequeue to the sink being done with the frame
+    STAGE_REQUEUE,      // sink done to the buffer being back with the driver
+    STAGE_TOTAL,        // driver timestamp to the sink being done with the frame
+    STAGE_COUNT,
+};
+
+static const char *stage_names[STAGE_COUNT] = {
+    "capture -> dequeue",
+    "dequeue -> written",
+    "written -> requeued",
+    "capture -> written",
+};
+
+struct frame_stats {
+    struct histogram hist[STAGE_COUNT];
+    struct frame_trace_record inflight[VIDEO_MAX_FRAME];
+
+    int seq_valid;
+    uint32_t next_seq;
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t gaps;
+    uint64_t no_timestamp;      // frames whose timestamp isn't on our clock
+
+    FILE *trace;
+    int trace_error;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * frame_stats_create - start collecting frame stats, also tracing every frame to "trace_name"
+ *
+ * Pass a NULL "trace_name" to only keep the histograms.
+ * @returns the new stats, or NULL with errno set
+ */
+struct frame_stats *frame_stats_create(const char *trace_name) {
+    struct frame_stats *st = calloc(1, sizeof(struct frame_stats));
+    if (st == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (trace_name == NULL) {
+        return st;
+    }
+
+    st->trace = fopen(trace_name, "w");
+    if (st->trace == NULL) {
+        int err = errno;
+        free(st);
+        errno = err;
+        return NULL;
+    }
+
+    // Records are small, let them pile up into large writes
+    setvbuf(st->trace, NULL, _IOFBF, 1 << 20);
+
+    struct frame_trace_header hdr = {
+        .magic = FRAME_TRACE_MAGIC,
+        .version = FRAME_TRACE_VERSION,
+        .record_size = sizeof(struct frame_trace_record),
+    };
+    if (!fwrite(&hdr, sizeof(hdr), 1, st->trace)) {
+        st->trace_error = errno;
+    }
+
+    return st;
+}
+
+/**
+ * frame_stats_dequeued - note that "buf" was just dequeued
+ *
+ * @returns how many frames are missing from the sequence right before this one
+ */
+uint32_t frame_stats_dequeued(struct frame_stats *st, const struct v4l2_buffer *buf) {
+    uint64_t now = monotonic_ns();
+
+    uint32_t gap = st->seq_valid ? buf->sequence - st->next_seq : 0;
+    st->seq_valid = 1;
+    st->next_seq = buf->sequence + 1;
+    st->frames++;
+    if (gap > 0) {
+        st->dropped += gap;
+        st->gaps++;
+    }
+
+    if (buf->index >= VIDEO_MAX_FRAME) {
+        return gap;
+    }
+
+    struct frame_trace_record *rec = &st->inflight[buf->index];
+    memset(rec, 0, sizeof(*rec));
+    rec->sequence = buf->sequence;
+    rec->index = buf->index;
+    rec->flags = buf->flags;
+    rec->dropped = gap;
+    rec->dequeue_ns = now;
+
+    // Only monotonic timestamps can be compared with our clock
+    if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        rec->timestamp_ns = (uint64_t) buf->timestamp.tv_sec * 1000000000ULL
+            + (uint64_t) buf->timestamp.tv_usec * 1000;
+        if (rec->timestamp_ns <= now) {
+            hist_record(&st->hist[STAGE_DRIVER], now - rec->timestamp_ns);
+        }
+    } else {
+        st->no_timestamp++;
+    }
+
+    return gap;
+}
+
+/**
+ * frame_stats_written - note that the sink is done with buffer "index"
+ */
+void frame_stats_written(struct frame_stats *st, uint32_t index) {
+    if (index >= VIDEO_MAX_FRAME) {
+        return;
+    }
+
+    struct frame_trace_record *rec = &st->inflight[index];
+    rec->written_ns = monotonic_ns();
+    hist_record(&st->hist[STAGE_WRITE], rec->written_ns - rec->dequeue_ns);
+    if (rec->timestamp_ns != 0 && rec->timestamp_ns <= rec->written_ns) {
+        hist_record(&st->hist[STAGE_TOTAL], rec->written_ns - rec->timestamp_ns);
+    }
+}
+
+/**
+ * frame_stats_requeued - note that buffer "index" is back with the driver, and trace the frame
+ */
+void frame_stats_requeued(struct frame_stats *st, uint32_t index) {
+    if (index >= VIDEO_MAX_FRAME) {
+        return;
+    }
+
+    struct frame_trace_record *rec = &st->inflight[index];
+    rec->requeue_ns = monotonic_ns();
+    hist_record(&st->hist[STAGE_REQUEUE], rec->requeue_ns - rec->written_ns);
+
+    if (st->trace != NULL && st->trace_error == 0 && !fwrite(rec, sizeof(*rec), 1, st->trace)) {
+        st->trace_error = errno;
+    }
+}
+
+/**
+ * frame_stats_restart - the source restarted streaming, and its sequence numbers with it
+ */
+void frame_stats_restart(struct frame_stats *st) {
+    st->seq_valid = 0;
+}
+
+/**
+ * frame_stats_dropped - how many frames the source dropped so far
+ */
+uint64_t frame_stats_dropped(const struct frame_stats *st) {
+    return st->dropped;
+}
+
+/**
+ * frame_stats_print - print the frame counts and a latency summary of every stage
+ */
+void frame_stats_print(const struct frame_stats *st, FILE *out) {
+    fprintf(out, "Frames: %llu captured, %llu dropped in %llu gaps\n",
+            (unsigned long long) st->frames, (unsigned long long) st->dropped,
+            (unsigned long long) st->gaps);
+    if (st->no_timestamp > 0) {
+        fprintf(out, "%llu frames had no monotonic driver timestamp\n",
+                (unsigned long long) st->no_timestamp);
+    }
+
+    fprintf(out, "Latency in us         %8s %9s %9s %9s %9s %9s %9s %9s\n",
+            "frames", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        const struct histogram *h = &st->hist[s];
+        if (h->count == 0) {
+            continue;
+        }
+
+        fprintf(out, "  %-19s %8llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", stage_names[s],
+                (unsigned long long) h->count, h->min / 1000.0,
+                (double) h->sum / h->count / 1000.0, hist_percentile(h, 50) / 1000.0,
+                hist_percentile(h, 90) / 1000.0, hist_percentile(h, 99) / 1000.0,
+                hist_percentile(h, 99.9) / 1000.0, h->max / 1000.0);
+    }
+}
+
+/**
+ * frame_stats_close - finish the trace file and free the stats
+ *
+ * @returns 0, or -1 with errno set if the trace couldn't be written completely
+ */
+int frame_stats_close(struct frame_stats *st) {
+    if (st == NULL) {
+        return 0;
+    }
+
+    int err = st->trace_error;
+    if (st->trace != NULL && EOF == fclose(st->trace) && err == 0) {
+        err = errno;
+    }
+
+    free(st);
+    errno = err;
+    return (err == 0) ? 0 : -1;
+}
@@ -0,0 +1,49 @@
+#ifndef __FRAME_STATS_H_
+#define __FRAME_STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+/*
+ * Per-frame timing: when the driver captured a frame, when we dequeued it, when the sink was
+ * done with it and when it went back to the driver.  Every stage feeds a log-linear histogram
+ * (HDR-style: about 1% precision from nanoseconds to minutes, in constant memory), and every
+ * frame can also be appended to a binary trace file.
+ *
+ * The trace file starts with a frame_trace_header, followed by one frame_trace_record per
+ * frame, in the order buffers were requeued.  All times are CLOCK_MONOTONIC nanoseconds.
+ */
+
+#define FRAME_TRACE_MAGIC 0x52544343    // "CCTR"
+#define FRAME_TRACE_VERSION 1
+
+struct frame_trace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+struct frame_trace_record {
+    uint32_t sequence;
+    uint32_t index;
+    uint32_t flags;             // v4l2_buffer flags
+    uint32_t dropped;           // frames missing from the sequence right before this one
+    uint64_t timestamp_ns;      // driver timestamp, 0 unless it is on CLOCK_MONOTONIC
+    uint64_t dequeue_ns;
+    uint64_t written_ns;
+    uint64_t requeue_ns;
+};
+
+struct frame_stats;
+
+struct frame_stats *frame_stats_create(const char *trace_name);
+uint32_t frame_stats_dequeued(struct frame_stats *st, const struct v4l2_buffer *buf);
+void frame_stats_written(struct frame_stats *st, uint32_t index);
+void frame_stats_requeued(struct frame_stats *st, uint32_t index);
+void frame_stats_restart(struct frame_stats *st);
+uint64_t frame_stats_dropped(const struct frame_stats *st);
+void frame_stats_print(const struct frame_stats *st, FILE *out);
+int frame_stats_close(struct frame_stats *st);
+#endif
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#include "frame_sync.h"
+
+/*
+ * Every stream has a FIFO of "depth" frames.  Once they all have a frame, the newest of the
+ * oldest frames decides: a stream's oldest frame more than the tolerance before it can't match
+ * anything that is still to come from that newest stream, so it's dropped.  When no frame is
+ * dropped the oldest frames are within the tolerance of each other, and they make a set.
+ */
+
+struct sync_queue {
+    struct v4l2_buffer frames[VIDEO_MAX_FRAME];
+    int head;
+    int len;
+    uint64_t unmatched;
+    uint64_t late;
+};
+
+struct frame_sync {
+    int streams;
+    int depth;
+    uint64_t tolerance_ns;
+    frame_sync_emit_fn emit;
+    frame_sync_drop_fn drop;
+    void *arg;
+
+    uint64_t sets;
+    uint64_t spread_sum;
+    uint64_t spread_max;
+    struct sync_queue queues[];
+};
+
+static uint64_t timestamp_ns(const struct v4l2_buffer *buf) {
+    return (uint64_t) buf->timestamp.tv_sec * 1000000000ULL
+        + (uint64_t) buf->timestamp.tv_usec * 1000;
+}
+
+static struct v4l2_buffer *queue_head(struct sync_queue *q) {
+    return &q->frames[q->head];
+}
+
+static void queue_pop(struct frame_sync *fs, struct sync_queue *q) {
+    q->head = (q->head + 1) % fs->depth;
+    q->len--;
+}
+
+/**
+ * drop_head - hand the oldest frame of "stream" back, and count why
+ */
+static void drop_head(struct frame_sync *fs, int stream, enum frame_sync_drop why) {
+    struct sync_queue *q = &fs->queues[stream];
+    struct v4l2_buffer buf = *queue_head(q);
+    queue_pop(fs, q);
+
+    if (why == FRAME_SYNC_UNMATCHED) {
+        q->unmatched++;
+    } else if (why == FRAME_SYNC_LATE) {
+        q->late++;
+    }
+    fs->drop(fs->arg, stream, &buf, why);
+}
+
+/**
+ * match - emit every set the queued frames make up
+ */
+static int match(struct frame_sync *fs) {
+    for (;;) {
+        uint64_t newest = 0, oldest = UINT64_MAX;
+        for (int s = 0; s < fs->streams; s++) {
+            struct sync_queue *q = &fs->queues[s];
+            if (q->len == 0) {
+                return 0;
+            }
+
+            uint64_t ts = timestamp_ns(queue_head(q));
+            newest = (ts > newest) ? ts : newest;
+            oldest = (ts < oldest) ? ts : oldest;
+        }
+
+        if (newest - oldest > fs->tolerance_ns) {
+            for (int s = 0; s < fs->streams; s++) {
+                if (timestamp_ns(queue_head(&fs->queues[s])) + fs->tolerance_ns < newest) {
+                    drop_head(fs, s, FRAME_SYNC_UNMATCHED);
+                }
+            }
+            continue;
+        }
+
+        struct v4l2_buffer set[FRAME_SYNC_MAX_STREAMS];
+        for (int s = 0; s < fs->streams; s++) {
+            struct sync_queue *q = &fs->queues[s];
+            set[s] = *queue_head(q);
+            queue_pop(fs, q);
+        }
+
+        uint64_t spread = newest - oldest;
+        fs->spread_sum += spread;
+        if (spread > fs->spread_max) {
+            fs->spread_max = spread;
+        }
+
+        if (-1 == fs->emit(fs->arg, fs->sets++, set, fs->streams, spread)) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * frame_sync_create - start grouping the frames of "streams" cameras into sets
+ *
+ * Each stream queues at most "depth" frames while waiting for the others, and frames in a set
+ * are at most "tolerance_ns" apart.  "emit" gets every set, "drop" every other frame.
+ * @returns the new frame sync, or NULL with errno set
+ */
+struct frame_sync *frame_sync_create(int streams, int depth, uint64_t tolerance_ns,
+        frame_sync_emit_fn emit, frame_sync_drop_fn drop, void *arg) {
+    if (streams < 1 || streams > FRAME_SYNC_MAX_STREAMS || depth < 1 || depth > VIDEO_MAX_FRAME
+            || emit == NULL || drop == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct frame_sync *fs = calloc(1, sizeof(struct frame_sync)
+            + streams * sizeof(struct sync_queue));
+    if (fs == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    fs->streams = streams;
+    fs->depth = depth;
+    fs->tolerance_ns = tolerance_ns;
+    fs->emit = emit;
+    fs->drop = drop;
+    fs->arg = arg;
+    return fs;
+}
+
+/**
+ * frame_sync_push - queue a frame just dequeued from "stream", and emit any set it completes
+ *
+ * The frame's buffer comes back through the emit or the drop callback, possibly right away.
+ * Only frames with monotonic timestamps can be compared with other devices' frames, any other
+ * is refused with EINVAL, and its buffer stays with the caller.
+ * @returns 0, or -1 with errno set if the frame was refused or emitting a set failed
+ */
+int frame_sync_push(struct frame_sync *fs, int stream, const struct v4l2_buffer *buf) {
+    struct sync_queue *q = &fs->queues[stream];
+
+    if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (q->len == fs->depth) {
+        drop_head(fs, stream, FRAME_SYNC_LATE);
+    }
+    q->frames[(q->head + q->len) % fs->depth] = *buf;
+    q->len++;
+
+    return match(fs);
+}
+
+/**
+ * frame_sync_flush - drop every frame still waiting for a set
+ */
+void frame_sync_flush(struct frame_sync *fs) {
+    for (int s = 0; s < fs->streams; s++) {
+        while (fs->queues[s].len > 0) {
+            drop_head(fs, s, FRAME_SYNC_FLUSHED);
+        }
+    }
+}
+
+/**
+ * frame_sync_print - print how many sets were made, and how many frames of each stream weren't
+ */
+void frame_sync_print(const struct frame_sync *fs, FILE *out) {
+    fprintf(out, "Frame sets: %llu within %.1f us, spread mean %.1f us, max %.1f us\n",
+            (unsigned long long) fs->sets, fs->tolerance_ns / 1000.0,
+            fs->sets ? (double) fs->spread_sum / fs->sets / 1000.0 : 0.0,
+            fs->spread_max / 1000.0);
+    for (int s = 0; s < fs->streams; s++) {
+        fprintf(out, "  stream %d: %llu unmatched, %llu late\n", s,
+                (unsigned long long) fs->queues[s].unmatched,
+                (unsigned long long) fs->queues[s].late);
+    }
+}
+
+void frame_sync_close(struct frame_sync *fs) {
+    free(fs);
+}
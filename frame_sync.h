@@ -0,0 +1,50 @@
+#ifndef __FRAME_SYNC_H_
+#define __FRAME_SYNC_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+/*
+ * Frame sets across cameras: every stream's dequeued frames wait in a short queue until each
+ * stream has a frame whose timestamp lies within the tolerance of the others'.  Those frames go
+ * out together as one set.  Timestamps of different devices can only be compared on the
+ * monotonic clock, so frames with any other kind are refused.
+ *
+ * A frame that is too old to ever join a set is dropped as unmatched.  A stream whose queue is
+ * full drops its oldest frame as late.  Either way its buffer is handed back, so a stalled
+ * camera can't make the others hold on to more than their queue depth.
+ */
+
+#define FRAME_SYNC_MAX_STREAMS 16
+
+enum frame_sync_drop {
+    FRAME_SYNC_UNMATCHED,       // no frame of another stream was close enough in time
+    FRAME_SYNC_LATE,            // the queue was full waiting for the other streams
+    FRAME_SYNC_FLUSHED,         // still waiting when the sets were flushed
+};
+
+/**
+ * frame_sync_emit_fn - a complete set, with one frame of each of the "streams", in stream order
+ *
+ * "spread_ns" is how far apart the frames' timestamps are.
+ * @returns 0, or -1 with errno set to stop the sync from going on
+ */
+typedef int (*frame_sync_emit_fn)(void *arg, uint64_t set, struct v4l2_buffer *bufs, int streams,
+        uint64_t spread_ns);
+
+/**
+ * frame_sync_drop_fn - a frame that won't be part of any set
+ */
+typedef void (*frame_sync_drop_fn)(void *arg, int stream, struct v4l2_buffer *buf,
+        enum frame_sync_drop why);
+
+struct frame_sync;
+
+struct frame_sync *frame_sync_create(int streams, int depth, uint64_t tolerance_ns,
+        frame_sync_emit_fn emit, frame_sync_drop_fn drop, void *arg);
+int frame_sync_push(struct frame_sync *fs, int stream, const struct v4l2_buffer *buf);
+void frame_sync_flush(struct frame_sync *fs);
+void frame_sync_print(const struct frame_sync *fs, FILE *out);
+void frame_sync_close(struct frame_sync *fs);
+#endif
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#include "motion.h"
+
+#define MOTION_MAX_SIZE 16384
+
+struct motion_detector {
+    const struct convert_kernels *k;
+    uint32_t fourcc;
+    uint32_t width;
+    uint32_t bpl;
+    int rows;                   // rows compared
+    int step;
+
+    // Luma of the rows compared, of the frame last measured and of the reference
+    uint8_t *cur;
+    uint8_t *ref;
+    int has_ref;
+    int measured;
+};
+
+/**
+ * motion_supported - whether frames of "fourcc" can be compared
+ */
+int motion_supported(uint32_t fourcc) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_GREY:
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_YVU420:
+        case V4L2_PIX_FMT_SBGGR8:
+        case V4L2_PIX_FMT_SGBRG8:
+        case V4L2_PIX_FMT_SGRBG8:
+        case V4L2_PIX_FMT_SRGGB8:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * motion_create - compare frames of "fmt" on every "step"th row
+ *
+ * "kernels" can be NULL for the fastest ones the CPU supports.
+ * @returns the new detector, or NULL with errno set
+ */
+struct motion_detector *motion_create(const struct v4l2_format *fmt, int step,
+        const struct convert_kernels *kernels) {
+    const struct v4l2_pix_format *pix = &fmt->fmt.pix;
+    if (!motion_supported(pix->pixelformat) || step < 1 || pix->width == 0 || pix->height == 0
+            || pix->width > MOTION_MAX_SIZE || pix->height > MOTION_MAX_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct motion_detector *md = calloc(1, sizeof(struct motion_detector));
+    if (md == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    md->k = (kernels != NULL) ? kernels : convert_kernels_best();
+    md->fourcc = pix->pixelformat;
+    md->width = pix->width & ~1u;
+    md->step = step;
+    md->rows = (pix->height + step - 1) / step;
+
+    int packed = (md->fourcc == V4L2_PIX_FMT_YUYV || md->fourcc == V4L2_PIX_FMT_UYVY);
+    md->bpl = pix->bytesperline;
+    if (md->bpl == 0) {
+        md->bpl = packed ? pix->width * 2 : pix->width;
+    }
+
+    md->cur = malloc((size_t) md->rows * md->width);
+    md->ref = malloc((size_t) md->rows * md->width);
+    if (md->cur == NULL || md->ref == NULL) {
+        motion_free(md);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return md;
+}
+
+/**
+ * motion_measure - compare the luma of "frame" with the reference
+ *
+ * @returns the mean absolute difference per sample, or -1 without a reference yet
+ */
+double motion_measure(struct motion_detector *md, const uint8_t *frame) {
+    uint64_t sad = 0;
+    for (int r = 0; r < md->rows; r++) {
+        const uint8_t *row = frame + (size_t) r * md->step * md->bpl;
+        uint8_t *cur = md->cur + (size_t) r * md->width;
+        if (md->fourcc == V4L2_PIX_FMT_YUYV || md->fourcc == V4L2_PIX_FMT_UYVY) {
+            md->k->packed_y(row, cur, md->width, md->fourcc == V4L2_PIX_FMT_UYVY);
+        } else {
+            memcpy(cur, row, md->width);
+        }
+
+        if (md->has_ref) {
+            sad += md->k->sad_row(cur, md->ref + (size_t) r * md->width, md->width);
+        }
+    }
+    md->measured = 1;
+
+    if (!md->has_ref) {
+        return -1;
+    }
+    return (double) sad / ((double) md->rows * md->width);
+}
+
+/**
+ * motion_keep - make the frame last measured the reference
+ */
+void motion_keep(struct motion_detector *md) {
+    if (!md->measured) {
+        return;
+    }
+
+    uint8_t *tmp = md->ref;
+    md->ref = md->cur;
+    md->cur = tmp;
+    md->has_ref = 1;
+    md->measured = 0;
+}
+
+void motion_free(struct motion_detector *md) {
+    if (md == NULL) {
+        return;
+    }
+
+    free(md->cur);
+    free(md->ref);
+    free(md);
+}
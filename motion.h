@@ -0,0 +1,54 @@
+#ifndef __MOTION_H_
+#define __MOTION_H_
+
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#include "convert.h"
+
+/*
+ * Change detection on the luma of frames: the mean absolute difference between a frame and a
+ * reference frame, over every "step"th row.  Luma is the Y of YUYV, UYVY and the semi-planar
+ * and planar YUV formats, the samples of GREY, and the raw samples of 8-bit Bayer frames.
+ *
+ * Frames that are let through can be logged, one motion_log_record per frame in the order they
+ * were written, after a motion_log_header, so the sequence numbers and timestamps of written
+ * frames are kept and the gaps between them stay visible.
+ */
+
+#define MOTION_LOG_MAGIC 0x4c4d4343     // "CCML"
+#define MOTION_LOG_VERSION 1
+
+struct motion_log_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+enum motion_reason {
+    MOTION_FIRST,       // there was nothing to compare with yet
+    MOTION_TRIGGER,     // it differs from the reference by more than the threshold
+    MOTION_PRE_ROLL,    // it came right before a trigger
+    MOTION_POST_ROLL,   // it came right after one
+};
+
+struct motion_log_record {
+    uint32_t sequence;
+    uint32_t flags;             // v4l2_buffer flags
+    uint32_t reason;            // enum motion_reason
+    uint32_t skipped;           // frames not written right before this one
+    uint32_t level;             // mean difference from the reference, in 256ths
+    uint32_t reserved;
+    uint64_t timestamp_ns;      // driver timestamp
+};
+
+struct motion_detector;
+
+int motion_supported(uint32_t fourcc);
+struct motion_detector *motion_create(const struct v4l2_format *fmt, int step,
+        const struct convert_kernels *kernels);
+double motion_measure(struct motion_detector *md, const uint8_t *frame);
+void motion_keep(struct motion_detector *md);
+void motion_free(struct motion_detector *md);
+#endif
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+
+#include "probe.h"
+#include "v4l2_helper.h"
+
+#define PROBE_PATH_MAX 4096
+#define PROBE_MAX_ENTRIES 65536     // of each kind in a cache file, anything more is garbage
+
+/**
+ * fnv1a - fold "len" bytes of "data" into the hash "h"
+ */
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * make_dir - create the directory "dir" unless it is there already
+ */
+static int make_dir(const char *dir) {
+    if (-1 == mkdir(dir, 0755) && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * cache_path - the name of the cache file of the device "caps" describes, creating the
+ * directories on the way
+ *
+ * @returns 0, or -1 with errno set if there is nowhere to keep the cache
+ */
+static int cache_path(const struct v4l2_capability *caps, char *path, size_t size) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[PROBE_PATH_MAX];
+    int n;
+    if (xdg != NULL && xdg[0] == '/') {
+        n = snprintf(dir, sizeof(dir), "%s", xdg);
+    } else if (home != NULL && home[0] == '/') {
+        n = snprintf(dir, sizeof(dir), "%s/.cache", home);
+    } else {
+        errno = ENOENT;
+        return -1;
+    }
+    if (n < 0 || (size_t) n + sizeof("/camcap") > sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (-1 == make_dir(dir)) {
+        return -1;
+    }
+    strcat(dir, "/camcap");
+    if (-1 == make_dir(dir)) {
+        return -1;
+    }
+
+    uint64_t h = 0xcbf29ce484222325ULL;
+    h = fnv1a(h, caps->driver, sizeof(caps->driver));
+    h = fnv1a(h, caps->card, sizeof(caps->card));
+    h = fnv1a(h, caps->bus_info, sizeof(caps->bus_info));
+    h = fnv1a(h, &caps->version, sizeof(caps->version));
+    n = snprintf(path, size, "%s/probe-%016llx", dir, (unsigned long long) h);
+    if (n < 0 || (size_t) n >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * fill_key - the part of the cache header that tells which device it belongs to
+ */
+static void fill_key(struct probe_cache_header *hdr, const struct v4l2_capability *caps) {
+    memcpy(hdr->driver, caps->driver, sizeof(hdr->driver));
+    memcpy(hdr->card, caps->card, sizeof(hdr->card));
+    memcpy(hdr->bus_info, caps->bus_info, sizeof(hdr->bus_info));
+    hdr->driver_version = caps->version;
+}
+
+/**
+ * load_cache - read the catalogue of the device "caps" describes from the cache file "path"
+ */
+static int load_cache(const char *path, const struct v4l2_capability *caps,
+        struct device_probe *probe) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    struct probe_cache_header hdr, key;
+    fill_key(&key, caps);
+    if (!fread(&hdr, sizeof(hdr), 1, f) || hdr.magic != PROBE_CACHE_MAGIC
+            || hdr.version != PROBE_CACHE_VERSION
+            || memcmp(hdr.driver, key.driver, sizeof(hdr.driver)) != 0
+            || memcmp(hdr.card, key.card, sizeof(hdr.card)) != 0
+            || memcmp(hdr.bus_info, key.bus_info, sizeof(hdr.bus_info)) != 0
+            || hdr.driver_version != key.driver_version
+            || hdr.format_count > PROBE_MAX_ENTRIES || hdr.size_count > PROBE_MAX_ENTRIES
+            || hdr.interval_count > PROBE_MAX_ENTRIES) {
+        goto stale;
+    }
+
+    probe->format_count = hdr.format_count;
+    probe->size_count = hdr.size_count;
+    probe->interval_count = hdr.interval_count;
+    probe->formats = calloc(hdr.format_count + 1, sizeof(struct v4l2_fmtdesc));
+    probe->sizes = calloc(hdr.size_count + 1, sizeof(struct v4l2_frmsizeenum));
+    probe->intervals = calloc(hdr.interval_count + 1, sizeof(struct v4l2_frmivalenum));
+    if (probe->formats == NULL || probe->sizes == NULL || probe->intervals == NULL) {
+        fclose(f);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Nothing may be missing, or follow
+    if (hdr.format_count != fread(probe->formats, sizeof(struct v4l2_fmtdesc),
+                hdr.format_count, f)
+            || hdr.size_count != fread(probe->sizes, sizeof(struct v4l2_frmsizeenum),
+                hdr.size_count, f)
+            || hdr.interval_count != fread(probe->intervals, sizeof(struct v4l2_frmivalenum),
+                hdr.interval_count, f)
+            || fgetc(f) != EOF) {
+        goto stale;
+    }
+
+    fclose(f);
+    return 0;
+
+stale:
+    fclose(f);
+    errno = ESTALE;
+    return -1;
+}
+
+/**
+ * save_cache - write the catalogue of the device "caps" describes to the cache file "path"
+ *
+ * It is written next to it first and renamed over it, so a cache file is never seen half done.
+ */
+static int save_cache(const char *path, const struct v4l2_capability *caps,
+        const struct device_probe *probe) {
+    char tmp[PROBE_PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) {
+        return -1;
+    }
+
+    struct probe_cache_header hdr = {
+        .magic = PROBE_CACHE_MAGIC,
+        .version = PROBE_CACHE_VERSION,
+        .format_count = probe->format_count,
+        .size_count = probe->size_count,
+        .interval_count = probe->interval_count,
+    };
+    fill_key(&hdr, caps);
+
+    int ok = fwrite(&hdr, sizeof(hdr), 1, f)
+        && (size_t) probe->format_count == fwrite(probe->formats, sizeof(struct v4l2_fmtdesc),
+                probe->format_count, f)
+        && (size_t) probe->size_count == fwrite(probe->sizes, sizeof(struct v4l2_frmsizeenum),
+                probe->size_count, f)
+        && (size_t) probe->interval_count == fwrite(probe->intervals,
+                sizeof(struct v4l2_frmivalenum), probe->interval_count, f);
+    if (EOF == fclose(f) || !ok || -1 == rename(tmp, path)) {
+        int err = ok ? errno : EIO;
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * append - add the "more_count" entries of "size" bytes in "more" to the array "all"
+ *
+ * "more" is freed either way.
+ */
+static int append(void **all, int *count, void *more, int more_count, size_t size) {
+    if (more_count > 0) {
+        uint8_t *grown = realloc(*all, (size_t) (*count + more_count) * size);
+        if (grown == NULL) {
+            free(more);
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(grown + (size_t) *count * size, more, (size_t) more_count * size);
+        *all = grown;
+        *count += more_count;
+    }
+    free(more);
+    return 0;
+}
+
+/**
+ * enumerate_device - ask the device for its catalogue, the frame intervals too if "intervals"
+ * is set
+ */
+static int enumerate_device(int fd, int intervals, struct device_probe *probe) {
+    probe->format_count = enum_pixel_formats(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, &probe->formats);
+    if (probe->format_count == -1) {
+        probe->format_count = 0;
+        return -1;
+    }
+
+    for (int i = 0; i < probe->format_count; i++) {
+        uint32_t pixel_format = probe->formats[i].pixelformat;
+        struct v4l2_frmsizeenum *sizes = NULL;
+        int size_count = enum_frame_size(fd, pixel_format, &sizes);
+        if (size_count == -1) {
+            return -1;
+        }
+
+        int first = probe->size_count;
+        if (-1 == append((void **) &probe->sizes, &probe->size_count, sizes, size_count,
+                    sizeof(struct v4l2_frmsizeenum))) {
+            return -1;
+        }
+
+        for (int s = first; intervals && s < probe->size_count; s++) {
+            const struct v4l2_frmsizeenum *size = &probe->sizes[s];
+            if (size->type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+                continue;
+            }
+
+            // Intervals are only ever listed, a driver that can't tell just has none
+            struct v4l2_frmivalenum *ivals = NULL;
+            int ival_count = enum_frame_intervals(fd, pixel_format, size->discrete.width,
+                    size->discrete.height, &ivals);
+            if (ival_count >= 0 && -1 == append((void **) &probe->intervals,
+                        &probe->interval_count, ivals, ival_count,
+                        sizeof(struct v4l2_frmivalenum))) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * probe_device - fill in the catalogue of the device "fd", which "caps" describes
+ *
+ * It comes from the cache when the device is in there, unless "refresh" is set.  Otherwise the
+ * device is asked, and the cache updated.
+ * @returns 0 on success, -1 with errno set on failure
+ */
+int probe_device(int fd, const struct v4l2_capability *caps, int refresh,
+        struct device_probe *probe) {
+    if (fd < 0 || caps == NULL || probe == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(probe, 0, sizeof(*probe));
+    char path[PROBE_PATH_MAX];
+    int cache = (0 == cache_path(caps, path, sizeof(path)));
+    if (cache && !refresh) {
+        if (0 == load_cache(path, caps, probe)) {
+            probe->cached = 1;
+            return 0;
+        }
+        probe_free(probe);
+    }
+
+    if (-1 == enumerate_device(fd, cache, probe)) {
+        int err = errno;
+        probe_free(probe);
+        errno = err;
+        return -1;
+    }
+
+    // A cache that can't be written only costs the next launch some time
+    if (cache) {
+        save_cache(path, caps, probe);
+    }
+    return 0;
+}
+
+/**
+ * probe_format_valid - returns a non-zero value if the device captures in the pixel format
+ */
+int probe_format_valid(const struct device_probe *probe, uint32_t pixel_format) {
+    for (int i = 0; i < probe->format_count; i++) {
+        if (probe->formats[i].pixelformat == pixel_format) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * probe_frame_size_valid - returns a non-zero value if the device captures frames of the pixel
+ * format at the frame size
+ */
+int probe_frame_size_valid(const struct device_probe *probe, uint32_t pixel_format,
+        uint32_t width, uint32_t height) {
+    for (int i = 0; i < probe->size_count; i++) {
+        if (probe->sizes[i].pixel_format == pixel_format
+                && frame_size_matches(&probe->sizes[i], width, height)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void probe_free(struct device_probe *probe) {
+    free(probe->formats);
+    free(probe->sizes);
+    free(probe->intervals);
+    memset(probe, 0, sizeof(*probe));
+}
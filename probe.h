@@ -0,0 +1,56 @@
+#ifndef __PROBE_H_
+#define __PROBE_H_
+
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+/*
+ * Device probe - the catalogue of what a capture device can do: its pixel formats, the frame
+ * sizes of each, and the frame intervals of each discrete size.
+ *
+ * Enumerating all that can take many ioctls, and seconds on some UVC devices, so the catalogue
+ * is kept in a cache file, one per device, named after and checked against the driver, card,
+ * bus info and driver version the device reports.  Later launches read it from there instead.
+ * The cache lives in $XDG_CACHE_HOME/camcap, or ~/.cache/camcap.  Frame intervals are only
+ * enumerated when the catalogue can be cached.
+ *
+ * A cache file is a probe_cache_header followed by the v4l2_fmtdesc of every format, the
+ * v4l2_frmsizeenum of every frame size and the v4l2_frmivalenum of every frame interval, each
+ * in the order the driver listed them.
+ */
+
+#define PROBE_CACHE_MAGIC 0x43504343    // "CCPC"
+#define PROBE_CACHE_VERSION 1
+
+struct probe_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t driver[16];
+    uint8_t card[32];
+    uint8_t bus_info[32];
+    uint32_t driver_version;
+    uint32_t format_count;
+    uint32_t size_count;
+    uint32_t interval_count;
+};
+
+/**
+ * device_probe - the catalogue of a device
+ */
+struct device_probe {
+    struct v4l2_fmtdesc *formats;
+    int format_count;
+    struct v4l2_frmsizeenum *sizes;         // of every format, in turn
+    int size_count;
+    struct v4l2_frmivalenum *intervals;     // of every discrete size, in turn
+    int interval_count;
+    int cached;                 // whether it was read from the cache
+};
+
+int probe_device(int fd, const struct v4l2_capability *caps, int refresh,
+        struct device_probe *probe);
+int probe_format_valid(const struct device_probe *probe, uint32_t pixel_format);
+int probe_frame_size_valid(const struct device_probe *probe, uint32_t pixel_format,
+        uint32_t width, uint32_t height);
+void probe_free(struct device_probe *probe);
+#endif
@@ -0,0 +1,444 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#include "scale.h"
+
+#define SCALE_MAX_SIZE 16384
+// Box sums of more rows than this could overflow the 16-bit row sums
+#define SCALE_MAX_BOX 257
+
+enum scale_filter {
+    SCALE_COPY,
+    SCALE_BOX,
+    SCALE_BILINEAR,
+};
+
+static const char *const filter_names[] = { "copy", "box", "bilinear" };
+
+/**
+ * scale_component - where the samples of one byte of a pixel group are, like the U of YUYV
+ */
+struct scale_component {
+    int offset;         // byte of the row's first sample
+    int stride;         // bytes from one sample to the next
+    int per_group;      // samples in a group
+    int index;          // which of them this byte holds
+};
+
+/**
+ * scale_layout - a plane of groups of "group_pixels" pixels in "group_bytes" bytes
+ */
+struct scale_layout {
+    int group_pixels;
+    int group_bytes;
+    struct scale_component comp[4];
+};
+
+static const struct scale_layout grey_layout = { 1, 1, { { 0, 1, 1, 0 } } };
+static const struct scale_layout rgb24_layout = { 1, 3,
+    { { 0, 3, 1, 0 }, { 1, 3, 1, 0 }, { 2, 3, 1, 0 } } };
+static const struct scale_layout yuyv_layout = { 2, 4,
+    { { 0, 2, 2, 0 }, { 1, 4, 1, 0 }, { 0, 2, 2, 1 }, { 3, 4, 1, 0 } } };
+static const struct scale_layout uyvy_layout = { 2, 4,
+    { { 0, 4, 1, 0 }, { 1, 2, 2, 0 }, { 2, 4, 1, 0 }, { 1, 2, 2, 1 } } };
+// NV12's chroma plane, with one UV pair per (subsampled) pixel
+static const struct scale_layout uv_layout = { 1, 2, { { 0, 2, 1, 0 }, { 1, 2, 1, 0 } } };
+
+/**
+ * scale_plane - how one plane of the region is filtered into the output
+ *
+ * Horizontally, output byte j is blended from region bytes xa[j] and xb[j] by xf[j] 256ths,
+ * or, for the box filter, is the average of "kx" samples from xa[j] on, xb[j] bytes apart.
+ */
+struct scale_plane {
+    size_t src_offset;      // first byte of the region, from the start of the frame
+    size_t dst_offset;
+    uint32_t src_bpl;
+    uint32_t dst_bpl;
+    int src_rows;
+    int rows;
+    int vsub;               // frame rows per row of the plane
+    int span;               // bytes of a region row
+    int kx, ky;
+    int hcopy;              // the region is as wide as the output
+    uint32_t *xa;
+    uint32_t *xb;
+    uint8_t *xf;
+};
+
+struct scale_scratch {
+    uint8_t *row;
+    uint16_t *sums;
+};
+
+struct scaler {
+    const struct convert_kernels *k;
+    enum scale_filter filter;
+    struct scale_plane planes[2];
+    int plane_count;
+    uint32_t height;
+    size_t size;
+
+    struct pool_bands bands;    // scratch is a scale_scratch per slot
+};
+
+/**
+ * scale_supported - whether frames in "fourcc" can be cropped and scaled
+ */
+int scale_supported(uint32_t fourcc) {
+    return fourcc == V4L2_PIX_FMT_GREY || fourcc == V4L2_PIX_FMT_RGB24
+        || fourcc == V4L2_PIX_FMT_YUYV || fourcc == V4L2_PIX_FMT_UYVY
+        || fourcc == V4L2_PIX_FMT_NV12;
+}
+
+static const struct scale_layout *find_layout(uint32_t fourcc) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_RGB24:
+            return &rgb24_layout;
+        case V4L2_PIX_FMT_YUYV:
+            return &yuyv_layout;
+        case V4L2_PIX_FMT_UYVY:
+            return &uyvy_layout;
+        default:
+            return &grey_layout;
+    }
+}
+
+/**
+ * bilinear_pos - where output sample "i" of "n_out" lies among "n_src" samples, in 256ths
+ *
+ * The pixel centers line up, so sample i sits at (i + 0.5) * n_src / n_out - 0.5.  Positions
+ * are clamped to the first and last sample.
+ */
+static void bilinear_pos(int i, int n_out, int n_src, int *first, int *frac) {
+    int64_t pos = ((int64_t) (2 * i + 1) * n_src * 256) / (2 * (int64_t) n_out) - 128;
+    if (pos < 0) {
+        pos = 0;
+    }
+    *first = (int) (pos >> 8);
+    *frac = (int) (pos & 255);
+    if (*first >= n_src - 1) {
+        *first = n_src - 1;
+        *frac = 0;
+    }
+}
+
+/**
+ * setup_plane - fill in the horizontal table of a plane whose region is "src_pixels" wide,
+ * scaled to "out_pixels"
+ */
+static int setup_plane(struct scale_plane *p, const struct scale_layout *l,
+        enum scale_filter filter, int src_pixels, int out_pixels) {
+    p->span = src_pixels / l->group_pixels * l->group_bytes;
+    p->dst_bpl = out_pixels / l->group_pixels * l->group_bytes;
+    p->kx = src_pixels / out_pixels;
+    p->ky = p->src_rows / p->rows;
+    p->hcopy = (src_pixels == out_pixels);
+    if (filter == SCALE_COPY) {
+        return 0;
+    }
+
+    p->xa = malloc(p->dst_bpl * sizeof(uint32_t));
+    p->xb = malloc(p->dst_bpl * sizeof(uint32_t));
+    p->xf = malloc(p->dst_bpl);
+    if (p->xa == NULL || p->xb == NULL || p->xf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (uint32_t j = 0; j < p->dst_bpl; j++) {
+        const struct scale_component *c = &l->comp[j % l->group_bytes];
+        int i = (j / l->group_bytes) * c->per_group + c->index;
+        if (filter == SCALE_BOX) {
+            p->xa[j] = c->offset + i * p->kx * c->stride;
+            p->xb[j] = c->stride;
+            p->xf[j] = 0;
+            continue;
+        }
+
+        int first, frac;
+        bilinear_pos(i, out_pixels * c->per_group / l->group_pixels,
+                src_pixels * c->per_group / l->group_pixels, &first, &frac);
+        p->xa[j] = c->offset + first * c->stride;
+        p->xb[j] = (frac != 0) ? p->xa[j] + c->stride : p->xa[j];
+        p->xf[j] = frac;
+    }
+
+    return 0;
+}
+
+static void free_scratch(void *scratch) {
+    struct scale_scratch *s = scratch;
+    free(s->row);
+    free(s->sums);
+}
+
+static int init_scratch(void *owner, void *scratch) {
+    const struct scaler *sc = owner;
+    struct scale_scratch *s = scratch;
+
+    // The first plane always has the widest rows
+    size_t span = sc->planes[0].span;
+    s->row = malloc(span);
+    s->sums = malloc(span * sizeof(uint16_t));
+    if (s->row == NULL || s->sums == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * scaler_create - set up cutting region "crop" out of frames of format "in" and scaling it to
+ * "width" x "height"
+ *
+ * "crop" can be NULL for the whole frame, and "width" and "height" 0 for the region's size.
+ * "kernels" can be NULL for the fastest ones the CPU supports.  The format of the scaled frames
+ * is filled in to "out".
+ * @returns the new scaler, or NULL with errno set (EINVAL for regions or sizes we can't do)
+ */
+struct scaler *scaler_create(const struct v4l2_format *in, const struct v4l2_rect *crop,
+        uint32_t width, uint32_t height, const struct convert_kernels *kernels,
+        struct v4l2_format *out) {
+    const struct v4l2_pix_format *pix = &in->fmt.pix;
+    struct v4l2_rect r = { 0, 0, pix->width, pix->height };
+    if (crop != NULL) {
+        r = *crop;
+    }
+    width = (width != 0) ? width : r.width;
+    height = (height != 0) ? height : r.height;
+
+    // Chroma is shared by pixel pairs, and for NV12 by row pairs too
+    uint32_t fourcc = pix->pixelformat;
+    int yuv = (fourcc == V4L2_PIX_FMT_YUYV || fourcc == V4L2_PIX_FMT_UYVY
+            || fourcc == V4L2_PIX_FMT_NV12);
+    int nv12 = (fourcc == V4L2_PIX_FMT_NV12);
+    if (!scale_supported(fourcc) || r.left < 0 || r.top < 0 || r.width == 0 || r.height == 0
+            || (uint64_t) r.left + r.width > pix->width
+            || (uint64_t) r.top + r.height > pix->height
+            || width > SCALE_MAX_SIZE || height > SCALE_MAX_SIZE
+            || (yuv && ((r.left | r.width | width) & 1) != 0)
+            || (nv12 && ((r.top | r.height | height) & 1) != 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct scaler *sc = calloc(1, sizeof(struct scaler));
+    if (sc == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    sc->k = (kernels != NULL) ? kernels : convert_kernels_best();
+    sc->height = height;
+
+    if (r.width == width && r.height == height) {
+        sc->filter = SCALE_COPY;
+    } else if ((r.width % width) == 0 && (r.height % height) == 0
+            && r.height / height <= SCALE_MAX_BOX) {
+        sc->filter = SCALE_BOX;
+    } else {
+        sc->filter = SCALE_BILINEAR;
+    }
+
+    const struct scale_layout *layout = find_layout(fourcc);
+    uint32_t bpl = (pix->bytesperline != 0) ? pix->bytesperline
+        : pix->width / layout->group_pixels * layout->group_bytes;
+
+    struct scale_plane *p = &sc->planes[0];
+    p->src_offset = (size_t) r.top * bpl + r.left / layout->group_pixels * layout->group_bytes;
+    p->src_bpl = bpl;
+    p->src_rows = r.height;
+    p->rows = height;
+    p->vsub = 1;
+    sc->plane_count = 1;
+    if (-1 == setup_plane(p, layout, sc->filter, r.width, width)) {
+        goto fail;
+    }
+    size_t size = (size_t) p->dst_bpl * p->rows;
+
+    if (nv12) {
+        p = &sc->planes[1];
+        p->src_offset = (size_t) bpl * pix->height + (size_t) (r.top / 2) * bpl + r.left;
+        p->dst_offset = size;
+        p->src_bpl = bpl;
+        p->src_rows = r.height / 2;
+        p->rows = height / 2;
+        p->vsub = 2;
+        sc->plane_count = 2;
+        if (-1 == setup_plane(p, &uv_layout, sc->filter, r.width / 2, width / 2)) {
+            goto fail;
+        }
+        size += (size_t) p->dst_bpl * p->rows;
+    }
+
+    sc->bands = (struct pool_bands) { .height = sc->height,
+        .scratch_size = sizeof(struct scale_scratch), .scratch_init = init_scratch,
+        .scratch_free = free_scratch, .owner = sc };
+    if (-1 == pool_bands_set_pool(&sc->bands, NULL)) {
+        goto fail;
+    }
+
+    *out = *in;
+    out->fmt.pix.width = width;
+    out->fmt.pix.height = height;
+    out->fmt.pix.bytesperline = sc->planes[0].dst_bpl;
+    out->fmt.pix.sizeimage = size;
+    sc->size = size;
+    return sc;
+
+fail: ;
+    int err = errno;
+    scaler_free(sc);
+    errno = err;
+    return NULL;
+}
+
+/**
+ * filter_box - average the sums of "ky" region rows over "kx" columns into "out"
+ */
+static void filter_box(const struct scale_plane *p, const uint16_t *sums, uint8_t *out) {
+    int kx = p->kx, area = p->kx * p->ky;
+    for (uint32_t j = 0; j < p->dst_bpl; j++) {
+        const uint16_t *s = sums + p->xa[j];
+        uint32_t sum = 0;
+        for (int i = 0; i < kx; i++) {
+            sum += s[i * p->xb[j]];
+        }
+        out[j] = (sum + area / 2) / area;
+    }
+}
+
+/**
+ * filter_bilinear - interpolate a region row horizontally into "out"
+ */
+static void filter_bilinear(const struct scale_plane *p, const uint8_t *row, uint8_t *out) {
+    if (p->hcopy) {
+        memcpy(out, row, p->dst_bpl);
+        return;
+    }
+    for (uint32_t j = 0; j < p->dst_bpl; j++) {
+        int f = p->xf[j];
+        out[j] = ((row[p->xa[j]] * (256 - f)) + (row[p->xb[j]] * f) + 128) >> 8;
+    }
+}
+
+/**
+ * scale_rows - scale output rows "r0" up to "r1" of a plane
+ */
+static void scale_rows(struct scaler *sc, const struct scale_plane *p,
+        struct scale_scratch *scratch, const uint8_t *src, uint8_t *dst, int r0, int r1) {
+    const uint8_t *region = src + p->src_offset;
+    uint8_t *out = dst + p->dst_offset;
+
+    for (int r = r0; r < r1; r++) {
+        uint8_t *line = out + (size_t) r * p->dst_bpl;
+        switch (sc->filter) {
+            case SCALE_COPY:
+                memcpy(line, region + (size_t) r * p->src_bpl, p->span);
+                break;
+
+            case SCALE_BOX: {
+                const uint8_t *in = region + (size_t) r * p->ky * p->src_bpl;
+                for (int i = 0; i < p->ky; i++) {
+                    sc->k->sum_row(in + (size_t) i * p->src_bpl, scratch->sums, p->span, i == 0);
+                }
+                filter_box(p, scratch->sums, line);
+                break;
+            }
+
+            case SCALE_BILINEAR: {
+                int first, frac;
+                bilinear_pos(r, p->rows, p->src_rows, &first, &frac);
+                const uint8_t *in = region + (size_t) first * p->src_bpl;
+                if (frac != 0) {
+                    sc->k->lerp_row(in, in + p->src_bpl, scratch->row, p->span, frac);
+                    in = scratch->row;
+                }
+                filter_bilinear(p, in, line);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * scale_band - scale band "band" of a frame, with the scratch rows of "slot"
+ */
+static void scale_band(struct scaler *sc, int band, int slot, const uint8_t *src, uint8_t *dst) {
+    int rows = sc->bands.band_rows;
+    int r0 = band * rows;
+    int r1 = (r0 + rows < (int) sc->height) ? r0 + rows : (int) sc->height;
+    for (int i = 0; i < sc->plane_count; i++) {
+        const struct scale_plane *p = &sc->planes[i];
+        scale_rows(sc, p, pool_bands_scratch(&sc->bands, slot), src, dst, r0 / p->vsub,
+                (r1 + p->vsub - 1) / p->vsub);
+    }
+}
+
+struct scale_job {
+    struct scaler *sc;
+    const uint8_t *src;
+    uint8_t *dst;
+};
+
+static void scale_job_band(void *arg, int band, int slot) {
+    struct scale_job *job = arg;
+    scale_band(job->sc, band, slot, job->src, job->dst);
+}
+
+/**
+ * scaler_set_pool - scale frames in bands of rows on the threads of "pool", which has to
+ * outlive the scaler
+ *
+ * @returns 0 on success, -1 with errno set on failure (and then scales on one thread)
+ */
+int scaler_set_pool(struct scaler *sc, struct thread_pool *pool) {
+    return pool_bands_set_pool(&sc->bands, pool);
+}
+
+/**
+ * scale_frame - crop and scale the frame at "src" into "dst", which holds the output's sizeimage
+ */
+void scale_frame(struct scaler *sc, const uint8_t *src, uint8_t *dst) {
+    if (sc->bands.pool == NULL) {
+        for (int i = 0; i < sc->bands.band_count; i++) {
+            scale_band(sc, i, 0, src, dst);
+        }
+        return;
+    }
+
+    struct scale_job job = { sc, src, dst };
+    thread_pool_run(sc->bands.pool, sc->bands.band_count, scale_job_band, &job);
+}
+
+/**
+ * scaler_frame_size - the size of a scaled frame
+ */
+size_t scaler_frame_size(const struct scaler *sc) {
+    return sc->size;
+}
+
+/**
+ * scaler_filter - the name of the filter frames are scaled with
+ */
+const char *scaler_filter(const struct scaler *sc) {
+    return filter_names[sc->filter];
+}
+
+void scaler_free(struct scaler *sc) {
+    if (sc == NULL) {
+        return;
+    }
+
+    pool_bands_free(&sc->bands);
+    for (int i = 0; i < 2; i++) {
+        free(sc->planes[i].xa);
+        free(sc->planes[i].xb);
+        free(sc->planes[i].xf);
+    }
+    free(sc);
+}
@@ -0,0 +1,35 @@
+#ifndef __SCALE_H_
+#define __SCALE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#include "convert.h"
+#include "thread_pool.h"
+
+/*
+ * Cropping and downscaling frames in the format they were captured in: GREY, RGB24, YUYV, UYVY
+ * and NV12.  Chroma is scaled on its own, subsampled grid.
+ *
+ * A region of the frame is cut out and scaled to the output size.  When the region is a whole
+ * multiple of the output size in both directions, each output sample is the box average of the
+ * samples it covers; otherwise samples are interpolated bilinearly, with the pixel centers of
+ * the output lined up with those of the region.  Without scaling the rows are only copied.
+ *
+ * Rows are blended or summed vertically by SIMD kernels from convert.h, and filtered
+ * horizontally through a table computed once per output row layout.
+ */
+
+struct scaler;
+
+int scale_supported(uint32_t fourcc);
+struct scaler *scaler_create(const struct v4l2_format *in, const struct v4l2_rect *crop,
+        uint32_t width, uint32_t height, const struct convert_kernels *kernels,
+        struct v4l2_format *out);
+int scaler_set_pool(struct scaler *sc, struct thread_pool *pool);
+void scale_frame(struct scaler *sc, const uint8_t *src, uint8_t *dst);
+size_t scaler_frame_size(const struct scaler *sc);
+const char *scaler_filter(const struct scaler *sc);
+void scaler_free(struct scaler *sc);
+#endif
@@ -0,0 +1,48 @@
+#ifndef __SHARE_PROTO_H_
+#define __SHARE_PROTO_H_
+
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+/*
+ * Buffer sharing protocol, spoken over a SOCK_SEQPACKET Unix domain socket.
+ *
+ * Right after connecting, a subscriber receives a share_hello describing the format, with one
+ * file descriptor per capture buffer attached (SCM_RIGHTS, in index order).  Those are DMABUFs
+ * when capturing from a device, and can be mapped read-only.  From then on camcap sends a
+ * SHARE_MSG_READY share_frame for every frame, and the subscriber must answer each of them with
+ * a SHARE_MSG_RELEASE carrying the same index once it no longer reads the buffer.  The buffer
+ * is only refilled after every subscriber it was sent to has released it.
+ */
+
+#define SHARE_PROTO_VERSION 1
+
+enum share_msg_type {
+    SHARE_MSG_HELLO = 1,
+    SHARE_MSG_READY,
+    SHARE_MSG_RELEASE,
+};
+
+struct share_hello {
+    uint32_t type;
+    uint32_t version;
+    uint32_t buf_count;
+    uint32_t max_held;          // READY frames a subscriber may hold before it misses frames
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;
+    uint32_t bytesperline;
+    uint32_t sizeimage;
+    uint32_t length[VIDEO_MAX_FRAME];
+};
+
+struct share_frame {
+    uint32_t type;
+    uint32_t index;
+    uint32_t sequence;
+    uint32_t bytesused;
+    uint32_t flags;             // v4l2_buffer flags
+    uint32_t reserved;
+    uint64_t timestamp_us;      // driver timestamp, CLOCK_MONOTONIC for most drivers
+};
+#endif
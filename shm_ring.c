@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_ring.h"
+
+/*
+ * Shared-memory ring reader library - see shm_ring.h for the layout and the rules.
+ */
+
+struct shm_reader {
+    struct shm_ring_header *hdr;
+    size_t map_size;
+    struct shm_ring_reader *entry;  // our entry in hdr->readers, NULL if they were all taken
+    uint64_t next;
+    uint64_t lost;
+};
+
+/**
+ * claim_entry - take a free reader entry, so the publisher can see how we are doing
+ *
+ * Readers that die without closing keep their entries, so once none are free the entry of a
+ * reader that is gone is taken over instead.
+ */
+static struct shm_ring_reader *claim_entry(struct shm_ring_header *hdr) {
+    int32_t pid = getpid();
+
+    for (int i = 0; i < SHM_RING_MAX_READERS; i++) {
+        int32_t expected = 0;
+        if (__atomic_compare_exchange_n(&hdr->readers[i].pid, &expected, pid, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return &hdr->readers[i];
+        }
+    }
+
+    for (int i = 0; i < SHM_RING_MAX_READERS; i++) {
+        int32_t expected = __atomic_load_n(&hdr->readers[i].pid, __ATOMIC_ACQUIRE);
+        if (expected != 0 && -1 == kill(expected, 0) && errno == ESRCH
+                && __atomic_compare_exchange_n(&hdr->readers[i].pid, &expected, pid, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return &hdr->readers[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void update_entry(struct shm_reader *rd) {
+    if (rd->entry == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&rd->entry->next_frame, rd->next, __ATOMIC_RELAXED);
+    __atomic_store_n(&rd->entry->lost, rd->lost, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&rd->entry->frames, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * shm_reader_open - attach to the ring camcap publishes as "name"
+ *
+ * With "latest" set, reading starts at the most recent frame, otherwise at the oldest one
+ * still in the ring.
+ * @returns the new reader, or NULL with errno set (EAGAIN if the ring isn't set up yet)
+ */
+struct shm_reader *shm_reader_open(const char *name, int latest) {
+    struct shm_reader *rd = calloc(1, sizeof(struct shm_reader));
+    if (rd == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    int fd = shm_open(name, (O_RDWR | O_CLOEXEC), 0);
+    if (fd == -1) {
+        goto fail;
+    }
+
+    struct stat st;
+    if (-1 == fstat(fd, &st)) {
+        close(fd);
+        goto fail;
+    }
+
+    if ((size_t) st.st_size < sizeof(struct shm_ring_header)) {
+        close(fd);
+        errno = EAGAIN;
+        goto fail;
+    }
+
+    rd->map_size = st.st_size;
+    rd->hdr = mmap(NULL, rd->map_size, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    close(fd);
+    if (rd->hdr == MAP_FAILED) {
+        rd->hdr = NULL;
+        goto fail;
+    }
+
+    struct shm_ring_header *hdr = rd->hdr;
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC) {
+        errno = EAGAIN;
+        goto fail;
+    }
+    if (hdr->version != SHM_RING_VERSION || hdr->slot_count == 0
+            || sizeof(struct shm_ring_header)
+                + hdr->slot_count * sizeof(struct shm_ring_slot) > hdr->data_offset
+            || hdr->data_offset + (uint64_t) hdr->slot_count * hdr->slot_size > rd->map_size) {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    uint64_t published = __atomic_load_n(&hdr->published, __ATOMIC_ACQUIRE);
+    if (latest) {
+        rd->next = (published > 0) ? published - 1 : 0;
+    } else {
+        rd->next = (published >= hdr->slot_count) ? published - hdr->slot_count + 1 : 0;
+    }
+
+    rd->entry = claim_entry(hdr);
+    if (rd->entry != NULL) {
+        __atomic_store_n(&rd->entry->frames, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&rd->entry->lost, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&rd->entry->next_frame, rd->next, __ATOMIC_RELAXED);
+    }
+
+    return rd;
+
+fail: ;
+    int err = errno;
+    if (rd->hdr != NULL) {
+        munmap(rd->hdr, rd->map_size);
+    }
+    free(rd);
+    errno = err;
+    return NULL;
+}
+
+/**
+ * shm_reader_header - the ring's header, for the format of the frames
+ */
+const struct shm_ring_header *shm_reader_header(const struct shm_reader *rd) {
+    return rd->hdr;
+}
+
+/**
+ * wait_published - sleep until more than "seen" frames are published, or "timeout_ms" passes
+ */
+static int wait_published(struct shm_reader *rd, uint64_t seen, int timeout_ms) {
+    struct shm_ring_header *hdr = rd->hdr;
+
+    // Pairs with the publisher bumping "notify" and then checking "waiters"
+    __atomic_add_fetch(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
+    uint32_t notify = __atomic_load_n(&hdr->notify, __ATOMIC_SEQ_CST);
+
+    int ret = 0;
+    if (__atomic_load_n(&hdr->published, __ATOMIC_SEQ_CST) == seen
+            && !__atomic_load_n(&hdr->closed, __ATOMIC_SEQ_CST)) {
+        struct timespec ts = { .tv_sec = timeout_ms / 1000,
+            .tv_nsec = (timeout_ms % 1000) * 1000000L };
+        ret = syscall(SYS_futex, &hdr->notify, FUTEX_WAIT, notify,
+                (timeout_ms < 0) ? NULL : &ts, NULL, 0);
+        if (ret == -1 && (errno == EAGAIN || errno == EINTR)) {
+            ret = 0;
+        }
+    }
+
+    int err = errno;
+    __atomic_sub_fetch(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
+    errno = err;
+    return ret;
+}
+
+/**
+ * shm_reader_next - copy the next frame into "dst" and describe it in "info"
+ *
+ * Frames the publisher overwrote before we got to them are skipped and counted as lost.
+ * Waits up to "timeout_ms" for a new frame, or forever if it is negative.
+ * @returns 1 when a frame was read, 0 once the publisher has stopped and every frame was read,
+ *          -1 with errno set on error (ETIMEDOUT, or EMSGSIZE if "dst" is too small)
+ */
+int shm_reader_next(struct shm_reader *rd, void *dst, size_t dst_size,
+        struct shm_ring_frame *info, int timeout_ms) {
+    struct shm_ring_header *hdr = rd->hdr;
+    uint64_t count = hdr->slot_count;
+    uint64_t lost_before = rd->lost;
+
+    for (;;) {
+        uint64_t published = __atomic_load_n(&hdr->published, __ATOMIC_ACQUIRE);
+        if (rd->next >= published) {
+            // The publisher sets "closed" after its last frame, so nothing more will come
+            if (__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE)) {
+                if (rd->next >= __atomic_load_n(&hdr->published, __ATOMIC_ACQUIRE)) {
+                    return 0;
+                }
+                continue;
+            }
+
+            if (-1 == wait_published(rd, published, timeout_ms)) {
+                return -1;
+            }
+            if (timeout_ms >= 0 && __atomic_load_n(&hdr->published, __ATOMIC_ACQUIRE) == published
+                    && !__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE)) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            continue;
+        }
+
+        // The oldest frame's slot is the one the publisher rewrites next, don't even try it
+        if (published - rd->next >= count) {
+            rd->lost += published - count + 1 - rd->next;
+            rd->next = published - count + 1;
+        }
+
+        struct shm_ring_slot *slot = &hdr->slots[rd->next % count];
+        uint64_t gen = __atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE);
+        struct shm_ring_slot meta = *slot;
+
+        if ((gen & 1) || meta.frame != rd->next) {
+            // Rewritten under us already
+            rd->lost++;
+            rd->next++;
+            continue;
+        }
+
+        if (meta.bytesused > dst_size || meta.bytesused > hdr->slot_size) {
+            // Torn metadata looks just as wrong, only trust it if nothing changed since
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->gen, __ATOMIC_RELAXED) != gen) {
+                rd->lost++;
+                rd->next++;
+                continue;
+            }
+            errno = EMSGSIZE;
+            return -1;
+        }
+        memcpy(dst, (uint8_t *) hdr + hdr->data_offset + (rd->next % count) * hdr->slot_size,
+                meta.bytesused);
+
+        // Only if the generation is still the same did we copy a whole, untorn frame
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->gen, __ATOMIC_RELAXED) != gen) {
+            rd->lost++;
+            rd->next++;
+            continue;
+        }
+
+        info->frame = rd->next;
+        info->sequence = meta.sequence;
+        info->bytesused = meta.bytesused;
+        info->flags = meta.flags;
+        info->timestamp_us = meta.timestamp_us;
+        info->lag = __atomic_load_n(&hdr->published, __ATOMIC_ACQUIRE) - rd->next - 1;
+        info->lost = rd->lost - lost_before;
+
+        rd->next++;
+        update_entry(rd);
+        return 1;
+    }
+}
+
+/**
+ * shm_reader_close - detach from the ring
+ */
+void shm_reader_close(struct shm_reader *rd) {
+    if (rd == NULL) {
+        return;
+    }
+
+    if (rd->entry != NULL) {
+        __atomic_store_n(&rd->entry->pid, 0, __ATOMIC_RELEASE);
+    }
+    munmap(rd->hdr, rd->map_size);
+    free(rd);
+}
@@ -0,0 +1,89 @@
+#ifndef __SHM_RING_H_
+#define __SHM_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+/*
+ * Shared-memory frame ring, published by camcap --shm and read by any number of processes.
+ *
+ * The POSIX shared memory object starts with a shm_ring_header, followed by "slot_count" frame
+ * slots of "slot_size" bytes each, starting at "data_offset".  Frame number n (counting from 0
+ * since publishing started) goes into slot n % slot_count.  The publisher never waits for
+ * readers: every slot is protected by a seqlock, whose generation is odd while the slot is
+ * being rewritten, so a reader copies the frame out and then checks the generation didn't
+ * change under it.  A reader that falls more than slot_count frames behind loses frames.
+ *
+ * Readers claim an entry in "readers" and keep their progress there, which is how the
+ * publisher reports per-reader lag.  The entry of a reader that died without giving it back is
+ * taken over by a new one once no entry is free.
+ */
+
+#define SHM_RING_MAGIC 0x6d616363   // "ccam"
+#define SHM_RING_VERSION 1
+#define SHM_RING_MAX_READERS 16
+#define SHM_RING_CACHE_LINE 64
+
+struct shm_ring_slot {
+    uint64_t gen;               // seqlock generation, odd while the slot is being written
+    uint64_t frame;             // frame number in the ring, frame % slot_count is this slot
+    uint32_t sequence;          // driver sequence number
+    uint32_t bytesused;
+    uint32_t flags;             // v4l2_buffer flags
+    uint32_t reserved;
+    uint64_t timestamp_us;      // driver timestamp, CLOCK_MONOTONIC for most drivers
+} __attribute__((aligned(SHM_RING_CACHE_LINE)));
+
+struct shm_ring_reader {
+    int32_t pid;                // 0 for a free entry
+    uint32_t reserved;
+    uint64_t next_frame;        // the next frame this reader will read
+    uint64_t frames;            // frames read
+    uint64_t lost;              // frames overwritten before the reader got to them
+} __attribute__((aligned(SHM_RING_CACHE_LINE)));
+
+struct shm_ring_header {
+    uint32_t magic;             // written last by the publisher, once the ring is set up
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint64_t data_offset;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;
+    uint32_t bytesperline;
+    uint32_t sizeimage;
+    uint32_t closed;            // set when the publisher stops
+
+    // Frames published so far, and a futex word bumped with it for readers waiting on new ones
+    uint64_t published __attribute__((aligned(SHM_RING_CACHE_LINE)));
+    uint32_t notify;
+    uint32_t waiters;
+
+    struct shm_ring_reader readers[SHM_RING_MAX_READERS];
+    struct shm_ring_slot slots[];
+};
+
+/**
+ * shm_ring_frame - where a frame is in the ring, and its metadata
+ */
+struct shm_ring_frame {
+    uint64_t frame;
+    uint32_t sequence;
+    uint32_t bytesused;
+    uint32_t flags;
+    uint64_t timestamp_us;
+    uint64_t lag;               // frames published after this one by the time it was read
+    uint64_t lost;              // frames skipped since the previous read
+};
+
+struct shm_reader;
+
+struct shm_reader *shm_reader_open(const char *name, int latest);
+const struct shm_ring_header *shm_reader_header(const struct shm_reader *rd);
+int shm_reader_next(struct shm_reader *rd, void *dst, size_t dst_size,
+        struct shm_ring_frame *info, int timeout_ms);
+void shm_reader_close(struct shm_reader *rd);
+#endif
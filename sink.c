@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#include "sink.h"
+
+/**
+ * sink_set_release - set the callback used to hand held buffers back
+ */
+void sink_set_release(struct sink *snk, sink_release_fn release, void *arg) {
+    snk->release = release;
+    snk->release_arg = arg;
+}
+
+/**
+ * sink_submit - pass a frame to the sink
+ *
+ * @returns 0 if the buffer can be reused right away, 1 if it will come back through the
+ *          release callback, -1 on failure with errno set
+ */
+int sink_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    if (snk == NULL || data == NULL || buf == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return snk->ops->submit(snk, data, buf);
+}
+
+/**
+ * sink_process_events - hand back any buffers the sink has finished with
+ */
+int sink_process_events(struct sink *snk) {
+    if (snk == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (snk->ops->process_events == NULL) {
+        return 0;
+    }
+    return snk->ops->process_events(snk);
+}
+
+/**
+ * sink_flush - wait until every held buffer has been handed back
+ */
+int sink_flush(struct sink *snk) {
+    if (snk == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (snk->ops->flush == NULL) {
+        return 0;
+    }
+    return snk->ops->flush(snk);
+}
+
+/**
+ * sink_close - flush and free the sink
+ */
+int sink_close(struct sink *snk) {
+    if (snk == NULL) {
+        return 0;
+    }
+
+    return snk->ops->close(snk);
+}
+
+/**
+ * numbered_name - the output name "out_name" with "n" before its extension, at least "digits"
+ * digits wide, like "clip-0001.yuv"
+ */
+void numbered_name(const char *out_name, uint32_t n, int digits, char *name, size_t size) {
+    const char *base = strrchr(out_name, '/');
+    base = (base != NULL) ? base + 1 : out_name;
+    const char *ext = strrchr(base, '.');
+    if (ext == NULL || ext == base) {
+        ext = base + strlen(base);
+    }
+    snprintf(name, size, "%.*s-%0*u%s", (int) (ext - out_name), out_name, digits, n, ext);
+}
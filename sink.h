@@ -0,0 +1,91 @@
+#ifndef __SINK_H_
+#define __SINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+
+struct sink;
+struct capture_source;
+struct converter;
+struct compressor;
+struct scaler;
+struct thread_pool;
+struct motion_detector;
+
+/**
+ * sink_release_fn - called when a sink is done with a buffer it held on to
+ */
+typedef void (*sink_release_fn)(void *arg, struct v4l2_buffer *buf);
+
+/**
+ * sink_ops - the operations every frame sink has to provide
+ *
+ * submit() returns 0 once the sink is finished with the frame data, so the buffer can be given
+ * back to the source straight away, or 1 if the sink holds on to the buffer and will hand it
+ * back through the release callback later.  Sinks that hold buffers set "event_fd", and
+ * process_events() must be called whenever it becomes readable.  A buffer is never released
+ * from within its own submit().  All operations return -1 with errno set on error.
+ */
+struct sink_ops {
+    const char *name;
+    int (*submit)(struct sink *snk, void *data, struct v4l2_buffer *buf);
+    int (*process_events)(struct sink *snk);
+    int (*flush)(struct sink *snk);
+    int (*close)(struct sink *snk);
+};
+
+struct sink {
+    const struct sink_ops *ops;
+    int event_fd;
+    sink_release_fn release;
+    void *release_arg;
+};
+
+enum thread_sink_policy {
+    THREAD_SINK_HOLD,   // keep the capture buffer until the writer is done with it
+    THREAD_SINK_COPY,   // copy into a preallocated pool so the buffer can be requeued at once
+};
+
+enum stripe_policy {
+    STRIPE_ROUND_ROBIN,     // every stripe in turn
+    STRIPE_LEAST_LOADED,    // the stripe with the fewest frames waiting for its writer
+};
+
+struct sink *file_sink_open(const char *file_name, int fd);
+struct sink *container_sink_open(const char *file_name, int fd, const struct v4l2_format *fmt,
+        uint32_t codec);
+struct sink *thread_sink_open(struct sink *inner, enum thread_sink_policy policy, int buf_count,
+        int pool_frames, size_t frame_size);
+int thread_sink_backlog(const struct sink *snk);
+struct sink *direct_sink_open(const char *file_name, uint64_t prealloc);
+struct sink *uring_sink_open(const char *file_name, int fd, struct mmaped_buffer *bufs,
+        int buf_count, int sqpoll);
+struct sink *splice_sink_open(int fd, size_t frame_size, int buf_count);
+struct sink *dmabuf_sink_open(const char *path, struct capture_source *src,
+        const struct v4l2_format *fmt);
+struct sink *shm_sink_open(const char *name, const struct v4l2_format *fmt, int slots);
+struct sink *convert_sink_open(struct sink *inner, struct scaler *sc, struct converter *cv,
+        struct compressor *cmp, struct thread_pool *threads, const struct v4l2_format *out,
+        int frames, int in_flight);
+struct sink *motion_sink_open(struct sink *inner, struct motion_detector *md, double threshold,
+        int pre_roll, int post_roll, int frames, size_t frame_size, const char *log_name);
+struct sink *trigger_sink_open(const char *out_name, int ring_frames, int post,
+        size_t frame_size, const char *socket_path, const struct v4l2_format *container,
+        uint32_t codec);
+int trigger_sink_fire(struct sink *snk);
+struct sink *segment_sink_open(const char *out_name, uint64_t max_bytes, uint64_t max_ns,
+        uint64_t prealloc, const struct v4l2_format *container, uint32_t codec);
+struct sink *stripe_sink_open(const char *manifest_name, struct sink **stripes,
+        const char *const *names, int count, enum stripe_policy policy,
+        const struct v4l2_format *fmt, int container);
+
+void sink_set_release(struct sink *snk, sink_release_fn release, void *arg);
+int sink_submit(struct sink *snk, void *data, struct v4l2_buffer *buf);
+int sink_process_events(struct sink *snk);
+int sink_flush(struct sink *snk);
+int sink_close(struct sink *snk);
+void numbered_name(const char *out_name, uint32_t n, int digits, char *name, size_t size);
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "sink.h"
+#include "container.h"
+
+/*
+ * Container sink - writes frames into a frame container (see container.h), each with its
+ * header, and an index chunk after every CONTAINER_CHUNK_FRAMES of them.
+ */
+
+struct container_sink {
+    struct sink snk;
+    FILE *out;
+    int seekable;               // whether the header can be updated as chunks are written
+    struct container_header hdr;
+    uint32_t codec;
+    uint64_t pos;               // bytes written so far
+    uint64_t frames;
+
+    // Offsets of the frames written since the last chunk
+    uint64_t *pending;
+    uint32_t pending_cnt;
+
+    // Offsets of the chunks written so far
+    uint64_t *directory;
+    uint64_t chunk_count, directory_len;
+};
+
+static int put(struct container_sink *cs, const void *data, size_t len) {
+    if (len > 0 && !fwrite(data, len, 1, cs->out)) {
+        return -1;
+    }
+    cs->pos += len;
+    return 0;
+}
+
+/**
+ * write_chunk - list the frames written since the last chunk, and point the header at it
+ */
+static int write_chunk(struct container_sink *cs) {
+    if (cs->chunk_count == cs->directory_len) {
+        uint64_t len = (cs->directory_len > 0) ? cs->directory_len * 2 : 64;
+        uint64_t *directory = realloc(cs->directory, len * sizeof(uint64_t));
+        if (directory == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        cs->directory = directory;
+        cs->directory_len = len;
+    }
+
+    uint64_t at = cs->pos;
+    struct container_index ix = {
+        .magic = CONTAINER_INDEX_MAGIC,
+        .count = cs->pending_cnt,
+        .first_frame = cs->frames - cs->pending_cnt,
+        .prev = (cs->chunk_count > 0) ? cs->directory[cs->chunk_count - 1] : 0,
+    };
+    if (-1 == put(cs, &ix, sizeof(ix))
+            || -1 == put(cs, cs->pending, cs->pending_cnt * sizeof(uint64_t))) {
+        return -1;
+    }
+    cs->directory[cs->chunk_count++] = at;
+    cs->pending_cnt = 0;
+
+    // The chunk has to be in the file before the header leads to it
+    if (cs->seekable) {
+        if (EOF == fflush(cs->out)) {
+            return -1;
+        }
+        if (-1 == pwrite(fileno(cs->out), &at, sizeof(at),
+                    offsetof(struct container_header, last_chunk))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int container_sink_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct container_sink *cs = (struct container_sink *) snk;
+    static const uint8_t zeros[8];
+
+    struct container_frame frame = {
+        .magic = CONTAINER_FRAME_MAGIC,
+        .size = buf->bytesused,
+        .sequence = buf->sequence,
+        .flags = buf->flags,
+        .pixelformat = cs->hdr.pixelformat,
+        .codec = cs->codec,
+        .timestamp_ns = (uint64_t) buf->timestamp.tv_sec * 1000000000ULL
+            + (uint64_t) buf->timestamp.tv_usec * 1000,
+    };
+
+    cs->pending[cs->pending_cnt++] = cs->pos;
+    cs->frames++;
+    if (-1 == put(cs, &frame, sizeof(frame)) || -1 == put(cs, data, buf->bytesused)
+            || -1 == put(cs, zeros, (8 - (buf->bytesused & 7)) & 7)) {
+        return -1;
+    }
+
+    if (cs->pending_cnt == cs->hdr.chunk_frames && -1 == write_chunk(cs)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * finish - write the last chunk, the directory and the trailer
+ */
+static int finish(struct container_sink *cs) {
+    if (cs->pending_cnt > 0 && -1 == write_chunk(cs)) {
+        return -1;
+    }
+
+    struct container_trailer tr = {
+        .magic = CONTAINER_TRAILER_MAGIC,
+        .chunk_frames = cs->hdr.chunk_frames,
+        .frame_count = cs->frames,
+        .chunk_count = cs->chunk_count,
+        .directory = cs->pos,
+    };
+    if (-1 == put(cs, cs->directory, cs->chunk_count * sizeof(uint64_t))
+            || -1 == put(cs, &tr, sizeof(tr))) {
+        return -1;
+    }
+    return 0;
+}
+
+static int container_sink_close(struct sink *snk) {
+    struct container_sink *cs = (struct container_sink *) snk;
+    int ret = 0;
+
+    if (cs->out != NULL) {
+        if (-1 == finish(cs)) {
+            ret = -1;
+        }
+        if (EOF == fclose(cs->out)) {
+            ret = -1;
+        }
+    }
+
+    free(cs->pending);
+    free(cs->directory);
+    free(cs);
+    return ret;
+}
+
+static const struct sink_ops container_sink_ops = {
+    .name = "container",
+    .submit = container_sink_submit,
+    .close = container_sink_close,
+};
+
+/**
+ * container_sink_open - create a sink writing frames of format "fmt" into the container
+ *                       "file_name", or into "fd" if it is NULL
+ *
+ * "codec" is what the frames are compressed with, or CODEC_NONE.  The fd stays owned by the
+ * caller.  Only a file that can be seeked gets its header updated as index chunks are written,
+ * for the index to be rebuilt quickly if it is never closed.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *container_sink_open(const char *file_name, int fd, const struct v4l2_format *fmt,
+        uint32_t codec) {
+    struct container_sink *cs = calloc(1, sizeof(struct container_sink));
+    if (cs == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    cs->snk.ops = &container_sink_ops;
+    cs->snk.event_fd = -1;
+    cs->codec = codec;
+
+    cs->hdr = (struct container_header) {
+        .magic = CONTAINER_MAGIC,
+        .version = CONTAINER_VERSION,
+        .header_size = sizeof(struct container_header),
+        .chunk_frames = CONTAINER_CHUNK_FRAMES,
+        .width = fmt->fmt.pix.width,
+        .height = fmt->fmt.pix.height,
+        .pixelformat = fmt->fmt.pix.pixelformat,
+        .bytesperline = fmt->fmt.pix.bytesperline,
+        .sizeimage = fmt->fmt.pix.sizeimage,
+        .field = fmt->fmt.pix.field,
+    };
+
+    cs->pending = calloc(CONTAINER_CHUNK_FRAMES, sizeof(uint64_t));
+    if (cs->pending == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    if (file_name != NULL) {
+        cs->out = fopen(file_name, "w");
+    } else {
+        // Closing the sink mustn't close the caller's fd
+        int dup_fd = dup(fd);
+        if (dup_fd == -1) {
+            goto fail;
+        }
+        cs->out = fdopen(dup_fd, "w");
+        if (cs->out == NULL) {
+            close(dup_fd);
+        }
+    }
+    if (cs->out == NULL) {
+        goto fail;
+    }
+    cs->seekable = (lseek(fileno(cs->out), 0, SEEK_CUR) == 0);
+
+    if (-1 == put(cs, &cs->hdr, sizeof(cs->hdr)) || EOF == fflush(cs->out)) {
+        goto fail;
+    }
+
+    return &cs->snk;
+
+fail:
+    {
+        int err = errno;
+        if (cs->out != NULL) {
+            fclose(cs->out);
+        }
+        free(cs->pending);
+        free(cs);
+        errno = err;
+    }
+    return NULL;
+}
@@ -0,0 +1,514 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <linux/videodev2.h>
+
+#include "sink.h"
+#include "convert.h"
+#include "scale.h"
+#include "buffer_pool.h"
+#include "codec.h"
+
+/*
+ * Convert sink - crops and scales every frame, converts it to another pixel format,
+ * compresses it, or any of those in that order, and passes it on to an inner sink.
+ *
+ * The conversion reads straight from the capture buffer and writes into a frame of our own
+ * pool, so the capture buffer can go back to the source as soon as submit() returns.  The
+ * inner sink sees the pool frames as its buffers, and may hold on to them; only when it holds
+ * every one of them does submit() wait for it to hand one back.  Frames that go through more
+ * than one step are scaled and converted into frames of pools of their own first.
+ *
+ * With a thread pool, frames are converted on it while the capture loop goes on.  The capture
+ * buffer is then held until its conversion is done, unless the frame was scaled first, and up
+ * to "in_flight" frames are converted at once.  Conversions finish out of order when the pool
+ * is busy, but the inner sink gets the frames in the order they were submitted.  Scaling also
+ * runs on the pool, but the capture loop waits for it.
+ *
+ * Compression, when there is any, takes the place of the conversion as the step run while the
+ * capture loop goes on, and the conversion is waited for like scaling.  The inner sink gets
+ * compressed frames of varying size.
+ */
+
+/**
+ * convert_pending - a frame being converted or compressed on the pool
+ */
+struct convert_pending {
+    struct convert_job job;
+    struct compress_job cjob;
+    struct v4l2_buffer buf;     // the capture buffer it is converted from
+    int held;                   // whether the capture buffer is still needed
+    int index;                  // the frame it is converted into
+};
+
+struct convert_sink {
+    struct sink snk;
+    struct sink *inner;
+    struct scaler *sc;
+    struct converter *cv;
+    struct compressor *cmp;
+    struct thread_pool *threads;
+    const struct convert_kernels *kernels;
+    struct v4l2_format out;
+
+    // Scaled frames waiting for conversion or compression, and converted ones waiting for
+    // compression, one per frame in flight
+    struct buffer_pool scaled_pool;
+    struct mmaped_buffer *scaled;
+    struct buffer_pool converted_pool;
+    struct mmaped_buffer *converted;
+
+    struct buffer_pool pool;
+    struct mmaped_buffer *frames;
+    int frame_count;
+    int *free_frames;
+    int free_cnt;
+
+    // Conversions on the pool, oldest first
+    struct convert_pending *pending;
+    int in_flight;
+    int pending_head;
+    int pending_cnt;
+    int done_fd;                // eventfd signalled when a conversion is done
+    int epoll_fd;               // waits for "done_fd" and the inner sink's event_fd together
+    int error;
+
+    // Counters
+    uint64_t frames_done;
+    uint64_t bytes_compressed;  // what the frames passed on came to
+    uint64_t convert_ns;        // time the capture loop spent converting, or waiting for it
+    uint64_t waits;             // submits that had to wait for the inner sink
+    uint64_t job_waits;         // submits that had to wait for a conversion
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void release_frame(void *arg, struct v4l2_buffer *buf) {
+    struct convert_sink *cs = arg;
+    cs->free_frames[cs->free_cnt++] = buf->index;
+}
+
+/**
+ * wait_frame - wait for the inner sink to hand back a frame of the pool
+ */
+static int wait_frame(struct convert_sink *cs) {
+    cs->waits++;
+    while (cs->free_cnt == 0) {
+        struct pollfd pfd = { .fd = cs->inner->event_fd, .events = POLLIN };
+        if (-1 == poll(&pfd, 1, -1)) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        if (-1 == sink_process_events(cs->inner)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * pass_frame - hand the converted frame "index" of "size" bytes to the inner sink
+ */
+static int pass_frame(struct convert_sink *cs, int index, const struct v4l2_buffer *buf,
+        uint32_t size) {
+    uint8_t *frame = cs->frames[index].start;
+    struct v4l2_buffer out = *buf;
+    out.index = index;
+    out.memory = V4L2_MEMORY_USERPTR;
+    out.m.userptr = (unsigned long) frame;
+    out.length = cs->frames[index].length;
+    out.bytesused = size;
+
+    int r = sink_submit(cs->inner, frame, &out);
+    if (r != 1) {
+        cs->free_frames[cs->free_cnt++] = index;
+    }
+    return (r == -1) ? -1 : 0;
+}
+
+static int pending_done(const struct convert_sink *cs, const struct convert_pending *p) {
+    return (cs->cmp != NULL) ? compress_frame_done(&p->cjob) : convert_frame_done(&p->job);
+}
+
+static void pending_wait(const struct convert_sink *cs, struct convert_pending *p) {
+    if (cs->cmp != NULL) {
+        compress_frame_wait(&p->cjob);
+    } else {
+        convert_frame_wait(&p->job);
+    }
+}
+
+/**
+ * finish_pending - pass on the conversions that are done, in order, and give their capture
+ * buffers back
+ *
+ * With "wait" set, waits for the oldest one at least.
+ */
+static int finish_pending(struct convert_sink *cs, int wait) {
+    int ret = 0;
+    while (cs->pending_cnt > 0) {
+        struct convert_pending *p = &cs->pending[cs->pending_head];
+        if (!pending_done(cs, p)) {
+            if (!wait) {
+                break;
+            }
+            uint64_t start = monotonic_ns();
+            cs->job_waits++;
+            pending_wait(cs, p);
+            cs->convert_ns += monotonic_ns() - start;
+        }
+        wait = 0;
+
+        cs->pending_head = (cs->pending_head + 1) % cs->in_flight;
+        cs->pending_cnt--;
+        cs->frames_done++;
+        if (p->held) {
+            cs->snk.release(cs->snk.release_arg, &p->buf);
+        }
+
+        uint32_t size = cs->out.fmt.pix.sizeimage;
+        if (cs->cmp != NULL) {
+            size = compress_frame_finish(&p->cjob);
+            cs->bytes_compressed += size;
+        }
+
+        // After an error the frames are dropped, but the capture buffers still go back
+        if (cs->error == 0 && -1 == pass_frame(cs, p->index, &p->buf, size)) {
+            cs->error = errno;
+        } else if (cs->error != 0) {
+            cs->free_frames[cs->free_cnt++] = p->index;
+        }
+    }
+
+    if (cs->error != 0) {
+        errno = cs->error;
+        ret = -1;
+    }
+    return ret;
+}
+
+static int convert_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct convert_sink *cs = (struct convert_sink *) snk;
+
+    if (cs->error != 0) {
+        errno = cs->error;
+        return -1;
+    }
+
+    if (cs->pending != NULL) {
+        if (cs->pending_cnt == cs->in_flight && -1 == finish_pending(cs, 1)) {
+            return -1;
+        }
+        while (cs->free_cnt == 0) {
+            int r = (cs->pending_cnt > 0) ? finish_pending(cs, 1) : wait_frame(cs);
+            if (r == -1) {
+                return -1;
+            }
+        }
+
+        int slot = (cs->pending_head + cs->pending_cnt) % cs->in_flight;
+        struct convert_pending *p = &cs->pending[slot];
+        p->buf = *buf;
+        p->held = 1;
+        p->index = cs->free_frames[--cs->free_cnt];
+        cs->pending_cnt++;
+
+        // Once scaled or converted, the last step doesn't need the capture buffer any more
+        uint64_t start = monotonic_ns();
+        if (cs->sc != NULL) {
+            scale_frame(cs->sc, data, cs->scaled[slot].start);
+            data = cs->scaled[slot].start;
+            p->held = 0;
+        }
+        if (cs->cv != NULL && cs->cmp != NULL) {
+            convert_frame(cs->cv, data, cs->converted[slot].start);
+            data = cs->converted[slot].start;
+            p->held = 0;
+        }
+        cs->convert_ns += monotonic_ns() - start;
+
+        uint8_t *frame = cs->frames[p->index].start;
+        if (cs->cmp != NULL) {
+            compress_frame_start(cs->cmp, &p->cjob, data, frame, cs->done_fd);
+        } else {
+            convert_frame_start(cs->cv, &p->job, data, frame, cs->done_fd);
+        }
+        return p->held;
+    }
+
+    if (cs->free_cnt == 0 && -1 == wait_frame(cs)) {
+        return -1;
+    }
+    int index = cs->free_frames[--cs->free_cnt];
+    uint8_t *frame = cs->frames[index].start;
+    uint32_t size = cs->out.fmt.pix.sizeimage;
+
+    // Every step but the last writes into a frame of its own
+    uint64_t start = monotonic_ns();
+    if (cs->sc != NULL) {
+        uint8_t *to = (cs->cv != NULL || cs->cmp != NULL) ? cs->scaled[0].start : frame;
+        scale_frame(cs->sc, data, to);
+        data = to;
+    }
+    if (cs->cv != NULL) {
+        uint8_t *to = (cs->cmp != NULL) ? cs->converted[0].start : frame;
+        convert_frame(cs->cv, data, to);
+        data = to;
+    }
+    if (cs->cmp != NULL) {
+        size = compress_frame(cs->cmp, data, frame);
+        cs->bytes_compressed += size;
+    }
+    cs->convert_ns += monotonic_ns() - start;
+    cs->frames_done++;
+
+    // Either way the capture buffer was only read by the conversion
+    return pass_frame(cs, index, buf, size);
+}
+
+static int convert_process_events(struct sink *snk) {
+    struct convert_sink *cs = (struct convert_sink *) snk;
+
+    if (cs->done_fd >= 0) {
+        uint64_t cnt;
+        if (-1 == read(cs->done_fd, &cnt, sizeof(cnt)) && errno != EAGAIN && errno != EINTR) {
+            return -1;
+        }
+        if (-1 == finish_pending(cs, 0)) {
+            return -1;
+        }
+    }
+    return sink_process_events(cs->inner);
+}
+
+static int convert_flush(struct sink *snk) {
+    struct convert_sink *cs = (struct convert_sink *) snk;
+
+    int ret = 0;
+    while (cs->pending_cnt > 0) {
+        if (-1 == finish_pending(cs, 1)) {
+            ret = -1;
+        }
+    }
+    if (-1 == sink_flush(cs->inner)) {
+        return -1;
+    }
+    if (ret == -1) {
+        errno = cs->error;
+    }
+    return ret;
+}
+
+static void convert_free(struct convert_sink *cs) {
+    // Conversions still running write into our frames and read the capture buffers
+    while (cs->pending_cnt > 0) {
+        struct convert_pending *p = &cs->pending[cs->pending_head];
+        pending_wait(cs, p);
+        cs->pending_head = (cs->pending_head + 1) % cs->in_flight;
+        cs->pending_cnt--;
+    }
+
+    compressor_free(cs->cmp);
+    converter_free(cs->cv);
+    scaler_free(cs->sc);
+    thread_pool_free(cs->threads);
+    buffer_pool_free(&cs->pool);
+    buffer_pool_free(&cs->scaled_pool);
+    buffer_pool_free(&cs->converted_pool);
+    if (cs->epoll_fd >= 0) {
+        close(cs->epoll_fd);
+    }
+    if (cs->done_fd >= 0) {
+        close(cs->done_fd);
+    }
+    free(cs->pending);
+    free(cs->scaled);
+    free(cs->converted);
+    free(cs->frames);
+    free(cs->free_frames);
+    free(cs);
+}
+
+static int convert_close(struct sink *snk) {
+    struct convert_sink *cs = (struct convert_sink *) snk;
+
+    int ret = sink_close(cs->inner);
+    int err = errno;
+
+    double us = cs->frames_done ? cs->convert_ns / 1000.0 / cs->frames_done : 0.0;
+    if (cs->sc != NULL || cs->cv != NULL) {
+        fprintf(stderr, "Convert: %llu frames to %s %ux%u with %s kernels, %.1f us per frame, "
+                "%llu waits for the writer\n", (unsigned long long) cs->frames_done,
+                pix_fmt_to_str(cs->out.fmt.pix.pixelformat), cs->out.fmt.pix.width,
+                cs->out.fmt.pix.height, cs->kernels->name, us, (unsigned long long) cs->waits);
+    }
+    if (cs->cmp != NULL) {
+        uint64_t raw = cs->frames_done * cs->out.fmt.pix.sizeimage;
+        fprintf(stderr, "Compress: %llu frames with %s, %llu MB to %llu MB (%.2f:1), %.1f us "
+                "per frame, %llu waits for the writer\n", (unsigned long long) cs->frames_done,
+                codec_name(CODEC_MED_RICE), (unsigned long long) (raw >> 20),
+                (unsigned long long) (cs->bytes_compressed >> 20),
+                cs->bytes_compressed ? (double) raw / cs->bytes_compressed : 0.0, us,
+                (unsigned long long) cs->waits);
+    }
+    if (cs->pending != NULL) {
+        fprintf(stderr, "Convert: %llu waits for a conversion with %d in flight\n",
+                (unsigned long long) cs->job_waits, cs->in_flight);
+    }
+    if (cs->threads != NULL) {
+        thread_pool_print(cs->threads, "Convert pool");
+    }
+
+    convert_free(cs);
+    errno = err;
+    return ret;
+}
+
+static const struct sink_ops convert_sink_ops = {
+    .name = "convert",
+    .submit = convert_submit,
+    .process_events = convert_process_events,
+    .flush = convert_flush,
+    .close = convert_close,
+};
+
+/**
+ * convert_sink_open - scale frames with "sc", then convert them with "cv", then compress them
+ * with "cmp", and pass them on to "inner"
+ *
+ * Any but one of "sc", "cv" and "cmp" can be NULL, and "threads" is the pool they were given,
+ * or NULL.  "out" is the format of the frames passed on, as the converter gave it, before they
+ * are compressed.  "frames" is how many of those frames the inner sink may hold at once, it
+ * sees them as buffer indexes below that.  With a pool and a converter or compressor, up to
+ * "in_flight" frames (at most "frames") are converted at once.  The convert sink takes over
+ * "sc", "cv", "cmp", "threads" and "inner", also when it fails.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *convert_sink_open(struct sink *inner, struct scaler *sc, struct converter *cv,
+        struct compressor *cmp, struct thread_pool *threads, const struct v4l2_format *out,
+        int frames, int in_flight) {
+    struct convert_sink *cs = NULL;
+    if (inner == NULL || (sc == NULL && cv == NULL && cmp == NULL) || out == NULL || frames <= 0
+            || in_flight <= 0) {
+        errno = EINVAL;
+    } else if (NULL == (cs = calloc(1, sizeof(struct convert_sink)))) {
+        errno = ENOMEM;
+    }
+    if (cs == NULL) {
+        int err = errno;
+        sink_close(inner);
+        compressor_free(cmp);
+        converter_free(cv);
+        scaler_free(sc);
+        thread_pool_free(threads);
+        errno = err;
+        return NULL;
+    }
+
+    cs->snk.ops = &convert_sink_ops;
+    cs->snk.event_fd = inner->event_fd;
+    cs->inner = inner;
+    cs->sc = sc;
+    cs->cv = cv;
+    cs->cmp = cmp;
+    cs->threads = threads;
+    cs->kernels = (cv != NULL) ? converter_kernels(cv) : convert_kernels_best();
+    cs->out = *out;
+    cs->frame_count = frames;
+    cs->done_fd = -1;
+    cs->epoll_fd = -1;
+
+    cs->frames = calloc(frames, sizeof(struct mmaped_buffer));
+    cs->free_frames = calloc(frames, sizeof(int));
+    if (cs->frames == NULL || cs->free_frames == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    size_t size = (cmp != NULL) ? codec_bound(out) : out->fmt.pix.sizeimage;
+    if (-1 == buffer_pool_alloc(&cs->pool, cs->frames, frames, size)) {
+        goto fail;
+    }
+    for (int i = frames - 1; i >= 0; i--) {
+        cs->free_frames[cs->free_cnt++] = i;
+    }
+
+    // The last step runs while the capture loop goes on
+    struct thread_pool *last = (cmp != NULL) ? compressor_pool(cmp)
+        : (cv != NULL) ? converter_pool(cv) : NULL;
+    if (last != NULL) {
+        cs->in_flight = (in_flight < frames) ? in_flight : frames;
+        cs->pending = calloc(cs->in_flight, sizeof(struct convert_pending));
+        if (cs->pending == NULL) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        if (-1 == (cs->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+            goto fail;
+        }
+
+        // The capture loop waits for one fd: finished conversions and the inner sink's events
+        if (inner->event_fd < 0) {
+            cs->snk.event_fd = cs->done_fd;
+        } else {
+            if (-1 == (cs->epoll_fd = epoll_create1(EPOLL_CLOEXEC))) {
+                goto fail;
+            }
+            struct epoll_event ev = { .events = EPOLLIN };
+            if (-1 == epoll_ctl(cs->epoll_fd, EPOLL_CTL_ADD, cs->done_fd, &ev)
+                    || -1 == epoll_ctl(cs->epoll_fd, EPOLL_CTL_ADD, inner->event_fd, &ev)) {
+                goto fail;
+            }
+            cs->snk.event_fd = cs->epoll_fd;
+        }
+    }
+
+    int count = (cs->pending != NULL) ? cs->in_flight : 1;
+    if (sc != NULL && (cv != NULL || cmp != NULL)) {
+        cs->scaled = calloc(count, sizeof(struct mmaped_buffer));
+        if (cs->scaled == NULL) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        if (-1 == buffer_pool_alloc(&cs->scaled_pool, cs->scaled, count, scaler_frame_size(sc))) {
+            goto fail;
+        }
+    }
+    if (cv != NULL && cmp != NULL) {
+        cs->converted = calloc(count, sizeof(struct mmaped_buffer));
+        if (cs->converted == NULL) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        if (-1 == buffer_pool_alloc(&cs->converted_pool, cs->converted, count,
+                    out->fmt.pix.sizeimage)) {
+            goto fail;
+        }
+    }
+
+    sink_set_release(inner, release_frame, cs);
+    return &cs->snk;
+
+fail: ;
+    int err = errno;
+    sink_close(inner);
+    convert_free(cs);
+    errno = err;
+    return NULL;
+}
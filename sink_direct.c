@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+
+#include "sink.h"
+
+/*
+ * Direct sink - writes frames with O_DIRECT, bypassing the page cache.
+ *
+ * O_DIRECT needs the file offset, the length and the memory of every write aligned.  Whole
+ * blocks are written straight from the frame when its memory is suitably aligned (which the
+ * page-aligned capture buffers are), everything else goes through an aligned staging buffer.
+ * The tail of a frame that doesn't fill a block waits in the staging buffer for the next frame,
+ * and the last partial block is padded and trimmed off again with ftruncate on close.
+ */
+
+#define DIRECT_ALIGN 4096
+#define STAGING_SIZE (4 * 1024 * 1024)
+
+struct direct_sink {
+    struct sink snk;
+    int fd;
+    uint32_t mem_align;
+    uint32_t block;             // file offset and length alignment
+    uint8_t *staging;
+    size_t staged;              // bytes waiting in the staging buffer, always < STAGING_SIZE
+    uint64_t offset;            // file offset of the start of the staging buffer
+
+    // Counters
+    uint64_t direct_bytes;
+    uint64_t staged_bytes;
+};
+
+/**
+ * write_all - pwrite "len" aligned bytes at "off", retrying after short writes
+ */
+static int write_all(int fd, const uint8_t *data, size_t len, uint64_t off) {
+    while (len > 0) {
+        ssize_t r = pwrite(fd, data, len, off);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (r == 0) {
+            errno = EIO;
+            return -1;
+        }
+
+        data += r;
+        len -= r;
+        off += r;
+    }
+
+    return 0;
+}
+
+/**
+ * flush_staging - write out the whole blocks in the staging buffer, keep the partial one
+ */
+static int flush_staging(struct direct_sink *ds) {
+    size_t whole = ds->staged - (ds->staged % ds->block);
+    if (whole == 0) {
+        return 0;
+    }
+
+    if (-1 == write_all(ds->fd, ds->staging, whole, ds->offset)) {
+        return -1;
+    }
+
+    ds->offset += whole;
+    ds->staged -= whole;
+    memmove(ds->staging, ds->staging + whole, ds->staged);
+    return 0;
+}
+
+static int direct_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct direct_sink *ds = (struct direct_sink *) snk;
+    const uint8_t *p = data;
+    size_t len = buf->bytesused;
+
+    // Complete the partial block left over from the previous frame first
+    if (ds->staged > 0) {
+        size_t fill = ds->block - (ds->staged % ds->block);
+        if (fill > len) {
+            fill = len;
+        }
+
+        memcpy(ds->staging + ds->staged, p, fill);
+        ds->staged += fill;
+        ds->staged_bytes += fill;
+        p += fill;
+        len -= fill;
+
+        if (-1 == flush_staging(ds)) {
+            return -1;
+        }
+    }
+
+    // The block-aligned middle of the frame, straight from its buffer if we are allowed to
+    size_t whole = len - (len % ds->block);
+    if (ds->staged == 0 && whole > 0 && ((uintptr_t) p % ds->mem_align) == 0) {
+        if (-1 == write_all(ds->fd, p, whole, ds->offset)) {
+            return -1;
+        }
+
+        ds->offset += whole;
+        ds->direct_bytes += whole;
+        p += whole;
+        len -= whole;
+    }
+
+    // Whatever is left goes through the staging buffer
+    while (len > 0) {
+        size_t chunk = STAGING_SIZE - ds->staged;
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        memcpy(ds->staging + ds->staged, p, chunk);
+        ds->staged += chunk;
+        ds->staged_bytes += chunk;
+        p += chunk;
+        len -= chunk;
+
+        if (-1 == flush_staging(ds)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * finish - write the final partial block padded with zeroes, and cut the file to its real size
+ */
+static int finish(struct direct_sink *ds) {
+    uint64_t size = ds->offset + ds->staged;
+
+    if (ds->staged > 0) {
+        size_t padded = ds->staged + (ds->block - (ds->staged % ds->block)) % ds->block;
+        memset(ds->staging + ds->staged, 0, padded - ds->staged);
+        if (-1 == write_all(ds->fd, ds->staging, padded, ds->offset)) {
+            return -1;
+        }
+    }
+
+    // Also gives back whatever we preallocated and didn't use
+    return ftruncate(ds->fd, size);
+}
+
+static int direct_close(struct sink *snk) {
+    struct direct_sink *ds = (struct direct_sink *) snk;
+    int ret = 0;
+    int err = 0;
+
+    if (-1 == finish(ds)) {
+        err = errno;
+        ret = -1;
+    }
+
+    fprintf(stderr, "O_DIRECT: %llu bytes written from the frame buffers, %llu through staging\n",
+            (unsigned long long) ds->direct_bytes, (unsigned long long) ds->staged_bytes);
+
+    if (close(ds->fd) == -1 && ret == 0) {
+        err = errno;
+        ret = -1;
+    }
+
+    munmap(ds->staging, STAGING_SIZE);
+    free(ds);
+    errno = err;
+    return ret;
+}
+
+static const struct sink_ops direct_sink_ops = {
+    .name = "direct",
+    .submit = direct_submit,
+    .close = direct_close,
+};
+
+/**
+ * get_alignment - ask the filesystem what O_DIRECT needs, assume a page if it can't tell us
+ */
+static void get_alignment(struct direct_sink *ds) {
+    ds->mem_align = DIRECT_ALIGN;
+    ds->block = DIRECT_ALIGN;
+
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+    if (0 == statx(ds->fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx)
+            && (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_mem_align != 0
+            && stx.stx_dio_offset_align != 0) {
+        ds->mem_align = stx.stx_dio_mem_align;
+        ds->block = stx.stx_dio_offset_align;
+    }
+#endif
+}
+
+/**
+ * direct_sink_open - create a sink writing to "file_name" with O_DIRECT
+ *
+ * "prealloc" bytes are reserved up front with fallocate, so the filesystem can lay the file
+ * out in one go instead of extending it write by write.  Pass 0 to skip that.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *direct_sink_open(const char *file_name, uint64_t prealloc) {
+    if (file_name == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct direct_sink *ds = calloc(1, sizeof(struct direct_sink));
+    if (ds == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ds->snk.ops = &direct_sink_ops;
+    ds->snk.event_fd = -1;
+
+    ds->fd = open(file_name, (O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC), 0666);
+    if (ds->fd == -1) {
+        int err = errno;
+        free(ds);
+        errno = err;
+        return NULL;
+    }
+
+    get_alignment(ds);
+
+    ds->staging = mmap(NULL, STAGING_SIZE, (PROT_READ | PROT_WRITE),
+            (MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE), -1, 0);
+    if (ds->staging == MAP_FAILED) {
+        int err = errno;
+        close(ds->fd);
+        free(ds);
+        errno = err;
+        return NULL;
+    }
+
+    if (prealloc > 0 && -1 == fallocate(ds->fd, 0, 0, prealloc)) {
+        // Not every filesystem can, that only costs us some performance
+        perror("Warning: unable to preallocate output file");
+    }
+
+    return &ds->snk;
+}
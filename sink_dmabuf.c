@@ -0,0 +1,438 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/videodev2.h>
+
+#include "source.h"
+#include "sink.h"
+#include "share_proto.h"
+
+/*
+ * DMABUF sink - shares the capture buffers themselves with other processes.
+ *
+ * Every buffer is exported once (VIDIOC_EXPBUF), and the file descriptors are passed to each
+ * subscriber when it connects, so frames are never copied.  Each frame is announced to every
+ * subscriber with room for it, and the buffer is held until all of them have released it.  A
+ * subscriber that already holds "max_held" frames misses the next ones rather than stalling
+ * the capture, and one that disconnects implicitly releases everything it held.
+ *
+ * The sink's event_fd is an epoll fd watching the listening socket and the subscribers.
+ */
+
+#define MAX_SUBSCRIBERS 16
+#define FLUSH_TIMEOUT_MS 2000
+
+struct subscriber {
+    int fd;                 // -1 for a free slot
+    uint32_t holding;       // bit mask of the buffer indexes this subscriber hasn't released
+};
+
+struct dmabuf_sink {
+    struct sink snk;
+    int listen_fd;
+    char *path;
+
+    struct share_hello hello;
+    int buf_fds[VIDEO_MAX_FRAME];
+    int buf_count;
+    int max_held;
+
+    struct v4l2_buffer held[VIDEO_MAX_FRAME];
+    int refs[VIDEO_MAX_FRAME];  // subscribers still reading each buffer
+    int held_cnt;
+
+    struct subscriber subs[MAX_SUBSCRIBERS];
+
+    // Counters
+    uint64_t published;
+    uint64_t unwatched;     // frames nobody was subscribed for
+    uint64_t missed;        // frames not sent to a subscriber that was too far behind
+    uint64_t subscribed;
+};
+
+static void unref_buffer(struct dmabuf_sink *ds, int index) {
+    if (--ds->refs[index] == 0) {
+        ds->held_cnt--;
+        ds->snk.release(ds->snk.release_arg, &ds->held[index]);
+    }
+}
+
+/**
+ * drop_subscriber - disconnect a subscriber, releasing every buffer it still held
+ */
+static void drop_subscriber(struct dmabuf_sink *ds, struct subscriber *sub) {
+    close(sub->fd);
+    sub->fd = -1;
+
+    for (int i = 0; i < ds->buf_count; i++) {
+        if (sub->holding & (1U << i)) {
+            sub->holding &= ~(1U << i);
+            unref_buffer(ds, i);
+        }
+    }
+}
+
+/**
+ * send_hello - describe the stream to a new subscriber and pass it the buffers
+ */
+static int send_hello(struct dmabuf_sink *ds, int fd) {
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * VIDEO_MAX_FRAME)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = { .iov_base = &ds->hello, .iov_len = sizeof(ds->hello) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * ds->buf_count),
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * ds->buf_count);
+    memcpy(CMSG_DATA(cmsg), ds->buf_fds, sizeof(int) * ds->buf_count);
+
+    if (-1 == sendmsg(fd, &msg, MSG_NOSIGNAL)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void accept_subscribers(struct dmabuf_sink *ds) {
+    int fd;
+    while (-1 != (fd = accept4(ds->listen_fd, NULL, NULL, (SOCK_NONBLOCK | SOCK_CLOEXEC)))) {
+        struct subscriber *sub = NULL;
+        for (int i = 0; i < MAX_SUBSCRIBERS && sub == NULL; i++) {
+            if (ds->subs[i].fd == -1) {
+                sub = &ds->subs[i];
+            }
+        }
+
+        if (sub == NULL) {
+            fprintf(stderr, "Too many subscribers, turning one away\n");
+            close(fd);
+            continue;
+        }
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = sub };
+        if (-1 == send_hello(ds, fd) || -1 == epoll_ctl(ds->snk.event_fd, EPOLL_CTL_ADD, fd, &ev)) {
+            perror("Error setting up subscriber");
+            close(fd);
+            continue;
+        }
+
+        sub->fd = fd;
+        sub->holding = 0;
+        ds->subscribed++;
+        fprintf(stdout, "Subscriber %d connected\n", (int) (sub - ds->subs));
+    }
+}
+
+/**
+ * read_subscriber - take in the releases a subscriber sent, drop it if it went away
+ */
+static void read_subscriber(struct dmabuf_sink *ds, struct subscriber *sub) {
+    for (;;) {
+        struct share_frame msg;
+        ssize_t r = recv(sub->fd, &msg, sizeof(msg), 0);
+        if (r == -1 && errno == EINTR) {
+            continue;
+        }
+        if (r == -1 && errno == EAGAIN) {
+            return;
+        }
+
+        if (r <= 0) {
+            fprintf(stdout, "Subscriber %d disconnected\n", (int) (sub - ds->subs));
+            drop_subscriber(ds, sub);
+            return;
+        }
+
+        // Anything but the release of a buffer it holds is a protocol error we just ignore
+        if ((size_t) r == sizeof(msg) && msg.type == SHARE_MSG_RELEASE
+                && msg.index < (uint32_t) ds->buf_count && (sub->holding & (1U << msg.index))) {
+            sub->holding &= ~(1U << msg.index);
+            unref_buffer(ds, msg.index);
+        }
+    }
+}
+
+static int dmabuf_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct dmabuf_sink *ds = (struct dmabuf_sink *) snk;
+    (void) data;
+
+    struct share_frame msg = {
+        .type = SHARE_MSG_READY,
+        .index = buf->index,
+        .sequence = buf->sequence,
+        .bytesused = buf->bytesused,
+        .flags = buf->flags,
+        .timestamp_us = (uint64_t) buf->timestamp.tv_sec * 1000000 + buf->timestamp.tv_usec,
+    };
+
+    int refs = 0;
+    int watched = 0;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        struct subscriber *sub = &ds->subs[i];
+        if (sub->fd == -1) {
+            continue;
+        }
+        watched = 1;
+
+        if (__builtin_popcount(sub->holding) >= ds->max_held) {
+            ds->missed++;
+            continue;
+        }
+
+        if (-1 == send(sub->fd, &msg, sizeof(msg), (MSG_DONTWAIT | MSG_NOSIGNAL))) {
+            if (errno == EAGAIN) {
+                ds->missed++;
+            } else {
+                fprintf(stdout, "Subscriber %d disconnected\n", i);
+                drop_subscriber(ds, sub);
+            }
+            continue;
+        }
+
+        sub->holding |= 1U << buf->index;
+        refs++;
+    }
+
+    ds->published++;
+    if (!watched) {
+        ds->unwatched++;
+    }
+
+    if (refs == 0) {
+        return 0;
+    }
+
+    ds->held[buf->index] = *buf;
+    ds->refs[buf->index] = refs;
+    ds->held_cnt++;
+    return 1;
+}
+
+static int dmabuf_process_events(struct sink *snk) {
+    struct dmabuf_sink *ds = (struct dmabuf_sink *) snk;
+
+    struct epoll_event evs[MAX_SUBSCRIBERS + 1];
+    int n = epoll_wait(snk->event_fd, evs, MAX_SUBSCRIBERS + 1, 0);
+    if (n == -1) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (evs[i].data.ptr == NULL) {
+            accept_subscribers(ds);
+            continue;
+        }
+
+        struct subscriber *sub = evs[i].data.ptr;
+        if (sub->fd != -1) {
+            read_subscriber(ds, sub);
+        }
+    }
+
+    return 0;
+}
+
+static int dmabuf_flush(struct sink *snk) {
+    struct dmabuf_sink *ds = (struct dmabuf_sink *) snk;
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (ds->held_cnt > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000
+            + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed_ms >= FLUSH_TIMEOUT_MS) {
+            break;
+        }
+
+        struct epoll_event ev;
+        int n = epoll_wait(snk->event_fd, &ev, 1, FLUSH_TIMEOUT_MS - elapsed_ms);
+        if (n == -1 && errno != EINTR) {
+            return -1;
+        }
+        if (n > 0 && -1 == dmabuf_process_events(snk)) {
+            return -1;
+        }
+    }
+
+    // Whoever still holds buffers now is stuck, don't let them keep the capture from ending
+    for (int i = 0; i < MAX_SUBSCRIBERS && ds->held_cnt > 0; i++) {
+        if (ds->subs[i].fd != -1 && ds->subs[i].holding != 0) {
+            fprintf(stderr, "Subscriber %d didn't release its buffers, disconnecting it\n", i);
+            drop_subscriber(ds, &ds->subs[i]);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * destroy - close every socket and buffer fd, and remove the socket from the filesystem
+ *
+ * Buffers still held by subscribers are not released, the capture is over by now.
+ */
+static void destroy(struct dmabuf_sink *ds) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (ds->subs[i].fd != -1) {
+            close(ds->subs[i].fd);
+        }
+    }
+
+    for (int i = 0; i < ds->buf_count; i++) {
+        if (ds->buf_fds[i] >= 0) {
+            close(ds->buf_fds[i]);
+        }
+    }
+
+    if (ds->listen_fd >= 0) {
+        close(ds->listen_fd);
+        unlink(ds->path);
+    }
+    if (ds->snk.event_fd >= 0) {
+        close(ds->snk.event_fd);
+    }
+
+    free(ds->path);
+    free(ds);
+}
+
+static int dmabuf_close(struct sink *snk) {
+    struct dmabuf_sink *ds = (struct dmabuf_sink *) snk;
+
+    fprintf(stderr, "Share: %llu frames published (%llu with no subscribers), %llu missed by "
+            "slow subscribers, %llu subscribers in total\n",
+            (unsigned long long) ds->published, (unsigned long long) ds->unwatched,
+            (unsigned long long) ds->missed, (unsigned long long) ds->subscribed);
+
+    destroy(ds);
+    return 0;
+}
+
+static const struct sink_ops dmabuf_sink_ops = {
+    .name = "dmabuf",
+    .submit = dmabuf_submit,
+    .process_events = dmabuf_process_events,
+    .flush = dmabuf_flush,
+    .close = dmabuf_close,
+};
+
+/**
+ * listen_on - create the non-blocking listening socket at "path", replacing a stale one
+ */
+static int listen_on(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, (SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC), 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    unlink(path);
+    if (-1 == bind(fd, (struct sockaddr *) &addr, sizeof(addr)) || -1 == listen(fd, 8)) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * dmabuf_sink_open - create a sink sharing the buffers of "src" through the socket at "path"
+ *
+ * The source's buffers must already be allocated, and "fmt" is the format they were set up for.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *dmabuf_sink_open(const char *path, struct capture_source *src,
+        const struct v4l2_format *fmt) {
+    if (path == NULL || src == NULL || fmt == NULL || src->buf_count > VIDEO_MAX_FRAME) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct dmabuf_sink *ds = calloc(1, sizeof(struct dmabuf_sink));
+    if (ds == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ds->snk.ops = &dmabuf_sink_ops;
+    ds->listen_fd = -1;
+    ds->buf_count = src->buf_count;
+    for (int i = 0; i < VIDEO_MAX_FRAME; i++) {
+        ds->buf_fds[i] = -1;
+    }
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        ds->subs[i].fd = -1;
+    }
+
+    // Leave at least one buffer to the capture, whatever a single subscriber does
+    ds->max_held = (ds->buf_count > 2) ? ds->buf_count / 2 : 1;
+
+    ds->hello.type = SHARE_MSG_HELLO;
+    ds->hello.version = SHARE_PROTO_VERSION;
+    ds->hello.buf_count = ds->buf_count;
+    ds->hello.max_held = ds->max_held;
+    ds->hello.width = fmt->fmt.pix.width;
+    ds->hello.height = fmt->fmt.pix.height;
+    ds->hello.pixelformat = fmt->fmt.pix.pixelformat;
+    ds->hello.bytesperline = fmt->fmt.pix.bytesperline;
+    ds->hello.sizeimage = fmt->fmt.pix.sizeimage;
+
+    ds->path = strdup(path);
+    ds->snk.event_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ds->path == NULL || ds->snk.event_fd == -1) {
+        goto fail;
+    }
+
+    for (int i = 0; i < ds->buf_count; i++) {
+        ds->buf_fds[i] = source_export_buffer(src, i);
+        if (ds->buf_fds[i] == -1) {
+            goto fail;
+        }
+        ds->hello.length[i] = src->bufs[i].length;
+    }
+
+    ds->listen_fd = listen_on(path);
+    if (ds->listen_fd == -1) {
+        goto fail;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (-1 == epoll_ctl(ds->snk.event_fd, EPOLL_CTL_ADD, ds->listen_fd, &ev)) {
+        goto fail;
+    }
+
+    return &ds->snk;
+
+fail: ;
+    int err = (ds->path == NULL) ? ENOMEM : errno;
+    destroy(ds);
+    errno = err;
+    return NULL;
+}
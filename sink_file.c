@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "sink.h"
+
+/*
+ * File sink - writes frames back to back into a file, or to an already open fd
+ */
+
+struct file_sink {
+    struct sink snk;
+    FILE *out;
+    int fd;
+};
+
+static int file_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct file_sink *fs = (struct file_sink *) snk;
+
+    if (NULL != fs->out) {
+        // Empty error buffers have nothing to write
+        if (buf->bytesused > 0 && !fwrite(data, buf->bytesused, 1, fs->out)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    // Pipes and sockets can take less than we give them
+    const uint8_t *p = data;
+    size_t len = buf->bytesused;
+    while (len > 0) {
+        ssize_t r = write(fs->fd, p, len);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        p += r;
+        len -= r;
+    }
+
+    return 0;
+}
+
+static int file_close(struct sink *snk) {
+    struct file_sink *fs = (struct file_sink *) snk;
+    int ret = 0;
+
+    if ((fs->out != NULL) && (EOF == fclose(fs->out))) {
+        ret = -1;
+    }
+
+    free(fs);
+    return ret;
+}
+
+static const struct sink_ops file_sink_ops = {
+    .name = "file",
+    .submit = file_submit,
+    .close = file_close,
+};
+
+/**
+ * file_sink_open - create a sink writing to "file_name", or to "fd" if it is NULL
+ *
+ * The fd stays owned by the caller.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *file_sink_open(const char *file_name, int fd) {
+    struct file_sink *fs = calloc(1, sizeof(struct file_sink));
+    if (fs == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    fs->snk.ops = &file_sink_ops;
+    fs->snk.event_fd = -1;
+    fs->fd = fd;
+
+    if (file_name != NULL) {
+        fs->out = fopen(file_name, "w");
+        if (fs->out == NULL) {
+            int err = errno;
+            free(fs);
+            errno = err;
+            return NULL;
+        }
+    }
+
+    return &fs->snk;
+}
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include <linux/videodev2.h>
+
+#include "sink.h"
+#include "motion.h"
+#include "buffer_pool.h"
+
+/*
+ * Motion sink - passes on only the frames that changed, and the frames around them.
+ *
+ * Every frame is compared with the last frame passed on.  When it differs by more than the
+ * threshold it is passed on, after the "pre_roll" frames that came right before it and
+ * followed by the "post_roll" frames after it.  The first frame is always passed on.
+ *
+ * Pre-roll frames are copied into a pool of our own, as the capture buffers have to go back
+ * to the source.  When the inner sink may hold on to the frames it gets, the frames passed on
+ * are copied into the pool as well, so it sees pool frames only; otherwise they go through as
+ * they are.
+ */
+
+/**
+ * motion_held - a frame kept for the pre-roll
+ */
+struct motion_held {
+    struct v4l2_buffer buf;
+    int index;                  // the pool frame it was copied into
+    uint32_t level;
+};
+
+struct motion_sink {
+    struct sink snk;
+    struct sink *inner;
+    struct motion_detector *md;
+    double threshold;
+    int post_roll;
+    int post_left;              // frames still to pass on after the last trigger
+    int copy;                   // pass on pool frames rather than the capture buffers
+    FILE *log;
+
+    struct buffer_pool pool;
+    struct mmaped_buffer *frames;
+    size_t frame_size;
+    int *free_frames;
+    int free_cnt;
+
+    // Pre-roll frames, oldest first
+    struct motion_held *ring;
+    int pre_roll;
+    int ring_head;
+    int ring_cnt;
+    uint32_t skipped;           // frames dropped since the last one passed on
+
+    // Counters
+    uint64_t frames_seen;
+    uint64_t passed;
+    uint64_t triggers;
+    uint64_t measure_ns;
+    uint64_t waits;             // submits that had to wait for the inner sink
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void release_frame(void *arg, struct v4l2_buffer *buf) {
+    struct motion_sink *ms = arg;
+    ms->free_frames[ms->free_cnt++] = buf->index;
+}
+
+/**
+ * wait_frame - wait for the inner sink to hand back a frame of the pool
+ */
+static int wait_frame(struct motion_sink *ms) {
+    ms->waits++;
+    while (ms->free_cnt == 0) {
+        struct pollfd pfd = { .fd = ms->inner->event_fd, .events = POLLIN };
+        if (-1 == poll(&pfd, 1, -1)) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        if (-1 == sink_process_events(ms->inner)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * log_frame - note down a frame passed on
+ */
+static int log_frame(struct motion_sink *ms, const struct v4l2_buffer *buf,
+        enum motion_reason reason, uint32_t level) {
+    ms->passed++;
+    uint32_t skipped = ms->skipped;
+    ms->skipped = 0;
+    if (ms->log == NULL) {
+        return 0;
+    }
+
+    struct motion_log_record rec = {
+        .sequence = buf->sequence,
+        .flags = buf->flags,
+        .reason = reason,
+        .skipped = skipped,
+        .level = level,
+        .timestamp_ns = (uint64_t) buf->timestamp.tv_sec * 1000000000ULL
+            + (uint64_t) buf->timestamp.tv_usec * 1000,
+    };
+    if (!fwrite(&rec, sizeof(rec), 1, ms->log)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * pass_frame - hand the pool frame "index" to the inner sink
+ */
+static int pass_frame(struct motion_sink *ms, int index, const struct v4l2_buffer *buf) {
+    uint8_t *frame = ms->frames[index].start;
+    struct v4l2_buffer out = *buf;
+    out.index = index;
+    out.memory = V4L2_MEMORY_USERPTR;
+    out.m.userptr = (unsigned long) frame;
+    out.length = ms->frames[index].length;
+
+    int r = sink_submit(ms->inner, frame, &out);
+    if (r != 1) {
+        ms->free_frames[ms->free_cnt++] = index;
+    }
+    return (r == -1) ? -1 : 0;
+}
+
+/**
+ * copy_frame - copy a frame into a pool frame
+ *
+ * @returns the pool frame, or -1 with errno set
+ */
+static int copy_frame(struct motion_sink *ms, const void *data, const struct v4l2_buffer *buf) {
+    if (ms->free_cnt == 0 && -1 == wait_frame(ms)) {
+        return -1;
+    }
+    int index = ms->free_frames[--ms->free_cnt];
+    size_t size = (buf->bytesused < ms->frame_size) ? buf->bytesused : ms->frame_size;
+    memcpy(ms->frames[index].start, data, size);
+    return index;
+}
+
+/**
+ * hold_frame - keep a frame for the pre-roll, dropping the oldest one if the ring is full
+ */
+static int hold_frame(struct motion_sink *ms, const void *data, const struct v4l2_buffer *buf,
+        uint32_t level) {
+    int index;
+    if (ms->ring_cnt == ms->pre_roll) {
+        index = ms->ring[ms->ring_head].index;
+        ms->ring_head = (ms->ring_head + 1) % ms->pre_roll;
+        ms->ring_cnt--;
+        ms->skipped++;
+
+        size_t size = (buf->bytesused < ms->frame_size) ? buf->bytesused : ms->frame_size;
+        memcpy(ms->frames[index].start, data, size);
+    } else if (-1 == (index = copy_frame(ms, data, buf))) {
+        return -1;
+    }
+
+    struct motion_held *h = &ms->ring[(ms->ring_head + ms->ring_cnt) % ms->pre_roll];
+    h->buf = *buf;
+    h->index = index;
+    h->level = level;
+    ms->ring_cnt++;
+    return 0;
+}
+
+/**
+ * pass_ring - pass on the pre-roll frames, oldest first
+ */
+static int pass_ring(struct motion_sink *ms) {
+    while (ms->ring_cnt > 0) {
+        struct motion_held *h = &ms->ring[ms->ring_head];
+        ms->ring_head = (ms->ring_head + 1) % ms->pre_roll;
+        ms->ring_cnt--;
+
+        if (-1 == log_frame(ms, &h->buf, MOTION_PRE_ROLL, h->level)
+                || -1 == pass_frame(ms, h->index, &h->buf)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int motion_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct motion_sink *ms = (struct motion_sink *) snk;
+    ms->frames_seen++;
+
+    uint64_t start = monotonic_ns();
+    double level = motion_measure(ms->md, data);
+    ms->measure_ns += monotonic_ns() - start;
+    uint32_t fixed = (level < 0) ? 0 : (uint32_t) (level * 256 + 0.5);
+
+    enum motion_reason reason;
+    if (level < 0 || level > ms->threshold) {
+        reason = (level < 0) ? MOTION_FIRST : MOTION_TRIGGER;
+        if (ms->post_left == 0) {
+            ms->triggers++;
+        }
+        ms->post_left = ms->post_roll;
+        if (-1 == pass_ring(ms)) {
+            return -1;
+        }
+    } else if (ms->post_left > 0) {
+        reason = MOTION_POST_ROLL;
+        ms->post_left--;
+    } else if (ms->pre_roll > 0) {
+        return (-1 == hold_frame(ms, data, buf, fixed)) ? -1 : 0;
+    } else {
+        ms->skipped++;
+        return 0;
+    }
+
+    // What gets passed on is what the next frames are compared with
+    motion_keep(ms->md);
+    if (-1 == log_frame(ms, buf, reason, fixed)) {
+        return -1;
+    }
+    if (!ms->copy) {
+        return sink_submit(ms->inner, data, buf);
+    }
+
+    int index = copy_frame(ms, data, buf);
+    return (index == -1) ? -1 : pass_frame(ms, index, buf);
+}
+
+static int motion_process_events(struct sink *snk) {
+    struct motion_sink *ms = (struct motion_sink *) snk;
+    return sink_process_events(ms->inner);
+}
+
+static int motion_flush(struct sink *snk) {
+    struct motion_sink *ms = (struct motion_sink *) snk;
+    if (ms->log != NULL && 0 != fflush(ms->log)) {
+        return -1;
+    }
+    return sink_flush(ms->inner);
+}
+
+static void motion_free_sink(struct motion_sink *ms) {
+    motion_free(ms->md);
+    buffer_pool_free(&ms->pool);
+    free(ms->ring);
+    free(ms->frames);
+    free(ms->free_frames);
+    free(ms);
+}
+
+static int motion_close(struct sink *snk) {
+    struct motion_sink *ms = (struct motion_sink *) snk;
+
+    int ret = sink_close(ms->inner);
+    int err = errno;
+    if (ms->log != NULL && 0 != fclose(ms->log) && ret == 0) {
+        ret = -1;
+        err = errno;
+    }
+
+    fprintf(stderr, "Motion: %llu of %llu frames passed on, %llu triggers, %.1f us per "
+            "comparison, %llu waits for the writer\n", (unsigned long long) ms->passed,
+            (unsigned long long) ms->frames_seen, (unsigned long long) ms->triggers,
+            ms->frames_seen ? ms->measure_ns / 1000.0 / ms->frames_seen : 0.0,
+            (unsigned long long) ms->waits);
+
+    motion_free_sink(ms);
+    errno = err;
+    return ret;
+}
+
+static const struct sink_ops motion_sink_ops = {
+    .name = "motion",
+    .submit = motion_submit,
+    .process_events = motion_process_events,
+    .flush = motion_flush,
+    .close = motion_close,
+};
+
+/**
+ * motion_sink_open - pass frames on to "inner" only when "md" finds them differing from the
+ * last one passed on by more than "threshold", with "pre_roll" frames before and "post_roll"
+ * after
+ *
+ * "frame_size" is the most a frame can take.  "frames" is how many frames the inner sink may
+ * hold at once; it sees pool frames as buffer indexes below "frames" + "pre_roll".  With
+ * "log_name" set, every frame passed on is logged there.  The motion sink takes over "md" and
+ * "inner", also when it fails.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *motion_sink_open(struct sink *inner, struct motion_detector *md, double threshold,
+        int pre_roll, int post_roll, int frames, size_t frame_size, const char *log_name) {
+    struct motion_sink *ms = NULL;
+    if (inner == NULL || md == NULL || threshold < 0 || pre_roll < 0 || post_roll < 0
+            || frames <= 0 || frame_size == 0) {
+        errno = EINVAL;
+    } else if (NULL == (ms = calloc(1, sizeof(struct motion_sink)))) {
+        errno = ENOMEM;
+    }
+    if (ms == NULL) {
+        int err = errno;
+        sink_close(inner);
+        motion_free(md);
+        errno = err;
+        return NULL;
+    }
+
+    ms->snk.ops = &motion_sink_ops;
+    ms->snk.event_fd = inner->event_fd;
+    ms->inner = inner;
+    ms->md = md;
+    ms->threshold = threshold;
+    ms->pre_roll = pre_roll;
+    ms->post_roll = post_roll;
+    ms->frame_size = frame_size;
+
+    // Sinks without an event fd never hold on to frames
+    ms->copy = (inner->event_fd >= 0);
+    int count = pre_roll + (ms->copy ? frames : 0);
+    if (count > 0) {
+        ms->frames = calloc(count, sizeof(struct mmaped_buffer));
+        ms->free_frames = calloc(count, sizeof(int));
+        ms->ring = calloc(pre_roll + 1, sizeof(struct motion_held));
+        if (ms->frames == NULL || ms->free_frames == NULL || ms->ring == NULL) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        if (-1 == buffer_pool_alloc(&ms->pool, ms->frames, count, frame_size)) {
+            goto fail;
+        }
+        for (int i = count - 1; i >= 0; i--) {
+            ms->free_frames[ms->free_cnt++] = i;
+        }
+    }
+
+    if (log_name != NULL) {
+        ms->log = fopen(log_name, "w");
+        if (ms->log == NULL) {
+            goto fail;
+        }
+        struct motion_log_header hdr = {
+            .magic = MOTION_LOG_MAGIC,
+            .version = MOTION_LOG_VERSION,
+            .record_size = sizeof(struct motion_log_record),
+        };
+        if (!fwrite(&hdr, sizeof(hdr), 1, ms->log)) {
+            errno = EIO;
+            goto fail;
+        }
+    }
+
+    sink_set_release(inner, release_frame, ms);
+    return &ms->snk;
+
+fail: ;
+    int err = errno;
+    sink_close(inner);
+    if (ms->log != NULL) {
+        fclose(ms->log);
+    }
+    motion_free_sink(ms);
+    errno = err;
+    return NULL;
+}
@@ -0,0 +1,437 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <linux/falloc.h>
+#include <linux/videodev2.h>
+
+#include "sink.h"
+
+/*
+ * Segment sink - writes frames into a series of files, starting the next one once the current
+ * one reaches a size or has been written to for long enough, so recording can go on forever.
+ *
+ * The capture thread only ever writes frames.  Everything else happens on a background thread:
+ * the next segment is opened and its space preallocated while the current one is being written,
+ * so rotating only swaps it in.  Written data is pushed to disk a window at a time with
+ * sync_file_range() and dropped from the page cache with posix_fadvise(), rather than building
+ * up until it has to be written back all at once, and a finished segment is cut to its size,
+ * synced and closed.  If the next segment isn't open yet when it is due, frames keep going into
+ * the current one rather than waiting for it.
+ *
+ * Segments are named after the output name with their number, like "clip-000001.yuv", and are
+ * written back to back, or each as a frame container.
+ */
+
+#define SEGMENT_NAME_MAX 4096
+#define SEGMENT_DIGITS 6
+#define SEGMENT_JOBS 64
+#define SEGMENT_RESERVED_JOBS 4         // kept free for jobs that can't be dropped
+#define SEGMENT_SYNC_WINDOW (8 << 20)
+
+enum segment_job_type {
+    JOB_OPEN,       // open the next segment
+    JOB_SYNC,       // start writing back a window, and drop the one before from the cache
+    JOB_CLOSE,      // finish, sync and close a segment
+    JOB_STOP,
+};
+
+struct segment {
+    int fd;
+    struct sink *file;
+    uint32_t number;
+    uint64_t bytes;
+};
+
+struct segment_job {
+    enum segment_job_type type;
+    struct segment seg;
+    uint64_t offset;
+};
+
+struct segment_sink {
+    struct sink snk;
+    char *out_name;
+    int container;              // whether segments are written as frame containers
+    struct v4l2_format fmt;     // of the frames in them
+    uint32_t codec;             // and what they are compressed with
+    uint64_t max_bytes;         // 0 for no limit
+    uint64_t max_ns;            // 0 for no limit
+    uint64_t prealloc;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    // With the lock held: jobs for the background thread, and what it has to say
+    struct segment_job jobs[SEGMENT_JOBS];
+    int job_head, job_cnt;
+    struct segment next;
+    int next_ready;
+    int error;                  // errno of the first failure, 0 if none
+
+    // Capture thread only
+    struct segment cur;
+    uint64_t cur_start_ns;
+    uint64_t synced;            // bytes of the current segment handed to the sync job
+    uint32_t segments;
+    uint64_t bytes;
+    uint64_t late;              // frames written past a limit, waiting for the next segment
+    uint64_t dropped_syncs;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void set_error(struct segment_sink *ss, int err) {
+    pthread_mutex_lock(&ss->lock);
+    if (ss->error == 0) {
+        ss->error = err;
+    }
+    pthread_mutex_unlock(&ss->lock);
+}
+
+/**
+ * push_job - hand a job to the background thread
+ *
+ * Jobs that can be dropped are, when the thread falls far behind.
+ * @returns 0 if the job was queued, -1 if it was dropped
+ */
+static int push_job(struct segment_sink *ss, const struct segment_job *job) {
+    int ret = 0;
+    pthread_mutex_lock(&ss->lock);
+    int room = SEGMENT_JOBS - ss->job_cnt - ((job->type == JOB_SYNC) ? SEGMENT_RESERVED_JOBS : 0);
+    if (room > 0) {
+        ss->jobs[(ss->job_head + ss->job_cnt) % SEGMENT_JOBS] = *job;
+        ss->job_cnt++;
+        pthread_cond_signal(&ss->wake);
+    } else {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&ss->lock);
+    return ret;
+}
+
+/**
+ * open_segment - create segment "number", reserve its space and start writing it
+ */
+static int open_segment(struct segment_sink *ss, uint32_t number, struct segment *seg) {
+    char name[SEGMENT_NAME_MAX];
+    numbered_name(ss->out_name, number, SEGMENT_DIGITS, name, sizeof(name));
+
+    seg->number = number;
+    seg->bytes = 0;
+    seg->fd = open(name, (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC), 0644);
+    if (seg->fd == -1) {
+        return -1;
+    }
+
+    // Not every filesystem can, and the segment works without it
+    if (ss->prealloc > 0) {
+        fallocate(seg->fd, FALLOC_FL_KEEP_SIZE, 0, ss->prealloc);
+    }
+
+    seg->file = ss->container ? container_sink_open(NULL, seg->fd, &ss->fmt, ss->codec)
+        : file_sink_open(NULL, seg->fd);
+    if (seg->file == NULL) {
+        int err = errno;
+        close(seg->fd);
+        unlink(name);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * close_segment - finish a segment, give back the space it didn't use, and sync it to disk
+ */
+static int close_segment(struct segment *seg) {
+    int ret = 0;
+    int err = 0;
+
+    struct stat st;
+    if (-1 == sink_close(seg->file) || -1 == fstat(seg->fd, &st)
+            || -1 == ftruncate(seg->fd, st.st_size) || -1 == fdatasync(seg->fd)) {
+        err = errno;
+        ret = -1;
+    }
+    posix_fadvise(seg->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    if (-1 == close(seg->fd) && ret == 0) {
+        err = errno;
+        ret = -1;
+    }
+    errno = err;
+    return ret;
+}
+
+/**
+ * sync_window - start writing back the window at "offset", and once the window before it is
+ * on disk, drop it from the page cache
+ */
+static int sync_window(int fd, uint64_t offset, uint64_t len) {
+    if (-1 == sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE)) {
+        return -1;
+    }
+    if (offset == 0) {
+        return 0;
+    }
+
+    uint64_t prev = (offset > SEGMENT_SYNC_WINDOW) ? offset - SEGMENT_SYNC_WINDOW : 0;
+    if (-1 == sync_file_range(fd, prev, offset - prev, (SYNC_FILE_RANGE_WAIT_BEFORE
+                    | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER))) {
+        return -1;
+    }
+    posix_fadvise(fd, prev, offset - prev, POSIX_FADV_DONTNEED);
+    return 0;
+}
+
+static void *segment_main(void *arg) {
+    struct segment_sink *ss = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&ss->lock);
+        while (ss->job_cnt == 0) {
+            pthread_cond_wait(&ss->wake, &ss->lock);
+        }
+        struct segment_job job = ss->jobs[ss->job_head];
+        ss->job_head = (ss->job_head + 1) % SEGMENT_JOBS;
+        ss->job_cnt--;
+        pthread_mutex_unlock(&ss->lock);
+
+        switch (job.type) {
+            case JOB_OPEN:
+                if (-1 == open_segment(ss, job.seg.number, &job.seg)) {
+                    set_error(ss, errno);
+                    break;
+                }
+                pthread_mutex_lock(&ss->lock);
+                ss->next = job.seg;
+                ss->next_ready = 1;
+                pthread_mutex_unlock(&ss->lock);
+                break;
+
+            case JOB_SYNC:
+                if (-1 == sync_window(job.seg.fd, job.offset, job.seg.bytes - job.offset)) {
+                    set_error(ss, errno);
+                }
+                break;
+
+            case JOB_CLOSE:
+                if (-1 == close_segment(&job.seg)) {
+                    set_error(ss, errno);
+                }
+                break;
+
+            case JOB_STOP:
+                return NULL;
+        }
+    }
+}
+
+/**
+ * rotate - swap in the next segment if it is ready, and have the current one closed
+ *
+ * @returns 0 once rotated, -1 if the next segment isn't open yet
+ */
+static int rotate(struct segment_sink *ss, uint64_t now) {
+    pthread_mutex_lock(&ss->lock);
+    int ready = ss->next_ready;
+    struct segment next = ss->next;
+    ss->next_ready = 0;
+    pthread_mutex_unlock(&ss->lock);
+    if (!ready) {
+        return -1;
+    }
+
+    struct segment_job close_job = { .type = JOB_CLOSE, .seg = ss->cur };
+    struct segment_job open_job = { .type = JOB_OPEN, .seg = { .number = next.number + 1 } };
+    push_job(ss, &close_job);
+    push_job(ss, &open_job);
+
+    ss->cur = next;
+    ss->cur_start_ns = now;
+    ss->synced = 0;
+    ss->segments++;
+
+    char name[SEGMENT_NAME_MAX];
+    numbered_name(ss->out_name, next.number, SEGMENT_DIGITS, name, sizeof(name));
+    fprintf(stdout, "Segment: writing %s\n", name);
+    return 0;
+}
+
+static int segment_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct segment_sink *ss = (struct segment_sink *) snk;
+
+    pthread_mutex_lock(&ss->lock);
+    int err = ss->error;
+    pthread_mutex_unlock(&ss->lock);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    uint64_t now = monotonic_ns();
+    if (ss->cur.bytes > 0
+            && ((ss->max_bytes > 0 && ss->cur.bytes + buf->bytesused > ss->max_bytes)
+                || (ss->max_ns > 0 && now - ss->cur_start_ns >= ss->max_ns))
+            && -1 == rotate(ss, now)) {
+        ss->late++;
+    }
+
+    if (-1 == sink_submit(ss->cur.file, data, buf)) {
+        return -1;
+    }
+    ss->cur.bytes += buf->bytesused;
+    ss->bytes += buf->bytesused;
+
+    if (ss->cur.bytes - ss->synced >= SEGMENT_SYNC_WINDOW) {
+        struct segment_job job = { .type = JOB_SYNC, .seg = ss->cur, .offset = ss->synced };
+        if (-1 == push_job(ss, &job)) {
+            ss->dropped_syncs++;
+        }
+        ss->synced = ss->cur.bytes;
+    }
+    return 0;
+}
+
+static int segment_flush(struct sink *snk) {
+    struct segment_sink *ss = (struct segment_sink *) snk;
+
+    pthread_mutex_lock(&ss->lock);
+    int err = ss->error;
+    pthread_mutex_unlock(&ss->lock);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static void segment_free(struct segment_sink *ss) {
+    pthread_mutex_destroy(&ss->lock);
+    pthread_cond_destroy(&ss->wake);
+    free(ss->out_name);
+    free(ss);
+}
+
+static int segment_close(struct sink *snk) {
+    struct segment_sink *ss = (struct segment_sink *) snk;
+
+    struct segment_job close_job = { .type = JOB_CLOSE, .seg = ss->cur };
+    struct segment_job stop_job = { .type = JOB_STOP };
+    push_job(ss, &close_job);
+    push_job(ss, &stop_job);
+    pthread_join(ss->thread, NULL);
+
+    // The segment opened ahead was never written
+    if (ss->next_ready) {
+        char name[SEGMENT_NAME_MAX];
+        numbered_name(ss->out_name, ss->next.number, SEGMENT_DIGITS, name, sizeof(name));
+        sink_close(ss->next.file);
+        close(ss->next.fd);
+        unlink(name);
+    }
+
+    fprintf(stderr, "Segments: %u written, %llu bytes, %llu frames written past a limit while "
+            "the next segment was opened, %llu syncs left out\n", ss->segments,
+            (unsigned long long) ss->bytes, (unsigned long long) ss->late,
+            (unsigned long long) ss->dropped_syncs);
+
+    int err = ss->error;
+    segment_free(ss);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static const struct sink_ops segment_sink_ops = {
+    .name = "segment",
+    .submit = segment_submit,
+    .flush = segment_flush,
+    .close = segment_close,
+};
+
+/**
+ * segment_sink_open - write frames into segments named after "out_name", starting a new one
+ * before it would grow past "max_bytes" or once it has been written for "max_ns" nanoseconds
+ *
+ * Either limit can be 0 for none.  Every segment gets "prealloc" bytes reserved up front.  With
+ * "container" set, every segment is a frame container of frames of that format, compressed
+ * with "codec".
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *segment_sink_open(const char *out_name, uint64_t max_bytes, uint64_t max_ns,
+        uint64_t prealloc, const struct v4l2_format *container, uint32_t codec) {
+    if (out_name == NULL || (max_bytes == 0 && max_ns == 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct segment_sink *ss = calloc(1, sizeof(struct segment_sink));
+    if (ss == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ss->snk.ops = &segment_sink_ops;
+    ss->snk.event_fd = -1;
+    ss->max_bytes = max_bytes;
+    ss->max_ns = max_ns;
+    ss->prealloc = prealloc;
+    if (container != NULL) {
+        ss->container = 1;
+        ss->fmt = *container;
+        ss->codec = codec;
+    }
+    pthread_mutex_init(&ss->lock, NULL);
+    pthread_cond_init(&ss->wake, NULL);
+
+    ss->out_name = strdup(out_name);
+    if (ss->out_name == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    // The first segment is opened right away, so a bad output name shows up before capturing
+    if (-1 == open_segment(ss, 0, &ss->cur)) {
+        goto fail;
+    }
+    ss->cur_start_ns = monotonic_ns();
+    ss->segments = 1;
+
+    char name[SEGMENT_NAME_MAX];
+    numbered_name(ss->out_name, 0, SEGMENT_DIGITS, name, sizeof(name));
+    fprintf(stdout, "Segment: writing %s\n", name);
+
+    int perr = pthread_create(&ss->thread, NULL, segment_main, ss);
+    if (perr != 0) {
+        close_segment(&ss->cur);
+        errno = perr;
+        goto fail;
+    }
+
+    struct segment_job open_job = { .type = JOB_OPEN, .seg = { .number = 1 } };
+    push_job(ss, &open_job);
+    return &ss->snk;
+
+fail: ;
+    int err = errno;
+    segment_free(ss);
+    errno = err;
+    return NULL;
+}
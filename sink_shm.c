@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/videodev2.h>
+
+#include "sink.h"
+#include "shm_ring.h"
+
+/*
+ * Shared-memory sink - publishes every frame into a ring in POSIX shared memory.
+ *
+ * Publishing never waits for anyone: the frame is copied into the next slot under the slot's
+ * seqlock, and readers that were too slow find out from the generation and skip ahead.  See
+ * shm_ring.h for the layout.
+ */
+
+struct shm_sink {
+    struct sink snk;
+    char *name;
+    struct shm_ring_header *hdr;
+    size_t map_size;
+    uint8_t *data;
+    uint64_t published;
+};
+
+static int shm_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct shm_sink *ss = (struct shm_sink *) snk;
+    struct shm_ring_header *hdr = ss->hdr;
+
+    size_t len = buf->bytesused;
+    if (len > hdr->slot_size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    uint64_t n = ss->published;
+    struct shm_ring_slot *slot = &hdr->slots[n % hdr->slot_count];
+    uint64_t gen = slot->gen;
+
+    // Odd generation: readers that copy from the slot meanwhile will throw the copy away
+    __atomic_store_n(&slot->gen, gen + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->frame = n;
+    slot->sequence = buf->sequence;
+    slot->bytesused = len;
+    slot->flags = buf->flags;
+    slot->timestamp_us = (uint64_t) buf->timestamp.tv_sec * 1000000 + buf->timestamp.tv_usec;
+    memcpy(ss->data + (n % hdr->slot_count) * hdr->slot_size, data, len);
+
+    __atomic_store_n(&slot->gen, gen + 2, __ATOMIC_RELEASE);
+
+    ss->published = n + 1;
+    __atomic_store_n(&hdr->published, ss->published, __ATOMIC_SEQ_CST);
+
+    // Pairs with readers announcing themselves in "waiters" before sleeping on "notify"
+    __atomic_add_fetch(&hdr->notify, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->waiters, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &hdr->notify, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+
+    return 0;
+}
+
+/**
+ * print_readers - report how far behind every attached reader is
+ */
+static void print_readers(struct shm_sink *ss) {
+    struct shm_ring_header *hdr = ss->hdr;
+
+    for (int i = 0; i < SHM_RING_MAX_READERS; i++) {
+        struct shm_ring_reader *r = &hdr->readers[i];
+        int32_t pid = __atomic_load_n(&r->pid, __ATOMIC_ACQUIRE);
+        if (pid == 0) {
+            continue;
+        }
+
+        uint64_t next = __atomic_load_n(&r->next_frame, __ATOMIC_RELAXED);
+        fprintf(stderr, "  Reader %d%s: %llu frames read, %llu lost, %llu frames behind\n", pid,
+                (kill(pid, 0) == -1 && errno == ESRCH) ? " (gone)" : "",
+                (unsigned long long) __atomic_load_n(&r->frames, __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&r->lost, __ATOMIC_RELAXED),
+                (unsigned long long) ((next < ss->published) ? ss->published - next : 0));
+    }
+}
+
+static int shm_close(struct sink *snk) {
+    struct shm_sink *ss = (struct shm_sink *) snk;
+    struct shm_ring_header *hdr = ss->hdr;
+
+    // Let waiting readers know nothing more is coming
+    __atomic_store_n(&hdr->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&hdr->notify, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &hdr->notify, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    fprintf(stderr, "Shared memory: %llu frames published through %u slots\n",
+            (unsigned long long) ss->published, hdr->slot_count);
+    print_readers(ss);
+
+    // Readers still attached keep their mapping, the name just goes away
+    shm_unlink(ss->name);
+    munmap(ss->hdr, ss->map_size);
+    free(ss->name);
+    free(ss);
+    return 0;
+}
+
+static const struct sink_ops shm_sink_ops = {
+    .name = "shm",
+    .submit = shm_submit,
+    .close = shm_close,
+};
+
+/**
+ * shm_sink_open - create a sink publishing frames into the shared memory ring "name"
+ *
+ * The ring has "slots" frames, each big enough for the sizeimage of "fmt".  A stale ring left
+ * behind under the same name is replaced.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *shm_sink_open(const char *name, const struct v4l2_format *fmt, int slots) {
+    if (name == NULL || fmt == NULL || slots <= 0 || fmt->fmt.pix.sizeimage == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct shm_sink *ss = calloc(1, sizeof(struct shm_sink));
+    if (ss == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ss->snk.ops = &shm_sink_ops;
+    ss->snk.event_fd = -1;
+
+    // Slots start on cache lines, and the frame data on a page of its own
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t slot_size = ((uint64_t) fmt->fmt.pix.sizeimage + SHM_RING_CACHE_LINE - 1)
+        & ~(uint64_t) (SHM_RING_CACHE_LINE - 1);
+    uint64_t data_offset = sizeof(struct shm_ring_header)
+        + (uint64_t) slots * sizeof(struct shm_ring_slot);
+    data_offset = (data_offset + page - 1) & ~(uint64_t) (page - 1);
+    ss->map_size = data_offset + slot_size * slots;
+
+    ss->name = strdup(name);
+    if (ss->name == NULL) {
+        free(ss);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    shm_unlink(name);
+    int fd = shm_open(name, (O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC), 0660);
+    if (fd == -1) {
+        goto fail;
+    }
+
+    if (-1 == ftruncate(fd, ss->map_size)) {
+        close(fd);
+        shm_unlink(name);
+        goto fail;
+    }
+
+    ss->hdr = mmap(NULL, ss->map_size, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE),
+            fd, 0);
+    close(fd);
+    if (ss->hdr == MAP_FAILED) {
+        shm_unlink(name);
+        goto fail;
+    }
+
+    struct shm_ring_header *hdr = ss->hdr;
+    hdr->version = SHM_RING_VERSION;
+    hdr->slot_count = slots;
+    hdr->slot_size = slot_size;
+    hdr->data_offset = data_offset;
+    hdr->width = fmt->fmt.pix.width;
+    hdr->height = fmt->fmt.pix.height;
+    hdr->pixelformat = fmt->fmt.pix.pixelformat;
+    hdr->bytesperline = fmt->fmt.pix.bytesperline;
+    hdr->sizeimage = fmt->fmt.pix.sizeimage;
+    ss->data = (uint8_t *) hdr + data_offset;
+
+    // Readers check the magic before anything else, so it goes in last
+    __atomic_store_n(&hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+    return &ss->snk;
+
+fail: ;
+    int err = errno;
+    free(ss->name);
+    free(ss);
+    errno = err;
+    return NULL;
+}
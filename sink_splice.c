@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <linux/videodev2.h>
+
+#include "sink.h"
+
+/*
+ * Splice sink - streams frames into a pipe without copying them.
+ *
+ * vmsplice() puts references to the frame's pages into the pipe instead of copying the data,
+ * so the buffer must not be refilled until the reader has consumed every byte of it.  The pipe
+ * can't tell us when that happens, so while buffers are held a timer wakes us up to compare
+ * how many bytes we pushed in with how many are still waiting in the pipe (FIONREAD), and
+ * frames whose last byte has been read are handed back in order.
+ *
+ * That only holds for a reader that consumes the pipe with read().  One that moves the data on
+ * with splice() or tee() (pv does by default, and so do splice-based relays to sockets) empties
+ * the pipe while it still holds references to our pages, and the driver then fills them with
+ * later frames before they're sent.  So this sink is only used when asked for (--vmsplice);
+ * pipes are otherwise written like any file.
+ *
+ * We don't pass SPLICE_F_GIFT: gifted pages may be stolen by the reader, and capture buffers
+ * belong to the driver, which will DMA into them again.  Mappings the kernel can't take page
+ * references to (some drivers' buffers) make vmsplice fail, in which case we fall back to
+ * plain writes for the rest of the capture.
+ */
+
+#define DRAIN_POLL_NS 500000
+
+struct spliced_frame {
+    struct v4l2_buffer buf;
+    uint64_t end;           // pipe byte position just past the frame's last byte
+};
+
+struct splice_sink {
+    struct sink snk;
+    int fd;
+    int use_vmsplice;
+    uint64_t pushed;        // total bytes pushed into the pipe
+
+    // Frames in the pipe, oldest first
+    struct spliced_frame *held;
+    int held_head, held_cnt;
+    int buf_count;
+    int timer_armed;
+
+    // Counters
+    uint64_t spliced;
+    uint64_t written;
+    uint64_t partial;
+};
+
+static int arm_timer(struct splice_sink *ss, int on) {
+    if (ss->timer_armed == on) {
+        return 0;
+    }
+
+    struct itimerspec its = {0};
+    if (on) {
+        its.it_value.tv_nsec = DRAIN_POLL_NS;
+        its.it_interval.tv_nsec = DRAIN_POLL_NS;
+    }
+
+    ss->timer_armed = on;
+    return timerfd_settime(ss->snk.event_fd, 0, &its, NULL);
+}
+
+/**
+ * release_drained - hand back every frame the reader has consumed completely
+ */
+static int release_drained(struct splice_sink *ss) {
+    if (ss->held_cnt == 0) {
+        return 0;
+    }
+
+    int in_pipe;
+    if (-1 == ioctl(ss->fd, FIONREAD, &in_pipe)) {
+        return -1;
+    }
+
+    uint64_t drained = ss->pushed - in_pipe;
+    while (ss->held_cnt > 0 && ss->held[ss->held_head].end <= drained) {
+        struct spliced_frame *f = &ss->held[ss->held_head];
+        ss->held_head = (ss->held_head + 1) % ss->buf_count;
+        ss->held_cnt--;
+        ss->snk.release(ss->snk.release_arg, &f->buf);
+    }
+
+    return arm_timer(ss, ss->held_cnt > 0);
+}
+
+/**
+ * write_all - write the whole frame, coping with short writes
+ */
+static int write_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t r = write(fd, data, len);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        data += r;
+        len -= r;
+    }
+
+    return 0;
+}
+
+static int splice_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct splice_sink *ss = (struct splice_sink *) snk;
+    uint8_t *p = data;
+    size_t len = buf->bytesused;
+
+    while (ss->use_vmsplice && len > 0) {
+        struct iovec iov = { .iov_base = p, .iov_len = len };
+        ssize_t r = vmsplice(ss->fd, &iov, 1, 0);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if ((errno == EFAULT || errno == EINVAL) && p == (uint8_t *) data) {
+                fprintf(stderr, "vmsplice refused the frame buffers (%s), falling back to write\n",
+                        strerror(errno));
+                ss->use_vmsplice = 0;
+                break;
+            }
+            return -1;
+        }
+
+        if ((size_t) r < len && p == (uint8_t *) data) {
+            ss->partial++;
+        }
+        p += r;
+        len -= r;
+        ss->pushed += r;
+    }
+
+    // Once vmsplice has been given up on, frames (empty ones too) are only ever written
+    if (ss->use_vmsplice && len == 0) {
+        // Hand back what has drained so far before this frame joins the queue
+        if (-1 == release_drained(ss)) {
+            return -1;
+        }
+
+        ss->spliced++;
+        struct spliced_frame *f = &ss->held[(ss->held_head + ss->held_cnt) % ss->buf_count];
+        f->buf = *buf;
+        f->end = ss->pushed;
+        ss->held_cnt++;
+
+        if (-1 == arm_timer(ss, 1)) {
+            return -1;
+        }
+        return 1;
+    }
+
+    if (-1 == write_all(ss->fd, p, len)) {
+        return -1;
+    }
+    ss->pushed += len;
+    ss->written++;
+    return 0;
+}
+
+static int splice_process_events(struct sink *snk) {
+    struct splice_sink *ss = (struct splice_sink *) snk;
+
+    uint64_t cnt;
+    if (-1 == read(snk->event_fd, &cnt, sizeof(cnt)) && errno != EAGAIN && errno != EINTR) {
+        return -1;
+    }
+
+    return release_drained(ss);
+}
+
+static int splice_flush(struct sink *snk) {
+    struct splice_sink *ss = (struct splice_sink *) snk;
+
+    while (ss->held_cnt > 0) {
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = DRAIN_POLL_NS };
+        nanosleep(&ts, NULL);
+
+        if (-1 == release_drained(ss)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int splice_close(struct sink *snk) {
+    struct splice_sink *ss = (struct splice_sink *) snk;
+    int ret = splice_flush(snk);
+    int err = errno;
+
+    fprintf(stderr, "Pipe: %llu frames spliced (%llu didn't fit the pipe at once), %llu written\n",
+            (unsigned long long) ss->spliced, (unsigned long long) ss->partial,
+            (unsigned long long) ss->written);
+
+    close(snk->event_fd);
+    free(ss->held);
+    free(ss);
+    errno = err;
+    return ret;
+}
+
+static const struct sink_ops splice_sink_ops = {
+    .name = "splice",
+    .submit = splice_submit,
+    .process_events = splice_process_events,
+    .flush = splice_flush,
+    .close = splice_close,
+};
+
+/**
+ * grow_pipe - make the pipe big enough for every buffer's frame, or as big as we are allowed
+ */
+static void grow_pipe(int fd, size_t want) {
+    int size = fcntl(fd, F_GETPIPE_SZ);
+    if (size == -1) {
+        return;
+    }
+
+    if (want > (1U << 30)) {
+        want = 1U << 30;
+    }
+
+    // Above /proc/sys/fs/pipe-max-size (or the per-user limit) the kernel says EPERM, so halve
+    while (want > (size_t) size) {
+        if (fcntl(fd, F_SETPIPE_SZ, (int) want) != -1) {
+            return;
+        }
+        want /= 2;
+    }
+}
+
+/**
+ * splice_sink_open - create a sink streaming frames into the pipe "fd"
+ *
+ * Up to "buf_count" buffers of "frame_size" bytes can be held waiting for the reader.  The fd
+ * stays owned by the caller.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *splice_sink_open(int fd, size_t frame_size, int buf_count) {
+    if (fd < 0 || buf_count <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct splice_sink *ss = calloc(1, sizeof(struct splice_sink));
+    if (ss == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ss->snk.ops = &splice_sink_ops;
+    ss->fd = fd;
+    ss->use_vmsplice = 1;
+    ss->buf_count = buf_count;
+    ss->held = calloc(buf_count, sizeof(struct spliced_frame));
+    ss->snk.event_fd = timerfd_create(CLOCK_MONOTONIC, (TFD_NONBLOCK | TFD_CLOEXEC));
+    if (ss->held == NULL || ss->snk.event_fd == -1) {
+        int err = (ss->held == NULL) ? ENOMEM : errno;
+        if (ss->snk.event_fd >= 0) {
+            close(ss->snk.event_fd);
+        }
+        free(ss->held);
+        free(ss);
+        errno = err;
+        return NULL;
+    }
+
+    grow_pipe(fd, frame_size * buf_count);
+    return &ss->snk;
+}
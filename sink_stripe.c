@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <linux/videodev2.h>
+
+#include "sink.h"
+#include "stripe.h"
+
+/*
+ * Stripe sink - deals frames out across several files, each written on its own thread, so
+ * writing scales with the number of disks instead of stopping at what one of them can take.
+ *
+ * Every stripe is a thread sink writing one file, and the capture thread only hands frames to
+ * them.  Frames go to the stripes in turn, or to the stripe with the fewest frames still waiting
+ * for its writer, so a disk that falls behind gets fewer of them.  A manifest (see stripe.h)
+ * records where every frame went, in the order they came, so the sequence can be put back
+ * together.
+ *
+ * The sink's event_fd is an epoll fd watching the event fds of the stripes.
+ */
+
+struct stripe {
+    struct sink *snk;
+    char *name;
+    uint64_t frames;
+    uint64_t bytes;
+};
+
+struct stripe_sink {
+    struct sink snk;
+    struct stripe stripes[STRIPE_MAX];
+    int count;
+    enum stripe_policy policy;
+    int next;                   // the stripe whose turn it is
+    int container;
+    FILE *manifest;
+    int error;                  // errno of the first failed manifest write, 0 if none
+
+    // Counters
+    uint64_t uneven;            // frames that skipped a turn for a less loaded stripe
+};
+
+static void stripe_release(void *arg, struct v4l2_buffer *buf) {
+    struct stripe_sink *ss = arg;
+    ss->snk.release(ss->snk.release_arg, buf);
+}
+
+/**
+ * pick_stripe - the stripe the next frame goes to
+ *
+ * With STRIPE_LEAST_LOADED ties go to the stripe whose turn comes first.
+ */
+static int pick_stripe(struct stripe_sink *ss) {
+    int s = ss->next;
+    if (ss->policy == STRIPE_LEAST_LOADED) {
+        int least = thread_sink_backlog(ss->stripes[s].snk);
+        for (int i = 1; i < ss->count && least > 0; i++) {
+            int c = (ss->next + i) % ss->count;
+            int backlog = thread_sink_backlog(ss->stripes[c].snk);
+            if (backlog < least) {
+                least = backlog;
+                s = c;
+            }
+        }
+        if (s != ss->next) {
+            ss->uneven++;
+        }
+    }
+
+    ss->next = (s + 1) % ss->count;
+    return s;
+}
+
+static int stripe_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct stripe_sink *ss = (struct stripe_sink *) snk;
+
+    if (ss->error != 0) {
+        errno = ss->error;
+        return -1;
+    }
+
+    int s = pick_stripe(ss);
+    struct stripe *st = &ss->stripes[s];
+    struct stripe_manifest_record rec = {
+        .sequence = buf->sequence,
+        .flags = buf->flags,
+        .stripe = s,
+        .size = buf->bytesused,
+        .position = ss->container ? st->frames : st->bytes,
+        .timestamp_ns = (uint64_t) buf->timestamp.tv_sec * 1000000000ULL
+            + (uint64_t) buf->timestamp.tv_usec * 1000,
+    };
+
+    int r = sink_submit(st->snk, data, buf);
+    if (r == -1) {
+        return -1;
+    }
+    st->frames++;
+    st->bytes += buf->bytesused;
+
+    // The stripe may hold the buffer already, so a failure is only reported from the next call
+    if (!fwrite(&rec, sizeof(rec), 1, ss->manifest)) {
+        ss->error = EIO;
+    }
+    return r;
+}
+
+static int stripe_process_events(struct sink *snk) {
+    struct stripe_sink *ss = (struct stripe_sink *) snk;
+
+    struct epoll_event evs[STRIPE_MAX];
+    int n = epoll_wait(snk->event_fd, evs, STRIPE_MAX, 0);
+    if (n == -1) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (-1 == sink_process_events(ss->stripes[evs[i].data.u32].snk)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int stripe_flush(struct sink *snk) {
+    struct stripe_sink *ss = (struct stripe_sink *) snk;
+    int err = 0;
+
+    for (int i = 0; i < ss->count; i++) {
+        if (-1 == sink_flush(ss->stripes[i].snk) && err == 0) {
+            err = errno;
+        }
+    }
+    if (EOF == fflush(ss->manifest) && ss->error == 0) {
+        ss->error = errno;
+    }
+
+    if (err == 0) {
+        err = ss->error;
+    }
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static void stripe_free(struct stripe_sink *ss) {
+    for (int i = 0; i < STRIPE_MAX; i++) {
+        free(ss->stripes[i].name);
+    }
+    if (ss->manifest != NULL) {
+        fclose(ss->manifest);
+    }
+    if (ss->snk.event_fd >= 0) {
+        close(ss->snk.event_fd);
+    }
+    free(ss);
+}
+
+static int stripe_close(struct sink *snk) {
+    struct stripe_sink *ss = (struct stripe_sink *) snk;
+    int err = 0;
+
+    if (-1 == stripe_flush(snk)) {
+        err = errno;
+    }
+
+    for (int i = 0; i < ss->count; i++) {
+        struct stripe *st = &ss->stripes[i];
+        fprintf(stderr, "Stripe %d: %llu frames, %llu bytes to %s\n", i,
+                (unsigned long long) st->frames, (unsigned long long) st->bytes, st->name);
+        if (-1 == sink_close(st->snk) && err == 0) {
+            err = errno;
+        }
+    }
+    if (ss->policy == STRIPE_LEAST_LOADED) {
+        fprintf(stderr, "Stripes: %llu frames went to a less loaded stripe out of turn\n",
+                (unsigned long long) ss->uneven);
+    }
+
+    if (EOF == fclose(ss->manifest) && err == 0) {
+        err = errno;
+    }
+    ss->manifest = NULL;
+
+    stripe_free(ss);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static const struct sink_ops stripe_sink_ops = {
+    .name = "stripe",
+    .submit = stripe_submit,
+    .process_events = stripe_process_events,
+    .flush = stripe_flush,
+    .close = stripe_close,
+};
+
+/**
+ * write_header - start the manifest with its header and the names of the stripes
+ */
+static int write_header(struct stripe_sink *ss, const struct v4l2_format *fmt) {
+    size_t names_size = 0;
+    for (int i = 0; i < ss->count; i++) {
+        names_size += strlen(ss->stripes[i].name) + 1;
+    }
+
+    struct stripe_manifest_header hdr = {
+        .magic = STRIPE_MANIFEST_MAGIC,
+        .version = STRIPE_MANIFEST_VERSION,
+        .header_size = (sizeof(hdr) + names_size + 7) & ~(size_t) 7,
+        .record_size = sizeof(struct stripe_manifest_record),
+        .stripe_count = ss->count,
+        .container = ss->container,
+        .width = fmt->fmt.pix.width,
+        .height = fmt->fmt.pix.height,
+        .pixelformat = fmt->fmt.pix.pixelformat,
+        .bytesperline = fmt->fmt.pix.bytesperline,
+        .sizeimage = fmt->fmt.pix.sizeimage,
+    };
+    if (!fwrite(&hdr, sizeof(hdr), 1, ss->manifest)) {
+        errno = EIO;
+        return -1;
+    }
+
+    for (int i = 0; i < ss->count; i++) {
+        if (!fwrite(ss->stripes[i].name, strlen(ss->stripes[i].name) + 1, 1, ss->manifest)) {
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    static const char pad[8];
+    size_t pad_size = hdr.header_size - sizeof(hdr) - names_size;
+    if (pad_size > 0 && !fwrite(pad, pad_size, 1, ss->manifest)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * stripe_sink_open - deal frames of format "fmt" out across the "count" sinks of "stripes",
+ * which write the files "names", recording where each went in the manifest "manifest_name"
+ *
+ * Every stripe has to be a thread sink, so it is written on a thread of its own.  "container"
+ * tells whether the stripes are written as frame containers.  On success the stripe sink takes
+ * ownership of (and closes) the stripes.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *stripe_sink_open(const char *manifest_name, struct sink **stripes,
+        const char *const *names, int count, enum stripe_policy policy,
+        const struct v4l2_format *fmt, int container) {
+    if (manifest_name == NULL || count <= 0 || count > STRIPE_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        if (-1 == thread_sink_backlog(stripes[i])) {
+            return NULL;
+        }
+    }
+
+    struct stripe_sink *ss = calloc(1, sizeof(struct stripe_sink));
+    if (ss == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ss->snk.ops = &stripe_sink_ops;
+    ss->count = count;
+    ss->policy = policy;
+    ss->container = container;
+    ss->snk.event_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ss->snk.event_fd == -1) {
+        goto fail;
+    }
+
+    for (int i = 0; i < count; i++) {
+        ss->stripes[i].name = strdup(names[i]);
+        if (ss->stripes[i].name == NULL) {
+            errno = ENOMEM;
+            goto fail;
+        }
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+        if (-1 == epoll_ctl(ss->snk.event_fd, EPOLL_CTL_ADD, stripes[i]->event_fd, &ev)) {
+            goto fail;
+        }
+    }
+
+    ss->manifest = fopen(manifest_name, "w");
+    if (ss->manifest == NULL || -1 == write_header(ss, fmt)) {
+        goto fail;
+    }
+
+    for (int i = 0; i < count; i++) {
+        ss->stripes[i].snk = stripes[i];
+        sink_set_release(stripes[i], stripe_release, ss);
+    }
+    return &ss->snk;
+
+fail: ;
+    int err = errno;
+    stripe_free(ss);
+    errno = err;
+    return NULL;
+}
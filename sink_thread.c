@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include "sink.h"
+#include "spsc_ring.h"
+
+/*
+ * Thread sink - moves the writes of an inner sink onto a dedicated writer thread.
+ *
+ * The capture thread pushes work to the writer through a lock-free SPSC ring, and the writer
+ * hands finished work back through a second one.  A work entry is either the index of a capture
+ * buffer held until it has been written (ENTRY_HELD set), or a slot of the copy pool.  With the
+ * copy policy, frames are copied into the pool so the capture buffer can be requeued at once,
+ * and we only fall back to holding capture buffers while the pool is exhausted.
+ */
+
+#define ENTRY_HELD 0x80000000U
+
+struct held_frame {
+    void *data;
+    struct v4l2_buffer buf;
+};
+
+struct thread_sink {
+    struct sink snk;
+    struct sink *inner;
+    enum thread_sink_policy policy;
+
+    pthread_t thread;
+    struct spsc_ring work;      // capture thread -> writer
+    struct spsc_ring done;      // writer -> capture thread
+    int work_fd;                // eventfd waking the writer when it is asleep
+    int sleeping;
+    int stop;
+    int error;                  // errno of the first failed write, 0 if none
+    int outstanding;            // entries pushed to the writer and not handed back yet
+
+    // Capture buffers held for the writer, by v4l2_buffer.index
+    struct held_frame *held;
+    int buf_count;
+
+    // Copy pool
+    uint8_t *pool;
+    size_t pool_size;
+    size_t frame_size;
+    size_t slot_size;           // frame_size rounded up to whole pages
+    int pool_frames;
+    struct v4l2_buffer *pool_meta;
+    uint32_t *free_slots;
+    int free_cnt;
+
+    // Counters
+    uint64_t frames;
+    uint64_t copied;
+    uint64_t pool_exhausted;
+    int pool_high_water;
+    uint64_t max_write_ns;      // only touched by the writer until it is joined
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void signal_fd(int fd) {
+    uint64_t one = 1;
+    while (-1 == write(fd, &one, sizeof(one)) && errno == EINTR) {
+    }
+}
+
+/**
+ * next_work - pop the next work entry, sleeping on work_fd while the ring is empty
+ * @returns 0 with an entry, -1 once the sink is being closed and no work is left
+ */
+static int next_work(struct thread_sink *ts, uint32_t *entry) {
+    for (;;) {
+        if (0 == spsc_ring_pop(&ts->work, entry)) {
+            return 0;
+        }
+
+        // Announce we are going to sleep, then check again so a push can't slip by unnoticed
+        __atomic_store_n(&ts->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (0 == spsc_ring_pop(&ts->work, entry)) {
+            __atomic_store_n(&ts->sleeping, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        if (__atomic_load_n(&ts->stop, __ATOMIC_ACQUIRE)) {
+            return -1;
+        }
+
+        uint64_t cnt;
+        if (-1 == read(ts->work_fd, &cnt, sizeof(cnt)) && errno != EINTR) {
+            return -1;
+        }
+        __atomic_store_n(&ts->sleeping, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void *writer_main(void *arg) {
+    struct thread_sink *ts = arg;
+    uint32_t entry;
+
+    while (0 == next_work(ts, &entry)) {
+        void *data;
+        struct v4l2_buffer *buf;
+        if (entry & ENTRY_HELD) {
+            data = ts->held[entry & ~ENTRY_HELD].data;
+            buf = &ts->held[entry & ~ENTRY_HELD].buf;
+        } else {
+            data = ts->pool + (entry * ts->slot_size);
+            buf = &ts->pool_meta[entry];
+        }
+
+        // After a failure we keep handing buffers back, but stop writing
+        if (0 == __atomic_load_n(&ts->error, __ATOMIC_RELAXED)) {
+            uint64_t start = monotonic_ns();
+            if (-1 == sink_submit(ts->inner, data, buf)) {
+                __atomic_store_n(&ts->error, (errno != 0) ? errno : EIO, __ATOMIC_RELEASE);
+            }
+
+            uint64_t elapsed = monotonic_ns() - start;
+            if (elapsed > ts->max_write_ns) {
+                ts->max_write_ns = elapsed;
+            }
+        }
+
+        // Can't overflow, the ring has room for every entry that can be outstanding
+        spsc_ring_push(&ts->done, entry);
+        signal_fd(ts->snk.event_fd);
+    }
+
+    return NULL;
+}
+
+static int thread_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct thread_sink *ts = (struct thread_sink *) snk;
+
+    int err = __atomic_load_n(&ts->error, __ATOMIC_ACQUIRE);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    if (buf->index >= (uint32_t) ts->buf_count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ts->frames++;
+
+    int ret;
+    uint32_t entry;
+    if (ts->policy == THREAD_SINK_COPY && ts->free_cnt > 0 && buf->bytesused <= ts->frame_size) {
+        entry = ts->free_slots[--ts->free_cnt];
+        memcpy(ts->pool + (entry * ts->slot_size), data, buf->bytesused);
+        ts->pool_meta[entry] = *buf;
+        ts->copied++;
+
+        int used = ts->pool_frames - ts->free_cnt;
+        if (used > ts->pool_high_water) {
+            ts->pool_high_water = used;
+        }
+        ret = 0;
+    } else {
+        if (ts->policy == THREAD_SINK_COPY) {
+            ts->pool_exhausted++;
+        }
+
+        ts->held[buf->index].data = data;
+        ts->held[buf->index].buf = *buf;
+        entry = buf->index | ENTRY_HELD;
+        ret = 1;
+    }
+
+    spsc_ring_push(&ts->work, entry);
+    ts->outstanding++;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ts->sleeping, __ATOMIC_RELAXED)) {
+        signal_fd(ts->work_fd);
+    }
+
+    return ret;
+}
+
+static int thread_process_events(struct sink *snk) {
+    struct thread_sink *ts = (struct thread_sink *) snk;
+
+    uint64_t cnt;
+    if (-1 == read(snk->event_fd, &cnt, sizeof(cnt)) && errno != EAGAIN && errno != EINTR) {
+        return -1;
+    }
+
+    uint32_t entry;
+    while (0 == spsc_ring_pop(&ts->done, &entry)) {
+        ts->outstanding--;
+        if (entry & ENTRY_HELD) {
+            snk->release(snk->release_arg, &ts->held[entry & ~ENTRY_HELD].buf);
+        } else {
+            ts->free_slots[ts->free_cnt++] = entry;
+        }
+    }
+
+    return 0;
+}
+
+static int thread_flush(struct sink *snk) {
+    struct thread_sink *ts = (struct thread_sink *) snk;
+
+    while (ts->outstanding > 0) {
+        struct pollfd pfd = { .fd = snk->event_fd, .events = POLLIN };
+        if (-1 == poll(&pfd, 1, -1) && errno != EINTR) {
+            return -1;
+        }
+
+        if (-1 == thread_process_events(snk)) {
+            return -1;
+        }
+    }
+
+    int err = __atomic_load_n(&ts->error, __ATOMIC_ACQUIRE);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void thread_free(struct thread_sink *ts) {
+    spsc_ring_free(&ts->work);
+    spsc_ring_free(&ts->done);
+    if (ts->work_fd >= 0) {
+        close(ts->work_fd);
+    }
+    if (ts->snk.event_fd >= 0) {
+        close(ts->snk.event_fd);
+    }
+    if (ts->pool != NULL && ts->pool != MAP_FAILED) {
+        munmap(ts->pool, ts->pool_size);
+    }
+    free(ts->held);
+    free(ts->pool_meta);
+    free(ts->free_slots);
+    free(ts);
+}
+
+static int thread_close(struct sink *snk) {
+    struct thread_sink *ts = (struct thread_sink *) snk;
+    int ret = 0;
+    int err = 0;
+
+    if (-1 == thread_flush(snk)) {
+        err = errno;
+        ret = -1;
+    }
+
+    __atomic_store_n(&ts->stop, 1, __ATOMIC_RELEASE);
+    signal_fd(ts->work_fd);
+    pthread_join(ts->thread, NULL);
+
+    fprintf(stderr, "Writer: %llu frames (%llu copied, %llu held), ring high water %u/%u, "
+            "slowest write %.1f ms\n",
+            (unsigned long long) ts->frames, (unsigned long long) ts->copied,
+            (unsigned long long) (ts->frames - ts->copied),
+            ts->work.high_water, spsc_ring_capacity(&ts->work), ts->max_write_ns / 1e6);
+    if (ts->policy == THREAD_SINK_COPY) {
+        fprintf(stderr, "Writer: pool high water %d/%d, %llu frames held while it was full\n",
+                ts->pool_high_water, ts->pool_frames, (unsigned long long) ts->pool_exhausted);
+    }
+
+    if (-1 == sink_close(ts->inner) && ret == 0) {
+        err = errno;
+        ret = -1;
+    }
+
+    thread_free(ts);
+    errno = err;
+    return ret;
+}
+
+static const struct sink_ops thread_sink_ops = {
+    .name = "thread",
+    .submit = thread_submit,
+    .process_events = thread_process_events,
+    .flush = thread_flush,
+    .close = thread_close,
+};
+
+/**
+ * thread_sink_backlog - the number of frames handed to the writer and not handed back yet
+ *
+ * Frames are handed back by process_events(), so it counts those written since as well.
+ * @returns the count, or -1 with errno set if "snk" isn't a thread sink
+ */
+int thread_sink_backlog(const struct sink *snk) {
+    if (snk == NULL || snk->ops != &thread_sink_ops) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ((const struct thread_sink *) snk)->outstanding;
+}
+
+/**
+ * thread_sink_open - run "inner" on a writer thread
+ *
+ * "buf_count" is the number of capture buffers, and with the copy policy "pool_frames" frames
+ * of up to "frame_size" bytes are preallocated.  The inner sink must write synchronously.  On
+ * success the thread sink takes ownership of (and closes) the inner sink.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *thread_sink_open(struct sink *inner, enum thread_sink_policy policy, int buf_count,
+        int pool_frames, size_t frame_size) {
+    if (inner == NULL || inner->event_fd >= 0 || buf_count <= 0
+            || (policy == THREAD_SINK_COPY && (pool_frames <= 0 || frame_size == 0))) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct thread_sink *ts = calloc(1, sizeof(struct thread_sink));
+    if (ts == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ts->snk.ops = &thread_sink_ops;
+    ts->inner = inner;
+    ts->policy = policy;
+    ts->buf_count = buf_count;
+    ts->work_fd = eventfd(0, EFD_CLOEXEC);
+    ts->snk.event_fd = eventfd(0, (EFD_CLOEXEC | EFD_NONBLOCK));
+    if (ts->work_fd == -1 || ts->snk.event_fd == -1) {
+        goto fail;
+    }
+
+    if (policy != THREAD_SINK_COPY) {
+        pool_frames = 0;
+    }
+
+    // Both rings have room for every buffer and pool slot at once, so pushes never fail
+    if (-1 == spsc_ring_init(&ts->work, buf_count + pool_frames)
+            || -1 == spsc_ring_init(&ts->done, buf_count + pool_frames)) {
+        goto fail;
+    }
+
+    ts->held = calloc(buf_count, sizeof(struct held_frame));
+    if (ts->held == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    if (pool_frames > 0) {
+        ts->pool_frames = pool_frames;
+        // Page-aligned slots, like capture buffers, so sinks with alignment needs (O_DIRECT)
+        // can write straight from the pool
+        long page = sysconf(_SC_PAGESIZE);
+        ts->frame_size = frame_size;
+        ts->slot_size = (frame_size + page - 1) & ~((size_t) page - 1);
+        ts->pool_size = ts->slot_size * pool_frames;
+        // Populate now so the capture thread never takes a page fault copying into the pool
+        ts->pool = mmap(NULL, ts->pool_size, (PROT_READ | PROT_WRITE),
+                (MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE), -1, 0);
+        ts->pool_meta = calloc(pool_frames, sizeof(struct v4l2_buffer));
+        ts->free_slots = calloc(pool_frames, sizeof(uint32_t));
+        if (ts->pool == MAP_FAILED || ts->pool_meta == NULL || ts->free_slots == NULL) {
+            errno = ENOMEM;
+            goto fail;
+        }
+
+        for (int i = pool_frames - 1; i >= 0; i--) {
+            ts->free_slots[ts->free_cnt++] = i;
+        }
+    }
+
+    int perr = pthread_create(&ts->thread, NULL, writer_main, ts);
+    if (perr != 0) {
+        errno = perr;
+        goto fail;
+    }
+
+    return &ts->snk;
+
+fail:
+    {
+        int err = errno;
+        thread_free(ts);
+        errno = err;
+    }
+    return NULL;
+}
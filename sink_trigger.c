@@ -0,0 +1,577 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/videodev2.h>
+
+#include "sink.h"
+#include "spsc_ring.h"
+#include "buffer_pool.h"
+
+/*
+ * Trigger sink - keeps the last frames in a ring in memory, and only writes them out when
+ * triggered, to a new file per event, along with the frames that follow.
+ *
+ * Every frame is copied into a slot of a preallocated pool, so memory use never changes.  The
+ * ring holds the newest "ring_frames" of them.  A trigger, from trigger_sink_fire() or a
+ * "trigger" datagram on the control socket, hands the ring to a writer thread, followed by the
+ * next "post" frames; a trigger while those are still coming in extends the event.  The pool
+ * has room for the post-trigger frames besides a full ring, and frames keep coming into the
+ * slots the writer is done with, so capture never waits for the writer.  Only when the writer
+ * falls behind that far are frames left out of the ring (or the event).
+ *
+ * The capture thread pushes work to the writer through a lock-free SPSC ring: slots to write,
+ * and markers starting and ending an event.  The writer hands every entry back through a second
+ * one.
+ */
+
+#define ENTRY_START 0x80000000U
+#define ENTRY_END 0x40000000U
+#define ENTRY_EVENT (~(ENTRY_START | ENTRY_END))
+
+#define TRIGGER_COMMAND "trigger"
+#define TRIGGER_NAME_MAX 4096
+#define TRIGGER_MAX_SLOTS (1 << 24)
+
+struct trigger_sink {
+    struct sink snk;
+    char *out_name;
+    int container;              // whether events are written as frame containers
+    struct v4l2_format fmt;     // of the frames in them
+    uint32_t codec;             // and what they are compressed with
+
+    pthread_t thread;
+    struct spsc_ring work;      // capture thread -> writer
+    struct spsc_ring done;      // writer -> capture thread
+    int work_fd;                // eventfd waking the writer when it is asleep
+    int done_fd;                // eventfd signalled when the writer hands entries back
+    int sock_fd;                // control socket, or -1
+    int sleeping;
+    int stop;
+    int error;                  // errno of the first failed write, 0 if none
+    int outstanding;            // entries pushed to the writer and not handed back yet
+    int markers;                // of them, event markers
+    int max_markers;
+
+    // Frame slots, each free, in the ring, or with the writer
+    struct buffer_pool pool;
+    struct mmaped_buffer *slots;
+    struct v4l2_buffer *meta;
+    int slot_count;
+    uint32_t *free_slots;
+    int free_cnt;
+
+    // The newest frames not handed to the writer, oldest first
+    uint32_t *ring;
+    int ring_frames;
+    int ring_head;
+    int ring_cnt;
+
+    int post;
+    int post_left;              // frames still to come in the current event
+    uint32_t events;
+
+    // Writer side
+    struct sink *file;
+
+    // Counters
+    uint64_t frames;
+    uint64_t written;
+    uint64_t overruns;          // frames left out for want of a free slot
+    uint64_t lost;              // of them, frames that belonged to an event
+};
+
+static const struct sink_ops trigger_sink_ops;
+
+static void signal_fd(int fd) {
+    uint64_t one = 1;
+    while (-1 == write(fd, &one, sizeof(one)) && errno == EINTR) {
+    }
+}
+
+/**
+ * next_work - pop the next work entry, sleeping on work_fd while the ring is empty
+ * @returns 0 with an entry, -1 once the sink is being closed and no work is left
+ */
+static int next_work(struct trigger_sink *ts, uint32_t *entry) {
+    for (;;) {
+        if (0 == spsc_ring_pop(&ts->work, entry)) {
+            return 0;
+        }
+
+        // Announce we are going to sleep, then check again so a push can't slip by unnoticed
+        __atomic_store_n(&ts->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (0 == spsc_ring_pop(&ts->work, entry)) {
+            __atomic_store_n(&ts->sleeping, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        if (__atomic_load_n(&ts->stop, __ATOMIC_ACQUIRE)) {
+            return -1;
+        }
+
+        uint64_t cnt;
+        if (-1 == read(ts->work_fd, &cnt, sizeof(cnt)) && errno != EINTR) {
+            return -1;
+        }
+        __atomic_store_n(&ts->sleeping, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void set_error(struct trigger_sink *ts, int err) {
+    int none = 0;
+    __atomic_compare_exchange_n(&ts->error, &none, (err != 0) ? err : EIO, 0, __ATOMIC_RELEASE,
+            __ATOMIC_RELAXED);
+}
+
+static void *writer_main(void *arg) {
+    struct trigger_sink *ts = arg;
+    uint32_t entry;
+
+    while (0 == next_work(ts, &entry)) {
+        if (entry & ENTRY_START) {
+            char name[TRIGGER_NAME_MAX];
+            numbered_name(ts->out_name, entry & ENTRY_EVENT, 4, name, sizeof(name));
+            ts->file = ts->container ? container_sink_open(name, -1, &ts->fmt, ts->codec)
+                : file_sink_open(name, -1);
+            if (ts->file == NULL) {
+                set_error(ts, errno);
+            }
+        } else if (entry & ENTRY_END) {
+            if (-1 == sink_close(ts->file)) {
+                set_error(ts, errno);
+            }
+            ts->file = NULL;
+        } else if (ts->file != NULL && -1 == sink_submit(ts->file, ts->slots[entry].start,
+                    &ts->meta[entry])) {
+            // The rest of the event goes nowhere, and capture stops at the next frame
+            set_error(ts, errno);
+            sink_close(ts->file);
+            ts->file = NULL;
+        }
+
+        // Can't overflow, the ring has room for every entry that can be outstanding
+        spsc_ring_push(&ts->done, entry);
+        signal_fd(ts->done_fd);
+    }
+
+    return NULL;
+}
+
+/**
+ * push_work - hand an entry to the writer
+ */
+static void push_work(struct trigger_sink *ts, uint32_t entry) {
+    spsc_ring_push(&ts->work, entry);
+    ts->outstanding++;
+    if (entry & (ENTRY_START | ENTRY_END)) {
+        ts->markers++;
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ts->sleeping, __ATOMIC_RELAXED)) {
+        signal_fd(ts->work_fd);
+    }
+}
+
+/**
+ * take_done - take back what the writer is done with
+ */
+static void take_done(struct trigger_sink *ts) {
+    uint32_t entry;
+    while (0 == spsc_ring_pop(&ts->done, &entry)) {
+        ts->outstanding--;
+        if (entry & ENTRY_END) {
+            char name[TRIGGER_NAME_MAX];
+            numbered_name(ts->out_name, entry & ENTRY_EVENT, 4, name, sizeof(name));
+            fprintf(stdout, "Trigger: event %u written to %s\n", entry & ENTRY_EVENT, name);
+            ts->markers--;
+        } else if (entry & ENTRY_START) {
+            ts->markers--;
+        } else {
+            ts->free_slots[ts->free_cnt++] = entry;
+            ts->written++;
+        }
+    }
+}
+
+/**
+ * end_event - close the current event once its last frame is on its way
+ */
+static void end_event(struct trigger_sink *ts) {
+    ts->post_left = 0;
+    push_work(ts, ENTRY_END | ts->events);
+}
+
+/**
+ * trigger_sink_fire - write out the frames in the ring, and the ones that follow
+ *
+ * @returns 0 on success, also if there was nothing to write, -1 with errno set if "snk" isn't
+ *          a trigger sink
+ */
+int trigger_sink_fire(struct sink *snk) {
+    if (snk == NULL || snk->ops != &trigger_sink_ops) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct trigger_sink *ts = (struct trigger_sink *) snk;
+
+    // Triggered again while the event is still going on
+    if (ts->post_left > 0) {
+        ts->post_left = ts->post;
+        return 0;
+    }
+
+    if (ts->ring_cnt == 0 && ts->post == 0) {
+        return 0;
+    }
+    if (ts->markers + 2 > ts->max_markers) {
+        fprintf(stderr, "Trigger: too many events being written, ignoring the trigger\n");
+        return 0;
+    }
+
+    ts->events = (ts->events + 1) & ENTRY_EVENT;
+    char name[TRIGGER_NAME_MAX];
+    numbered_name(ts->out_name, ts->events, 4, name, sizeof(name));
+    fprintf(stdout, "Trigger: event %u, writing %d frames from the ring and %d more to %s\n",
+            ts->events, ts->ring_cnt, ts->post, name);
+
+    push_work(ts, ENTRY_START | ts->events);
+    while (ts->ring_cnt > 0) {
+        push_work(ts, ts->ring[ts->ring_head]);
+        ts->ring_head = (ts->ring_head + 1) % ts->ring_frames;
+        ts->ring_cnt--;
+    }
+
+    if (ts->post > 0) {
+        ts->post_left = ts->post;
+    } else {
+        end_event(ts);
+    }
+    return 0;
+}
+
+static int trigger_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct trigger_sink *ts = (struct trigger_sink *) snk;
+
+    int err = __atomic_load_n(&ts->error, __ATOMIC_ACQUIRE);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    take_done(ts);
+    ts->frames++;
+
+    // The ring keeps only the newest frames, and gives up its oldest when no slot is free
+    uint32_t slot;
+    if (ts->post_left == 0 && ts->ring_cnt == ts->ring_frames) {
+        slot = ts->ring[ts->ring_head];
+        ts->ring_head = (ts->ring_head + 1) % ts->ring_frames;
+        ts->ring_cnt--;
+    } else if (ts->free_cnt > 0) {
+        slot = ts->free_slots[--ts->free_cnt];
+    } else if (ts->ring_cnt > 0) {
+        slot = ts->ring[ts->ring_head];
+        ts->ring_head = (ts->ring_head + 1) % ts->ring_frames;
+        ts->ring_cnt--;
+    } else {
+        // Every slot is with the writer
+        ts->overruns++;
+        if (ts->post_left > 0) {
+            ts->lost++;
+            if (--ts->post_left == 0) {
+                end_event(ts);
+            }
+        }
+        return 0;
+    }
+
+    size_t size = (buf->bytesused < ts->slots[slot].length) ? buf->bytesused
+        : ts->slots[slot].length;
+    memcpy(ts->slots[slot].start, data, size);
+    ts->meta[slot] = *buf;
+    ts->meta[slot].bytesused = size;
+
+    if (ts->post_left > 0) {
+        push_work(ts, slot);
+        if (--ts->post_left == 0) {
+            end_event(ts);
+        }
+    } else {
+        ts->ring[(ts->ring_head + ts->ring_cnt) % ts->ring_frames] = slot;
+        ts->ring_cnt++;
+    }
+    return 0;
+}
+
+/**
+ * read_commands - fire for every "trigger" datagram on the control socket
+ */
+static int read_commands(struct trigger_sink *ts) {
+    for (;;) {
+        char msg[64];
+        ssize_t len = recv(ts->sock_fd, msg, sizeof(msg) - 1, 0);
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        while (len > 0 && (msg[len - 1] == '\n' || msg[len - 1] == '\r' || msg[len - 1] == ' ')) {
+            len--;
+        }
+        msg[len] = '\0';
+        if (strcmp(msg, TRIGGER_COMMAND) != 0) {
+            fprintf(stderr, "Trigger: ignoring unknown command \"%s\"\n", msg);
+            continue;
+        }
+        trigger_sink_fire(&ts->snk);
+    }
+}
+
+static int trigger_process_events(struct sink *snk) {
+    struct trigger_sink *ts = (struct trigger_sink *) snk;
+
+    uint64_t cnt;
+    if (-1 == read(ts->done_fd, &cnt, sizeof(cnt)) && errno != EAGAIN && errno != EINTR) {
+        return -1;
+    }
+    take_done(ts);
+
+    if (ts->sock_fd >= 0 && -1 == read_commands(ts)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int trigger_flush(struct sink *snk) {
+    // Capture buffers are never held, and events are written in the background
+    struct trigger_sink *ts = (struct trigger_sink *) snk;
+    int err = __atomic_load_n(&ts->error, __ATOMIC_ACQUIRE);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static void trigger_free(struct trigger_sink *ts) {
+    spsc_ring_free(&ts->work);
+    spsc_ring_free(&ts->done);
+    if (ts->work_fd >= 0) {
+        close(ts->work_fd);
+    }
+    if (ts->done_fd >= 0) {
+        close(ts->done_fd);
+    }
+    if (ts->snk.event_fd >= 0) {
+        close(ts->snk.event_fd);
+    }
+    if (ts->sock_fd >= 0) {
+        struct sockaddr_un addr;
+        socklen_t len = sizeof(addr);
+        if (0 == getsockname(ts->sock_fd, (struct sockaddr *) &addr, &len)
+                && len > sizeof(sa_family_t) && addr.sun_path[0] != '\0') {
+            unlink(addr.sun_path);
+        }
+        close(ts->sock_fd);
+    }
+    buffer_pool_free(&ts->pool);
+    free(ts->slots);
+    free(ts->meta);
+    free(ts->free_slots);
+    free(ts->ring);
+    free(ts->out_name);
+    free(ts);
+}
+
+static int trigger_close(struct sink *snk) {
+    struct trigger_sink *ts = (struct trigger_sink *) snk;
+
+    // An event still taking frames ends here, and every event is written out before we go
+    if (ts->post_left > 0) {
+        end_event(ts);
+    }
+    while (ts->outstanding > 0) {
+        struct pollfd pfd = { .fd = ts->done_fd, .events = POLLIN };
+        if (-1 == poll(&pfd, 1, -1) && errno != EINTR) {
+            break;
+        }
+        uint64_t cnt;
+        if (-1 == read(ts->done_fd, &cnt, sizeof(cnt)) && errno != EAGAIN && errno != EINTR) {
+            break;
+        }
+        take_done(ts);
+    }
+
+    __atomic_store_n(&ts->stop, 1, __ATOMIC_RELEASE);
+    signal_fd(ts->work_fd);
+    pthread_join(ts->thread, NULL);
+    sink_close(ts->file);
+
+    fprintf(stderr, "Trigger: %llu frames, %u events, %llu frames written, %llu left out for "
+            "want of a free slot (%llu of them from events), ring of %d frames\n",
+            (unsigned long long) ts->frames, ts->events, (unsigned long long) ts->written,
+            (unsigned long long) ts->overruns, (unsigned long long) ts->lost, ts->ring_frames);
+
+    int err = __atomic_load_n(&ts->error, __ATOMIC_ACQUIRE);
+    trigger_free(ts);
+    errno = err;
+    return (err != 0) ? -1 : 0;
+}
+
+static const struct sink_ops trigger_sink_ops = {
+    .name = "trigger",
+    .submit = trigger_submit,
+    .process_events = trigger_process_events,
+    .flush = trigger_flush,
+    .close = trigger_close,
+};
+
+/**
+ * open_socket - bind a datagram socket to "path", replacing a stale socket left there
+ */
+static int open_socket(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (0 == stat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (-1 == bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * trigger_sink_open - keep the last "ring_frames" frames of up to "frame_size" bytes, and
+ * write them and the "post" frames after them to a new file, named after "out_name", whenever
+ * triggered
+ *
+ * With "socket_path" set, "trigger" datagrams sent to a Unix socket there trigger it as well.
+ * With "container" set, every file is a frame container of frames of that format, compressed
+ * with "codec".
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *trigger_sink_open(const char *out_name, int ring_frames, int post,
+        size_t frame_size, const char *socket_path, const struct v4l2_format *container,
+        uint32_t codec) {
+    if (out_name == NULL || ring_frames <= 0 || post < 0 || frame_size == 0
+            || (int64_t) ring_frames + post + 1 > TRIGGER_MAX_SLOTS) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct trigger_sink *ts = calloc(1, sizeof(struct trigger_sink));
+    if (ts == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ts->snk.ops = &trigger_sink_ops;
+    ts->snk.event_fd = -1;
+    ts->work_fd = -1;
+    ts->done_fd = -1;
+    ts->sock_fd = -1;
+    ts->ring_frames = ring_frames;
+    ts->post = post;
+    if (container != NULL) {
+        ts->container = 1;
+        ts->fmt = *container;
+        ts->codec = codec;
+    }
+
+    // Room for a full ring while the frames of the last event are still being written
+    ts->slot_count = ring_frames + post + 1;
+    ts->max_markers = 2 * ts->slot_count + 2;
+
+    ts->out_name = strdup(out_name);
+    ts->slots = calloc(ts->slot_count, sizeof(struct mmaped_buffer));
+    ts->meta = calloc(ts->slot_count, sizeof(struct v4l2_buffer));
+    ts->free_slots = calloc(ts->slot_count, sizeof(uint32_t));
+    ts->ring = calloc(ring_frames, sizeof(uint32_t));
+    if (ts->out_name == NULL || ts->slots == NULL || ts->meta == NULL || ts->free_slots == NULL
+            || ts->ring == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    if (-1 == buffer_pool_alloc(&ts->pool, ts->slots, ts->slot_count, frame_size)) {
+        goto fail;
+    }
+    for (int i = ts->slot_count - 1; i >= 0; i--) {
+        ts->free_slots[ts->free_cnt++] = i;
+    }
+
+    // Both rings have room for every slot and marker at once, so pushes never fail
+    if (-1 == spsc_ring_init(&ts->work, ts->slot_count + ts->max_markers)
+            || -1 == spsc_ring_init(&ts->done, ts->slot_count + ts->max_markers)) {
+        goto fail;
+    }
+
+    ts->work_fd = eventfd(0, EFD_CLOEXEC);
+    ts->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ts->work_fd == -1 || ts->done_fd == -1) {
+        goto fail;
+    }
+    if (socket_path != NULL && -1 == (ts->sock_fd = open_socket(socket_path))) {
+        goto fail;
+    }
+
+    // The capture loop waits for one fd: the writer's and the control socket's
+    if (ts->sock_fd < 0) {
+        ts->snk.event_fd = dup(ts->done_fd);
+        if (ts->snk.event_fd == -1) {
+            goto fail;
+        }
+    } else {
+        if (-1 == (ts->snk.event_fd = epoll_create1(EPOLL_CLOEXEC))) {
+            goto fail;
+        }
+        struct epoll_event ev = { .events = EPOLLIN };
+        if (-1 == epoll_ctl(ts->snk.event_fd, EPOLL_CTL_ADD, ts->done_fd, &ev)
+                || -1 == epoll_ctl(ts->snk.event_fd, EPOLL_CTL_ADD, ts->sock_fd, &ev)) {
+            goto fail;
+        }
+    }
+
+    int perr = pthread_create(&ts->thread, NULL, writer_main, ts);
+    if (perr != 0) {
+        errno = perr;
+        goto fail;
+    }
+
+    return &ts->snk;
+
+fail: ;
+    int err = errno;
+    trigger_free(ts);
+    errno = err;
+    return NULL;
+}
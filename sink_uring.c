@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+#include "sink.h"
+
+/*
+ * io_uring sink - writes frames asynchronously, straight out of the capture buffers.
+ *
+ * Each submitted frame becomes one write SQE tagged with its buffer index, and the buffer is
+ * only handed back once the write completed.  The capture buffers are registered with the ring
+ * so the kernel doesn't have to map them for every write, the output file is registered too,
+ * and with a submission polling thread the steady state needs no system calls at all.  All of
+ * these are optional kernel features and we fall back one by one when they are refused.
+ */
+
+#define SQ_THREAD_IDLE_MS 2000
+
+struct uring_frame {
+    struct v4l2_buffer buf;
+    uint8_t *data;
+    uint32_t done;          // bytes already written
+    uint64_t offset;        // file offset of the start of the frame
+};
+
+struct uring_sink {
+    struct sink snk;
+    int ring_fd;
+    int out_fd;
+    int owns_fd;
+    int fixed_buffers;
+    int fixed_file;
+    int sqpoll;
+
+    // Submission queue
+    void *sq_ring;
+    size_t sq_ring_size;
+    uint32_t *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    // Completion queue
+    void *cq_ring;
+    size_t cq_ring_size;
+    uint32_t *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct uring_frame *frames;
+    int buf_count;
+    int inflight;
+    uint64_t next_offset;
+    int error;
+
+    // Counters
+    uint64_t writes;
+    uint64_t short_writes;
+    uint64_t enters;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(struct uring_sink *us, unsigned to_submit, unsigned min_complete,
+        unsigned flags) {
+    us->enters++;
+    return (int) syscall(__NR_io_uring_enter, us->ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int ring_fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+/**
+ * queue_write - queue a write of the rest of the frame in buffer "index", and submit it
+ */
+static int queue_write(struct uring_sink *us, uint32_t index) {
+    struct uring_frame *f = &us->frames[index];
+
+    uint32_t tail = *us->sq_tail;
+    uint32_t idx = tail & *us->sq_mask;
+    struct io_uring_sqe *sqe = &us->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    sqe->opcode = us->fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = us->fixed_file ? 0 : us->out_fd;
+    sqe->flags = us->fixed_file ? IOSQE_FIXED_FILE : 0;
+    sqe->off = f->offset + f->done;
+    sqe->addr = (uint64_t) (uintptr_t) (f->data + f->done);
+    sqe->len = f->buf.bytesused - f->done;
+    sqe->buf_index = us->fixed_buffers ? index : 0;
+    sqe->user_data = index;
+
+    us->sq_array[idx] = idx;
+    __atomic_store_n(us->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (us->sqpoll) {
+        // The kernel thread picks the entry up by itself unless it went to sleep
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(us->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+            if (-1 == uring_enter(us, 0, 0, IORING_ENTER_SQ_WAKEUP)) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    int r;
+    do {
+        r = uring_enter(us, 1, 0, 0);
+    } while (r == -1 && errno == EINTR);
+
+    return (r == -1) ? -1 : 0;
+}
+
+static int uring_submit(struct sink *snk, void *data, struct v4l2_buffer *buf) {
+    struct uring_sink *us = (struct uring_sink *) snk;
+
+    if (us->error != 0) {
+        errno = us->error;
+        return -1;
+    }
+
+    if (buf->index >= (uint32_t) us->buf_count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (buf->bytesused == 0) {
+        return 0;
+    }
+
+    struct uring_frame *f = &us->frames[buf->index];
+    f->buf = *buf;
+    f->data = data;
+    f->done = 0;
+    f->offset = us->next_offset;
+    us->next_offset += buf->bytesused;
+
+    if (-1 == queue_write(us, buf->index)) {
+        return -1;
+    }
+
+    us->inflight++;
+    us->writes++;
+    return 1;
+}
+
+static int uring_process_events(struct sink *snk) {
+    struct uring_sink *us = (struct uring_sink *) snk;
+
+    uint64_t cnt;
+    if (-1 == read(snk->event_fd, &cnt, sizeof(cnt)) && errno != EAGAIN && errno != EINTR) {
+        return -1;
+    }
+
+    uint32_t head = *us->cq_head;
+    while (head != __atomic_load_n(us->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &us->cqes[head & *us->cq_mask];
+        uint32_t index = (uint32_t) cqe->user_data;
+        int res = cqe->res;
+        head++;
+        __atomic_store_n(us->cq_head, head, __ATOMIC_RELEASE);
+
+        struct uring_frame *f = &us->frames[index];
+        if (res <= 0) {
+            // Remember the first error, but still hand the buffer back
+            if (us->error == 0) {
+                us->error = (res < 0) ? -res : EIO;
+            }
+        } else if (us->error == 0 && f->done + res < f->buf.bytesused) {
+            f->done += res;
+            us->short_writes++;
+            if (0 == queue_write(us, index)) {
+                continue;
+            }
+            us->error = errno;
+        }
+
+        us->inflight--;
+        snk->release(snk->release_arg, &f->buf);
+    }
+
+    if (us->error != 0) {
+        errno = us->error;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int uring_flush(struct sink *snk) {
+    struct uring_sink *us = (struct uring_sink *) snk;
+
+    while (us->inflight > 0) {
+        if (-1 == uring_enter(us, 0, 1, IORING_ENTER_GETEVENTS) && errno != EINTR) {
+            return -1;
+        }
+
+        // Keep reaping after an error, every buffer still has to be handed back
+        uring_process_events(snk);
+    }
+
+    if (us->error != 0) {
+        errno = us->error;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void uring_free(struct uring_sink *us) {
+    if (us->sqes != NULL && us->sqes != MAP_FAILED) {
+        munmap(us->sqes, us->sqes_size);
+    }
+    if (us->cq_ring != NULL && us->cq_ring != MAP_FAILED && us->cq_ring != us->sq_ring) {
+        munmap(us->cq_ring, us->cq_ring_size);
+    }
+    if (us->sq_ring != NULL && us->sq_ring != MAP_FAILED) {
+        munmap(us->sq_ring, us->sq_ring_size);
+    }
+    if (us->ring_fd >= 0) {
+        close(us->ring_fd);
+    }
+    if (us->snk.event_fd >= 0) {
+        close(us->snk.event_fd);
+    }
+    free(us->frames);
+    free(us);
+}
+
+static int uring_close(struct sink *snk) {
+    struct uring_sink *us = (struct uring_sink *) snk;
+    int ret = 0;
+    int err = 0;
+
+    if (-1 == uring_flush(snk)) {
+        err = errno;
+        ret = -1;
+    }
+
+    fprintf(stderr, "io_uring: %llu writes (%llu short), %llu io_uring_enter calls, "
+            "%s buffers, %s file, %s\n",
+            (unsigned long long) us->writes, (unsigned long long) us->short_writes,
+            (unsigned long long) us->enters,
+            us->fixed_buffers ? "registered" : "unregistered",
+            us->fixed_file ? "registered" : "unregistered",
+            us->sqpoll ? "SQ polling" : "no SQ polling");
+
+    if (us->owns_fd && close(us->out_fd) == -1 && ret == 0) {
+        err = errno;
+        ret = -1;
+    }
+
+    uring_free(us);
+    errno = err;
+    return ret;
+}
+
+static const struct sink_ops uring_sink_ops = {
+    .name = "io_uring",
+    .submit = uring_submit,
+    .process_events = uring_process_events,
+    .flush = uring_flush,
+    .close = uring_close,
+};
+
+/**
+ * map_rings - map the submission and completion rings set up by io_uring_setup
+ */
+static int map_rings(struct uring_sink *us, struct io_uring_params *p) {
+    us->sq_ring_size = p->sq_off.array + (p->sq_entries * sizeof(uint32_t));
+    us->cq_ring_size = p->cq_off.cqes + (p->cq_entries * sizeof(struct io_uring_cqe));
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (us->cq_ring_size > us->sq_ring_size) {
+            us->sq_ring_size = us->cq_ring_size;
+        }
+    }
+
+    us->sq_ring = mmap(NULL, us->sq_ring_size, (PROT_READ | PROT_WRITE),
+            (MAP_SHARED | MAP_POPULATE), us->ring_fd, IORING_OFF_SQ_RING);
+    if (us->sq_ring == MAP_FAILED) {
+        return -1;
+    }
+
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        us->cq_ring = us->sq_ring;
+    } else {
+        us->cq_ring = mmap(NULL, us->cq_ring_size, (PROT_READ | PROT_WRITE),
+                (MAP_SHARED | MAP_POPULATE), us->ring_fd, IORING_OFF_CQ_RING);
+        if (us->cq_ring == MAP_FAILED) {
+            return -1;
+        }
+    }
+
+    us->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    us->sqes = mmap(NULL, us->sqes_size, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE),
+            us->ring_fd, IORING_OFF_SQES);
+    if (us->sqes == MAP_FAILED) {
+        return -1;
+    }
+
+    uint8_t *sq = us->sq_ring;
+    us->sq_head = (uint32_t *) (sq + p->sq_off.head);
+    us->sq_tail = (uint32_t *) (sq + p->sq_off.tail);
+    us->sq_mask = (uint32_t *) (sq + p->sq_off.ring_mask);
+    us->sq_flags = (uint32_t *) (sq + p->sq_off.flags);
+    us->sq_array = (uint32_t *) (sq + p->sq_off.array);
+
+    uint8_t *cq = us->cq_ring;
+    us->cq_head = (uint32_t *) (cq + p->cq_off.head);
+    us->cq_tail = (uint32_t *) (cq + p->cq_off.tail);
+    us->cq_mask = (uint32_t *) (cq + p->cq_off.ring_mask);
+    us->cqes = (struct io_uring_cqe *) (cq + p->cq_off.cqes);
+
+    return 0;
+}
+
+/**
+ * uring_sink_open - create a sink writing frames to "file_name" (or "fd") through io_uring
+ *
+ * "bufs" are the buffers frames will be submitted from, so they can be registered with the
+ * kernel.  The output has to be a regular file, as writes complete out of order.  With
+ * "sqpoll", a kernel thread polls the submission queue so queueing a write needs no system call.
+ * @returns the new sink, or NULL with errno set
+ */
+struct sink *uring_sink_open(const char *file_name, int fd, struct mmaped_buffer *bufs,
+        int buf_count, int sqpoll) {
+    if (bufs == NULL || buf_count <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct uring_sink *us = calloc(1, sizeof(struct uring_sink));
+    if (us == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    us->snk.ops = &uring_sink_ops;
+    us->snk.event_fd = -1;
+    us->ring_fd = -1;
+    us->out_fd = -1;
+    us->owns_fd = (file_name != NULL);
+    us->buf_count = buf_count;
+
+    us->frames = calloc(buf_count, sizeof(struct uring_frame));
+    if (us->frames == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    if (file_name != NULL) {
+        us->out_fd = open(file_name, (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC), 0666);
+        if (us->out_fd == -1) {
+            goto fail;
+        }
+    } else {
+        us->out_fd = fd;
+        off_t pos = lseek(us->out_fd, 0, SEEK_CUR);
+        if (pos == -1) {
+            goto fail;
+        }
+        us->next_offset = pos;
+    }
+
+    struct stat st;
+    if (-1 == fstat(us->out_fd, &st)) {
+        goto fail;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = ESPIPE;
+        goto fail;
+    }
+
+    // Every buffer has at most one write in flight, so this never runs out of entries
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (sqpoll) {
+        p.flags = IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = SQ_THREAD_IDLE_MS;
+        us->ring_fd = uring_setup(buf_count * 2, &p);
+        if (us->ring_fd == -1) {
+            fprintf(stderr, "io_uring: unable to set up SQ polling (%s), using io_uring_enter\n",
+                    strerror(errno));
+        }
+    }
+    if (us->ring_fd == -1) {
+        memset(&p, 0, sizeof(p));
+        us->ring_fd = uring_setup(buf_count * 2, &p);
+        if (us->ring_fd == -1) {
+            goto fail;
+        }
+    }
+    us->sqpoll = (p.flags & IORING_SETUP_SQPOLL) != 0;
+
+    if (-1 == map_rings(us, &p)) {
+        goto fail;
+    }
+
+    us->snk.event_fd = eventfd(0, (EFD_CLOEXEC | EFD_NONBLOCK));
+    if (us->snk.event_fd == -1
+            || -1 == uring_register(us->ring_fd, IORING_REGISTER_EVENTFD, &us->snk.event_fd, 1)) {
+        goto fail;
+    }
+
+    // Driver mmap buffers can't always be pinned (VM_IO/VM_PFNMAP), so this may well fail
+    struct iovec *iov = calloc(buf_count, sizeof(struct iovec));
+    if (iov == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    for (int i = 0; i < buf_count; i++) {
+        iov[i].iov_base = bufs[i].start;
+        iov[i].iov_len = bufs[i].length;
+    }
+    us->fixed_buffers = (0 == uring_register(us->ring_fd, IORING_REGISTER_BUFFERS, iov, buf_count));
+    free(iov);
+
+    us->fixed_file = (0 == uring_register(us->ring_fd, IORING_REGISTER_FILES, &us->out_fd, 1));
+
+    return &us->snk;
+
+fail:
+    {
+        int err = errno;
+        if (us->owns_fd && us->out_fd >= 0) {
+            close(us->out_fd);
+        }
+        uring_free(us);
+        errno = err;
+    }
+    return NULL;
+}
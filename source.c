@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+#include "buffer_pool.h"
+#include "source.h"
+
+/**
+ * source_set_format - negotiate the format frames will be delivered in
+ *
+ * On success, the source fills in the fields the driver would (bytesperline, sizeimage, ...)
+ */
+int source_set_format(struct capture_source *src, struct v4l2_format *fmt) {
+    if (src == NULL || fmt == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return src->ops->set_format(src, fmt);
+}
+
+/**
+ * source_init_buffers - allocate "count" frame buffers, available afterwards in src->bufs
+ *
+ * Like a driver, the source may grant fewer buffers, src->buf_count says how many there are.
+ */
+int source_init_buffers(struct capture_source *src, int count) {
+    if (src == NULL || count <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return src->ops->init_buffers(src, count);
+}
+
+/**
+ * source_release_buffers - free the buffers, so they can be set up again with a different count
+ *
+ * The source must be stopped.
+ */
+int source_release_buffers(struct capture_source *src) {
+    if (src == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return src->ops->release_buffers(src);
+}
+
+/**
+ * source_start - queue all buffers and start delivering frames
+ */
+int source_start(struct capture_source *src) {
+    if (src == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return src->ops->start(src);
+}
+
+/**
+ * source_stop - stop delivering frames
+ */
+int source_stop(struct capture_source *src) {
+    if (src == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return src->ops->stop(src);
+}
+
+/**
+ * source_dequeue - take the next filled buffer from the source
+ *
+ * Returns -1 with errno set to EAGAIN if the source woke up without a frame being ready.
+ */
+int source_dequeue(struct capture_source *src, struct v4l2_buffer *buf) {
+    if (src == NULL || buf == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return src->ops->dequeue(src, buf);
+}
+
+/**
+ * source_enqueue - give a buffer back to the source to be filled again
+ */
+int source_enqueue(struct capture_source *src, struct v4l2_buffer *buf) {
+    if (src == NULL || buf == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return src->ops->enqueue(src, buf);
+}
+
+/**
+ * source_export_buffer - get a file descriptor other processes can map buffer "index" through
+ *
+ * @returns the new file descriptor, or -1 with errno set
+ */
+int source_export_buffer(struct capture_source *src, int index) {
+    if (src == NULL || index < 0 || index >= src->buf_count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return src->ops->export_buffer(src, index);
+}
+
+/**
+ * source_close - release the buffers and the source itself
+ */
+void source_close(struct capture_source *src) {
+    if (src != NULL) {
+        src->ops->close(src);
+    }
+}
+
+/*
+ * V4L2 source - a thin wrapper around the v4l2_helper calls
+ *
+ * Buffers are the driver's own mmap buffers, or come from our hugepage-backed pool when the
+ * driver can capture into user memory (USERPTR).
+ */
+
+struct v4l2_source {
+    struct capture_source src;
+    uint32_t sizeimage;
+    struct buffer_pool pool;
+};
+
+static int v4l2_set_format(struct capture_source *src, struct v4l2_format *fmt) {
+    struct v4l2_source *vs = (struct v4l2_source *) src;
+    if (-1 == set_stream_format(src->fd, fmt)) {
+        return -1;
+    }
+
+    vs->sizeimage = fmt->fmt.pix.sizeimage;
+    return 0;
+}
+
+static int v4l2_init_buffers(struct capture_source *src, int count) {
+    struct v4l2_source *vs = (struct v4l2_source *) src;
+    if (src->memory == 0) {
+        uint32_t caps = get_buffer_caps(src->fd);
+        src->memory = (caps & V4L2_BUF_CAP_SUPPORTS_USERPTR) ? V4L2_MEMORY_USERPTR
+            : V4L2_MEMORY_MMAP;
+    }
+
+    struct mmaped_buffer *bufs = calloc(count, sizeof(struct mmaped_buffer));
+    if (bufs == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Hand the array over before mapping so a partial failure still gets unmapped on close
+    src->bufs = bufs;
+    src->buf_count = count;
+
+    // The driver may grant fewer buffers than we asked for
+    int granted;
+    if (src->memory == V4L2_MEMORY_USERPTR) {
+        granted = init_userptr_buffers(src->fd, count);
+        if (granted > count) {
+            granted = count;
+        }
+        if (granted > 0 && -1 == buffer_pool_alloc(&vs->pool, bufs, granted, vs->sizeimage)) {
+            return -1;
+        }
+    } else {
+        granted = init_mmap_buffers(src->fd, bufs, count);
+    }
+
+    if (granted == -1) {
+        return -1;
+    }
+    if (granted == 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    src->buf_count = granted;
+    return 0;
+}
+
+static int v4l2_start(struct capture_source *src) {
+    if (src->memory == V4L2_MEMORY_USERPTR) {
+        return start_userptr_streaming(src->fd, src->bufs, src->buf_count);
+    }
+    return start_mmap_streaming(src->fd, src->buf_count);
+}
+
+static int v4l2_stop(struct capture_source *src) {
+    return stop_streaming(src->fd);
+}
+
+static int v4l2_dequeue(struct capture_source *src, struct v4l2_buffer *buf) {
+    return dequeue_frame(src->fd, src->memory, buf);
+}
+
+static int v4l2_enqueue(struct capture_source *src, struct v4l2_buffer *buf) {
+    return enqueue_frame(src->fd, buf);
+}
+
+static int v4l2_export_buffer(struct capture_source *src, int index) {
+    // Only the driver's own buffers can be exported
+    if (src->memory != V4L2_MEMORY_MMAP) {
+        errno = EINVAL;
+        return -1;
+    }
+    return export_buffer(src->fd, index);
+}
+
+static void unmap_buffers(struct capture_source *src) {
+    struct v4l2_source *vs = (struct v4l2_source *) src;
+    if (src->memory == V4L2_MEMORY_USERPTR) {
+        buffer_pool_free(&vs->pool);
+    } else {
+        for (int i = 0; i < src->buf_count; i++) {
+            if (src->bufs[i].start != NULL && src->bufs[i].start != MAP_FAILED) {
+                munmap(src->bufs[i].start, src->bufs[i].length);
+            }
+        }
+    }
+
+    free(src->bufs);
+    src->bufs = NULL;
+    src->buf_count = 0;
+}
+
+static int v4l2_release_buffers(struct capture_source *src) {
+    unmap_buffers(src);
+    return free_buffers(src->fd, src->memory);
+}
+
+static void v4l2_close(struct capture_source *src) {
+    struct v4l2_source *vs = (struct v4l2_source *) src;
+    unmap_buffers(src);
+
+    if ((src->fd >= 0) && (close(src->fd) == -1)) {
+        perror("Error closing file descriptor");
+    }
+
+    free(vs);
+}
+
+static const struct capture_source_ops v4l2_source_ops = {
+    .name = "v4l2",
+    .set_format = v4l2_set_format,
+    .init_buffers = v4l2_init_buffers,
+    .release_buffers = v4l2_release_buffers,
+    .start = v4l2_start,
+    .stop = v4l2_stop,
+    .dequeue = v4l2_dequeue,
+    .enqueue = v4l2_enqueue,
+    .export_buffer = v4l2_export_buffer,
+    .close = v4l2_close,
+};
+
+/**
+ * v4l2_source_open - open a V4L2 device for streaming
+ *
+ * The device fd is available in src->fd for querying capabilities and formats.
+ * @returns the new source, or NULL with errno set
+ */
+struct capture_source *v4l2_source_open(const char *dev_name) {
+    if (dev_name == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct v4l2_source *vs = calloc(1, sizeof(struct v4l2_source));
+    if (vs == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    vs->src.ops = &v4l2_source_ops;
+    vs->src.fd = open(dev_name, O_RDWR);
+    if (vs->src.fd == -1) {
+        int err = errno;
+        free(vs);
+        errno = err;
+        return NULL;
+    }
+
+    return &vs->src;
+}
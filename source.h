@@ -0,0 +1,60 @@
+#ifndef __SOURCE_H_
+#define __SOURCE_H_
+
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+
+struct capture_source;
+
+/**
+ * capture_source_ops - the operations every frame source has to provide
+ *
+ * These mirror the v4l2_helper calls camcap uses for streaming, so the capture loop does not
+ * need to care whether frames come from a real device or are being replayed.  All of them
+ * return 0 on success or -1 with errno set, except export_buffer, which returns a new file
+ * descriptor other processes can map the buffer through.
+ */
+struct capture_source_ops {
+    const char *name;
+    int (*set_format)(struct capture_source *src, struct v4l2_format *fmt);
+    int (*init_buffers)(struct capture_source *src, int count);
+    int (*release_buffers)(struct capture_source *src);
+    int (*start)(struct capture_source *src);
+    int (*stop)(struct capture_source *src);
+    int (*dequeue)(struct capture_source *src, struct v4l2_buffer *buf);
+    int (*enqueue)(struct capture_source *src, struct v4l2_buffer *buf);
+    int (*export_buffer)(struct capture_source *src, int index);
+    void (*close)(struct capture_source *src);
+};
+
+/**
+ * capture_source - a stream of frames in a set of buffers shared with the program
+ *
+ * "fd" becomes readable when a frame is ready to be dequeued.  "bufs" is owned by the source
+ * and indexed by v4l2_buffer.index.  "memory" can be set to V4L2_MEMORY_MMAP or
+ * V4L2_MEMORY_USERPTR before init_buffers, or left 0 to let the source choose, and holds the
+ * kind of buffers in use afterwards.
+ */
+struct capture_source {
+    const struct capture_source_ops *ops;
+    int fd;
+    struct mmaped_buffer *bufs;
+    int buf_count;
+    uint32_t memory;
+};
+
+struct capture_source *v4l2_source_open(const char *dev_name);
+struct capture_source *replay_source_open(const char *file_name, double fps);
+
+int source_set_format(struct capture_source *src, struct v4l2_format *fmt);
+int source_init_buffers(struct capture_source *src, int count);
+int source_release_buffers(struct capture_source *src);
+int source_start(struct capture_source *src);
+int source_stop(struct capture_source *src);
+int source_dequeue(struct capture_source *src, struct v4l2_buffer *buf);
+int source_enqueue(struct capture_source *src, struct v4l2_buffer *buf);
+int source_export_buffer(struct capture_source *src, int index);
+void source_close(struct capture_source *src);
+#endif
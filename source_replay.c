@@ -0,0 +1,589 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <linux/videodev2.h>
+
+#include "v4l2_helper.h"
+#include "buffer_pool.h"
+#include "container.h"
+#include "codec.h"
+#include "source.h"
+
+/*
+ * Replay source - serves frames from a recorded file, or a synthetic test pattern when no file
+ * is given, at a fixed frame rate.  It behaves like a driver would: frames are only captured
+ * into buffers that have been queued, and a frame that comes due while every buffer is held by
+ * the program is dropped, leaving a gap in the sequence numbers.  Like a driver supporting
+ * both, it captures into its own shareable buffers (MMAP) or into our buffer pool (USERPTR).
+ */
+
+#define NSEC_PER_SEC 1000000000ULL
+
+struct replay_source {
+    struct capture_source src;
+
+    struct v4l2_format fmt;
+    uint64_t period_ns;     // 0 means as fast as buffers are queued
+    uint64_t start_ns;
+    uint64_t frames_due;    // frames whose capture time has passed, dropped or not
+    uint32_t sequence;
+    int streaming;
+
+    // Buffers queued by the program, waiting to be filled
+    int *queued;
+    int queued_head, queued_cnt;
+
+    // Filled buffers, waiting to be dequeued
+    struct v4l2_buffer *done;
+    int done_head, done_cnt;
+
+    // Recorded frames, when replaying from a file of raw frames or from a container
+    uint8_t *file_data;
+    size_t file_size;
+    size_t file_frames;
+    struct container_reader *container;
+
+    // memfds backing MMAP buffers, so they can be shared like DMABUFs
+    int *buf_fds;
+    struct buffer_pool pool;
+
+    // Synthetic pattern, and where the moving bar was last drawn in each buffer
+    uint8_t *pattern;
+    uint32_t *bar_pos;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * NSEC_PER_SEC) + ts.tv_nsec;
+}
+
+/**
+ * arm_timer - make the timerfd fire at the absolute monotonic time "when_ns"
+ */
+static int arm_timer(struct replay_source *rs, uint64_t when_ns) {
+    struct itimerspec its = {0};
+    // A zero it_value would disarm the timer, so fire "immediately" at 1ns past boot instead
+    if (when_ns == 0) {
+        when_ns = 1;
+    }
+    its.it_value.tv_sec = when_ns / NSEC_PER_SEC;
+    its.it_value.tv_nsec = when_ns % NSEC_PER_SEC;
+    return timerfd_settime(rs->src.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int rearm_timer(struct replay_source *rs) {
+    if (rs->done_cnt > 0 || (rs->period_ns == 0 && rs->queued_cnt > 0)) {
+        return arm_timer(rs, 0);
+    }
+
+    if (rs->period_ns == 0) {
+        // Nothing to do until a buffer gets queued
+        struct itimerspec its = {0};
+        return timerfd_settime(rs->src.fd, 0, &its, NULL);
+    }
+
+    return arm_timer(rs, rs->start_ns + (rs->frames_due * rs->period_ns));
+}
+
+/**
+ * frame_layout - fill in bytesperline and sizeimage like a driver would
+ *
+ * Only formats with a fixed size are laid out in the pixel format registry, so those are all we
+ * can replay.
+ */
+static int frame_layout(struct v4l2_pix_format *pix) {
+    const struct pix_fmt_info *info = pix_fmt_info(pix->pixelformat);
+    if (info == NULL || info->bpp == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (pix->width == 0 || pix->height == 0 || (pix->width % 2) != 0 || (pix->height % 2) != 0
+            || (pix->width % info->align) != 0 || (pix->height % info->v_sub) != 0
+            || ((pix->width * info->line_bpp) % 8) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pix->field = V4L2_FIELD_NONE;
+    return pix_fmt_frame_size(pix->pixelformat, pix->width, pix->height, &pix->bytesperline,
+            &pix->sizeimage);
+}
+
+static int replay_set_format(struct capture_source *src, struct v4l2_format *fmt) {
+    struct replay_source *rs = (struct replay_source *) src;
+    if (rs->streaming || fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (-1 == frame_layout(&fmt->fmt.pix)) {
+        return -1;
+    }
+
+    if (rs->container != NULL) {
+        const struct container_header *hdr = container_header(rs->container);
+        if (hdr->pixelformat != fmt->fmt.pix.pixelformat || hdr->width != fmt->fmt.pix.width
+                || hdr->height != fmt->fmt.pix.height) {
+            fprintf(stderr, "Replay container holds %ux%u %s frames\n", hdr->width,
+                    hdr->height, pix_fmt_to_str(hdr->pixelformat));
+            errno = EINVAL;
+            return -1;
+        }
+        rs->file_frames = container_frame_count(rs->container);
+        if (rs->file_frames == 0) {
+            fprintf(stderr, "Replay container holds no frames\n");
+            errno = EINVAL;
+            return -1;
+        }
+    } else if (rs->file_data != NULL) {
+        rs->file_frames = rs->file_size / fmt->fmt.pix.sizeimage;
+        if (rs->file_frames == 0) {
+            fprintf(stderr, "Replay file is smaller than a single %u byte frame\n",
+                    fmt->fmt.pix.sizeimage);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    rs->fmt = *fmt;
+    return 0;
+}
+
+/**
+ * draw_bar - paint (or with "restore", erase) the moving bar at byte offset "pos" in each line
+ *
+ * The bar only touches the first plane, which gives a visibly moving pattern for packed and
+ * planar formats alike while keeping the per-frame cost to a small fraction of the frame.
+ */
+static void draw_bar(struct replay_source *rs, uint8_t *frame, uint32_t pos, int restore) {
+    uint32_t bpl = rs->fmt.fmt.pix.bytesperline;
+    uint32_t bar_width = bpl / 16;
+    if (pos + bar_width > bpl) {
+        bar_width = bpl - pos;
+    }
+
+    for (uint32_t y = 0; y < rs->fmt.fmt.pix.height; y++) {
+        size_t off = ((size_t) y * bpl) + pos;
+        if (restore) {
+            memcpy(frame + off, rs->pattern + off, bar_width);
+        } else {
+            memset(frame + off, 0xeb, bar_width);
+        }
+    }
+}
+
+static int init_pattern(struct replay_source *rs) {
+    struct v4l2_pix_format *pix = &rs->fmt.fmt.pix;
+    rs->pattern = malloc(pix->sizeimage);
+    rs->bar_pos = calloc(rs->src.buf_count, sizeof(uint32_t));
+    if (rs->pattern == NULL || rs->bar_pos == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // A diagonal ramp in the first plane, neutral values in any remaining (chroma) planes
+    size_t plane_size = (size_t) pix->bytesperline * pix->height;
+    for (uint32_t y = 0; y < pix->height; y++) {
+        for (uint32_t x = 0; x < pix->bytesperline; x++) {
+            rs->pattern[((size_t) y * pix->bytesperline) + x] = (uint8_t) (x + y);
+        }
+    }
+    memset(rs->pattern + plane_size, 0x80, pix->sizeimage - plane_size);
+
+    for (int i = 0; i < rs->src.buf_count; i++) {
+        memcpy(rs->src.bufs[i].start, rs->pattern, pix->sizeimage);
+        draw_bar(rs, rs->src.bufs[i].start, 0, 0);
+    }
+
+    return 0;
+}
+
+static int replay_init_buffers(struct capture_source *src, int count) {
+    struct replay_source *rs = (struct replay_source *) src;
+    uint32_t size = rs->fmt.fmt.pix.sizeimage;
+    if (rs->streaming || src->bufs != NULL || size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    src->bufs = calloc(count, sizeof(struct mmaped_buffer));
+    rs->queued = calloc(count, sizeof(int));
+    rs->done = calloc(count, sizeof(struct v4l2_buffer));
+    rs->buf_fds = malloc(count * sizeof(int));
+    if (src->bufs == NULL || rs->queued == NULL || rs->done == NULL || rs->buf_fds == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    src->buf_count = count;
+    for (int i = 0; i < count; i++) {
+        rs->buf_fds[i] = -1;
+    }
+
+    if (src->memory == 0) {
+        src->memory = V4L2_MEMORY_USERPTR;
+    }
+
+    if (src->memory == V4L2_MEMORY_USERPTR) {
+        if (-1 == buffer_pool_alloc(&rs->pool, src->bufs, count, size)) {
+            return -1;
+        }
+        return (rs->file_data == NULL) ? init_pattern(rs) : 0;
+    }
+
+    // Shared memfd mappings, page aligned and exportable, just like driver mmap buffers
+    for (int i = 0; i < count; i++) {
+        rs->buf_fds[i] = memfd_create("camcap-replay", MFD_CLOEXEC);
+        if (rs->buf_fds[i] == -1 || -1 == ftruncate(rs->buf_fds[i], size)) {
+            return -1;
+        }
+
+        src->bufs[i].length = size;
+        src->bufs[i].start = mmap(NULL, size, (PROT_READ | PROT_WRITE),
+                (MAP_SHARED | MAP_POPULATE), rs->buf_fds[i], 0);
+        if (MAP_FAILED == src->bufs[i].start) {
+            return -1;
+        }
+    }
+
+    if (rs->file_data == NULL) {
+        return init_pattern(rs);
+    }
+
+    return 0;
+}
+
+static int replay_start(struct capture_source *src) {
+    struct replay_source *rs = (struct replay_source *) src;
+    if (rs->streaming || src->bufs == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rs->queued_head = 0;
+    rs->queued_cnt = src->buf_count;
+    for (int i = 0; i < src->buf_count; i++) {
+        rs->queued[i] = i;
+    }
+    rs->done_head = 0;
+    rs->done_cnt = 0;
+    rs->frames_due = 0;
+
+    rs->streaming = 1;
+    rs->start_ns = monotonic_ns();
+    return rearm_timer(rs);
+}
+
+static int replay_stop(struct capture_source *src) {
+    struct replay_source *rs = (struct replay_source *) src;
+    struct itimerspec its = {0};
+    rs->streaming = 0;
+    return timerfd_settime(src->fd, 0, &its, NULL);
+}
+
+/**
+ * decompress_recorded - decompress a frame recorded with --compress into "frame"
+ *
+ * @returns the size of the frame, or 0 if it can't be decompressed
+ */
+static uint32_t decompress_recorded(struct replay_source *rs,
+        const struct container_frame *recorded, uint8_t *frame) {
+    const struct container_header *hdr = container_header(rs->container);
+    struct v4l2_format fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+    fmt.fmt.pix.width = hdr->width;
+    fmt.fmt.pix.height = hdr->height;
+    fmt.fmt.pix.pixelformat = hdr->pixelformat;
+    fmt.fmt.pix.bytesperline = hdr->bytesperline;
+    fmt.fmt.pix.sizeimage = hdr->sizeimage;
+
+    if (recorded->codec != CODEC_MED_RICE || hdr->sizeimage > rs->fmt.fmt.pix.sizeimage
+            || -1 == decompress_frame(&fmt, container_frame_data(recorded), recorded->size,
+                frame, NULL)) {
+        return 0;
+    }
+    return hdr->sizeimage;
+}
+
+/**
+ * capture - "capture" the next due frame into the oldest queued buffer
+ */
+static void capture(struct replay_source *rs, uint64_t timestamp_ns) {
+    int idx = rs->queued[rs->queued_head];
+    rs->queued_head = (rs->queued_head + 1) % rs->src.buf_count;
+    rs->queued_cnt--;
+
+    uint8_t *frame = rs->src.bufs[idx].start;
+    uint32_t size = rs->fmt.fmt.pix.sizeimage;
+    uint32_t flags = 0;
+    if (rs->container != NULL) {
+        // Frames keep the size they were recorded with, and come out damaged if they can't
+        // be read back
+        const struct container_frame *recorded = container_frame(rs->container,
+                rs->sequence % rs->file_frames);
+        if (recorded != NULL && recorded->codec != CODEC_NONE) {
+            size = decompress_recorded(rs, recorded, frame);
+            flags = (size == 0) ? V4L2_BUF_FLAG_ERROR : 0;
+        } else if (recorded == NULL) {
+            size = 0;
+            flags = V4L2_BUF_FLAG_ERROR;
+        } else {
+            size = (recorded->size < size) ? recorded->size : size;
+            memcpy(frame, container_frame_data(recorded), size);
+        }
+    } else if (rs->file_data != NULL) {
+        memcpy(frame, rs->file_data + ((rs->sequence % rs->file_frames) * size), size);
+    } else {
+        uint32_t bpl = rs->fmt.fmt.pix.bytesperline;
+        uint32_t pos = (rs->sequence * 8) % (bpl - (bpl / 16) + 1);
+        draw_bar(rs, frame, rs->bar_pos[idx], 1);
+        draw_bar(rs, frame, pos, 0);
+        rs->bar_pos[idx] = pos;
+    }
+
+    struct v4l2_buffer *buf = &rs->done[(rs->done_head + rs->done_cnt) % rs->src.buf_count];
+    memset(buf, 0, sizeof(struct v4l2_buffer));
+    buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf->memory = rs->src.memory;
+    buf->index = idx;
+    if (rs->src.memory == V4L2_MEMORY_USERPTR) {
+        buf->m.userptr = (unsigned long) frame;
+    }
+    buf->bytesused = size;
+    buf->length = rs->fmt.fmt.pix.sizeimage;
+    buf->field = V4L2_FIELD_NONE;
+    buf->flags = V4L2_BUF_FLAG_DONE | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | V4L2_BUF_FLAG_TSTAMP_SRC_EOF
+        | flags;
+    buf->sequence = rs->sequence;
+    buf->timestamp.tv_sec = timestamp_ns / NSEC_PER_SEC;
+    buf->timestamp.tv_usec = (timestamp_ns % NSEC_PER_SEC) / 1000;
+    rs->done_cnt++;
+}
+
+static int replay_dequeue(struct capture_source *src, struct v4l2_buffer *buf) {
+    struct replay_source *rs = (struct replay_source *) src;
+    if (!rs->streaming) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Clear the timer's readability, we work out what is due from the clock ourselves
+    uint64_t expirations;
+    if (-1 == read(src->fd, &expirations, sizeof(expirations)) && errno != EAGAIN) {
+        return -1;
+    }
+
+    uint64_t now = monotonic_ns();
+    if (rs->period_ns == 0) {
+        while (rs->queued_cnt > 0) {
+            capture(rs, now);
+            rs->sequence++;
+        }
+    } else {
+        uint64_t due = ((now - rs->start_ns) / rs->period_ns) + 1;
+        for (; rs->frames_due < due; rs->frames_due++) {
+            if (rs->queued_cnt > 0) {
+                capture(rs, rs->start_ns + (rs->frames_due * rs->period_ns));
+            }
+            rs->sequence++;
+        }
+    }
+
+    if (rs->done_cnt == 0) {
+        rearm_timer(rs);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    *buf = rs->done[rs->done_head];
+    rs->done_head = (rs->done_head + 1) % src->buf_count;
+    rs->done_cnt--;
+
+    return rearm_timer(rs);
+}
+
+static int replay_enqueue(struct capture_source *src, struct v4l2_buffer *buf) {
+    struct replay_source *rs = (struct replay_source *) src;
+    if (buf->index >= (uint32_t) src->buf_count || rs->queued_cnt == src->buf_count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rs->queued[(rs->queued_head + rs->queued_cnt) % src->buf_count] = buf->index;
+    rs->queued_cnt++;
+
+    if (rs->streaming && rs->period_ns == 0) {
+        return rearm_timer(rs);
+    }
+    return 0;
+}
+
+static int replay_export_buffer(struct capture_source *src, int index) {
+    struct replay_source *rs = (struct replay_source *) src;
+    if (src->memory != V4L2_MEMORY_MMAP) {
+        errno = EINVAL;
+        return -1;
+    }
+    return fcntl(rs->buf_fds[index], F_DUPFD_CLOEXEC, 0);
+}
+
+/**
+ * drop_buffers - unmap the buffers and forget everything that depends on how many there are
+ */
+static void drop_buffers(struct replay_source *rs) {
+    struct capture_source *src = &rs->src;
+
+    if (src->memory == V4L2_MEMORY_USERPTR) {
+        buffer_pool_free(&rs->pool);
+    } else {
+        for (int i = 0; src->bufs != NULL && i < src->buf_count; i++) {
+            if (src->bufs[i].start != NULL && src->bufs[i].start != MAP_FAILED) {
+                munmap(src->bufs[i].start, src->bufs[i].length);
+            }
+        }
+    }
+    for (int i = 0; rs->buf_fds != NULL && i < src->buf_count; i++) {
+        if (rs->buf_fds[i] >= 0) {
+            close(rs->buf_fds[i]);
+        }
+    }
+    free(rs->buf_fds);
+    free(src->bufs);
+    free(rs->queued);
+    free(rs->done);
+    free(rs->pattern);
+    free(rs->bar_pos);
+
+    rs->buf_fds = NULL;
+    src->bufs = NULL;
+    rs->queued = NULL;
+    rs->done = NULL;
+    rs->pattern = NULL;
+    rs->bar_pos = NULL;
+    src->buf_count = 0;
+}
+
+static int replay_release_buffers(struct capture_source *src) {
+    struct replay_source *rs = (struct replay_source *) src;
+    if (rs->streaming) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    drop_buffers(rs);
+    return 0;
+}
+
+static void replay_close(struct capture_source *src) {
+    struct replay_source *rs = (struct replay_source *) src;
+    drop_buffers(rs);
+
+    if (rs->file_data != NULL) {
+        munmap(rs->file_data, rs->file_size);
+    }
+    if (rs->container != NULL) {
+        container_close(rs->container);
+    }
+
+    if (src->fd >= 0) {
+        close(src->fd);
+    }
+
+    free(rs);
+}
+
+static const struct capture_source_ops replay_source_ops = {
+    .name = "replay",
+    .set_format = replay_set_format,
+    .init_buffers = replay_init_buffers,
+    .release_buffers = replay_release_buffers,
+    .start = replay_start,
+    .stop = replay_stop,
+    .dequeue = replay_dequeue,
+    .enqueue = replay_enqueue,
+    .export_buffer = replay_export_buffer,
+    .close = replay_close,
+};
+
+/**
+ * replay_source_open - create a source replaying "file_name" at "fps" frames per second
+ *
+ * The file holds raw frames back to back, exactly as camcap writes them, or is a frame
+ * container written with --container (with --compress, it is decompressed), and is replayed in
+ * a loop.  If "file_name" is NULL a synthetic moving test pattern is generated instead.  An
+ * "fps" of 0 delivers frames as fast as the program hands buffers back.
+ * @returns the new source, or NULL with errno set
+ */
+struct capture_source *replay_source_open(const char *file_name, double fps) {
+    if (fps < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct replay_source *rs = calloc(1, sizeof(struct replay_source));
+    if (rs == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    rs->src.ops = &replay_source_ops;
+    rs->period_ns = (fps > 0) ? (uint64_t) (NSEC_PER_SEC / fps) : 0;
+    rs->src.fd = timerfd_create(CLOCK_MONOTONIC, (TFD_NONBLOCK | TFD_CLOEXEC));
+    if (rs->src.fd == -1) {
+        goto fail;
+    }
+
+    if (file_name != NULL) {
+        rs->container = container_open(file_name);
+        if (rs->container == NULL && errno != EPROTO) {
+            goto fail;
+        }
+    }
+
+    if (file_name != NULL && rs->container == NULL) {
+        int fd = open(file_name, O_RDONLY);
+        if (fd == -1) {
+            goto fail;
+        }
+
+        struct stat st;
+        if (-1 == fstat(fd, &st)) {
+            close(fd);
+            goto fail;
+        }
+
+        if (st.st_size == 0) {
+            close(fd);
+            errno = EINVAL;
+            goto fail;
+        }
+
+        rs->file_size = st.st_size;
+        rs->file_data = mmap(NULL, rs->file_size, PROT_READ, (MAP_PRIVATE | MAP_POPULATE), fd, 0);
+        close(fd);
+        if (rs->file_data == MAP_FAILED) {
+            rs->file_data = NULL;
+            goto fail;
+        }
+    }
+
+    return &rs->src;
+
+fail:
+    {
+        int err = errno;
+        replay_close(&rs->src);
+        errno = err;
+    }
+    return NULL;
+}
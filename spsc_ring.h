@@ -0,0 +1,102 @@
+#ifndef __SPSC_RING_H_
+#define __SPSC_RING_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring of 32-bit values.
+ *
+ * Exactly one thread may push and exactly one thread may pop.  The producer and consumer
+ * indices live on separate cache lines.  The producer reads the consumer index on every push to
+ * keep an exact high-water mark; the consumer only re-reads the producer index once its cached
+ * copy says the ring is empty.
+ */
+
+#define SPSC_CACHE_LINE 64
+
+struct spsc_ring {
+    uint32_t *slots;
+    uint32_t mask;
+
+    // Producer side
+    uint32_t head __attribute__((aligned(SPSC_CACHE_LINE)));
+    uint32_t high_water;
+
+    // Consumer side
+    uint32_t tail __attribute__((aligned(SPSC_CACHE_LINE)));
+    uint32_t head_cache;
+};
+
+/**
+ * spsc_ring_init - allocate a ring holding at least "capacity" values
+ */
+static inline int spsc_ring_init(struct spsc_ring *r, uint32_t capacity) {
+    if (r == NULL || capacity == 0 || capacity > (1U << 31)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    r->slots = calloc(size, sizeof(uint32_t));
+    if (r->slots == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    r->mask = size - 1;
+    r->head = r->high_water = 0;
+    r->tail = r->head_cache = 0;
+    return 0;
+}
+
+static inline void spsc_ring_free(struct spsc_ring *r) {
+    free(r->slots);
+    r->slots = NULL;
+}
+
+static inline uint32_t spsc_ring_capacity(const struct spsc_ring *r) {
+    return r->mask + 1;
+}
+
+/**
+ * spsc_ring_push - producer only. Returns 0, or -1 if the ring is full
+ */
+static inline int spsc_ring_push(struct spsc_ring *r, uint32_t value) {
+    uint32_t head = r->head;
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (head - tail > r->mask) {
+        return -1;
+    }
+
+    r->slots[head & r->mask] = value;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    if (head + 1 - tail > r->high_water) {
+        r->high_water = head + 1 - tail;
+    }
+    return 0;
+}
+
+/**
+ * spsc_ring_pop - consumer only. Returns 0, or -1 if the ring is empty
+ */
+static inline int spsc_ring_pop(struct spsc_ring *r, uint32_t *value) {
+    uint32_t tail = r->tail;
+    if (tail == r->head_cache) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (tail == r->head_cache) {
+            return -1;
+        }
+    }
+
+    *value = r->slots[tail & r->mask];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+#endif
@@ -0,0 +1,47 @@
+#ifndef __STRIPE_H_
+#define __STRIPE_H_
+
+#include <stdint.h>
+
+/*
+ * Stripe manifest, written by camcap --stripe, which deals frames out across several files and
+ * records where every frame went, so the sequence can be put back together (see camcap-stripe).
+ *
+ * The manifest starts with a stripe_manifest_header, followed by the names of the stripes as
+ * they were given, each ending in a NUL, padded to "header_size".  After that comes one
+ * stripe_manifest_record per frame, in the order the frames were captured.  A frame is found
+ * at its "position" in its stripe: the byte offset of its data in a stripe of frames written
+ * back to back, or its frame number in a stripe written as a frame container.
+ *
+ * Everything is in host byte order.
+ */
+
+#define STRIPE_MANIFEST_MAGIC 0x4d534343    // "CCSM"
+#define STRIPE_MANIFEST_VERSION 1
+#define STRIPE_MAX 16
+
+struct stripe_manifest_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;       // of this header and the names after it, a multiple of 8
+    uint32_t record_size;
+    uint32_t stripe_count;
+    uint32_t container;         // whether the stripes are frame containers
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;
+    uint32_t bytesperline;
+    uint32_t sizeimage;
+    uint32_t reserved;
+};
+
+struct stripe_manifest_record {
+    uint32_t sequence;
+    uint32_t flags;             // v4l2_buffer flags
+    uint32_t stripe;            // the stripe it was written to, counting from 0
+    uint32_t size;              // bytes written
+    uint64_t position;          // where it is in the stripe, see above
+    uint64_t timestamp_ns;      // driver timestamp
+};
+#endif
@@ -0,0 +1,435 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+struct pool_task {
+    struct pool_batch *batch;
+    int item;
+};
+
+/**
+ * pool_queue - a worker's queue, a growable ring taken from at the front by its owner and at
+ * the back by thieves
+ */
+struct pool_queue {
+    pthread_mutex_t lock;
+    struct pool_task *tasks;
+    int cap;
+    int head;
+    int len;
+};
+
+struct pool_worker {
+    struct thread_pool *pool;
+    struct pool_queue queue;
+    pthread_t thread;
+    int slot;
+
+    // Counters, only written by the thread running in this slot
+    uint64_t ran;
+    uint64_t stolen;
+};
+
+struct thread_pool {
+    int threads;
+    int started;
+    // One per thread, plus one for the thread waiting for batches, whose queue stays empty
+    struct pool_worker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // workers waiting for items
+    pthread_cond_t finished;    // a thread waiting for a batch
+    int queued;                 // items in all queues, can dip below 0 while a batch starts
+    int stop;
+    int next;                   // worker the next batch starts at
+};
+
+static int queue_push(struct pool_queue *q, struct pool_task task) {
+    pthread_mutex_lock(&q->lock);
+    if (q->len == q->cap) {
+        int cap = (q->cap != 0) ? q->cap * 2 : 64;
+        struct pool_task *tasks = malloc(cap * sizeof(struct pool_task));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&q->lock);
+            errno = ENOMEM;
+            return -1;
+        }
+        for (int i = 0; i < q->len; i++) {
+            tasks[i] = q->tasks[(q->head + i) % q->cap];
+        }
+        free(q->tasks);
+        q->tasks = tasks;
+        q->cap = cap;
+        q->head = 0;
+    }
+
+    q->tasks[(q->head + q->len) % q->cap] = task;
+    q->len++;
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static int queue_take(struct pool_queue *q, int back, struct pool_task *task) {
+    pthread_mutex_lock(&q->lock);
+    if (q->len == 0) {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+
+    if (back) {
+        *task = q->tasks[(q->head + q->len - 1) % q->cap];
+    } else {
+        *task = q->tasks[q->head];
+        q->head = (q->head + 1) % q->cap;
+    }
+    q->len--;
+    pthread_mutex_unlock(&q->lock);
+    return 1;
+}
+
+/**
+ * take_task - the next item for the thread in "slot": its own first, then stolen
+ */
+static int take_task(struct thread_pool *pool, int slot, struct pool_task *task) {
+    struct pool_worker *self = &pool->workers[slot];
+    if (queue_take(&self->queue, 0, task)) {
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+        return 1;
+    }
+
+    for (int i = 1; i <= pool->threads; i++) {
+        struct pool_worker *victim = &pool->workers[(slot + i) % pool->threads];
+        if (victim != self && queue_take(&victim->queue, 1, task)) {
+            __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+            __atomic_add_fetch(&self->stolen, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void finish_batch(struct thread_pool *pool, struct pool_batch *batch) {
+    // Its owner may see "finished" without the lock and free the batch right away, so nothing
+    // in it is touched after that.  The fd outlives the batch: it is only closed once the pool's
+    // threads are gone.
+    int done_fd = batch->done_fd;
+    pthread_mutex_lock(&pool->lock);
+    __atomic_store_n(&batch->finished, 1, __ATOMIC_RELEASE);
+    if (done_fd >= 0) {
+        uint64_t one = 1;
+        while (-1 == write(done_fd, &one, sizeof(one)) && errno == EINTR) {
+        }
+    }
+    pthread_cond_broadcast(&pool->finished);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void run_task(struct thread_pool *pool, int slot, struct pool_task *task) {
+    struct pool_batch *batch = task->batch;
+    batch->fn(batch->arg, task->item, slot);
+    __atomic_add_fetch(&pool->workers[slot].ran, 1, __ATOMIC_RELAXED);
+
+    if (__atomic_sub_fetch(&batch->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+        finish_batch(pool, batch);
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct pool_worker *w = arg;
+    struct thread_pool *pool = w->pool;
+
+    for (;;) {
+        struct pool_task task;
+        if (take_task(pool, w->slot, &task)) {
+            run_task(pool, w->slot, &task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) <= 0 && !pool->stop) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        int stop = pool->stop && __atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) <= 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * thread_pool_create - start "threads" worker threads
+ *
+ * With "cpu_count" CPUs listed in "cpus", worker i only runs on cpus[i % cpu_count].
+ * @returns the new pool, or NULL with errno set
+ */
+struct thread_pool *thread_pool_create(int threads, const int *cpus, int cpu_count) {
+    if (threads < 1 || threads > THREAD_POOL_MAX_THREADS || (cpu_count > 0 && cpus == NULL)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (int i = 0; i < cpu_count; i++) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    struct thread_pool *pool = calloc(1, sizeof(struct thread_pool));
+    if (pool == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    pool->threads = threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+
+    pool->workers = calloc(threads + 1, sizeof(struct pool_worker));
+    if (pool->workers == NULL) {
+        thread_pool_free(pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (int i = 0; i <= threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].slot = i;
+        pthread_mutex_init(&pool->workers[i].queue.lock, NULL);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (cpu_count > 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i % cpu_count], &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+
+        int err = pthread_create(&pool->workers[i].thread, &attr, worker_main, &pool->workers[i]);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            thread_pool_free(pool);
+            errno = err;
+            return NULL;
+        }
+        pool->started++;
+    }
+
+    return pool;
+}
+
+/**
+ * thread_pool_threads - the number of worker threads, which is also the slot of the thread
+ * waiting for batches
+ */
+int thread_pool_threads(const struct thread_pool *pool) {
+    return pool->threads;
+}
+
+/**
+ * thread_pool_start - queue up the items of "batch" and return
+ *
+ * Items that don't fit in a queue, when it can't grow, are run right away.
+ */
+void thread_pool_start(struct thread_pool *pool, struct pool_batch *batch) {
+    batch->remaining = batch->count;
+    batch->finished = 0;
+    if (batch->count == 0) {
+        finish_batch(pool, batch);
+        return;
+    }
+
+    int n = pool->threads;
+    int first = pool->next;
+    pool->next = (pool->next + 1) % n;
+
+    int queued = 0;
+    for (int w = 0; w < n; w++) {
+        struct pool_queue *q = &pool->workers[(first + w) % n].queue;
+        for (int item = batch->count * w / n; item < batch->count * (w + 1) / n; item++) {
+            struct pool_task task = { batch, item };
+            if (0 == queue_push(q, task)) {
+                queued++;
+            } else {
+                run_task(pool, n, &task);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    __atomic_add_fetch(&pool->queued, queued, __ATOMIC_ACQ_REL);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * thread_pool_done - whether every item of a started batch has run
+ */
+int thread_pool_done(const struct pool_batch *batch) {
+    return __atomic_load_n(&batch->finished, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * thread_pool_wait - help running items until "batch" is done
+ *
+ * The items run may belong to other batches as well.
+ */
+void thread_pool_wait(struct thread_pool *pool, struct pool_batch *batch) {
+    int slot = pool->threads;
+    while (!thread_pool_done(batch)) {
+        struct pool_task task;
+        if (take_task(pool, slot, &task)) {
+            run_task(pool, slot, &task);
+            continue;
+        }
+
+        // Whatever is left of the batch is running on the workers
+        pthread_mutex_lock(&pool->lock);
+        while (!thread_pool_done(batch) && __atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) <= 0) {
+            pthread_cond_wait(&pool->finished, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * thread_pool_run - run items 0 up to "count" on the pool and the calling thread, and return
+ * once all have run
+ */
+void thread_pool_run(struct thread_pool *pool, int count, thread_pool_fn fn, void *arg) {
+    struct pool_batch batch = { .fn = fn, .arg = arg, .count = count, .done_fd = -1 };
+    thread_pool_start(pool, &batch);
+    thread_pool_wait(pool, &batch);
+}
+
+/**
+ * thread_pool_print - how the items were spread over the threads
+ */
+void thread_pool_print(const struct thread_pool *pool, const char *label) {
+    uint64_t ran = 0, stolen = 0;
+    for (int i = 0; i <= pool->threads; i++) {
+        ran += __atomic_load_n(&pool->workers[i].ran, __ATOMIC_RELAXED);
+        stolen += __atomic_load_n(&pool->workers[i].stolen, __ATOMIC_RELAXED);
+    }
+
+    fprintf(stderr, "%s: %d threads ran %llu items, %llu of them stolen, %llu on the waiting "
+            "thread\n", label, pool->threads, (unsigned long long) ran,
+            (unsigned long long) stolen,
+            (unsigned long long) __atomic_load_n(&pool->workers[pool->threads].ran,
+                __ATOMIC_RELAXED));
+}
+
+/**
+ * thread_pool_free - stop the workers once the queued items have run, and free the pool
+ */
+void thread_pool_free(struct thread_pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->started; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    if (pool->workers != NULL) {
+        for (int i = 0; i <= pool->threads; i++) {
+            pthread_mutex_destroy(&pool->workers[i].queue.lock);
+            free(pool->workers[i].queue.tasks);
+        }
+        free(pool->workers);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->finished);
+    free(pool);
+}
+
+/*
+ * Bands
+ */
+
+/**
+ * split_bands - split frames into up to "count" bands of whole row pairs
+ */
+static void split_bands(struct pool_bands *pb, int count) {
+    int h = pb->height;
+    pb->band_rows = ((h + count - 1) / count + 1) & ~1;
+    pb->band_count = (h + pb->band_rows - 1) / pb->band_rows;
+}
+
+static void free_scratch(struct pool_bands *pb) {
+    for (int i = 0; pb->scratch_free != NULL && i < pb->slots; i++) {
+        pb->scratch_free(pool_bands_scratch(pb, i));
+    }
+    free(pb->scratch);
+    pb->scratch = NULL;
+    pb->slots = 0;
+}
+
+/**
+ * alloc_scratch - scratch for "slots" threads
+ */
+static int alloc_scratch(struct pool_bands *pb, int slots) {
+    pb->scratch = calloc(slots, pb->scratch_size);
+    if (pb->scratch == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    pb->slots = slots;
+
+    for (int i = 0; pb->scratch_init != NULL && i < slots; i++) {
+        if (-1 == pb->scratch_init(pb->owner, pool_bands_scratch(pb, i))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * pool_bands_set_pool - run the bands on the threads of "pool", which has to outlive them, or
+ * on the calling thread alone if it's NULL
+ *
+ * @returns 0 on success, -1 with errno set on failure (and then the bands run on one thread, if
+ * it got as far as setting that up)
+ */
+int pool_bands_set_pool(struct pool_bands *pb, struct thread_pool *pool) {
+    free_scratch(pb);
+    pb->pool = NULL;
+    split_bands(pb, 1);
+
+    int slots = (pool != NULL) ? thread_pool_threads(pool) + 1 : 1;
+    if (-1 == alloc_scratch(pb, slots)) {
+        int err = errno;
+        free_scratch(pb);
+        if (pool != NULL && -1 == alloc_scratch(pb, 1)) {
+            free_scratch(pb);
+        }
+        errno = err;
+        return -1;
+    }
+    if (pool != NULL) {
+        // A few bands per thread, so threads that finish early have some to steal
+        pb->pool = pool;
+        split_bands(pb, 2 * slots);
+    }
+    return 0;
+}
+
+void pool_bands_free(struct pool_bands *pb) {
+    free_scratch(pb);
+}
@@ -0,0 +1,85 @@
+#ifndef __THREAD_POOL_H_
+#define __THREAD_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Work-stealing thread pool for splitting per-frame work into items, like bands of rows.
+ *
+ * A batch of items is spread over the workers' queues in contiguous runs.  Every worker takes
+ * items from the front of its own queue, and when that runs dry steals from the back of the
+ * others'.  Batches can be waited for, in which case the waiting thread helps out, or be left
+ * running while the caller goes on, with an eventfd telling it when they are done.
+ *
+ * Every item is run with a "slot": the worker's index, or thread_pool_threads() for the thread
+ * that waits.  Per-thread scratch can be indexed by it, so only one thread outside the pool may
+ * wait for batches at a time.
+ */
+
+#define THREAD_POOL_MAX_THREADS 64
+
+typedef void (*thread_pool_fn)(void *arg, int item, int slot);
+
+/**
+ * pool_batch - a set of items to run on a pool
+ *
+ * The caller fills in "fn", "arg", "count" and "done_fd" (an eventfd to signal once every item
+ * has run, or -1), and keeps the batch around until it is done.  "done_fd" may be signalled just
+ * after the batch is done, so it has to stay open until the pool is freed.
+ */
+struct pool_batch {
+    thread_pool_fn fn;
+    void *arg;
+    int count;
+    int done_fd;
+
+    // Private
+    int remaining;
+    int finished;
+};
+
+struct thread_pool;
+
+/**
+ * pool_bands - frames split into bands of whole row pairs to run on a pool, with scratch for
+ * every slot that may run one
+ *
+ * The owner fills in "height", "scratch_size", "scratch_init" (which sets up one slot's
+ * scratch, returning -1 with errno set on failure) and "scratch_free" (which also gets scratch
+ * that was only set up part way, or not at all, zeroed), and "owner" to pass to them.
+ */
+struct pool_bands {
+    uint32_t height;
+    size_t scratch_size;
+    int (*scratch_init)(void *owner, void *scratch);
+    void (*scratch_free)(void *scratch);
+    void *owner;
+
+    // Set by pool_bands_set_pool()
+    struct thread_pool *pool;       // NULL to run the bands on the calling thread
+    int band_count;
+    int band_rows;
+    uint8_t *scratch;               // "slots" of "scratch_size" bytes
+    int slots;
+};
+
+struct thread_pool *thread_pool_create(int threads, const int *cpus, int cpu_count);
+int thread_pool_threads(const struct thread_pool *pool);
+void thread_pool_start(struct thread_pool *pool, struct pool_batch *batch);
+int thread_pool_done(const struct pool_batch *batch);
+void thread_pool_wait(struct thread_pool *pool, struct pool_batch *batch);
+void thread_pool_run(struct thread_pool *pool, int count, thread_pool_fn fn, void *arg);
+void thread_pool_print(const struct thread_pool *pool, const char *label);
+void thread_pool_free(struct thread_pool *pool);
+
+int pool_bands_set_pool(struct pool_bands *pb, struct thread_pool *pool);
+void pool_bands_free(struct pool_bands *pb);
+
+/**
+ * pool_bands_scratch - the scratch of slot "slot"
+ */
+static inline void *pool_bands_scratch(const struct pool_bands *pb, int slot) {
+    return pb->scratch + (size_t) slot * pb->scratch_size;
+}
+#endif
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -18,26 +19,212 @@ static int xioctl(int fd, int request, void *arg) {
     return ret;
 }
 
+/*
+ * Pixel format registry - what v4l2_tbl.h says about every pixel format, in one array, with a
+ * perfect hash over the fourccs and one over the short names, so finding a format is a couple
+ * of multiplies and a single compare however many there are.
+ *
+ * The hashes are hash-and-displace: a key's hash picks a bucket, and the bucket's displacement,
+ * mixed into the hash again, picks the key's slot.  Displacements are found when the program
+ * starts, biggest buckets first, each the smallest one that lands all of its keys in free slots.
+ * Should that ever fail, lookups fall back to going through the array.
+ */
+
+#define PIX_FMT_PLANES(packing) \
+    (((packing) == PIX_PLANAR) ? 3 : ((packing) == PIX_SEMI_PLANAR) ? 2 : 1)
+
+static const struct pix_fmt_info pix_fmts[] = {
+#define V4L2T_PIX_FMT(d, sn, des, bpp, line_bpp, packing, h_sub, v_sub, align) \
+    { d, #sn, des, bpp, line_bpp, PIX_FMT_PLANES(PIX_##packing), h_sub, v_sub, align, \
+        PIX_##packing },
+#include "v4l2_tbl.h"
+#undef V4L2T_PIX_FMT
+};
+
+#define PIX_FMT_COUNT (sizeof(pix_fmts) / sizeof(pix_fmts[0]))
+#define PIX_HASH_SLOTS 256          // a power of two, and room to spare over PIX_FMT_COUNT
+#define PIX_HASH_BUCKETS 64
+
+_Static_assert(PIX_FMT_COUNT < PIX_HASH_SLOTS, "too many pixel formats for the hash");
+
+struct pix_hash {
+    uint16_t disp[PIX_HASH_BUCKETS];
+    uint8_t slots[PIX_HASH_SLOTS];  // index into pix_fmts + 1, 0 if free
+    int built;
+};
+
+static struct pix_hash fourcc_hash, name_hash;
+
+static uint32_t mix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t name_key(const char *name) {
+    uint32_t h = 0x811c9dc5;
+    while (*name != '\0') {
+        h = (h ^ (uint8_t) *name++) * 0x01000193;
+    }
+    return h;
+}
+
+static unsigned int pix_hash_slot(const struct pix_hash *ph, uint32_t key) {
+    uint32_t h = mix32(key);
+    return mix32(h ^ ph->disp[h % PIX_HASH_BUCKETS]) % PIX_HASH_SLOTS;
+}
+
+/**
+ * pix_hash_build - find the displacements that give each of the "keys" of pix_fmts a slot of
+ * its own
+ */
+static int pix_hash_build(struct pix_hash *ph, const uint32_t *keys) {
+    uint8_t members[PIX_HASH_BUCKETS][PIX_FMT_COUNT];
+    int sizes[PIX_HASH_BUCKETS] = {0};
+    for (size_t i = 0; i < PIX_FMT_COUNT; i++) {
+        unsigned int b = mix32(keys[i]) % PIX_HASH_BUCKETS;
+        members[b][sizes[b]++] = i;
+    }
+
+    int order[PIX_HASH_BUCKETS];
+    for (int b = 0; b < PIX_HASH_BUCKETS; b++) {
+        int j = b;
+        for (; j > 0 && sizes[order[j - 1]] < sizes[b]; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = b;
+    }
+
+    for (int o = 0; o < PIX_HASH_BUCKETS && sizes[order[o]] > 0; o++) {
+        int b = order[o];
+        uint32_t d = 0;
+        for (; d <= UINT16_MAX; d++) {
+            ph->disp[b] = d;
+            int placed = 0;
+            for (; placed < sizes[b]; placed++) {
+                unsigned int s = pix_hash_slot(ph, keys[members[b][placed]]);
+                if (ph->slots[s] != 0) {
+                    break;
+                }
+                ph->slots[s] = members[b][placed] + 1;
+            }
+            if (placed == sizes[b]) {
+                break;
+            }
+            while (placed-- > 0) {
+                ph->slots[pix_hash_slot(ph, keys[members[b][placed]])] = 0;
+            }
+        }
+        if (d > UINT16_MAX) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+__attribute__((constructor)) static void pix_fmt_hash_init(void) {
+    uint32_t keys[PIX_FMT_COUNT];
+
+    for (size_t i = 0; i < PIX_FMT_COUNT; i++) {
+        keys[i] = pix_fmts[i].fourcc;
+    }
+    fourcc_hash.built = (0 == pix_hash_build(&fourcc_hash, keys));
+
+    for (size_t i = 0; i < PIX_FMT_COUNT; i++) {
+        keys[i] = name_key(pix_fmts[i].name);
+    }
+    name_hash.built = (0 == pix_hash_build(&name_hash, keys));
+}
+
 /**
  * print_pix_fmt - Prints a list of all known pixel formats, their fourcc value, and a description
  */
 void print_pix_formats(void) {
-#define V4L2T_PIX_FMT(d, sn, des) \
-    fprintf(stdout, "%s (0x%08x) - \"%s\"\n", #sn, d, des);
-#include "v4l2_tbl.h"
-#undef V4L2T_PIX_FMT
+    for (size_t i = 0; i < PIX_FMT_COUNT; i++) {
+        fprintf(stdout, "%s (0x%08x) - \"%s\"\n", pix_fmts[i].name, pix_fmts[i].fourcc,
+                pix_fmts[i].description);
+    }
+}
+
+/**
+ * pix_fmt_info - Returns what is known about a pixel format, or NULL if it isn't known
+ */
+const struct pix_fmt_info *pix_fmt_info(uint32_t fmt) {
+    if (fourcc_hash.built) {
+        uint8_t slot = fourcc_hash.slots[pix_hash_slot(&fourcc_hash, fmt)];
+        if (slot != 0 && pix_fmts[slot - 1].fourcc == fmt) {
+            return &pix_fmts[slot - 1];
+        }
+        return NULL;
+    }
+
+    for (size_t i = 0; i < PIX_FMT_COUNT; i++) {
+        if (pix_fmts[i].fourcc == fmt) {
+            return &pix_fmts[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * pix_fmt_info_by_name - Returns what is known about the pixel format with a short name, or NULL
+ * if there is none
+ */
+const struct pix_fmt_info *pix_fmt_info_by_name(const char *short_name) {
+    if (name_hash.built) {
+        uint8_t slot = name_hash.slots[pix_hash_slot(&name_hash, name_key(short_name))];
+        if (slot != 0 && strcmp(pix_fmts[slot - 1].name, short_name) == 0) {
+            return &pix_fmts[slot - 1];
+        }
+        return NULL;
+    }
+
+    for (size_t i = 0; i < PIX_FMT_COUNT; i++) {
+        if (strcmp(pix_fmts[i].name, short_name) == 0) {
+            return &pix_fmts[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * pix_fmt_frame_size - the bytes per line of the first plane and the size of a whole frame of
+ * "width" x "height" pixels in the pixel format, rounding bytes and chroma rows that are only
+ * partly used up
+ *
+ * @returns 0, or -1 with errno set to EINVAL if the format has no fixed size
+ */
+int pix_fmt_frame_size(uint32_t fmt, uint32_t width, uint32_t height, uint32_t *bytesperline,
+        uint32_t *sizeimage) {
+    const struct pix_fmt_info *info = pix_fmt_info(fmt);
+    if (info == NULL || info->bpp == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Any chroma planes after the first plane, in rows of "v_sub" lines
+    uint64_t bpl = ((uint64_t) width * info->line_bpp + 7) / 8;
+    uint64_t chroma_bpl = ((uint64_t) width * (info->bpp - info->line_bpp) * info->v_sub + 7) / 8;
+    uint64_t size = bpl * height + chroma_bpl * ((height + info->v_sub - 1) / info->v_sub);
+    if (size > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *bytesperline = bpl;
+    *sizeimage = size;
+    return 0;
 }
 
 /**
- * get_pix_fmt_str - Returns a string describing the fourcc pixel format
- *                   Returns "UNKNOWWN" for an invalid or unknown pixel format
+ * pix_fmt_to_str - Returns the short name of a pixel format, or "UNKNOWN"
  */
 const char* pix_fmt_to_str(uint32_t fmt) {
-#define V4L2T_PIX_FMT(d, sn, des) \
-    if (fmt == d) { return #sn; }
-#include "v4l2_tbl.h"
-#undef V4L2T_PIX_FMT
-    return "UNKNOWN";
+    const struct pix_fmt_info *info = pix_fmt_info(fmt);
+    return (info != NULL) ? info->name : "UNKNOWN";
 }
 
 /**
@@ -45,11 +232,8 @@ const char* pix_fmt_to_str(uint32_t fmt) {
  *                  Returns 0 if the name is not found
  */
 uint32_t str_to_pix_fmt(const char *short_name) {
-#define V4L2T_PIX_FMT(d, sn, des) \
-    if (strcmp(#sn, short_name) == 0) { return (d); }
-#include "v4l2_tbl.h"
-#undef V4L2T_PIX_FMT
-    return 0;
+    const struct pix_fmt_info *info = pix_fmt_info_by_name(short_name);
+    return (info != NULL) ? info->fourcc : 0;
 }
 
 /**
@@ -84,20 +268,44 @@ static int get_nth_format (int fd, enum v4l2_buf_type type, int n, struct v4l2_f
 }
 
 /**
- * count_formats - run through enumerating the formats, and return when the syscalls begin failing
+ * enumerate - run through an enumeration ioctl once, from index 0 until it fails
+ *
+ * "query" is the filled in request of "size" bytes, which starts with its index like every
+ * V4L2 enumeration struct does.  Each result is stored in an array allocated into "out".
+ * @returns the number of results, or -1 with errno set
  */
-static int count_formats (int fd, enum v4l2_buf_type type) {
-    struct v4l2_fmtdesc f = {0};
-    int fmt_cnt = 0;
-    while (get_nth_format(fd, type, fmt_cnt, &f) >= 0) {
-        fmt_cnt++;
+static int enumerate(int fd, int request, const void *query, size_t size, void **out) {
+    uint8_t *all = NULL;
+    uint32_t count = 0, capacity = 0;
+    for (;;) {
+        if (count == capacity) {
+            capacity = (capacity > 0) ? capacity * 2 : 16;
+            uint8_t *grown = realloc(all, (size_t) capacity * size);
+            if (grown == NULL) {
+                free(all);
+                errno = ENOMEM;
+                return -1;
+            }
+            all = grown;
+        }
+
+        uint8_t *next = all + (size_t) count * size;
+        memcpy(next, query, size);
+        memcpy(next, &count, sizeof(count));
+        if (-1 == xioctl(fd, request, next)) {
+            break;
+        }
+        count++;
     }
 
+    // The end of the list shows up as EINVAL
     if (errno != EINVAL) {
+        free(all);
         return -1;
     }
 
-    return fmt_cnt;
+    *out = all;
+    return (int) count;
 }
 
 /**
@@ -113,27 +321,9 @@ int enum_pixel_formats(int fd, enum v4l2_buf_type type, struct v4l2_fmtdesc **fo
         return -1;
     }
 
-    int fmt_cnt = count_formats(fd, type);
-    if (fmt_cnt <= 0) {
-        return fmt_cnt;
-    }
-
-    struct v4l2_fmtdesc *fmt = malloc(fmt_cnt * sizeof(struct v4l2_fmtdesc));
-    if (fmt == NULL) {
-        errno = ENOMEM;
-        return -1;
-    }
-
-    for (int i = 0; i < fmt_cnt; i++) {
-        if (get_nth_format(fd, type, i, &fmt[i]) == -1) {
-            free(fmt);
-            return -1;
-        }
-    }
-
-    *format = fmt;
-
-    return fmt_cnt;
+    struct v4l2_fmtdesc query = {0};
+    query.type = type;
+    return enumerate(fd, VIDIOC_ENUM_FMT, &query, sizeof(query), (void **) format);
 }
 
 /**
@@ -162,22 +352,11 @@ static int get_nth_frame_size(int fd, int pixel_format, int n, struct v4l2_frmsi
     return xioctl(fd, VIDIOC_ENUM_FRAMESIZES, frm_sz_enum);
 }
 
-static int get_framesize_count(int fd, int pixel_format) {
-    struct v4l2_frmsizeenum fsze = {0};
-    int frm_sz_cnt = 0;
-    while (get_nth_frame_size(fd, pixel_format, frm_sz_cnt, &fsze) >= 0) {
-        frm_sz_cnt++;
-    }
-
-    if (errno != EINVAL) {
-        return -1;
-    }
-
-    return frm_sz_cnt;
-}
-
 /**
- * enum_frame_sizes - allocate space for a 
+ * enum_frame_size - enumerate the frame sizes of a pixel format
+ *
+ * This will allocate memory and save the address in "frm_sz_enum"
+ * @returns the number of frame sizes, or -1 with errno set
  */
 int enum_frame_size(int fd, int pixel_format, struct v4l2_frmsizeenum **frm_sz_enum) {
     if (fd < 0 || frm_sz_enum == NULL) {
@@ -185,28 +364,60 @@ int enum_frame_size(int fd, int pixel_format, struct v4l2_frmsizeenum **frm_sz_e
         return -1;
     }
 
-    int frm_sz_cnt = get_framesize_count(fd, pixel_format);
-    if (frm_sz_cnt < 0) {
-        return frm_sz_cnt;
-    }
+    struct v4l2_frmsizeenum query = {0};
+    query.pixel_format = pixel_format;
+    return enumerate(fd, VIDIOC_ENUM_FRAMESIZES, &query, sizeof(query), (void **) frm_sz_enum);
+}
 
-    struct v4l2_frmsizeenum *fsze = malloc(frm_sz_cnt * sizeof(struct v4l2_frmsizeenum));
-    if (fsze == NULL) {
-        errno = ENOMEM;
+/**
+ * enum_frame_intervals - enumerate the frame intervals of a pixel format at a frame size
+ *
+ * This will allocate memory and save the address in "frm_iv_enum"
+ * @returns the number of frame intervals, or -1 with errno set
+ */
+int enum_frame_intervals(int fd, uint32_t pixel_format, uint32_t width, uint32_t height,
+        struct v4l2_frmivalenum **frm_iv_enum) {
+    if (fd < 0 || frm_iv_enum == NULL) {
+        errno = EINVAL;
         return -1;
     }
 
-    for (int i = 0; i < frm_sz_cnt; i++) {
-        if (get_nth_frame_size(fd, pixel_format, i, &fsze[i]) < 0) {
-            free(fsze);
-            fsze = NULL;
-            return -1;
-        }
-    }
-
-    *frm_sz_enum = fsze;
+    struct v4l2_frmivalenum query = {0};
+    query.pixel_format = pixel_format;
+    query.width = width;
+    query.height = height;
+    return enumerate(fd, VIDIOC_ENUM_FRAMEINTERVALS, &query, sizeof(query),
+            (void **) frm_iv_enum);
+}
 
-    return frm_sz_cnt;
+/**
+ * frame_size_matches - returns a non-zero value if "fsze" includes the frame size
+ *
+ * Ranges are checked with arithmetic, rather than by stepping through their sizes.
+ */
+int frame_size_matches(const struct v4l2_frmsizeenum *fsze, uint32_t width, uint32_t height) {
+    const struct v4l2_frmsize_stepwise *sw = &fsze->stepwise;
+    switch (fsze->type) {
+        case V4L2_FRMSIZE_TYPE_DISCRETE:
+            return width == fsze->discrete.width && height == fsze->discrete.height;
+
+        case V4L2_FRMSIZE_TYPE_CONTINUOUS:
+        case V4L2_FRMSIZE_TYPE_STEPWISE:
+            if (width < sw->min_width || width > sw->max_width
+                    || height < sw->min_height || height > sw->max_height) {
+                return 0;
+            }
+            // Continuous ranges have steps of 1, but don't count on drivers saying so
+            if (fsze->type == V4L2_FRMSIZE_TYPE_CONTINUOUS) {
+                return 1;
+            }
+            return (sw->step_width == 0 || (width - sw->min_width) % sw->step_width == 0)
+                && (sw->step_height == 0 || (height - sw->min_height) % sw->step_height == 0);
+
+        default:
+            // This is an unknown type of frame specification
+            return 0;
+    }
 }
 
 /**
@@ -220,39 +431,9 @@ int frame_size_valid(int fd, uint32_t pixel_format, uint32_t width, uint32_t hei
 
     // Check to see if the frame size is valid for the given pixel format
     struct v4l2_frmsizeenum fsze = {0};
-
-    uint32_t cur_width, cur_height;
     for (int i = 0; -1 != get_nth_frame_size(fd, pixel_format, i, &fsze) ; i++) {
-        switch(fsze.type) {
-            case V4L2_FRMSIZE_TYPE_DISCRETE:
-                if (width == fsze.discrete.width && height == fsze.discrete.height) {
-                    return 1;
-                }
-                break;
-
-            case V4L2_FRMSIZE_TYPE_CONTINUOUS:
-                if ((fsze.stepwise.min_width <= width) && (width <= fsze.stepwise.max_width)
-                        && (fsze.stepwise.min_height <= height) && (height <= fsze.stepwise.max_height)) {
-                    return 1;
-                }
-                break;
-
-            case V4L2_FRMSIZE_TYPE_STEPWISE:
-                cur_width = fsze.stepwise.min_width;
-                cur_height = fsze.stepwise.min_height;
-                while ((cur_width <= fsze.stepwise.max_width) && (cur_height <= fsze.stepwise.max_height)) {
-                    if (cur_width == width && cur_height == height) {
-                        return 1;
-                    }
-
-                    cur_width += fsze.stepwise.step_width;
-                    cur_height += fsze.stepwise.step_height;
-                }
-                break;
-
-            default:
-                // This is an unknown type of frame specification. Abort!
-                return 0;
+        if (frame_size_matches(&fsze, width, height)) {
+            return 1;
         }
     }
 
@@ -271,8 +452,89 @@ int set_stream_format(int fd, struct v4l2_format *fmt) {
     return xioctl(fd, VIDIOC_S_FMT, fmt);
 }
 
+/**
+ * get_stream_format - read back the format a device streams in
+ */
+int get_stream_format(int fd, struct v4l2_format *fmt) {
+    if (fd < 0 || fmt == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    return xioctl(fd, VIDIOC_G_FMT, fmt);
+}
+
+/**
+ * set_crop - have a device crop its frames to "rect" in hardware
+ *
+ * Drivers round the rectangle to what they can do.  Unless it comes out exactly as asked for,
+ * the default crop is put back.  Cropping can change the format, so read it back afterwards.
+ * @returns 0 if the device crops to "rect", -1 with errno set if not (ERANGE if it can only
+ *          crop to some other rectangle)
+ */
+int set_crop(int fd, const struct v4l2_rect *rect) {
+    if (fd < 0 || rect == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct v4l2_selection sel = {0};
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_CROP;
+    sel.r = *rect;
+    if (-1 == xioctl(fd, VIDIOC_S_SELECTION, &sel)) {
+        return -1;
+    }
+
+    if (sel.r.left == rect->left && sel.r.top == rect->top && sel.r.width == rect->width
+            && sel.r.height == rect->height) {
+        return 0;
+    }
+
+    struct v4l2_selection def = {0};
+    def.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    def.target = V4L2_SEL_TGT_CROP_DEFAULT;
+    if (0 == xioctl(fd, VIDIOC_G_SELECTION, &def)) {
+        def.target = V4L2_SEL_TGT_CROP;
+        xioctl(fd, VIDIOC_S_SELECTION, &def);
+    }
+    errno = ERANGE;
+    return -1;
+}
+
+/**
+ * get_frame_rate - the frame rate a device captures at
+ *
+ * @returns 0 with "fps" filled in, -1 with errno set if the device doesn't say
+ */
+int get_frame_rate(int fd, double *fps) {
+    if (fd < 0 || fps == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct v4l2_streamparm parm = {0};
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (-1 == xioctl(fd, VIDIOC_G_PARM, &parm)) {
+        return -1;
+    }
+
+    struct v4l2_fract *tpf = &parm.parm.capture.timeperframe;
+    if (tpf->numerator == 0 || tpf->denominator == 0) {
+        errno = ENODATA;
+        return -1;
+    }
+    *fps = (double) tpf->denominator / tpf->numerator;
+    return 0;
+}
+
 /**
  * init_mmap_buffers - get a set of mmaped buffers related between the driver and the program
+ *
+ * The driver may grant a different number of buffers than asked for.  At most "count" of them
+ * are mapped into "bufs".
+ * @returns the number of buffers mapped, or -1 with errno set
  */
 int init_mmap_buffers(int fd, struct mmaped_buffer *bufs, int count) {
     if (fd < 0 || bufs == NULL || count < 0) {
@@ -289,6 +551,10 @@ int init_mmap_buffers(int fd, struct mmaped_buffer *bufs, int count) {
         return -1;
     }
 
+    if (req.count < (uint32_t) count) {
+        count = req.count;
+    }
+
     struct v4l2_buffer buf;
     for (int i = 0; i < count; i++) {
         memset(&buf, 0, sizeof(buf));
@@ -306,7 +572,111 @@ int init_mmap_buffers(int fd, struct mmaped_buffer *bufs, int count) {
         }
     }
 
-    return 0;
+    return count;
+}
+
+/**
+ * get_buffer_caps - ask the driver which kinds of streaming memory it supports
+ *
+ * @returns the V4L2_BUF_CAP_* flags, 0 if the driver is too old to tell us
+ */
+uint32_t get_buffer_caps(int fd) {
+    struct v4l2_requestbuffers req = {0};
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req)) {
+        return 0;
+    }
+
+    return req.capabilities;
+}
+
+/**
+ * init_userptr_buffers - tell the driver we will capture into "count" buffers of our own
+ *
+ * @returns the number of buffers the driver granted, or -1 with errno set
+ */
+int init_userptr_buffers(int fd, int count) {
+    if (fd < 0 || count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct v4l2_requestbuffers req = {0};
+    req.count = count;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_USERPTR;
+
+    if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req)) {
+        return -1;
+    }
+
+    return req.count;
+}
+
+/**
+ * free_buffers - give all buffers of the "memory" type back, streaming must be stopped
+ */
+int free_buffers(int fd, uint32_t memory) {
+    struct v4l2_requestbuffers req = {0};
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = memory;
+
+    return xioctl(fd, VIDIOC_REQBUFS, &req);
+}
+
+/**
+ * start_userptr_streaming - queue our own buffers "bufs" and tell the driver to start
+ */
+int start_userptr_streaming(int fd, struct mmaped_buffer *bufs, int buf_count) {
+    if (fd < 0 || bufs == NULL || buf_count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct v4l2_buffer buf;
+
+    for (int i = 0; i < buf_count; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_USERPTR;
+        buf.index = i;
+        buf.m.userptr = (unsigned long) bufs[i].start;
+        buf.length = bufs[i].length;
+
+        if (-1 == xioctl(fd, VIDIOC_QBUF, &buf)) {
+            return -1;
+        }
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    return xioctl(fd, VIDIOC_STREAMON, &type);
+}
+
+/**
+ * export_buffer - get a DMABUF file descriptor for the mmaped buffer at "index"
+ *
+ * @returns the new read-only file descriptor, or -1 with errno set
+ */
+int export_buffer(int fd, int index) {
+    if (fd < 0 || index < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct v4l2_exportbuffer expbuf = {0};
+    expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    expbuf.index = index;
+    expbuf.flags = O_RDONLY | O_CLOEXEC;
+
+    if (-1 == xioctl(fd, VIDIOC_EXPBUF, &expbuf)) {
+        return -1;
+    }
+
+    return expbuf.fd;
 }
 
 /**
@@ -352,6 +722,13 @@ int stop_streaming(int fd) {
  * read_frame - after sucessfully returning from a select, get the data from the buffer
  */
 int read_frame(int fd, struct v4l2_buffer *buf) {
+    return dequeue_frame(fd, V4L2_MEMORY_MMAP, buf);
+}
+
+/**
+ * dequeue_frame - take the next filled buffer of the given "memory" type from the driver
+ */
+int dequeue_frame(int fd, uint32_t memory, struct v4l2_buffer *buf) {
     if (fd < 0 || buf == NULL) {
         errno = EINVAL;
         return -1;
@@ -359,7 +736,7 @@ int read_frame(int fd, struct v4l2_buffer *buf) {
 
     memset (buf, 0, sizeof(struct v4l2_buffer));
     buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf->memory = V4L2_MEMORY_MMAP;
+    buf->memory = memory;
 
     return xioctl(fd, VIDIOC_DQBUF, buf);
 }
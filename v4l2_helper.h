@@ -8,7 +8,38 @@ struct mmaped_buffer {
     size_t length;
 };
 
+/**
+ * pix_packing - how the pixels of a format are laid out in memory
+ */
+enum pix_packing {
+    PIX_OPAQUE,                 // compressed, or a layout that isn't described
+    PIX_PACKED,                 // whole bytes per pixel (or pixel group), one plane
+    PIX_BIT_PACKED,             // pixels packed across byte boundaries, one plane
+    PIX_SEMI_PLANAR,            // a luma plane, then one of interleaved chroma
+    PIX_PLANAR,                 // a luma plane, then one for each chroma component
+};
+
+/**
+ * pix_fmt_info - what is known about a pixel format, from v4l2_tbl.h
+ */
+struct pix_fmt_info {
+    uint32_t fourcc;
+    const char *name;
+    const char *description;
+    uint8_t bpp;                // bits per pixel over all planes, 0 if it has no fixed size
+    uint8_t line_bpp;           // bits per pixel of the first plane
+    uint8_t planes;
+    uint8_t h_sub;              // chroma subsampling, horizontally and vertically
+    uint8_t v_sub;
+    uint8_t align;              // the multiple of pixels a line has to be
+    enum pix_packing packing;
+};
+
 void print_pix_formats(void);
+const struct pix_fmt_info *pix_fmt_info(uint32_t fmt);
+const struct pix_fmt_info *pix_fmt_info_by_name(const char *short_name);
+int pix_fmt_frame_size(uint32_t fmt, uint32_t width, uint32_t height, uint32_t *bytesperline,
+        uint32_t *sizeimage);
 const char* pix_fmt_to_str(uint32_t fmt);
 uint32_t str_to_pix_fmt(const char *short_name);
 
@@ -18,14 +49,26 @@ int get_device_capabilities(int fd, struct v4l2_capability *caps);
 
 int enum_pixel_formats(int fd, enum v4l2_buf_type type, struct v4l2_fmtdesc **formats);
 int enum_frame_size(int fd, int pixel_format, struct v4l2_frmsizeenum **frm_sz_enum);
+int enum_frame_intervals(int fd, uint32_t pixel_format, uint32_t width, uint32_t height,
+        struct v4l2_frmivalenum **frm_iv_enum);
 int pixel_format_valid(int fd, enum v4l2_buf_type type, uint32_t pixel_format);
 int frame_size_valid(int fd, uint32_t pixel_format, uint32_t width, uint32_t height);
+int frame_size_matches(const struct v4l2_frmsizeenum *fsze, uint32_t width, uint32_t height);
 
 int set_stream_format(int fd, struct v4l2_format *fmt);
+int get_stream_format(int fd, struct v4l2_format *fmt);
+int set_crop(int fd, const struct v4l2_rect *rect);
+int get_frame_rate(int fd, double *fps);
 int init_mmap_buffers(int fd, struct mmaped_buffer *bufs, int count);
 int start_mmap_streaming(int fd, int buf_count);
+uint32_t get_buffer_caps(int fd);
+int init_userptr_buffers(int fd, int count);
+int start_userptr_streaming(int fd, struct mmaped_buffer *bufs, int buf_count);
+int free_buffers(int fd, uint32_t memory);
+int export_buffer(int fd, int index);
 int stop_streaming(int fd);
 
 int read_frame(int fd, struct v4l2_buffer *buf);
+int dequeue_frame(int fd, uint32_t memory, struct v4l2_buffer *buf);
 int enqueue_frame(int fd, struct v4l2_buffer *buf);
 #endif